@@ -0,0 +1,83 @@
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// MSB-first bit writer. Bits collect in a 64-bit accumulator and are stored
+// to the backing buffer 32 bits at a time.
+//
+// The buffer is either owned by the writer (initBitWriter with buf == NULL),
+// in which case it grows as needed, or provided by the caller with a fixed
+// capacity. A fixed buffer that runs out of space is never silently cut
+// short: the writer keeps counting bits, sets `overflow`, and
+// finishBitWriter returns -1. bitWriterTell then gives the size that
+// would have been needed.
+typedef struct BitWriter {
+    uint8_t* buf;
+    size_t capacity;  // bytes
+    size_t pos;       // bytes stored in buf
+    uint64_t acc;     // pending bits, right-aligned
+    int bits;         // number of pending bits in acc (0..31 between calls)
+    int owns_buffer;
+    int overflow;
+} BitWriter;
+
+#define BITWRITER_DEFAULT_CAPACITY 4096
+
+// buf == NULL: allocate a growable buffer of `capacity` bytes (0 for default)
+int initBitWriter(BitWriter* bw, uint8_t* buf, size_t capacity);
+
+void freeBitWriter(BitWriter* bw);
+
+// Drop all written bits but keep the buffer
+void resetBitWriter(BitWriter* bw);
+
+// Slow path of putBits: make room for `bytes` more bytes
+int reserveBitWriter(BitWriter* bw, size_t bytes);
+
+// Write the low `n` bits of `value`, 0 <= n <= 32
+static inline void putBits(BitWriter* bw, uint32_t value, int n) {
+    if(n == 0) {
+        return;
+    }
+    bw->acc = (bw->acc << n) | (value & (0xFFFFFFFFu >> (32 - n)));
+    bw->bits += n;
+    if(bw->bits >= 32) {
+        bw->bits -= 32;
+        uint32_t word = (uint32_t)(bw->acc >> bw->bits);
+        if(bw->pos + 4 > bw->capacity && reserveBitWriter(bw, 4) != 0) {
+            bw->pos += 4; // keep counting, nothing is stored
+            return;
+        }
+        bw->buf[bw->pos] = word >> 24;
+        bw->buf[bw->pos + 1] = word >> 16;
+        bw->buf[bw->pos + 2] = word >> 8;
+        bw->buf[bw->pos + 3] = word;
+        bw->pos += 4;
+    }
+}
+
+// Number of bits written so far
+static inline size_t bitWriterTell(const BitWriter* bw) {
+    return bw->pos * 8 + bw->bits;
+}
+
+// Pad with zero bits up to the next byte boundary
+static inline void alignBitWriter(BitWriter* bw) {
+    putBits(bw, 0, (8 - (bw->bits & 7)) & 7);
+}
+
+// Byte-align and write a 32-bit start code 0x000001xx
+static inline void putStartCode(BitWriter* bw, uint8_t code) {
+    alignBitWriter(bw);
+    putBits(bw, 0x00000100u | code, 32);
+}
+
+// Byte-align and store every pending bit into the buffer. Returns the number
+// of bytes in the buffer, or -1 if a fixed buffer overflowed.
+long finishBitWriter(BitWriter* bw);
+
+// Byte-align `dst` and append the finished contents of `src` to it
+int appendBitWriter(BitWriter* dst, const BitWriter* src);
+#endif
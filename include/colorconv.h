@@ -0,0 +1,52 @@
+#ifndef COLORCONV_H
+#define COLORCONV_H
+
+#include <stdint.h>
+
+// Fixed-point RGB to YCbCr 4:2:0 conversion.
+//
+// Uses the full-range BT.601 matrix of JFIF, so converted RGB input and raw
+// JPEG planes end up in the same color space:
+//     Y  =  0.299 R + 0.587 G + 0.114 B
+//     Cb = -0.1687 R - 0.3313 G + 0.5 B + 128
+//     Cr =  0.5 R - 0.4187 G - 0.0813 B + 128
+// Coefficients have COLOR_CONST_BITS fraction bits. Chroma is computed from
+// the sum of each 2x2 block of pixels, which equals averaging the four chroma
+// values. For odd sizes the last column/row is repeated, so the chroma planes
+// are (width + 1) / 2 by (height + 1) / 2. All backends are bit-exact.
+#define COLOR_CONST_BITS 14
+
+typedef enum ColorBackend {
+    COLOR_BACKEND_SCALAR = 0,
+    COLOR_BACKEND_SSE2,
+    COLOR_BACKEND_AVX2,
+    COLOR_BACKEND_COUNT
+} ColorBackend;
+
+// Planes of a YCbCr 4:2:0 picture, each with its own line stride in bytes
+typedef struct YuvPlanes {
+    uint8_t* y;
+    uint8_t* cb;
+    uint8_t* cr;
+    int stride_y;
+    int stride_cb;
+    int stride_cr;
+} YuvPlanes;
+
+// Pick the fastest backend the CPU supports. Called on demand by
+// convertRgbToYuv420, calling it at startup is optional.
+void initColorConversion(void);
+
+// Convert packed 8-bit RGB with `stride_rgb` bytes per line
+void convertRgbToYuv420(const uint8_t* rgb, int stride_rgb, int width, int height, const YuvPlanes* planes);
+
+ColorBackend getColorBackend(void);
+
+// Force a backend (for tests and benchmarks). Returns -1 if the CPU
+// does not support it.
+int setColorBackend(ColorBackend backend);
+
+int isColorBackendSupported(ColorBackend backend);
+
+const char* getColorBackendName(ColorBackend backend);
+#endif
@@ -4,12 +4,23 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include "bitstream.h"
+#include "mux.h"
 #include "readImage.h"
 
 #define LEN_SYS_HEADER 9
 
-// Write the sequence header of the mpeg file
-// bit_rate: choose one of the following:
+// Bytes of the pack header and of the system header with its start code
+#define PACK_HEADER_BYTES 12
+#define SYSTEM_HEADER_BYTES (6 + LEN_SYS_HEADER)
+
+// Largest STD buffer of the video stream: 13 bits in units of 1024 bytes
+#define STD_BUFFER_SIZE_MAX (0x1FFF * 1024)
+
+// All writers append bit-exact header fields to a BitWriter. Start codes
+// are byte-aligned with zero stuffing.
+
+// picture_rate code of the sequence header for a frame rate:
 //     1: 23.976 fps
 //     2: 24 fps
 //     3: 25 fps
@@ -18,25 +29,66 @@
 //     6: 50 fps
 //     7: 59.94 fps
 //     8: 60 fps
-// n is the index of the image
-void writePackHeader(FILE* file_mpeg, int width, int height, uint16_t frame_rate, int bit_rate);
+uint8_t frameRateCode(uint16_t fps);
+
+// Write the pack header of the mpeg file
+// scr: system clock reference in 90 kHz ticks
+// bit_rate: in bits/s, written as mux_rate
+void writePackHeader(BitWriter* bw, uint64_t scr, int bit_rate);
+
+// Starts the first pack of the stream, with the rate bound and the STD
+// buffer size of the video stream in bytes, rounded up to 1024
+void writeSystemHeader(BitWriter* bw, uint16_t len_header, int bitrate, int std_buffer_size);
 
-// Optional. Including ratebound. Not used now
-void writeSystemHeader(FILE* file_mpeg, uint16_t len_header, int bitrat);
+// Time stamp left out of a packet header
+#define TIME_STAMP_NONE UINT64_MAX
 
-// the unit of buffer size is 128
-void writePacket(FILE* file_mpeg, uint16_t size_buffer, int bitrate, uint16_t fps);
+// Video packet header for len_data bytes of data that follow it. The first
+// packet of the stream also gives the STD buffer size, as in the system
+// header. pts and dts in 90 kHz ticks or TIME_STAMP_NONE; the DTS is left
+// out if it equals the PTS.
+void writePacket(BitWriter* bw, uint16_t len_data, int first_packet, uint64_t pts, uint64_t dts, int std_buffer_size);
 
-void writeSequenceHeader(FILE* file_mpeg, uint16_t width, uint16_t height);
+// Bytes of that packet header
+int packetHeaderSize(int first_packet, uint64_t pts, uint64_t dts);
 
-void writeGOPHeader(FILE* file_mlv);
+void writeSequenceHeader(BitWriter* bw, uint16_t width, uint16_t height, uint8_t frame_rate_code);
 
-void writePictureHeader(FILE* file_mlv);
+// first_frame: display number of the first picture of the GOP in the
+// sequence, written as its time code at the rate of frame_rate_code.
+// closed_gop: no B picture of the GOP refers to the previous GOP.
+void writeGOPHeader(BitWriter* bw, uint32_t first_frame, uint8_t frame_rate_code, uint8_t closed_gop);
+
+// picture_coding_type
+#define PICTURE_TYPE_I 1
+#define PICTURE_TYPE_P 2
+#define PICTURE_TYPE_B 3
+
+// vbv_delay of a variable bit rate stream
+#define VBV_DELAY_VARIABLE 0xFFFF
+
+// temporal_reference: display order within the GOP, mod 1024
+// vbv_delay: in 90 kHz ticks, or VBV_DELAY_VARIABLE
+// forward_f_code: vector range of P and B pictures, ignored for I
+// backward_f_code: vector range of B pictures, ignored otherwise
+void writePictureHeader(BitWriter* bw, uint16_t temporal_reference, uint8_t picture_type, uint16_t vbv_delay,
+                        uint8_t forward_f_code, uint8_t backward_f_code);
 
 // Parameter:
-// index: the vertical position of slice (only 4 bit is allowed)
-// scal: quatization scale 0-51
-void writeSliceHeader(FILE* file_mlv, uint8_t index, uint8_t scal);
+// index: the vertical position of slice (1-175)
+// scal: quatization scale 1-31
+void writeSliceHeader(BitWriter* bw, uint8_t index, uint8_t scal);
+
+void writeSequenceEndCode(BitWriter* bw);
+
+// Write the contents of `bw` to the muxer and empty it
+int flushBitstream(Muxer* mux, BitWriter* bw);
 
-FILE* createMLV(char* filename_p, ImageInfo imageinfo);
-#endif
\ No newline at end of file
+// Open the output file, or memory with a NULL filename_p, and write the
+// sequence header, as a system stream or in raw mode as the bare video
+// stream. Each GOP then starts with
+// writeGOPHeader and each picture with writePictureHeader; closeMuxer ends
+// the file after writeSequenceEndCode. Returns 0, or -1 if the file cannot
+// be created.
+int createMLV(Muxer* mux, char* filename_p, ImageInfo imageinfo, int raw);
+#endif
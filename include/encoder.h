@@ -0,0 +1,95 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stdint.h>
+
+#include "bitstream.h"
+#include "colorconv.h"
+#include "gop.h"
+#include "motion.h"
+#include "readImage.h"
+
+#define MACROBLOCK_SIZE 16
+
+// Analysis of an inter macroblock, private to the encoder
+typedef struct MacroblockDecision MacroblockDecision;
+// Wavefront progress of a macroblock row, private to the encoder
+typedef struct RowProgress RowProgress;
+
+// State shared by all pictures of a sequence
+typedef struct EncoderContext {
+    int width;
+    int height;
+    int mb_width;       // macroblocks per row
+    int mb_height;      // macroblock rows
+    uint8_t scale;      // quantizer_scale 1..31
+    int num_threads;    // 0: OpenMP default
+    int slice_rows;     // macroblock rows per slice, 1 after initEncoder; may change between pictures
+    BitWriter* slices;  // one writer per slice, reused across pictures
+
+    // Inter coding, only set up with a search range
+    int search_range;       // full pels, clamped to the f_code range
+    uint8_t f_code;         // forward_f_code of P pictures
+    Frame* ref;             // reconstruction of the last I or P picture
+    Frame* ref_prev;        // and of the one before, forward reference of B pictures
+    Frame* recon;           // reconstruction of the picture being encoded
+    int num_anchors;        // I and P pictures encoded so far
+    MotionVector* mvs;      // vectors of the picture being encoded, per macroblock
+    MotionVector* prev_mvs; // vectors of `ref`
+    HalfPelPlanes halfpel;  // interpolations of `ref`, built on first use
+    HalfPelPlanes halfpel_prev; // and of `ref_prev`
+    int halfpel_ready;
+    int halfpel_prev_ready;
+    MacroblockDecision* decisions; // analysis of the inter picture being encoded
+    RowProgress* row_progress; // macroblocks analyzed per row
+    int reconstruct_bidir;  // also decode B pictures, which nothing refers to, for measuring
+    const Frame* decoded;   // what a decoder shows for the last picture, NULL if not reconstructed
+} EncoderContext;
+
+// `search_range` in full pels enables P pictures; 0 encodes intra only and
+// skips the reconstruction. Input frames must have the layout of
+// allocFrame(width, height, FRAME_PAD), like those of readImage, which the
+// reconstructions share. A size that is not a multiple of 16 ends in
+// partial macroblocks, which are coded whole from the edge pixels repeated
+// into the border of the input frame.
+int initEncoder(EncoderContext* ctx, int width, int height, uint8_t scale, int num_threads, int search_range);
+
+void freeEncoder(EncoderContext* ctx);
+
+// Encode the slices of an intra picture and append them to `bw`.
+// Each slice starts with its own start code and resets the DC predictors,
+// so slices are encoded in parallel into their own writers and then
+// stitched in order. The result does not depend on the thread count.
+int encodeIntraPicture(EncoderContext* ctx, const ImageInfo* imageinfo, BitWriter* bw);
+
+// Intra picture straight from JPEG coefficients: no IDCT, color conversion
+// or forward DCT, the blocks are only requantized. `image` must come from a
+// successful readCoefficients with the size given to initEncoder.
+int encodeTranscodedPicture(EncoderContext* ctx, const CoefImage* image, BitWriter* bw);
+
+// Encode the slices of a P picture predicted from the last I or P picture.
+// Each macroblock is motion compensated with a half-pel vector or coded
+// intra when that is cheaper. Macroblocks that would code nothing at a
+// zero vector are skipped, unchanged ones before any search or DCT.
+//
+// Motion search, mode decision, quantization and reconstruction run first
+// over all macroblocks. A macroblock starts from the vectors found left,
+// above and above right of it, so rows run in parallel as a wavefront,
+// each two macroblocks behind the row above. The slices are then written
+// from that analysis, also in parallel, and stitched in order. The result
+// does not depend on the thread count. Needs a search range; returns -1
+// otherwise.
+int encodeInterPicture(EncoderContext* ctx, const ImageInfo* imageinfo, BitWriter* bw);
+
+// Encode the slices of a B picture between the last two I or P pictures,
+// which lie forward_distance pictures before and backward_distance after
+// it in display order. Macroblocks are predicted forward, backward or from
+// the average of both, and skipped when they repeat the prediction of the
+// previous macroblock without residual. Analysis and writing run like those
+// of P pictures. Needs a search range and two anchors; returns -1 otherwise.
+int encodeBidirPicture(EncoderContext* ctx, const ImageInfo* imageinfo, int forward_distance, int backward_distance, BitWriter* bw);
+
+// Encode a picture of the reorder buffer with the encoder of its type,
+// after a GOP header if it starts one and its picture header
+int encodeCodedPicture(EncoderContext* ctx, const CodedPicture* picture, uint8_t frame_rate_code, BitWriter* bw);
+#endif
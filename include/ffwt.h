@@ -5,6 +5,22 @@
 
 #define N 8  // 8x8 DCT size
 
+// Maximum number of distinct batch sizes whose plans are kept
+#define MAX_BATCH_PLANS 16
+
+// Build the cached FFTW plans. Safe to call from several threads; the plans
+// are only built once. performdct2d calls it on demand, but calling it at
+// startup keeps the planning cost out of the encode loop.
+void initDCTPlans(void);
+
+// Release all cached plans, at teardown only: the block plan is not built
+// again, so no transform may run afterwards, and none may run meanwhile,
+// since a performdct2dBatch in progress can still be using a batch plan
+void cleanupDCTPlans(void);
+
 // Function to perform 2D DCT-II on an 8x8 matrix
 void performdct2d(double mat[8][8]);
-#endif
\ No newline at end of file
+
+// Perform 2D DCT-II on `count` consecutive 8x8 matrices (e.g. a macroblock row)
+void performdct2dBatch(double blocks[][8][8], int count);
+#endif
@@ -0,0 +1,63 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "colorconv.h"
+
+// Every row of every plane starts on this boundary
+#define FRAME_ALIGN 64
+// Border of readImage and encoder frames in luma pixels; chroma gets half
+#define FRAME_PAD 32
+
+// A 4:2:0 picture in one aligned allocation.
+//
+// Each plane has a border of `pad` (luma) or pad / 2 (chroma) pixels on
+// every side, rounded up to FRAME_ALIGN on the left so rows stay aligned.
+// Reads and whole-block writes that run a little past the picture stay
+// inside the buffer; padFrame fills the border by repeating the edge.
+// The layout only depends on the size and border, so frames allocated
+// alike share their strides.
+typedef struct Frame {
+    YuvPlanes planes;   // top-left pixel and stride of each plane
+    int width;
+    int height;
+    int pad;
+    uint8_t* data;      // the allocation, `size` bytes
+    size_t size;
+} Frame;
+
+// NULL if out of memory
+Frame* allocFrame(int width, int height, int pad);
+
+void freeFrame(Frame* frame);
+
+// Repeat the edge pixels of each plane into its border
+void padFrame(Frame* frame);
+
+// Frames handed back for reuse, so a sequence allocates its buffers once.
+// Safe to share between threads.
+typedef struct FramePool {
+    pthread_mutex_t lock;
+    Frame** frames;     // released frames
+    int num_frames;
+    int capacity;
+    int pad;            // border of the frames it allocates
+    int num_allocated;  // frames allocated so far
+} FramePool;
+
+void initFramePool(FramePool* pool, int pad);
+
+// Free the released frames; frames still in use stay valid
+void freeFramePool(FramePool* pool);
+
+// A released frame of this size, or a new one. Released frames of other
+// sizes are freed then, as the sequence has changed size. NULL if out of
+// memory.
+Frame* acquireFrame(FramePool* pool, int width, int height);
+
+// Hand a frame back for reuse; NULL is ignored
+void releaseFrame(FramePool* pool, Frame* frame);
+#endif
@@ -0,0 +1,76 @@
+#ifndef GOP_H
+#define GOP_H
+
+#include "readImage.h"
+
+// GOP structure: every `size` pictures an I picture, every `distance`
+// pictures an anchor (I or P) and B pictures in between.
+// distance 1 codes no B pictures.
+typedef struct GopConfig {
+    int size;       // N
+    int distance;   // M
+    int closed;     // 1: every GOP ends with a P, so no B refers across GOPs
+} GopConfig;
+
+// One picture in coded order
+typedef struct CodedPicture {
+    ImageInfo image;
+    int display_index;      // in the sequence, from 0
+    int type;               // PICTURE_TYPE_*
+    int temporal_reference; // display order within its GOP
+    int gop_start;          // a GOP header comes first
+    int gop_first;          // display index of the first picture of the GOP, for the time code
+    int closed_gop;         // closed_gop flag of that header
+    int forward_distance;   // pictures back to the forward reference, 0 for I
+    int backward_distance;  // pictures ahead to the backward reference, B only
+} CodedPicture;
+
+// Turns frames in display order into pictures in coded order: each anchor
+// is coded before the B pictures that precede it in display order.
+//
+// Only the B pictures waiting for their backward reference and the anchor
+// that releases them are held, so the buffer needs `distance` frames
+// however long the GOP is. Frames are not copied: pushReorderFrame swaps
+// buffers with the caller.
+typedef struct ReorderBuffer {
+    GopConfig config;
+    int capacity;
+    CodedPicture* pictures;     // storage
+    CodedPicture** free_list;
+    int num_free;
+    CodedPicture** pending;     // B pictures in display order
+    int num_pending;
+    CodedPicture** queue;       // pictures ready to encode, in coded order
+    int queue_head;
+    int queue_len;
+    CodedPicture* current;      // last picture returned
+    int next_display;
+    int last_anchor;            // display index of the last anchor, -1 before the first
+    int gop_first;              // display index of the first picture of the current GOP
+} ReorderBuffer;
+
+// size >= 1 and 1 <= distance <= size
+int initReorderBuffer(ReorderBuffer* reorder, const GopConfig* config);
+
+void freeReorderBuffer(ReorderBuffer* reorder);
+
+// Picture type of the frame with this display index under `config`
+int gopPictureType(const GopConfig* config, int display_index);
+
+// Take the next frame in display order, to be coded as a picture of
+// `type`, usually gopPictureType. Its pixels move into the buffer and
+// `frame` gets an unused frame of the reorder buffer in exchange, NULL at
+// first, so whoever fills `frame` next must accept a NULL frame.
+// A B picture after distance - 1 others becomes a P picture, and the
+// first picture always becomes an I picture.
+// All pictures must have been taken with nextCodedPicture before.
+int pushReorderFrame(ReorderBuffer* reorder, ImageInfo* frame, int type);
+
+// After the last frame: the trailing B pictures get an anchor by turning
+// the last of them into a P picture
+void flushReorderBuffer(ReorderBuffer* reorder);
+
+// Next picture in coded order, or NULL if it needs more frames. The
+// picture stays valid until the next call.
+CodedPicture* nextCodedPicture(ReorderBuffer* reorder);
+#endif
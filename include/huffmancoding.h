@@ -3,8 +3,7 @@
 
 #include <stdint.h>
 
-// Buffer size to store the bitstream
-#define MAX_BITSTREAM_SIZE 1024
+#include "bitstream.h"
 
 // Simulate Huffman encoding (actual implementation should use standard tables)
 typedef struct {
@@ -22,6 +21,6 @@ extern HuffmanCode ac_huffman_table[];
 extern const int zigzag_order[64];
 
 // Function prototypes
-void writeBits(uint8_t* bitstream_buffer, int* bitstream_index_p, uint16_t bitstring, uint8_t bitlength);
-void performHuffmanCoding(uint8_t* bitstream_buffer, int* bitstream_index_p, double* mat, double previous_dc_coeffi);
+void writeBits(BitWriter* bw, uint16_t bitstring, uint8_t bitlength);
+void performHuffmanCoding(BitWriter* bw, double* mat, double previous_dc_coeffi);
 #endif // HUFFMAN_ENCODING_H
@@ -0,0 +1,67 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <pthread.h>
+
+#include "readImage.h"
+
+#define INGEST_MAX_PATH 256
+
+// One frame buffer of the ring
+typedef struct IngestSlot {
+    ImageInfo image;
+    int index;     // frame number held, -1 if none
+    int state;     // INGEST_SLOT_*
+} IngestSlot;
+
+// Decodes a numbered JPEG sequence ahead of the encoder.
+//
+// Frame n always goes to slot n % num_slots. A decoder thread may only claim
+// frame n once frame n - num_slots has been released, so at most num_slots
+// frames are in memory however long the sequence is, and the frames are
+// reused once every slot has been filled. A slot without a frame of the
+// right size, e.g. after the reorder buffer traded it away, takes one from
+// the pool. Frames are handed out strictly in order.
+typedef struct IngestPipeline {
+    char pattern[INGEST_MAX_PATH];  // printf pattern with one int, e.g. "Image%03d.jpeg"
+    int first;                      // number of the first file
+    int count;                      // number of frames
+    int num_slots;
+    IngestSlot* slots;
+    FramePool pool;
+    int num_threads;
+    pthread_t* threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free;   // signalled when the consumer releases a frame
+    pthread_cond_t frame_ready; // signalled when a decoder finishes a frame
+    int next_decode;            // next frame a decoder will claim
+    int next_out;               // next frame nextIngestFrame returns
+    int released;               // frames given back by the consumer
+    int stop;
+    int failed;                 // a file could not be read
+} IngestPipeline;
+
+// Number of consecutive files pattern(first), pattern(first + 1), ... that exist
+int countIngestFrames(const char* pattern, int first);
+
+// Start `num_threads` decoders (0: one per core) over frames first..first+count-1
+// with a ring of `num_slots` buffers (0: two per decoder).
+int startIngest(IngestPipeline* pipeline, const char* pattern, int first, int count, int num_threads, int num_slots);
+
+// Wait for the next frame in order. Returns NULL after the last frame, at
+// a file that cannot be read, which also sets `failed`, or once the
+// pipeline is cancelled.
+// The frame stays valid until it is released.
+ImageInfo* nextIngestFrame(IngestPipeline* pipeline);
+
+// Give the oldest frame returned by nextIngestFrame back to the ring
+void releaseIngestFrame(IngestPipeline* pipeline);
+
+// Make the decoders stop after their current frame and nextIngestFrame
+// return NULL, without waiting. Frames handed out stay valid.
+void cancelIngest(IngestPipeline* pipeline);
+
+// Stop the decoders, also before the end of the sequence, and free the ring
+void stopIngest(IngestPipeline* pipeline);
+#endif
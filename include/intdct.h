@@ -0,0 +1,59 @@
+#ifndef INTDCT_H
+#define INTDCT_H
+
+#include <stdint.h>
+
+// Fixed-point 8x8 forward DCT-II.
+//
+// Input is an 8x8 block of int16 samples in raster order (pixels 0..255 or
+// prediction residuals -255..255). Output is the orthonormal 2D DCT
+//     F(u,v) = 1/4 C(u) C(v) sum_x sum_y f(x,y) cos((2x+1)u pi/16) cos((2y+1)v pi/16)
+// rounded to int16, which is the scale used by the MPEG-1 quantizer.
+//
+// The FFTW reference (performdct2d) is unnormalized; its output relates to
+// this one by F(u,v) = fftw(u,v) * C(u) C(v) / 16. Every backend stays within
+// DCT_TOLERANCE of the rounded reference, and all backends are bit-exact with
+// each other.
+#define DCT_TOLERANCE 1
+
+// Fraction bits of the coefficient table and of the intermediate rows
+#define DCT_CONST_BITS 13
+#define DCT_PASS1_BITS 4
+
+typedef enum DCTBackend {
+    DCT_BACKEND_SCALAR = 0,
+    DCT_BACKEND_SSE2,
+    DCT_BACKEND_AVX2,
+    DCT_BACKEND_COUNT
+} DCTBackend;
+
+// Pick the fastest backend the CPU supports. Called on demand by
+// performIntDCT, calling it at startup is optional.
+void initIntDCT(void);
+
+// Transform one block in place using the selected backend
+void performIntDCT(int16_t block[64]);
+
+// Transform the 8x8 pixels at `src`, `stride` bytes per row, into `block`.
+// Rows are loaded and widened straight into registers, no staging copy.
+void performIntDCTPixels(int16_t block[64], const uint8_t* src, int stride);
+
+// Same for the prediction error src - pred of two 8x8 pixel blocks
+void performIntDCTResidual(int16_t block[64], const uint8_t* src, int stride_src, const uint8_t* pred, int stride_pred);
+
+// Backend used by performIntDCT
+DCTBackend getDCTBackend(void);
+
+// Force a backend (for tests and benchmarks). Returns -1 if the CPU
+// does not support it.
+int setDCTBackend(DCTBackend backend);
+
+int isDCTBackendSupported(DCTBackend backend);
+
+const char* getDCTBackendName(DCTBackend backend);
+
+// Inverse of performIntDCT for dequantized coefficients (-2048..2047), used
+// to reconstruct reference pictures. Scalar only: it runs on coded blocks
+// of reference pictures, and blocks without coefficients are skipped.
+void performIntIDCT(int16_t block[64]);
+#endif
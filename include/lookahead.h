@@ -0,0 +1,70 @@
+#ifndef LOOKAHEAD_H
+#define LOOKAHEAD_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "gop.h"
+#include "ingest.h"
+
+// Downsampling factor of the analysis in each dimension
+#define LOOKAHEAD_SCALE 4
+
+// A frame with its decided picture type
+typedef struct LookaheadFrame {
+    ImageInfo* image;       // frame of the ingest pipeline
+    int index;              // display index
+    int type;               // PICTURE_TYPE_*
+    int64_t intra_cost;     // low-res estimates in SAD units
+    int64_t inter_cost;     // against the previous frame, intra_cost for the first
+    int scenecut;
+} LookaheadFrame;
+
+// Analyzes frames of an ingest pipeline on its own thread, ahead of the
+// encoder, and decides their picture types.
+//
+// Every frame is downsampled LOOKAHEAD_SCALE times in each dimension and
+// its low-res 8x8 blocks are costed intra (deviation from the mean) and
+// inter (SAD of a small full search in the previous frame). A frame that
+// predicts badly from the previous one is a scene cut and starts a GOP;
+// one that predicts well becomes a B picture, up to distance - 1 in a row.
+// GOPs are no longer than config.size. The type of a frame is known once
+// the next frame has been analyzed, and the thread runs up to `depth`
+// frames ahead.
+typedef struct Lookahead {
+    GopConfig config;
+    IngestPipeline* ingest;
+    int depth;
+    int width;              // of the low-res planes
+    int height;
+    uint8_t* lowres;        // depth + 1 planes, frame n in plane n % (depth + 1)
+    LookaheadFrame* frames; // frame n in entry n % depth
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t decided;   // signalled when a frame gets its type
+    pthread_cond_t consumed;  // signalled when the encoder moves on
+    int num_analyzed;
+    int num_decided;
+    int num_out;            // frames the encoder is done with
+    int returned;           // the encoder holds frame num_out
+    int done;
+    int stop;
+
+    // Decision state of the thread
+    int last_intra;         // display index of the last I picture
+    int bidir_run;          // B pictures in a row
+} Lookahead;
+
+// Start analyzing the frames of `ingest`, which must have at least 2 slots.
+// The ingest pipeline must only be read through nextLookaheadFrame then.
+int startLookahead(Lookahead* lookahead, IngestPipeline* ingest, const GopConfig* config, int depth);
+
+// Next frame in display order with its type, or NULL after the last one.
+// The previous frame is given up, its ingest frame can then be released.
+LookaheadFrame* nextLookaheadFrame(Lookahead* lookahead);
+
+// Stop the thread, also before the end of the sequence, and free the
+// buffers. Call before stopIngest.
+void stopLookahead(Lookahead* lookahead);
+#endif
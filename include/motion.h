@@ -0,0 +1,103 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+
+// Motion vectors are in half-pel units, the unit of the MPEG-1 syntax
+typedef struct MotionVector {
+    int x;
+    int y;
+} MotionVector;
+
+// Backends of all motion kernels: SAD, half-pel interpolation and prediction
+typedef enum SADBackend {
+    SAD_BACKEND_SCALAR = 0,
+    SAD_BACKEND_SSE2,
+    SAD_BACKEND_AVX2,
+    SAD_BACKEND_COUNT
+} SADBackend;
+
+// Displacements in full pels a search may use for one macroblock, so that
+// the block stays inside the reference picture and the f_code range
+typedef struct MotionRange {
+    int x_min;
+    int x_max;
+    int y_min;
+    int y_max;
+} MotionRange;
+
+// Half-pel interpolations of a reference luma plane, indexed by
+// (half_y << 1) | half_x. plane[0] is the reference itself, the others
+// are averaged with the rounding of the decoder:
+// plane[1] (a + b + 1) >> 1 horizontally, plane[2] vertically and
+// plane[3] (a + b + c + d + 2) >> 2. Past the last row or column the
+// edge pixel is repeated.
+typedef struct HalfPelPlanes {
+    const uint8_t* plane[4];
+    uint8_t* buf;       // storage of planes 1..3
+    int width;
+    int height;
+    int stride;         // of every plane
+} HalfPelPlanes;
+
+// Pick the fastest SAD backend the CPU supports. Called on demand by sad16x16.
+void initMotionSearch(void);
+
+// Sum of absolute differences of two 16x16 blocks. A stride of 0 repeats one row.
+int sad16x16(const uint8_t* a, int stride_a, const uint8_t* b, int stride_b);
+
+// Same for 8x8 blocks
+int sad8x8(const uint8_t* a, int stride_a, const uint8_t* b, int stride_b);
+
+// Full-pel search for the 16x16 block `cur` in `ref`, where `ref` points at
+// the co-located block of the reference picture.
+//
+// Every candidate (e.g. neighbouring and previous-picture vectors) is tried
+// first, then a hexagon search walks from the best one and a small diamond
+// refines the result. The cost of a vector is its SAD plus lambda times the
+// bits of its difference to `pmv` with the given f_code. Returns the SAD of
+// the chosen vector.
+int searchMotion(const uint8_t* cur, const uint8_t* ref, int stride, const MotionRange* range,
+                 const MotionVector* candidates, int num_candidates, MotionVector pmv, int f_code, int lambda,
+                 MotionVector* best);
+
+// Sub-pel refinement of a full-pel vector from searchMotion: the eight
+// half-pel positions around it are tried with the same cost. `cur` is the
+// block at (x, y) of the current picture. Updates `best` and returns its SAD.
+int refineHalfPel(const uint8_t* cur, int stride, const HalfPelPlanes* planes, int x, int y, const MotionRange* range,
+                  MotionVector pmv, int f_code, int lambda, MotionVector* best);
+
+// Planes for a reference with `stride` bytes per row
+int initHalfPelPlanes(HalfPelPlanes* planes, int width, int height, int stride);
+
+void freeHalfPelPlanes(HalfPelPlanes* planes);
+
+// Interpolate rows first_row .. first_row + num_rows - 1 of plane[0], which
+// the caller points at the reference luma (stride planes->stride). Row
+// ranges are independent, so a picture can be split among threads.
+void buildHalfPelRows(HalfPelPlanes* planes, int first_row, int num_rows);
+
+// Top-left pixel of the prediction of the block at (x, y) with the half-pel
+// vector (mv_x, mv_y); its stride is planes->stride
+const uint8_t* halfPelBlock(const HalfPelPlanes* planes, int x, int y, int mv_x, int mv_y);
+
+// Motion-compensated prediction of a width x height block. `ref` points at
+// the co-located block and (mv_x, mv_y) is in half pels of this plane;
+// half-pel positions average two or four pixels, rounding up. Widths that
+// are a multiple of 8 use the vector kernels.
+void predictBlock(uint8_t* dst, int stride_dst, const uint8_t* ref, int stride_ref, int mv_x, int mv_y, int width, int height);
+
+// Average of two predictions, rounding up: the prediction of interpolated
+// macroblocks of B pictures. `dst` may be `a` or `b`.
+void averageBlock(uint8_t* dst, int stride_dst, const uint8_t* a, int stride_a, const uint8_t* b, int stride_b, int width, int height);
+
+SADBackend getSADBackend(void);
+
+// Force a backend (for tests and benchmarks). Returns -1 if the CPU
+// does not support it.
+int setSADBackend(SADBackend backend);
+
+int isSADBackendSupported(SADBackend backend);
+
+const char* getSADBackendName(SADBackend backend);
+#endif
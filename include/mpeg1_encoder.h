@@ -3,7 +3,7 @@
 
 #include <stdint.h>
 
-#define MAX_BITSTREAM_SIZE 1024
+#include "bitstream.h"
 
 // MPEG-1 DC coefficient Huffman encoding table (12 categories)
 extern const uint16_t ff_mpeg12_vlc_dc_lum_code[12];
@@ -15,14 +15,81 @@ extern const unsigned char ff_mpeg12_vlc_dc_chroma_bits[12];
 // MPEG-1 AC coefficient Huffman encoding table (including symbols like 0x00, 0x01)
 extern const uint16_t ff_mpeg1_vlc_table[113][2];
 
+// Indices of the escape and end-of-block codes in ff_mpeg1_vlc_table
+#define AC_VLC_ESCAPE 111
+#define AC_VLC_EOB 112
+
+// Dense AC table: every run 0..63 and level -40..40, the largest level with
+// its own code. Larger levels are escaped directly.
+#define AC_VLC_RUNS 64
+#define AC_VLC_MAX_LEVEL 40
+#define AC_VLC_LEVELS (2 * AC_VLC_MAX_LEVEL + 1)
+#define AC_VLC_INDEX(run, level) ((run) * AC_VLC_LEVELS + (level) + AC_VLC_MAX_LEVEL)
+
+// DC predictor value at the start of each slice (1024 / 8)
+#define DC_PREDICTOR_RESET 128
+
+// motion_code VLC by |motion_code|, without the sign bit
+extern const uint8_t mpeg1_motion_vlc[17][2];
+
+// macroblock_address_increment VLC by increment 1..33. Each escape
+// adds 33 to the increment that follows it.
+extern const uint8_t mpeg1_address_increment_vlc[34][2];
+#define MB_ADDRESS_ESCAPE_CODE 0x8
+#define MB_ADDRESS_ESCAPE_BITS 11
+
+// coded_block_pattern VLC by pattern: bit 5 is Y0, ..., bit 1 Cb, bit 0 Cr
+extern const uint8_t mpeg1_cbp_vlc[64][2];
+
+// macroblock_type codes of P pictures: motion forward and/or coded
+// blocks, or intra. None of them carry a quantizer_scale.
+#define MB_TYPE_P_MC_CODED_CODE 0x1
+#define MB_TYPE_P_MC_CODED_BITS 1
+#define MB_TYPE_P_CODED_CODE 0x1
+#define MB_TYPE_P_CODED_BITS 2
+#define MB_TYPE_P_MC_CODE 0x1
+#define MB_TYPE_P_MC_BITS 3
+#define MB_TYPE_P_INTRA_CODE 0x3
+#define MB_TYPE_P_INTRA_BITS 5
+
+// macroblock_type codes of B pictures by prediction direction; the coded
+// variant of each is the code + 1 with the same length
+#define MB_TYPE_B_INTERPOLATED_CODE 0x2
+#define MB_TYPE_B_INTERPOLATED_BITS 2
+#define MB_TYPE_B_BACKWARD_CODE 0x2
+#define MB_TYPE_B_BACKWARD_BITS 3
+#define MB_TYPE_B_FORWARD_CODE 0x2
+#define MB_TYPE_B_FORWARD_BITS 4
+#define MB_TYPE_B_INTRA_CODE 0x3
+#define MB_TYPE_B_INTRA_BITS 5
+
 // Zigzag scan table
 extern const int zigzag_scan[64];
 
+// Build the (run, level) table from ff_mpeg1_vlc_table. Thread-safe and
+// called on demand by encode_mpeg1.
+void initAcVlcTable(void);
+
 // Function declarations
 void encode_dc(int dc_val, int prev_dc_val, const uint16_t* code_table, const unsigned char* bit_table, int* code, int* bits);
-void encode_ac(int ac_val, int* code, int* bits);
-int encode_mpeg1(uint8_t* buffer, int matrix[64], int prev_dc, const uint16_t* huff_code, const unsigned char* huff_bits);
-int encode_mpeg1_y(uint8_t* buffer, int matrix[64], int prev_dc);
-int encode_mpeg1_c(uint8_t* buffer, int matrix[64], int prev_dc);
+void encode_ac(int run, int level, uint32_t* code, int* bits);
+// Encoders append to the bit writer and return the number of bits written.
+// last: zigzag index of the last nonzero coefficient (63 if unknown)
+int encode_mpeg1(BitWriter* bw, int matrix[64], int last, int prev_dc, const uint16_t* huff_code, const unsigned char* huff_bits);
+int encode_mpeg1_y(BitWriter* bw, int matrix[64], int last, int prev_dc);
+int encode_mpeg1_c(BitWriter* bw, int matrix[64], int last, int prev_dc);
+// Non-intra block, last >= 0
+int encode_mpeg1_inter(BitWriter* bw, int matrix[64], int last);
+
+// One component of a motion vector difference in half-pel units, with the
+// picture's f_code (1..7). motion_bits gives the length without writing.
+int encode_motion(BitWriter* bw, int delta, int f_code);
+int motion_bits(int delta, int f_code);
+
+// Address increment of a macroblock: 1 + the number of macroblocks skipped
+// before it
+int encode_address_increment(BitWriter* bw, int increment);
+
+void encode_cbp(BitWriter* bw, int cbp);
 
 #endif // MPEG1_ENCODER_H
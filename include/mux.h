@@ -0,0 +1,117 @@
+#ifndef MUX_H
+#define MUX_H
+
+#include <stdint.h>
+
+#include "sink.h"
+
+// Bytes of each pack: pack header, packet header and video data. Only the
+// last pack of a stream is shorter.
+#define MUX_PACK_SIZE 2048
+
+// The first picture is decoded this long after the first pack arrives, and
+// no data arrives earlier than this before its picture is decoded, in 90 kHz
+// ticks
+#define MUX_DELAY 45000
+
+// Bytes held after a full packet until the start codes in them are parsed
+#define MUX_LOOKAHEAD 8
+
+// Pictures that can start in one packet; later ones go without time stamps
+#define MUX_MAX_PICTURES 64
+
+// Pictures that can wait in the STD buffer model at once. Data arrives at
+// most MUX_DELAY ahead of decoding, so there are no more than 30 at 60 fps
+// plus those of one packet; any beyond are taken as decoded only once the
+// next pack may start.
+#define MUX_MAX_BUFFERED 128
+
+// mux_rate is the rate of the stream so far times this, for the larger
+// pictures
+#define MUX_RATE_MARGIN 2
+
+// A picture start code in the window and its time stamps
+typedef struct MuxPicture {
+    int offset;
+    uint64_t pts;
+    uint64_t dts;
+} MuxPicture;
+
+// A picture in the STD buffer: from `start`, where the headers before it
+// begin, up to the start of the next, removed at `dts`
+typedef struct MuxBuffered {
+    uint64_t start;
+    uint64_t dts;
+} MuxBuffered;
+
+// Streams a video elementary stream into an MPEG-1 system stream.
+//
+// The stream goes in as bytes, in pieces of any size. The muxer finds its
+// start codes itself: the sequence header gives the frame rate and the
+// mux_rate, GOP headers and temporal references give the display order
+// of each picture. Every MUX_PACK_SIZE bytes are written as a pack, and a
+// packet in which a picture starts gets its PTS and DTS. Only the packet
+// being filled is held in memory.
+//
+// The STD buffer of the video stream is sized from the vbv_buffer_size of
+// the sequence header, which must hold the largest coded picture. Each
+// pack is sent at MUX_RATE_MARGIN times the rate the stream has averaged
+// so far, no more than MUX_DELAY before its data is decoded, and no sooner
+// than the pictures before it have left room for it in the STD buffer.
+//
+// In raw mode the elementary stream is written as it is.
+typedef struct Muxer {
+    OutputSink sink;
+    int raw;
+
+    // Data of the next packet with the bytes after it
+    uint8_t window[MUX_PACK_SIZE + MUX_LOOKAHEAD];
+    int fill;
+    MuxPicture pictures[MUX_MAX_PICTURES]; // starting in the window
+    int num_pictures;
+
+    // Start code parser
+    uint32_t prefix;        // last three bytes
+    int code;               // whose fields are being read, or -1
+    int code_offset;        // of its start code in the window
+    uint8_t fields[8];
+    int num_fields;
+    int need_fields;
+
+    int header_open;        // a picture's headers have started at header_start
+    uint64_t header_start;
+
+    // From the first sequence header
+    int rate_bound;         // bits/s of the raw 4:2:0 pictures, 0 until known
+    int std_buffer_size;    // bytes
+    uint8_t frame_rate_code;
+    long coded;             // pictures so far, in coded order
+    long gop_first;         // pictures before the current GOP
+
+    // STD buffer model
+    uint64_t position;      // stream bytes before the window
+    MuxBuffered buffered[MUX_MAX_BUFFERED]; // pictures not decoded by the last SCR
+    int num_buffered;
+    uint64_t decoded_dts;   // the next pack waits for this decoding time
+
+    uint64_t data_dts;      // of the picture the window starts in
+    uint64_t scr;           // of the last pack
+    int mux_rate;           // bits/s of the last pack
+    int pack_bytes;         // of the last pack
+    long packs;
+} Muxer;
+
+// Create `filename`, or with NULL a memory sink. Returns 0, or -1 if the
+// file cannot be created.
+int openMuxer(Muxer* mux, const char* filename, int raw);
+
+// Hand the output to `callback` instead. Returns 0, or -1 if out of memory.
+int openCallbackMuxer(Muxer* mux, SinkCallback callback, void* opaque, int raw);
+
+// Append elementary stream data. Returns 0, or -1 on a write error.
+int muxWrite(Muxer* mux, const uint8_t* data, size_t len);
+
+// Write the data left and the end code and close the sink. Returns 0, or
+// -1 on a write error.
+int closeMuxer(Muxer* mux);
+#endif
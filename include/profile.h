@@ -0,0 +1,88 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Scoped timers and counters per thread, off by default.
+//
+//     uint64_t start = profileStart();
+//     ... stage ...
+//     profileStop(PROFILE_DCT, start);
+//
+// While profiling is off every call is one test of profile_enabled. Once
+// on, each thread adds to its own totals without locking; profileSpan
+// also records an event for the trace, so it is meant for scopes of a
+// slice or more, profileStop for those of a block.
+
+typedef enum ProfileStage {
+    PROFILE_DECODE = 0, // JPEG decode of a frame, color conversion included
+    PROFILE_COLOR,      // RGB to YCbCr conversion
+    PROFILE_PICTURE,    // encoding of a picture
+    PROFILE_SLICE,      // an intra slice, or the analysis of an inter row
+    PROFILE_MOTION,     // motion search of a macroblock
+    PROFILE_DCT,
+    PROFILE_QUANT,
+    PROFILE_VLC,        // variable length coding of blocks and macroblocks
+    PROFILE_MUX,        // system layer and joining of segments
+    PROFILE_WRITE,      // writes of the output, on the writer thread
+    PROFILE_STAGE_COUNT
+} ProfileStage;
+
+typedef enum ProfileCounter {
+    PROFILE_BLOCKS = 0,     // blocks coded
+    PROFILE_ZERO_BLOCKS,    // blocks left out for having no coefficient
+    PROFILE_BITS,           // bits of slices
+    PROFILE_ESCAPES,        // AC coefficients coded with an escape
+    PROFILE_COUNTER_COUNT
+} ProfileCounter;
+
+extern int profile_enabled;
+
+// Start counting; `trace` also keeps the events of profileSpan
+void enableProfile(int trace);
+
+// Stop counting and drop everything recorded
+void resetProfile(void);
+
+uint64_t profileNow(void);
+void profileRecord(ProfileStage stage, uint64_t start, int event);
+void profileAdd(ProfileCounter counter, uint64_t n);
+
+static inline uint64_t profileStart(void) {
+    return __builtin_expect(profile_enabled, 0) ? profileNow() : 0;
+}
+
+static inline void profileStop(ProfileStage stage, uint64_t start) {
+    if(__builtin_expect(profile_enabled, 0)) {
+        profileRecord(stage, start, 0);
+    }
+}
+
+static inline void profileSpan(ProfileStage stage, uint64_t start) {
+    if(__builtin_expect(profile_enabled, 0)) {
+        profileRecord(stage, start, 1);
+    }
+}
+
+static inline void profileCount(ProfileCounter counter, uint64_t n) {
+    if(__builtin_expect(profile_enabled, 0)) {
+        profileAdd(counter, n);
+    }
+}
+
+// Table of the time and calls per stage summed over threads, then the
+// counters of each thread
+void printProfileSummary(FILE* file);
+
+// Nanoseconds spent in a stage, summed over threads
+uint64_t profileStageTime(ProfileStage stage);
+
+uint64_t profileCounterTotal(ProfileCounter counter);
+
+const char* profileStageName(ProfileStage stage);
+
+// Events as a Chrome trace (chrome://tracing, Perfetto). Returns -1 if the
+// file cannot be written.
+int writeProfileTrace(const char* filename);
+#endif
@@ -5,13 +5,33 @@
 
 #include "seperateMatrix.h"
 #include "ffwt.h"
+#include "intdct.h"
 
 #define PI 3.1415927
 
+// quantizer_scale is a 5-bit field, legal values are 1..31
+#define MAX_QUANT_SCALE 31
+
+// Largest level MPEG-1 can code (with escape)
+#define MAX_QUANT_LEVEL 255
+
+// Default non-intra matrix: 16 for every coefficient
+#define NON_INTRA_QUANT 16
+
+// Fraction bits of the quantizer reciprocals
+#define QUANT_RECIP_BITS 24
+
 extern const unsigned char quantization_table_y[BLOCKSIZE * BLOCKSIZE];
 
 extern const unsigned char quantization_table_c[BLOCKSIZE * BLOCKSIZE];
 
+// Multiply-and-shift reciprocals of scale * matrix entry, indexed [scale][raster position].
+// MPEG-1 has one intra matrix for all blocks, so there is none for chroma.
+extern const uint32_t quant_recip_y[MAX_QUANT_SCALE + 1][BLOCKSIZE * BLOCKSIZE];
+
+// Reciprocals of the non-intra step 2 * scale, indexed by scale
+extern const uint32_t quant_recip_inter[MAX_QUANT_SCALE + 1];
+
 void performFastDCT(double block[BLOCKSIZE*BLOCKSIZE]);
 
 // Function to apply 2D DCT on an 8x8 block
@@ -19,4 +39,29 @@ void performDCT(double block[BLOCKSIZE][BLOCKSIZE]);
 
 // scale from 0 to 51
 void quantizeBlock(int mat[BLOCKSIZE * BLOCKSIZE], uint8_t block[BLOCKSIZE*BLOCKSIZE], const unsigned char* quantization_table, uint8_t scale);
+
+// DCT and intra quantization in one step of the 8x8 pixels at `block`,
+// `stride` bytes per row, with a reciprocal row such as quant_recip_y[scale].
+// AC levels are round(8 * F / (scale * w)) and the DC level is round(F / 8),
+// the MPEG-1 intra rule, where F is the orthonormal DCT. Returns the zigzag
+// index of the last nonzero level, or -1 if all are zero.
+int transformQuantizeBlock(int mat[BLOCKSIZE * BLOCKSIZE], const uint8_t* block, int stride, const uint32_t recip[BLOCKSIZE * BLOCKSIZE]);
+
+// Same as transformQuantizeBlock, but starting from the quantized DCT
+// coefficients of a JPEG block and its quantization table, both in raster
+// order. The coefficients are dequantized and level shifted in the DCT
+// domain and then quantized with the MPEG-1 intra rule.
+int requantizeBlock(int mat[BLOCKSIZE * BLOCKSIZE], const int16_t jpeg_coef[BLOCKSIZE * BLOCKSIZE], const uint16_t jpeg_quant[BLOCKSIZE * BLOCKSIZE], const uint32_t recip[BLOCKSIZE * BLOCKSIZE]);
+
+// DCT and non-intra quantization of the prediction error src - pred of two
+// 8x8 pixel blocks. Levels are |F| / (2 * scale) truncated toward zero, the
+// inverse of the MPEG-1 non-intra reconstruction with the default matrix.
+// Returns the zigzag index of the last nonzero level, or -1 if all are zero.
+int transformQuantizeResidual(int mat[BLOCKSIZE * BLOCKSIZE], const uint8_t* src, int stride_src, const uint8_t* pred, int stride_pred, uint8_t scale);
+
+// Decoder side reconstruction of quantized levels (raster order) into DCT
+// coefficients for performIntIDCT, including mismatch control
+void dequantizeIntraBlock(int16_t coef[BLOCKSIZE * BLOCKSIZE], const int mat[BLOCKSIZE * BLOCKSIZE], uint8_t scale);
+
+void dequantizeInterBlock(int16_t coef[BLOCKSIZE * BLOCKSIZE], const int mat[BLOCKSIZE * BLOCKSIZE], uint8_t scale);
 #endif
\ No newline at end of file
@@ -1,21 +1,66 @@
 #ifndef READIMAGE_H
 #define READIMAGE_H
+#include <setjmp.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <jpeglib.h>
 
+#include "frame.h"
+
 #define NUMOFLINESREADINONETIME 16
 
 typedef struct ImageInfo {
-    unsigned char* buf_p;
+    Frame* frame;       // the pixels, NULL if there are none
     int width;
     int height;
-    size_t buf_size;
     uint16_t fps;
     int bitrate; // kbps
 } ImageInfo;
 
+// libjpeg's error handler, which returns to the reader on a fatal error
+// instead of exiting the process
+typedef struct JpegError {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} JpegError;
+
+// Decode a JPEG into a newly allocated frame with a border of FRAME_PAD
 int readImage(ImageInfo* imageinfo, char* filename);
+
+// Decode into imageinfo->frame. Without a frame of the picture's size, the
+// one held (if any) goes back to `pool` and another is taken from it; with
+// a NULL pool they are freed and allocated. 4:2:0 YCbCr files are read as
+// raw planes with no color conversion or upsampling, anything else goes
+// through RGB. Returns -1 if the file cannot be opened or decoded, with
+// the reason on stderr, or if out of memory.
+int readImageInto(ImageInfo* imageinfo, char* filename, FramePool* pool);
+
+// readImageInto from a JPEG file in memory, without printing anything
+int readImageData(ImageInfo* imageinfo, const uint8_t* data, size_t size, FramePool* pool);
+
+// Free the frame of readImage
+void freeImage(ImageInfo* imageinfo);
+
+// Quantized DCT coefficients of a 4:2:0 JPEG, left in libjpeg's own
+// block arrays. info carries the picture parameters, info.frame is NULL.
+typedef struct CoefImage {
+    ImageInfo info;
+    JBLOCKROW* rows[3];                  // Y, Cb, Cr: one pointer per block row
+    const uint16_t* quant[3];            // quantization table of each component, raster order
+    struct jpeg_decompress_struct cinfo;
+    JpegError error;
+    FILE* file;
+} CoefImage;
+
+// Read the coefficients without decoding to pixels. Returns -1 if the file
+// is not 4:2:0 or its size is not a multiple of the 16x16 macroblock, so
+// the blocks do not line up with MPEG-1 macroblocks; use readImage then.
+// Also -1 if it cannot be opened or read.
+int readCoefficients(CoefImage* image, char* filename);
+
+void freeCoefficients(CoefImage* image);
+
+void transferrRgb2Yuv420(unsigned char *yuv,unsigned char *rgb, int width, int height);
 #endif
\ No newline at end of file
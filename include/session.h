@@ -0,0 +1,66 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "colorconv.h"
+#include "sink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Settings of an encoding session. defaultSessionParams gives those of the
+// command line encoder.
+typedef struct SessionParams {
+    int fps;            // rounded up to an MPEG-1 frame rate
+    int scale;          // quantizer_scale 1..31
+    int gop_size;       // pictures from one I picture to the next
+    int gop_distance;   // pictures from one anchor to the next, 1 for no B pictures
+    int closed_gop;
+    int search_range;   // full pels of motion search, 0 for I pictures only
+    int num_threads;    // of the encoder, 0 for the OpenMP default
+    int raw;            // bare video stream instead of a system stream
+} SessionParams;
+
+void defaultSessionParams(SessionParams* params);
+
+// One video being encoded from frames pushed by the caller.
+//
+// Sessions share no state, so a process can run any number of them on
+// threads of its own, as long as each session is used by one thread at a
+// time. Picture types follow the GOP structure of the params. Frames are
+// encoded as soon as the reordering for B pictures allows, and the output
+// goes to the callback as it is produced, on the thread that pushes or
+// flushes.
+typedef struct EncoderSession EncoderSession;
+
+// NULL if the params are invalid or out of memory
+EncoderSession* openSession(const SessionParams* params, SinkCallback callback, void* opaque);
+
+// Push the next frame in display order. Every frame must have the size of
+// the first. Each returns 0, or -1 if the frame cannot be read or encoded
+// or the callback fails.
+
+// 4:2:0 planes, chroma of (width + 1) / 2 by (height + 1) / 2
+int pushYuvFrame(EncoderSession* session, const YuvPlanes* planes, int width, int height);
+
+// Packed 8-bit RGB with `stride` bytes per line
+int pushRgbFrame(EncoderSession* session, const uint8_t* rgb, int stride, int width, int height);
+
+int pushJpegFile(EncoderSession* session, const char* filename);
+
+int pushJpegData(EncoderSession* session, const uint8_t* data, size_t size);
+
+// Encode the frames held back for reordering and end the stream. Nothing
+// can be pushed after. Returns 0, or -1 if anything failed.
+int flushSession(EncoderSession* session);
+
+// Flush the session if that has not been done and free it
+void closeSession(EncoderSession* session);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,77 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes gathered before a file sink hands them to its writer thread
+#define SINK_CHUNK_SIZE (1 << 20)
+
+typedef enum SinkKind {
+    SINK_FILE,      // written by a thread of its own
+    SINK_MEMORY,    // kept in memory for the caller
+    SINK_CALLBACK,  // handed to a function of the caller
+} SinkKind;
+
+// Takes `len` bytes of output; nonzero fails the write
+typedef int (*SinkCallback)(void* opaque, const uint8_t* data, size_t len);
+
+// Where the output goes.
+//
+// A file sink fills one of two chunks while its writer thread writes the
+// other, so the encoder only waits for the disk when a whole chunk is
+// still being written. Write errors are kept and reported by the next
+// sinkWrite or by closeSink.
+//
+// A memory sink grows one buffer, which the caller takes over after
+// closeSink and frees with free().
+//
+// A callback sink gathers a chunk and passes it to the callback on the
+// thread that writes, when it is full or flushed.
+typedef struct OutputSink {
+    SinkKind kind;
+    uint64_t bytes;         // written so far
+
+    // SINK_MEMORY
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+
+    // SINK_CALLBACK
+    SinkCallback callback;
+    void* opaque;
+
+    // SINK_FILE, SINK_CALLBACK only uses the first chunk
+    int fd;
+    uint8_t* chunks[2];
+    int current;            // chunk being filled
+    size_t fill;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;   // a chunk is pending or the sink stops
+    pthread_cond_t done;    // the pending chunk is written
+    const uint8_t* pending;
+    size_t pending_size;
+    int stop;
+    int error;
+} OutputSink;
+
+// Create `filename`. Returns 0, or -1 if it cannot be created.
+int openFileSink(OutputSink* sink, const char* filename);
+
+void openMemorySink(OutputSink* sink);
+
+// Returns 0, or -1 if out of memory
+int openCallbackSink(OutputSink* sink, SinkCallback callback, void* opaque);
+
+// Returns 0, or -1 on a write error or out of memory
+int sinkWrite(OutputSink* sink, const void* data, size_t len);
+
+// Pass on the bytes gathered so far, to the writer thread or the callback
+int sinkFlush(OutputSink* sink);
+
+// Write what is left and close the file. Returns 0, or -1 if anything
+// failed to be written.
+int closeSink(OutputSink* sink);
+#endif
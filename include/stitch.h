@@ -0,0 +1,20 @@
+#ifndef STITCH_H
+#define STITCH_H
+
+// Join MPEG-1 files encoded separately from consecutive ranges of frames
+// into one file, as if it had been encoded in one go.
+//
+// Every segment is a bare video stream of createMLV in raw mode: a
+// sequence header and GOPs, ending with a sequence end code. The sequence
+// header of the first segment starts the output; those of the others are
+// dropped and must match the first one. Each GOP header
+// gets the time code of its position in the joined sequence, counted in
+// pictures, so the segments may number their frames from 0. A segment
+// that does not start with a closed GOP must not follow another one.
+//
+// The joined stream is muxed into a system stream, or written as it is
+// with `raw`.
+//
+// Returns 0, or -1 if a segment cannot be read or does not fit.
+int stitchSegments(const char* filename_o, char* const* segments, int num_segments, int raw);
+#endif
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitstream.h"
+
+int initBitWriter(BitWriter* bw, uint8_t* buf, size_t capacity) {
+    memset(bw, 0, sizeof(*bw));
+    if(buf) {
+        bw->buf = buf;
+        bw->capacity = capacity;
+        return 0;
+    }
+    if(capacity == 0) {
+        capacity = BITWRITER_DEFAULT_CAPACITY;
+    }
+    bw->buf = (uint8_t*)malloc(capacity);
+    if(!bw->buf) {
+        return -1;
+    }
+    bw->capacity = capacity;
+    bw->owns_buffer = 1;
+    return 0;
+}
+
+void freeBitWriter(BitWriter* bw) {
+    if(bw->owns_buffer) {
+        free(bw->buf);
+    }
+    memset(bw, 0, sizeof(*bw));
+}
+
+void resetBitWriter(BitWriter* bw) {
+    bw->pos = 0;
+    bw->acc = 0;
+    bw->bits = 0;
+    bw->overflow = 0;
+}
+
+int reserveBitWriter(BitWriter* bw, size_t bytes) {
+    if(bw->pos + bytes <= bw->capacity) {
+        return 0;
+    }
+    if(!bw->owns_buffer || bw->overflow) {
+        bw->overflow = 1;
+        return -1;
+    }
+    size_t capacity = bw->capacity * 2;
+    while(capacity < bw->pos + bytes) {
+        capacity *= 2;
+    }
+    uint8_t* buf = (uint8_t*)realloc(bw->buf, capacity);
+    if(!buf) {
+        bw->overflow = 1;
+        return -1;
+    }
+    bw->buf = buf;
+    bw->capacity = capacity;
+    return 0;
+}
+
+long finishBitWriter(BitWriter* bw) {
+    alignBitWriter(bw);
+    while(bw->bits > 0) {
+        bw->bits -= 8;
+        if(reserveBitWriter(bw, 1) == 0) {
+            bw->buf[bw->pos] = (uint8_t)(bw->acc >> bw->bits);
+        }
+        bw->pos++;
+    }
+    return bw->overflow ? -1 : (long)bw->pos;
+}
+
+int appendBitWriter(BitWriter* dst, const BitWriter* src) {
+    if(finishBitWriter(dst) < 0 || reserveBitWriter(dst, src->pos) != 0) {
+        dst->pos += src->pos;
+        return -1;
+    }
+    memcpy(dst->buf + dst->pos, src->buf, src->pos);
+    dst->pos += src->pos;
+    return src->overflow ? -1 : 0;
+}
@@ -0,0 +1,302 @@
+#include <pthread.h>
+
+#include "colorconv.h"
+#include "profile.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define COLORCONV_X86 1
+#include <immintrin.h>
+#endif
+
+// round(2^14 * coefficient), each row adjusted so that it sums to exactly
+// 2^14 (Y) or 0 (Cb, Cr)
+#define Y_R 4899
+#define Y_G 9617
+#define Y_B 1868
+#define CB_R -2765
+#define CB_G -5427
+#define CB_B 8192
+#define CR_R 8192
+#define CR_G -6860
+#define CR_B -1332
+
+// Chroma is computed from a 2x2 sum, i.e. four times the value
+#define CHROMA_BITS (COLOR_CONST_BITS + 2)
+#define Y_ROUNDING (1 << (COLOR_CONST_BITS - 1))
+#define CHROMA_OFFSET ((128 << CHROMA_BITS) + (1 << (CHROMA_BITS - 1)))
+
+// The vector kernels load 16 bytes for every 4 pixels (12 bytes), so they
+// stop this many pixels before the end of the line
+#define RGB_OVERREAD_PIXELS 2
+
+static inline uint8_t clamp255(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline uint8_t lumaFromRgb(const uint8_t* p) {
+    return (uint8_t)((Y_R * p[0] + Y_G * p[1] + Y_B * p[2] + Y_ROUNDING) >> COLOR_CONST_BITS);
+}
+
+// Convert columns x0..width-1 of a line pair. Odd widths repeat the last
+// column for the chroma sum.
+static void convertRowsScalar(const uint8_t* row0, const uint8_t* row1, int x0, int width,
+                              uint8_t* y0, uint8_t* y1, uint8_t* cb, uint8_t* cr) {
+    for(int x = x0; x < width; x += 2) {
+        int x1 = x + 1 < width ? x + 1 : x;
+        const uint8_t* p[4] = { row0 + 3 * x, row0 + 3 * x1, row1 + 3 * x, row1 + 3 * x1 };
+        y0[x] = lumaFromRgb(p[0]);
+        y0[x1] = lumaFromRgb(p[1]);
+        y1[x] = lumaFromRgb(p[2]);
+        y1[x1] = lumaFromRgb(p[3]);
+
+        int r = p[0][0] + p[1][0] + p[2][0] + p[3][0];
+        int g = p[0][1] + p[1][1] + p[2][1] + p[3][1];
+        int b = p[0][2] + p[1][2] + p[2][2] + p[3][2];
+        cb[x / 2] = clamp255((CB_R * r + CB_G * g + CB_B * b + CHROMA_OFFSET) >> CHROMA_BITS);
+        cr[x / 2] = clamp255((CR_R * r + CR_G * g + CR_B * b + CHROMA_OFFSET) >> CHROMA_BITS);
+    }
+}
+
+// Vector kernels convert 16 pixels of a line pair per step and return the
+// number of columns done; the scalar code finishes the line.
+static int convertRowsNone(const uint8_t* row0, const uint8_t* row1, int width,
+                           uint8_t* y0, uint8_t* y1, uint8_t* cb, uint8_t* cr) {
+    (void)row0;
+    (void)row1;
+    (void)width;
+    (void)y0;
+    (void)y1;
+    (void)cb;
+    (void)cr;
+    return 0;
+}
+
+#ifdef COLORCONV_X86
+// Both kernels widen each pixel to 16-bit R G B 0, so one pmaddwd against
+// (cR cG cB 0) yields two partial sums per pixel, which a pair of
+// shuffles then adds up.
+static inline __m128i sumPairsSSE2(__m128i m0, __m128i m1) {
+    __m128 a = _mm_castsi128_ps(m0);
+    __m128 b = _mm_castsi128_ps(m1);
+    return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(a, b, 0x88)),
+                         _mm_castps_si128(_mm_shuffle_ps(a, b, 0xDD)));
+}
+
+// 4 packed RGB pixels to R G B 0 bytes, using byte shifts in place of pshufb
+static inline __m128i loadRgbx4SSE2(const uint8_t* p) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i q = _mm_and_si128(v, _mm_setr_epi32(0x00FFFFFF, 0, 0, 0));
+    q = _mm_or_si128(q, _mm_and_si128(_mm_slli_si128(v, 1), _mm_setr_epi32(0, 0x00FFFFFF, 0, 0)));
+    q = _mm_or_si128(q, _mm_and_si128(_mm_slli_si128(v, 2), _mm_setr_epi32(0, 0, 0x00FFFFFF, 0)));
+    q = _mm_or_si128(q, _mm_and_si128(_mm_slli_si128(v, 3), _mm_setr_epi32(0, 0, 0, 0x00FFFFFF)));
+    return q;
+}
+
+static int convertRowsSSE2(const uint8_t* row0, const uint8_t* row1, int width,
+                           uint8_t* y0, uint8_t* y1, uint8_t* cb, uint8_t* cr) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i coef_y = _mm_setr_epi16(Y_R, Y_G, Y_B, 0, Y_R, Y_G, Y_B, 0);
+    const __m128i coef_cb = _mm_setr_epi16(CB_R, CB_G, CB_B, 0, CB_R, CB_G, CB_B, 0);
+    const __m128i coef_cr = _mm_setr_epi16(CR_R, CR_G, CR_B, 0, CR_R, CR_G, CR_B, 0);
+    const __m128i y_rounding = _mm_set1_epi32(Y_ROUNDING);
+    const __m128i chroma_offset = _mm_set1_epi32(CHROMA_OFFSET);
+
+    int x = 0;
+    for(; x + 16 + RGB_OVERREAD_PIXELS <= width; x += 16) {
+        __m128i luma[2][4];
+        __m128i blocks[4];
+        for(int g = 0; g < 4; g++) {
+            __m128i lo[2], hi[2];
+            for(int r = 0; r < 2; r++) {
+                __m128i q = loadRgbx4SSE2((r ? row1 : row0) + 3 * (x + 4 * g));
+                lo[r] = _mm_unpacklo_epi8(q, zero);
+                hi[r] = _mm_unpackhi_epi8(q, zero);
+                luma[r][g] = sumPairsSSE2(_mm_madd_epi16(lo[r], coef_y), _mm_madd_epi16(hi[r], coef_y));
+                luma[r][g] = _mm_srai_epi32(_mm_add_epi32(luma[r][g], y_rounding), COLOR_CONST_BITS);
+            }
+            // Vertical then horizontal sums: R G B 0 of two 2x2 blocks
+            __m128i vlo = _mm_add_epi16(lo[0], lo[1]);
+            __m128i vhi = _mm_add_epi16(hi[0], hi[1]);
+            vlo = _mm_add_epi16(vlo, _mm_srli_si128(vlo, 8));
+            vhi = _mm_add_epi16(vhi, _mm_srli_si128(vhi, 8));
+            blocks[g] = _mm_unpacklo_epi64(vlo, vhi);
+        }
+        uint8_t* dst_y[2] = { y0 + x, y1 + x };
+        for(int r = 0; r < 2; r++) {
+            __m128i w0 = _mm_packs_epi32(luma[r][0], luma[r][1]);
+            __m128i w1 = _mm_packs_epi32(luma[r][2], luma[r][3]);
+            _mm_storeu_si128((__m128i*)dst_y[r], _mm_packus_epi16(w0, w1));
+        }
+
+        __m128i c[2][2];
+        for(int h = 0; h < 2; h++) {
+            c[0][h] = sumPairsSSE2(_mm_madd_epi16(blocks[2 * h], coef_cb), _mm_madd_epi16(blocks[2 * h + 1], coef_cb));
+            c[1][h] = sumPairsSSE2(_mm_madd_epi16(blocks[2 * h], coef_cr), _mm_madd_epi16(blocks[2 * h + 1], coef_cr));
+            c[0][h] = _mm_srai_epi32(_mm_add_epi32(c[0][h], chroma_offset), CHROMA_BITS);
+            c[1][h] = _mm_srai_epi32(_mm_add_epi32(c[1][h], chroma_offset), CHROMA_BITS);
+        }
+        __m128i w_cb = _mm_packs_epi32(c[0][0], c[0][1]);
+        __m128i w_cr = _mm_packs_epi32(c[1][0], c[1][1]);
+        _mm_storel_epi64((__m128i*)(cb + x / 2), _mm_packus_epi16(w_cb, w_cb));
+        _mm_storel_epi64((__m128i*)(cr + x / 2), _mm_packus_epi16(w_cr, w_cr));
+    }
+    return x;
+}
+
+// Same steps with 8 pixels per register: pixels 0-3 in the low lane and
+// 4-7 in the high lane, so pshufb can do the R G B 0 expansion per lane.
+__attribute__((target("avx2")))
+static inline __m256i sumPairsAVX2(__m256i m0, __m256i m1) {
+    __m256 a = _mm256_castsi256_ps(m0);
+    __m256 b = _mm256_castsi256_ps(m1);
+    return _mm256_add_epi32(_mm256_castps_si256(_mm256_shuffle_ps(a, b, 0x88)),
+                            _mm256_castps_si256(_mm256_shuffle_ps(a, b, 0xDD)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i loadRgbx8AVX2(const uint8_t* p) {
+    const __m256i expand = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    __m256i v = _mm256_set_m128i(_mm_loadu_si128((const __m128i*)(p + 12)), _mm_loadu_si128((const __m128i*)p));
+    return _mm256_shuffle_epi8(v, expand);
+}
+
+__attribute__((target("avx2")))
+static int convertRowsAVX2(const uint8_t* row0, const uint8_t* row1, int width,
+                           uint8_t* y0, uint8_t* y1, uint8_t* cb, uint8_t* cr) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i coef_y = _mm256_setr_epi16(Y_R, Y_G, Y_B, 0, Y_R, Y_G, Y_B, 0, Y_R, Y_G, Y_B, 0, Y_R, Y_G, Y_B, 0);
+    const __m256i coef_cb = _mm256_setr_epi16(CB_R, CB_G, CB_B, 0, CB_R, CB_G, CB_B, 0, CB_R, CB_G, CB_B, 0, CB_R, CB_G, CB_B, 0);
+    const __m256i coef_cr = _mm256_setr_epi16(CR_R, CR_G, CR_B, 0, CR_R, CR_G, CR_B, 0, CR_R, CR_G, CR_B, 0, CR_R, CR_G, CR_B, 0);
+    const __m256i y_rounding = _mm256_set1_epi32(Y_ROUNDING);
+    const __m256i chroma_offset = _mm256_set1_epi32(CHROMA_OFFSET);
+    // Chroma comes out as blocks 0 1 4 5 | 2 3 6 7
+    const __m256i chroma_order = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+
+    int x = 0;
+    for(; x + 16 + RGB_OVERREAD_PIXELS <= width; x += 16) {
+        __m256i luma[2][2];
+        __m256i blocks[2];
+        for(int g = 0; g < 2; g++) {
+            __m256i lo[2], hi[2];
+            for(int r = 0; r < 2; r++) {
+                __m256i q = loadRgbx8AVX2((r ? row1 : row0) + 3 * (x + 8 * g));
+                lo[r] = _mm256_unpacklo_epi8(q, zero);
+                hi[r] = _mm256_unpackhi_epi8(q, zero);
+                luma[r][g] = sumPairsAVX2(_mm256_madd_epi16(lo[r], coef_y), _mm256_madd_epi16(hi[r], coef_y));
+                luma[r][g] = _mm256_srai_epi32(_mm256_add_epi32(luma[r][g], y_rounding), COLOR_CONST_BITS);
+            }
+            __m256i vlo = _mm256_add_epi16(lo[0], lo[1]);
+            __m256i vhi = _mm256_add_epi16(hi[0], hi[1]);
+            vlo = _mm256_add_epi16(vlo, _mm256_srli_si256(vlo, 8));
+            vhi = _mm256_add_epi16(vhi, _mm256_srli_si256(vhi, 8));
+            blocks[g] = _mm256_unpacklo_epi64(vlo, vhi);
+        }
+        uint8_t* dst_y[2] = { y0 + x, y1 + x };
+        for(int r = 0; r < 2; r++) {
+            __m256i w = _mm256_permute4x64_epi64(_mm256_packs_epi32(luma[r][0], luma[r][1]), 0xD8);
+            _mm_storeu_si128((__m128i*)dst_y[r],
+                             _mm_packus_epi16(_mm256_castsi256_si128(w), _mm256_extracti128_si256(w, 1)));
+        }
+
+        __m256i c_cb = sumPairsAVX2(_mm256_madd_epi16(blocks[0], coef_cb), _mm256_madd_epi16(blocks[1], coef_cb));
+        __m256i c_cr = sumPairsAVX2(_mm256_madd_epi16(blocks[0], coef_cr), _mm256_madd_epi16(blocks[1], coef_cr));
+        c_cb = _mm256_permutevar8x32_epi32(_mm256_srai_epi32(_mm256_add_epi32(c_cb, chroma_offset), CHROMA_BITS), chroma_order);
+        c_cr = _mm256_permutevar8x32_epi32(_mm256_srai_epi32(_mm256_add_epi32(c_cr, chroma_offset), CHROMA_BITS), chroma_order);
+        __m128i w_cb = _mm_packs_epi32(_mm256_castsi256_si128(c_cb), _mm256_extracti128_si256(c_cb, 1));
+        __m128i w_cr = _mm_packs_epi32(_mm256_castsi256_si128(c_cr), _mm256_extracti128_si256(c_cr, 1));
+        _mm_storel_epi64((__m128i*)(cb + x / 2), _mm_packus_epi16(w_cb, w_cb));
+        _mm_storel_epi64((__m128i*)(cr + x / 2), _mm_packus_epi16(w_cr, w_cr));
+    }
+    return x;
+}
+#endif
+
+typedef int (*ConvertRowsFn)(const uint8_t*, const uint8_t*, int, uint8_t*, uint8_t*, uint8_t*, uint8_t*);
+
+static const ConvertRowsFn color_backends[COLOR_BACKEND_COUNT] = {
+    convertRowsNone,
+#ifdef COLORCONV_X86
+    convertRowsSSE2,
+    convertRowsAVX2,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+static const char* color_backend_names[COLOR_BACKEND_COUNT] = { "scalar", "sse2", "avx2" };
+
+static pthread_once_t color_once = PTHREAD_ONCE_INIT;
+static ColorBackend color_backend = COLOR_BACKEND_SCALAR;
+
+int isColorBackendSupported(ColorBackend backend) {
+    switch(backend) {
+    case COLOR_BACKEND_SCALAR:
+        return 1;
+#ifdef COLORCONV_X86
+    case COLOR_BACKEND_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case COLOR_BACKEND_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return 0;
+    }
+}
+
+static void selectColorBackend(void) {
+#ifdef COLORCONV_X86
+    __builtin_cpu_init();
+#endif
+    for(int b = COLOR_BACKEND_COUNT - 1; b >= 0; b--) {
+        if(isColorBackendSupported((ColorBackend)b)) {
+            color_backend = (ColorBackend)b;
+            return;
+        }
+    }
+}
+
+void initColorConversion(void) {
+    pthread_once(&color_once, selectColorBackend);
+}
+
+void convertRgbToYuv420(const uint8_t* rgb, int stride_rgb, int width, int height, const YuvPlanes* planes) {
+    initColorConversion();
+    uint64_t start = profileStart();
+    ConvertRowsFn convert_rows = color_backends[color_backend];
+    for(int i = 0; i < height; i += 2) {
+        // An odd last line is paired with itself
+        int i1 = i + 1 < height ? i + 1 : i;
+        const uint8_t* row0 = rgb + (size_t)i * stride_rgb;
+        const uint8_t* row1 = rgb + (size_t)i1 * stride_rgb;
+        uint8_t* y0 = planes->y + (size_t)i * planes->stride_y;
+        uint8_t* y1 = planes->y + (size_t)i1 * planes->stride_y;
+        uint8_t* cb = planes->cb + (size_t)(i / 2) * planes->stride_cb;
+        uint8_t* cr = planes->cr + (size_t)(i / 2) * planes->stride_cr;
+        int x = convert_rows(row0, row1, width, y0, y1, cb, cr);
+        convertRowsScalar(row0, row1, x, width, y0, y1, cb, cr);
+    }
+    profileStop(PROFILE_COLOR, start);
+}
+
+ColorBackend getColorBackend(void) {
+    initColorConversion();
+    return color_backend;
+}
+
+int setColorBackend(ColorBackend backend) {
+    initColorConversion();
+    if(backend < 0 || backend >= COLOR_BACKEND_COUNT || !isColorBackendSupported(backend)) {
+        return -1;
+    }
+    color_backend = backend;
+    return 0;
+}
+
+const char* getColorBackendName(ColorBackend backend) {
+    if(backend < 0 || backend >= COLOR_BACKEND_COUNT) {
+        return "unknown";
+    }
+    return color_backend_names[backend];
+}
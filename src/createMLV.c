@@ -1,177 +1,193 @@
 #include "createMLV.h"
+#include "profile.h"
+
+// 33-bit time stamp split by marker bits, as used by SCR, PTS and DTS
+static void writeTimeStamp(BitWriter* bw, uint8_t prefix, uint64_t ts) {
+    putBits(bw, prefix, 4);
+    putBits(bw, (ts >> 30) & 0x07, 3);
+    putBits(bw, 1, 1);
+    putBits(bw, (ts >> 15) & 0x7FFF, 15);
+    putBits(bw, 1, 1);
+    putBits(bw, ts & 0x7FFF, 15);
+    putBits(bw, 1, 1);
+}
+
+// mux_rate/rate_bound are 22-bit fields in units of 50 bytes/s
+static uint32_t muxRate(int bit_rate) {
+    uint32_t rate = (uint32_t)((bit_rate + 399) / 400);
+    if(rate == 0) {
+        rate = 1;
+    }
+    return rate > 0x3FFFFF ? 0x3FFFFF : rate;
+}
+
+// STD_buffer_size in units of 1024 bytes
+static uint32_t stdBufferUnits(int size) {
+    uint32_t units = (uint32_t)(size + 1023) / 1024;
+    return units > 0x1FFF ? 0x1FFF : (units == 0 ? 1 : units);
+}
+
+uint8_t frameRateCode(uint16_t fps) {
+    if(fps <= 24) {
+        return 2;
+    }
+    if(fps <= 25) {
+        return 3;
+    }
+    if(fps <= 30) {
+        return 5;
+    }
+    if(fps <= 50) {
+        return 6;
+    }
+    return 8;
+}
 
-// Write the sequence header of the mpeg file
-// bit_rate: choose one of the following:
-//     1: 23.976 fps
-//     2: 24 fps
-//     3: 25 fps
-//     4: 29.97 fps
-//     5: 30 fps
-//     6: 50 fps
-//     7: 59.94 fps
-//     8: 60 fps
-// n is the index of the image
-void writePackHeader(FILE* file_mpeg, int width, int height, uint16_t frame_rate, int bit_rate) {
-    unsigned char sequence_header[12];
-
-    // Sync Byte
-    sequence_header[0] = 0x00;
-    sequence_header[1] = 0x00;
-    sequence_header[2] = 0x01;
-    sequence_header[3] = 0xBA; // Start of video stream
-
-    // System clock reference
-    size_t scr = 0 * 90000 / frame_rate;
-    sequence_header[4] = 0x20;
-    sequence_header[5] = 0x00;
-    sequence_header[6] = 0x01;
-    sequence_header[7] = 0x00;
-    sequence_header[8] = 0x01;
-
-    // Resolution (12 bits for horizontal, 12 bits for vertical)
-    //sequence_header[4] = (width >> 4) & 0xFF;                   // Higher 8 bits of horizontal size
-    //sequence_header[5] = ((width & 0x0F) << 4) | ((height >> 8) & 0x0F); // Lower 4 bits of horizontal and higher 4 bits of vertical
-    //sequence_header[6] = height & 0xFF;                         // Lower 8 bits of vertical size
-
-    // Frame rate and bit rate
-    //sequence_header[7] = (bit_rate >> 10) & 0xFF;               // Higher 8 bits of bit rate
-    //sequence_header[8] = (bit_rate >> 2) & 0xFF;                // Middle 8 bits of bit rate
-    bit_rate = bit_rate * 2.5;
-    sequence_header[9] = (bit_rate >> 15) | 0x80;       // Lower 2 bits of bit rate and VBV buffer size
-
-    // Frame rate code and marker bits
-    sequence_header[10] = (bit_rate >> 7) & 0xFF;        // Frame rate code (4 bits)
-    sequence_header[11] = ((bit_rate & 0x7F) << 1) | 0x01;                                 // Marker bits
-
-    // Write Sequence Header to file
-    fwrite(sequence_header, 1, sizeof(sequence_header), file_mpeg);
+// Write the pack header of the mpeg file
+// scr: system clock reference in 90 kHz ticks
+void writePackHeader(BitWriter* bw, uint64_t scr, int bit_rate) {
+    putStartCode(bw, 0xBA);
+    writeTimeStamp(bw, 0x2, scr);
+    putBits(bw, 1, 1);
+    putBits(bw, muxRate(bit_rate), 22);
+    putBits(bw, 1, 1);
 }
 
-// Optional. Including ratebound. Not used now
-void writeSystemHeader(FILE* file_mpeg, uint16_t len_header, int bitrate) {
-    unsigned char system_header[15];
-    system_header[0] = 0x00;
-    system_header[1] = 0x00;
-    system_header[2] = 0x01;
-    system_header[3] = 0xBB;
-
-    system_header[4] = len_header >> 8;
-    system_header[5] = len_header & 0xFF;
-    bitrate = bitrate * 2.5;
-    system_header[6] = (bitrate >> 15) | 0x80;       // Lower 2 bits of bit rate and VBV buffer size
-
-    // Frame rate code and marker bits
-    system_header[7] = (bitrate >> 7) & 0xFF;        // Frame rate code (4 bits)
-    system_header[8] = ((bitrate & 0x7F) << 1) | 0x01; 
-    system_header[9] = 0x00;
-    system_header[10] = 0x21;
-    system_header[11] = 0xFF;
-    system_header[12] = 0xE0;
-    system_header[13] = 0xE0;
-    system_header[14] = 0xE6;
-    fwrite(system_header, 1, sizeof(system_header), file_mpeg);
+// Starts the first pack of the stream, with the rate bound and STD buffer size
+void writeSystemHeader(BitWriter* bw, uint16_t len_header, int bitrate, int std_buffer_size) {
+    putStartCode(bw, 0xBB);
+    putBits(bw, len_header, 16);
+    putBits(bw, 1, 1);
+    putBits(bw, muxRate(bitrate), 22); // rate_bound
+    putBits(bw, 1, 1);
+    putBits(bw, 0, 6);    // audio_bound
+    putBits(bw, 0, 1);    // fixed_flag
+    putBits(bw, 0, 1);    // CSPS_flag
+    putBits(bw, 0, 1);    // system_audio_lock_flag
+    putBits(bw, 0, 1);    // system_video_lock_flag
+    putBits(bw, 1, 1);
+    putBits(bw, 1, 5);    // video_bound
+    putBits(bw, 0xFF, 8); // reserved_byte
+
+    // Video stream 0, STD buffer bound in units of 1024 bytes
+    putBits(bw, 0xE0, 8);
+    putBits(bw, 0x3, 2);
+    putBits(bw, 1, 1);
+    putBits(bw, stdBufferUnits(std_buffer_size), 13);
 }
 
-// the unit of buffer size is 128
-void writePacket(FILE* file_mpeg, uint16_t size_buffer, int bitrate, uint16_t fps) {
-    unsigned char system_header[16];
-    system_header[0] = 0x00;
-    system_header[1] = 0x00;
-    system_header[2] = 0x01;
-    system_header[3] = 0xE0;
-
-    uint16_t len_pack = bitrate / fps / 10;
-    system_header[4] = len_pack >> 8;
-    system_header[5] = len_pack & 0xFF;
-
-    //system_header[6] = (size_buffer >> 8) | 0x40;
-    //system_header[7] = size_buffer & 0xFF;
-
-    // PTS
-    system_header[6] = 0x31;
-    system_header[7] = 0x00;
-    system_header[8] = 0x03;
-    system_header[9] = 0x77;
-    system_header[10] = 0x01;
-
-    system_header[11] = 0x11;
-    system_header[12] = 0x00;
-    system_header[13] = 0x03;
-    system_header[14] = 0x5F;
-    system_header[15] = 0x91;
-
-    fwrite(system_header, 1, sizeof(system_header), file_mpeg);
+int packetHeaderSize(int first_packet, uint64_t pts, uint64_t dts) {
+    int size = 6 + (first_packet ? 2 : 0);
+    if(pts == TIME_STAMP_NONE) {
+        return size + 1;
+    }
+    return size + (dts == pts ? 5 : 10);
 }
 
-void writeSequenceHeader(FILE* file_mpeg, uint16_t width, uint16_t height) {
-    unsigned char sequence_header[12];
-    sequence_header[0] = 0x00;
-    sequence_header[1] = 0x00;
-    sequence_header[2] = 0x01;
-    sequence_header[3] = 0xB3;
-
-    sequence_header[4] = width >> 4;
-    sequence_header[5] = ((width & 0xF) << 1) | (height >> 8);
-    sequence_header[6] = height & 0xFF;
-
-    sequence_header[7] = 0x25; // 0100 0000
-    sequence_header[8] = 0xFF; // 0001 1100
-    sequence_header[9] = 0xFF; // 0111 0000
-    uint16_t size_buf = (uint16_t)(width * height * 1.5) + 1;
-    sequence_header[10] = 0xE0 | (size_buf >> 5);
-    sequence_header[11] = ((size_buf & 0x1F) << 3) | 0x00;
-    fwrite(sequence_header, 1, sizeof(sequence_header), file_mpeg);
+void writePacket(BitWriter* bw, uint16_t len_data, int first_packet, uint64_t pts, uint64_t dts, int std_buffer_size) {
+    putStartCode(bw, 0xE0);
+    putBits(bw, packetHeaderSize(first_packet, pts, dts) - 6 + len_data, 16);
+    if(first_packet) {
+        // STD buffer size in units of 1024 bytes
+        putBits(bw, 0x1, 2);
+        putBits(bw, 1, 1);
+        putBits(bw, stdBufferUnits(std_buffer_size), 13);
+    }
+    if(pts == TIME_STAMP_NONE) {
+        putBits(bw, 0x0F, 8);
+    } else if(dts == pts) {
+        writeTimeStamp(bw, 0x2, pts);
+    } else {
+        writeTimeStamp(bw, 0x3, pts);
+        writeTimeStamp(bw, 0x1, dts);
+    }
 }
 
-void writeGOPHeader(FILE* file_mlv) {
-    unsigned char header_GOP[8];
-    header_GOP[0] = 0x00;
-    header_GOP[1] = 0x00;
-    header_GOP[2] = 0x01;
-    header_GOP[3] = 0xB8;
-
-    header_GOP[4] = 0x80;// drop frame & time
-    header_GOP[5] = 0x08;
-    header_GOP[6] = 0x00;
-    header_GOP[7] = 0x40;
-    fwrite(header_GOP, 1, sizeof(header_GOP), file_mlv);
+void writeSequenceHeader(BitWriter* bw, uint16_t width, uint16_t height, uint8_t frame_rate_code) {
+    putStartCode(bw, 0xB3);
+    putBits(bw, width, 12);
+    putBits(bw, height, 12);
+    putBits(bw, 0x2, 4);     // pel_aspect_ratio
+    putBits(bw, frame_rate_code, 4);
+    putBits(bw, 0x3FFFF, 18); // bit_rate: variable
+    putBits(bw, 1, 1);
+
+    // vbv_buffer_size in units of 16 kbit, large enough for one raw frame
+    uint32_t size_buf = ((uint32_t)width * height * 3 / 2 + 2047) / 2048;
+    putBits(bw, size_buf > 0x3FF ? 0x3FF : size_buf, 10);
+    putBits(bw, 0, 1); // constrained_parameters_flag
+    putBits(bw, 0, 1); // load_intra_quantizer_matrix
+    putBits(bw, 0, 1); // load_non_intra_quantizer_matrix
 }
 
-void writePictureHeader(FILE* file_mlv) {
-    unsigned char header_pic[8];
-    header_pic[0] = 0x00;
-    header_pic[1] = 0x00;
-    header_pic[2] = 0x01;
-    header_pic[3] = 0x00;
-
-    header_pic[4] = 0x00;//  要改
-    header_pic[5] = 0x0F;
-    header_pic[6] = 0xFF;
-    header_pic[7] = 0xF8;
-    fwrite(header_pic, 1, sizeof(header_pic), file_mlv);
+// Nominal rate of each frame_rate_code, which time codes count in
+static const uint8_t frame_rate_of_code[9] = { 30, 24, 24, 25, 30, 30, 50, 60, 60 };
+
+void writeGOPHeader(BitWriter* bw, uint32_t first_frame, uint8_t frame_rate_code, uint8_t closed_gop) {
+    uint32_t rate = frame_rate_of_code[frame_rate_code < 9 ? frame_rate_code : 0];
+    uint32_t seconds = first_frame / rate;
+    putStartCode(bw, 0xB8);
+    putBits(bw, 0, 1); // drop_frame_flag
+    putBits(bw, (seconds / 3600) % 24, 5); // hours
+    putBits(bw, (seconds / 60) % 60, 6);   // minutes
+    putBits(bw, 1, 1);
+    putBits(bw, seconds % 60, 6);          // seconds
+    putBits(bw, first_frame % rate, 6);    // pictures
+    putBits(bw, closed_gop, 1);
+    putBits(bw, 0, 1); // broken_link
+}
+
+void writePictureHeader(BitWriter* bw, uint16_t temporal_reference, uint8_t picture_type, uint16_t vbv_delay,
+                        uint8_t forward_f_code, uint8_t backward_f_code) {
+    putStartCode(bw, 0x00);
+    putBits(bw, temporal_reference & 0x3FF, 10);
+    putBits(bw, picture_type, 3);
+    putBits(bw, vbv_delay, 16);
+    if(picture_type == PICTURE_TYPE_P || picture_type == PICTURE_TYPE_B) {
+        putBits(bw, 0, 1); // full_pel_forward_vector
+        putBits(bw, forward_f_code, 3);
+    }
+    if(picture_type == PICTURE_TYPE_B) {
+        putBits(bw, 0, 1); // full_pel_backward_vector
+        putBits(bw, backward_f_code, 3);
+    }
+    putBits(bw, 0, 1);       // extra_bit_picture
 }
 
 // Parameter:
-// index: the vertical position of slice (only 4 bit is allowed)
-// scal: quatization scale 0-51
-void writeSliceHeader(FILE* file_mlv, uint8_t index, uint8_t scal) {
-    unsigned char header_sli[5];
-    header_sli[0] = 0x00;
-    header_sli[1] = 0x00;
-    header_sli[2] = 0x01;
-    header_sli[3] = index;
-
-    header_sli[4] = (scal << 3) | 0x03;
-    fwrite(header_sli, 1, sizeof(header_sli), file_mlv);
+// index: the vertical position of slice (1-175)
+// scal: quatization scale 1-31
+void writeSliceHeader(BitWriter* bw, uint8_t index, uint8_t scal) {
+    putStartCode(bw, index);
+    putBits(bw, scal, 5);
+    putBits(bw, 0, 1); // extra_bit_slice
+}
+
+void writeSequenceEndCode(BitWriter* bw) {
+    putStartCode(bw, 0xB7);
 }
 
-FILE* createMLV(char* filename_p, ImageInfo imageinfo) {
-    FILE* file_mlv = fopen(filename_p, "wb");
-    writePackHeader(file_mlv, imageinfo.width, imageinfo.height, imageinfo.fps, imageinfo.bitrate);
-    writeSystemHeader(file_mlv, LEN_SYS_HEADER, imageinfo.bitrate);
-    writePacket(file_mlv, 1000, imageinfo.bitrate, imageinfo.fps);
-    writeSequenceHeader(file_mlv, imageinfo.width, imageinfo.height);
-    writeGOPHeader(file_mlv);
-    writePictureHeader(file_mlv);
-    return file_mlv;
-}
\ No newline at end of file
+// Write the contents of `bw` to the muxer and empty it
+int flushBitstream(Muxer* mux, BitWriter* bw) {
+    long len = finishBitWriter(bw);
+    uint64_t start = profileStart();
+    if(len < 0 || muxWrite(mux, bw->buf, len) != 0) {
+        return -1;
+    }
+    profileSpan(PROFILE_MUX, start);
+    resetBitWriter(bw);
+    return 0;
+}
+
+int createMLV(Muxer* mux, char* filename_p, ImageInfo imageinfo, int raw) {
+    if(openMuxer(mux, filename_p, raw) != 0) {
+        fprintf(stderr, "Error creating output file %s!\n", filename_p);
+        return -1;
+    }
+    BitWriter bw;
+    initBitWriter(&bw, NULL, 0);
+    writeSequenceHeader(&bw, imageinfo.width, imageinfo.height, frameRateCode(imageinfo.fps));
+    int ret = flushBitstream(mux, &bw);
+    freeBitWriter(&bw);
+    return ret;
+}
@@ -0,0 +1,985 @@
+#include <omp.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "createMLV.h"
+#include "encoder.h"
+#include "mpeg1_encoder.h"
+#include "profile.h"
+#include "quantization.h"
+
+// A macroblock is coded intra in a P picture when its deviation from its
+// own mean beats the best motion-compensated SAD by this much
+#define INTRA_MODE_BIAS 512
+
+// Prediction directions of an inter macroblock. P pictures predict forward.
+#define PREDICT_INTRA 0
+#define PREDICT_FORWARD 1
+#define PREDICT_BACKWARD 2
+#define PREDICT_INTERPOLATED (PREDICT_FORWARD | PREDICT_BACKWARD)
+
+// Checks of the row above before a wavefront row blocks on it
+#define WAVEFRONT_SPINS 1024
+
+// Analysis of an inter macroblock, coded later in slice order
+struct MacroblockDecision {
+    int16_t levels[6][BLOCKSIZE * BLOCKSIZE];
+    int8_t last[6];
+    uint8_t mode;           // PREDICT_*
+    uint8_t cbp;
+    MotionVector mv[2];     // forward and backward vectors found, also for other modes
+};
+
+// The row below waits on `advanced` when `done` falls too far behind,
+// after saying so in `waiting`
+struct RowProgress {
+    int done;               // macroblocks analyzed
+    int waiting;
+    pthread_mutex_t lock;
+    pthread_cond_t advanced;
+};
+
+// Top-left pixel and stride of block 0..5 (Y0 Y1 Y2 Y3 Cb Cr) of a macroblock
+static uint8_t* blockAddress(const YuvPlanes* planes, int block, int x_block, int y_block, int* stride) {
+    if(block < 4) {
+        *stride = planes->stride_y;
+        return planes->y + (y_block * MACROBLOCK_SIZE + (block / 2) * BLOCKSIZE) * planes->stride_y +
+            x_block * MACROBLOCK_SIZE + (block % 2) * BLOCKSIZE;
+    }
+    *stride = block == 4 ? planes->stride_cb : planes->stride_cr;
+    return (block == 4 ? planes->cb : planes->cr) + y_block * BLOCKSIZE * *stride + x_block * BLOCKSIZE;
+}
+
+static inline uint8_t clampPixel(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static int numSlices(const EncoderContext* ctx) {
+    return (ctx->mb_height + ctx->slice_rows - 1) / ctx->slice_rows;
+}
+
+// Macroblock rows [first_row, end_row) of a slice
+static void sliceRows(const EncoderContext* ctx, int slice, int* first_row, int* end_row) {
+    *first_row = slice * ctx->slice_rows;
+    *end_row = *first_row + ctx->slice_rows < ctx->mb_height ? *first_row + ctx->slice_rows : ctx->mb_height;
+}
+
+// Partial macroblocks at the right and bottom edge run into the border of
+// the input frame, which then repeats the edge pixels
+static void padPartialMacroblocks(const EncoderContext* ctx, const ImageInfo* imageinfo) {
+    if(ctx->width % MACROBLOCK_SIZE != 0 || ctx->height % MACROBLOCK_SIZE != 0) {
+        padFrame(imageinfo->frame);
+    }
+}
+
+int initEncoder(EncoderContext* ctx, int width, int height, uint8_t scale, int num_threads, int search_range) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->width = width;
+    ctx->height = height;
+    // A partial macroblock at the right or bottom edge is coded whole
+    ctx->mb_width = (width + MACROBLOCK_SIZE - 1) / MACROBLOCK_SIZE;
+    ctx->mb_height = (height + MACROBLOCK_SIZE - 1) / MACROBLOCK_SIZE;
+    ctx->scale = scale;
+    ctx->num_threads = num_threads;
+    ctx->slice_rows = 1;
+    // What is allocated so far is freed on failure; the rest is still zero
+    ctx->slices = (BitWriter*)calloc(ctx->mb_height, sizeof(BitWriter));
+    if(!ctx->slices) {
+        freeEncoder(ctx);
+        return -1;
+    }
+    for(int i = 0; i < ctx->mb_height; i++) {
+        if(initBitWriter(&ctx->slices[i], NULL, ctx->mb_width * 64) != 0) {
+            freeEncoder(ctx);
+            return -1;
+        }
+    }
+
+    if(search_range > 0) {
+        // Smallest f_code whose vector range [-8f, 8f - 1] full pels covers the search
+        ctx->f_code = 1;
+        while(ctx->f_code < 7 && 8 * (1 << (ctx->f_code - 1)) - 1 < search_range) {
+            ctx->f_code++;
+        }
+        int max_range = 8 * (1 << (ctx->f_code - 1)) - 1;
+        ctx->search_range = search_range < max_range ? search_range : max_range;
+        int num_mbs = ctx->mb_width * ctx->mb_height;
+        int coded_width = ctx->mb_width * MACROBLOCK_SIZE;
+        int coded_height = ctx->mb_height * MACROBLOCK_SIZE;
+        ctx->ref = allocFrame(width, height, FRAME_PAD);
+        ctx->ref_prev = allocFrame(width, height, FRAME_PAD);
+        ctx->recon = allocFrame(width, height, FRAME_PAD);
+        ctx->mvs = (MotionVector*)calloc(num_mbs, sizeof(MotionVector));
+        ctx->prev_mvs = (MotionVector*)calloc(num_mbs, sizeof(MotionVector));
+        ctx->decisions = (MacroblockDecision*)calloc(num_mbs, sizeof(MacroblockDecision));
+        ctx->row_progress = (RowProgress*)calloc(ctx->mb_height, sizeof(RowProgress));
+        for(int i = 0; i < ctx->mb_height && ctx->row_progress; i++) {
+            pthread_mutex_init(&ctx->row_progress[i].lock, NULL);
+            pthread_cond_init(&ctx->row_progress[i].advanced, NULL);
+        }
+        if(!ctx->ref || !ctx->ref_prev || !ctx->recon || !ctx->mvs || !ctx->prev_mvs || !ctx->decisions || !ctx->row_progress ||
+           initHalfPelPlanes(&ctx->halfpel, coded_width, coded_height, ctx->ref->planes.stride_y) != 0 ||
+           initHalfPelPlanes(&ctx->halfpel_prev, coded_width, coded_height, ctx->ref->planes.stride_y) != 0) {
+            freeEncoder(ctx);
+            return -1;
+        }
+        // Chroma half-pel predictions at the edge of the coded area can read
+        // one pixel past it, which stays the same in every picture
+        for(int i = 0; i < 3; i++) {
+            Frame* frame = i == 0 ? ctx->ref : (i == 1 ? ctx->ref_prev : ctx->recon);
+            memset(frame->data, 0, frame->size);
+        }
+        initMotionSearch();
+    }
+    initIntDCT();
+    initAcVlcTable();
+    return 0;
+}
+
+void freeEncoder(EncoderContext* ctx) {
+    for(int i = 0; i < ctx->mb_height && ctx->slices; i++) {
+        freeBitWriter(&ctx->slices[i]);
+    }
+    free(ctx->slices);
+    freeFrame(ctx->ref);
+    freeFrame(ctx->ref_prev);
+    freeFrame(ctx->recon);
+    free(ctx->mvs);
+    free(ctx->prev_mvs);
+    free(ctx->decisions);
+    for(int i = 0; i < ctx->mb_height && ctx->row_progress; i++) {
+        pthread_mutex_destroy(&ctx->row_progress[i].lock);
+        pthread_cond_destroy(&ctx->row_progress[i].advanced);
+    }
+    free(ctx->row_progress);
+    freeHalfPelPlanes(&ctx->halfpel);
+    freeHalfPelPlanes(&ctx->halfpel_prev);
+    ctx->slices = NULL;
+    ctx->ref = NULL;
+    ctx->ref_prev = NULL;
+    ctx->recon = NULL;
+    ctx->mvs = NULL;
+    ctx->prev_mvs = NULL;
+    ctx->decisions = NULL;
+    ctx->row_progress = NULL;
+}
+
+// Transform and quantize the six blocks of an intra macroblock, read in
+// place from the picture
+static void quantizeIntraMacroblock(const YuvPlanes* cur, int x_block, int y_block, const uint32_t* recip,
+                                    int mat_quan[6][BLOCKSIZE * BLOCKSIZE], int last[6]) {
+    for(int b = 0; b < 6; b++) {
+        int stride;
+        const uint8_t* src = blockAddress(cur, b, x_block, y_block, &stride);
+        last[b] = transformQuantizeBlock(mat_quan[b], src, stride, recip);
+    }
+}
+
+// Write the blocks of an intra macroblock from its quantized Y0..Y3, Cb and Cr
+static void writeIntraMacroblock(BitWriter* bw, int mat_quan[6][BLOCKSIZE * BLOCKSIZE], const int last[6], int prev_dc[3]) {
+    for(int i = 0; i < 4; i++) {
+        encode_mpeg1_y(bw, mat_quan[i], last[i], prev_dc[0]);
+        prev_dc[0] = mat_quan[i][0]; // First element (DC coefficient for Y)
+    }
+    encode_mpeg1_c(bw, mat_quan[4], last[4], prev_dc[1]);
+    prev_dc[1] = mat_quan[4][0]; // First element (DC coefficient for Cb)
+    encode_mpeg1_c(bw, mat_quan[5], last[5], prev_dc[2]);
+    prev_dc[2] = mat_quan[5][0]; // First element (DC coefficient for Cr)
+}
+
+// Decode an intra macroblock the way the decoder will, into the reconstruction
+static void reconstructIntraMacroblock(const EncoderContext* ctx, int mat_quan[6][BLOCKSIZE * BLOCKSIZE], const int last[6],
+                                       uint8_t scale, int x_block, int y_block) {
+    const YuvPlanes* recon = &ctx->recon->planes;
+    for(int b = 0; b < 6; b++) {
+        int stride;
+        uint8_t* dst = blockAddress(recon, b, x_block, y_block, &stride);
+        int16_t coef[BLOCKSIZE * BLOCKSIZE];
+        if(last[b] <= 0) {
+            // A DC-only block is flat: F(0,0) / 8 = the DC level
+            memset(coef, 0, sizeof(coef));
+            for(int i = 0; i < BLOCKSIZE * BLOCKSIZE; i++) {
+                coef[i] = mat_quan[b][0];
+            }
+        } else {
+            dequantizeIntraBlock(coef, mat_quan[b], scale);
+            performIntIDCT(coef);
+        }
+        for(int i = 0; i < BLOCKSIZE; i++) {
+            for(int j = 0; j < BLOCKSIZE; j++) {
+                dst[i * stride + j] = clampPixel(coef[i * BLOCKSIZE + j]);
+            }
+        }
+    }
+}
+
+// Encode the macroblock rows of one slice
+static void encodeIntraSlice(const EncoderContext* ctx, const ImageInfo* imageinfo, int slice, BitWriter* bw) {
+    int prev_dc[3] = { DC_PREDICTOR_RESET, DC_PREDICTOR_RESET, DC_PREDICTOR_RESET };
+    const uint32_t* recip = quant_recip_y[ctx->scale];
+    const YuvPlanes* planes = &imageinfo->frame->planes;
+
+    uint64_t start_slice = profileStart();
+    int first_row;
+    int end_row;
+    sliceRows(ctx, slice, &first_row, &end_row);
+
+    writeSliceHeader(bw, first_row + 1, ctx->scale);
+    for(int y_block = first_row; y_block < end_row; y_block++) {
+        for(int x_block = 0; x_block < ctx->mb_width; x_block++) {
+            int mat_quan[6][BLOCKSIZE * BLOCKSIZE];
+            int last[6];
+            quantizeIntraMacroblock(planes, x_block, y_block, recip, mat_quan, last);
+
+            // Macroblock header: address increment 1, intra without quantizer
+            uint64_t start = profileStart();
+            putBits(bw, 1, 1);
+            putBits(bw, 1, 1);
+            writeIntraMacroblock(bw, mat_quan, last, prev_dc);
+            profileStop(PROFILE_VLC, start);
+            if(ctx->recon) {
+                reconstructIntraMacroblock(ctx, mat_quan, last, ctx->scale, x_block, y_block);
+            }
+        }
+    }
+    finishBitWriter(bw);
+    profileCount(PROFILE_BITS, bitWriterTell(bw));
+    profileSpan(PROFILE_SLICE, start_slice);
+}
+
+// Append the slices in order; each one ends byte-aligned
+static int stitchSlices(EncoderContext* ctx, BitWriter* bw) {
+    int ret = 0;
+    for(int slice = 0; slice < numSlices(ctx); slice++) {
+        if(appendBitWriter(bw, &ctx->slices[slice]) != 0) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+// The reconstruction just written becomes the newest reference, and the
+// one it replaces the forward reference of B pictures
+static void finishReferencePicture(EncoderContext* ctx) {
+    ctx->decoded = NULL;
+    if(!ctx->recon) {
+        return;
+    }
+    Frame* picture = ctx->ref_prev;
+    ctx->ref_prev = ctx->ref;
+    ctx->ref = ctx->recon;
+    ctx->recon = picture;
+    HalfPelPlanes planes = ctx->halfpel_prev;
+    ctx->halfpel_prev = ctx->halfpel;
+    ctx->halfpel = planes;
+    ctx->halfpel_prev_ready = ctx->halfpel_ready;
+    ctx->halfpel_ready = 0;
+    ctx->num_anchors++;
+    MotionVector* mvs = ctx->prev_mvs;
+    ctx->prev_mvs = ctx->mvs;
+    ctx->mvs = mvs;
+    ctx->decoded = ctx->ref;
+}
+
+int encodeIntraPicture(EncoderContext* ctx, const ImageInfo* imageinfo, BitWriter* bw) {
+    uint64_t start = profileStart();
+    padPartialMacroblocks(ctx, imageinfo);
+    int num_threads = ctx->num_threads > 0 ? ctx->num_threads : omp_get_max_threads();
+
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+    for(int slice = 0; slice < numSlices(ctx); slice++) {
+        resetBitWriter(&ctx->slices[slice]);
+        encodeIntraSlice(ctx, imageinfo, slice, &ctx->slices[slice]);
+    }
+    if(ctx->mvs) {
+        memset(ctx->mvs, 0, ctx->mb_width * ctx->mb_height * sizeof(MotionVector));
+    }
+    finishReferencePicture(ctx);
+    int ret = stitchSlices(ctx, bw);
+    profileSpan(PROFILE_PICTURE, start);
+    return ret;
+}
+
+// Whether every block of a macroblock quantizes to zero against the
+// co-located reference block, decided from SADs before any DCT. No
+// coefficient of a block exceeds its SAD / 4, the integer DCT is within 1
+// of that, and non-intra levels truncate |F| / 2s, so a SAD below
+// 4 * (2s - 1) gives all-zero levels.
+static int isStaticMacroblock(const YuvPlanes* cur, const YuvPlanes* ref, int x_block, int y_block, int scale) {
+    int limit = 4 * (2 * scale - 1);
+    int stride;
+    const uint8_t* a = blockAddress(cur, 0, x_block, y_block, &stride);
+    const uint8_t* b = blockAddress(ref, 0, x_block, y_block, &stride);
+    int sad = sad16x16(a, stride, b, stride);
+    // Then at least one luma block reaches the limit
+    if(sad >= 4 * limit) {
+        return 0;
+    }
+    for(int block = sad < limit ? 4 : 0; block < 6; block++) {
+        a = blockAddress(cur, block, x_block, y_block, &stride);
+        b = blockAddress(ref, block, x_block, y_block, &stride);
+        if(sad8x8(a, stride, b, stride) >= limit) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// A skipped macroblock of a P picture is the co-located reference block
+static void reconstructSkippedMacroblock(const YuvPlanes* ref, const YuvPlanes* recon, int x_block, int y_block) {
+    for(int b = 0; b < 6; b++) {
+        int stride;
+        const uint8_t* src = blockAddress(ref, b, x_block, y_block, &stride);
+        uint8_t* dst = blockAddress(recon, b, x_block, y_block, &stride);
+        for(int i = 0; i < BLOCKSIZE; i++) {
+            memcpy(dst + i * stride, src + i * stride, BLOCKSIZE);
+        }
+    }
+}
+
+// Displacements that keep a macroblock inside the coded area of the reference
+static MotionRange searchRange(const EncoderContext* ctx, int x_block, int y_block) {
+    int x = x_block * MACROBLOCK_SIZE;
+    int y = y_block * MACROBLOCK_SIZE;
+    MotionRange range = {
+        .x_min = -x > -ctx->search_range ? -x : -ctx->search_range,
+        .x_max = ctx->mb_width * MACROBLOCK_SIZE - MACROBLOCK_SIZE - x,
+        .y_min = -y > -ctx->search_range ? -y : -ctx->search_range,
+        .y_max = ctx->mb_height * MACROBLOCK_SIZE - MACROBLOCK_SIZE - y,
+    };
+    range.x_max = range.x_max < ctx->search_range ? range.x_max : ctx->search_range;
+    range.y_max = range.y_max < ctx->search_range ? range.y_max : ctx->search_range;
+    return range;
+}
+
+// Intra cost: deviation from the mean of the macroblock
+static int intraCost(const uint8_t* cur_y, int stride) {
+    static const uint8_t zero_row[MACROBLOCK_SIZE] = { 0 };
+    uint8_t mean_row[MACROBLOCK_SIZE];
+    memset(mean_row, (sad16x16(cur_y, stride, zero_row, 0) + 128) >> 8, MACROBLOCK_SIZE);
+    return sad16x16(cur_y, stride, mean_row, 0);
+}
+
+// Prediction of the six blocks from one reference. Chroma vectors are the
+// luma ones halved toward zero.
+static void predictMacroblock(const HalfPelPlanes* halfpel, const YuvPlanes* ref, int x_block, int y_block, MotionVector mv,
+                              uint8_t pred[6][BLOCKSIZE * BLOCKSIZE]) {
+    const uint8_t* pred_y = halfPelBlock(halfpel, x_block * MACROBLOCK_SIZE, y_block * MACROBLOCK_SIZE, mv.x, mv.y);
+    for(int b = 0; b < 4; b++) {
+        for(int i = 0; i < BLOCKSIZE; i++) {
+            memcpy(pred[b] + i * BLOCKSIZE, pred_y + ((b / 2) * BLOCKSIZE + i) * halfpel->stride + (b % 2) * BLOCKSIZE, BLOCKSIZE);
+        }
+    }
+    for(int b = 4; b < 6; b++) {
+        int stride;
+        const uint8_t* src = blockAddress(ref, b, x_block, y_block, &stride);
+        predictBlock(pred[b], BLOCKSIZE, src, stride, mv.x / 2, mv.y / 2, BLOCKSIZE, BLOCKSIZE);
+    }
+}
+
+// Transform and quantize the prediction error of the six blocks. Returns
+// the coded_block_pattern.
+static int quantizeResidualMacroblock(const YuvPlanes* cur, int x_block, int y_block, uint8_t pred[6][BLOCKSIZE * BLOCKSIZE],
+                                      uint8_t scale, int mat_quan[6][BLOCKSIZE * BLOCKSIZE], int last[6]) {
+    int cbp = 0;
+    for(int b = 0; b < 6; b++) {
+        int stride;
+        const uint8_t* src = blockAddress(cur, b, x_block, y_block, &stride);
+        last[b] = transformQuantizeResidual(mat_quan[b], src, stride, pred[b], BLOCKSIZE, scale);
+        if(last[b] >= 0) {
+            cbp |= 1 << (5 - b);
+        }
+    }
+    return cbp;
+}
+
+// Reconstruction of a predicted macroblock: prediction plus the decoded residual
+static void reconstructInterMacroblock(const YuvPlanes* recon, uint8_t pred[6][BLOCKSIZE * BLOCKSIZE],
+                                       int mat_quan[6][BLOCKSIZE * BLOCKSIZE], const int last[6], uint8_t scale,
+                                       int x_block, int y_block) {
+    for(int b = 0; b < 6; b++) {
+        int stride;
+        int16_t coef[BLOCKSIZE * BLOCKSIZE];
+        uint8_t* dst = blockAddress(recon, b, x_block, y_block, &stride);
+        if(last[b] >= 0) {
+            dequantizeInterBlock(coef, mat_quan[b], scale);
+            performIntIDCT(coef);
+        } else {
+            memset(coef, 0, sizeof(coef));
+        }
+        for(int i = 0; i < BLOCKSIZE; i++) {
+            for(int j = 0; j < BLOCKSIZE; j++) {
+                dst[i * stride + j] = clampPixel(pred[b][i * BLOCKSIZE + j] + coef[i * BLOCKSIZE + j]);
+            }
+        }
+    }
+}
+
+static void writeInterBlocks(BitWriter* bw, int mat_quan[6][BLOCKSIZE * BLOCKSIZE], const int last[6]) {
+    for(int b = 0; b < 6; b++) {
+        if(last[b] >= 0) {
+            encode_mpeg1_inter(bw, mat_quan[b], last[b]);
+        }
+    }
+}
+
+// Levels up to the last nonzero one are kept in zigzag order, which is
+// all that the block writers read
+static void storeLevels(MacroblockDecision* decision, int mat_quan[6][BLOCKSIZE * BLOCKSIZE], const int last[6]) {
+    for(int b = 0; b < 6; b++) {
+        decision->last[b] = (int8_t)last[b];
+        for(int i = 0; i <= last[b]; i++) {
+            decision->levels[b][i] = (int16_t)mat_quan[b][zigzag_scan[i]];
+        }
+    }
+}
+
+static void loadLevels(const MacroblockDecision* decision, int mat_quan[6][BLOCKSIZE * BLOCKSIZE], int last[6]) {
+    for(int b = 0; b < 6; b++) {
+        last[b] = decision->last[b];
+        for(int i = 0; i <= last[b]; i++) {
+            mat_quan[b][zigzag_scan[i]] = decision->levels[b][i];
+        }
+    }
+}
+
+// The first and last macroblock of a slice must be coded
+static int isSliceEdge(const EncoderContext* ctx, int x_block, int y_block) {
+    int row = y_block % ctx->slice_rows;
+    return (x_block == 0 && row == 0) ||
+        (x_block == ctx->mb_width - 1 && (row == ctx->slice_rows - 1 || y_block == ctx->mb_height - 1));
+}
+
+// Analysis runs as a wavefront: a macroblock reads the vectors found above
+// and above right of it in the same picture, so each row stays two
+// macroblocks behind the one above. The row above is usually only a
+// macroblock away, so it is polled a while before the thread sleeps; a
+// stalled row, such as one whose thread was preempted, then costs no CPU.
+static void waitForRow(const EncoderContext* ctx, int y_block, int x_block) {
+    RowProgress* row = &ctx->row_progress[y_block];
+    int needed = x_block + 2 < ctx->mb_width ? x_block + 2 : ctx->mb_width;
+    for(int i = 0; i < WAVEFRONT_SPINS; i++) {
+        if(__atomic_load_n(&row->done, __ATOMIC_ACQUIRE) >= needed) {
+            return;
+        }
+    }
+    pthread_mutex_lock(&row->lock);
+    // Sequentially consistent with finishMacroblock, so either it sees the
+    // flag or this sees its progress
+    __atomic_store_n(&row->waiting, 1, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&row->done, __ATOMIC_SEQ_CST) < needed) {
+        pthread_cond_wait(&row->advanced, &row->lock);
+    }
+    __atomic_store_n(&row->waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&row->lock);
+}
+
+static void finishMacroblock(const EncoderContext* ctx, int x_block, int y_block) {
+    RowProgress* row = &ctx->row_progress[y_block];
+    __atomic_store_n(&row->done, x_block + 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&row->waiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&row->lock);
+        pthread_cond_broadcast(&row->advanced);
+        pthread_mutex_unlock(&row->lock);
+    }
+}
+
+// Start the wavefront of a picture
+static void resetRowProgress(EncoderContext* ctx) {
+    for(int i = 0; i < ctx->mb_height; i++) {
+        ctx->row_progress[i].done = 0;
+    }
+}
+
+// Search, choose the mode, quantize and reconstruct one macroblock of a
+// P picture. `pmv` is the vector predictor as far as this row knows it.
+static void analyzeInterMacroblock(const EncoderContext* ctx, const YuvPlanes* cur, const YuvPlanes* ref, const YuvPlanes* recon,
+                                   int x_block, int y_block, MotionVector* pmv) {
+    int mb = y_block * ctx->mb_width + x_block;
+    int x = x_block * MACROBLOCK_SIZE;
+    int y = y_block * MACROBLOCK_SIZE;
+    const uint8_t* cur_y = cur->y + y * cur->stride_y + x;
+    MacroblockDecision* decision = &ctx->decisions[mb];
+    MotionVector zero = { 0, 0 };
+
+    // Unchanged regions are skipped without a search or DCT
+    if(!isSliceEdge(ctx, x_block, y_block) && isStaticMacroblock(cur, ref, x_block, y_block, ctx->scale)) {
+        reconstructSkippedMacroblock(ref, recon, x_block, y_block);
+        profileCount(PROFILE_ZERO_BLOCKS, 6);
+        decision->mode = PREDICT_FORWARD;
+        decision->cbp = 0;
+        decision->mv[0] = zero;
+        ctx->mvs[mb] = zero;
+        *pmv = zero;
+        return;
+    }
+
+    // Left, upper and upper right neighbours of this picture and the
+    // co-located, right and lower vectors of the previous one
+    MotionRange range = searchRange(ctx, x_block, y_block);
+    MotionVector candidates[6];
+    int num_candidates = 0;
+    if(x_block > 0) {
+        candidates[num_candidates++] = ctx->mvs[mb - 1];
+    }
+    if(y_block > 0) {
+        waitForRow(ctx, y_block - 1, x_block);
+        candidates[num_candidates++] = ctx->mvs[mb - ctx->mb_width];
+        if(x_block + 1 < ctx->mb_width) {
+            candidates[num_candidates++] = ctx->mvs[mb - ctx->mb_width + 1];
+        }
+    }
+    candidates[num_candidates++] = ctx->prev_mvs[mb];
+    if(x_block + 1 < ctx->mb_width) {
+        candidates[num_candidates++] = ctx->prev_mvs[mb + 1];
+    }
+    if(y_block + 1 < ctx->mb_height) {
+        candidates[num_candidates++] = ctx->prev_mvs[mb + ctx->mb_width];
+    }
+    MotionVector mv;
+    uint64_t start = profileStart();
+    searchMotion(cur_y, ref->y + y * ref->stride_y + x, cur->stride_y, &range,
+                 candidates, num_candidates, *pmv, ctx->f_code, ctx->scale, &mv);
+    int sad = refineHalfPel(cur_y, cur->stride_y, &ctx->halfpel, x, y, &range, *pmv, ctx->f_code, ctx->scale, &mv);
+    profileStop(PROFILE_MOTION, start);
+
+    int mat_quan[6][BLOCKSIZE * BLOCKSIZE];
+    int last[6];
+    if(intraCost(cur_y, cur->stride_y) + INTRA_MODE_BIAS < sad) {
+        quantizeIntraMacroblock(cur, x_block, y_block, quant_recip_y[ctx->scale], mat_quan, last);
+        reconstructIntraMacroblock(ctx, mat_quan, last, ctx->scale, x_block, y_block);
+        storeLevels(decision, mat_quan, last);
+        decision->mode = PREDICT_INTRA;
+        ctx->mvs[mb] = zero;
+        *pmv = zero;
+        return;
+    }
+
+    uint8_t pred[6][BLOCKSIZE * BLOCKSIZE];
+    predictMacroblock(&ctx->halfpel, ref, x_block, y_block, mv, pred);
+    int cbp = quantizeResidualMacroblock(cur, x_block, y_block, pred, ctx->scale, mat_quan, last);
+    storeLevels(decision, mat_quan, last);
+    decision->mode = PREDICT_FORWARD;
+    decision->cbp = (uint8_t)cbp;
+    decision->mv[0] = mv;
+    ctx->mvs[mb] = mv;
+    // Skipping and coding without a vector both leave a zero predictor
+    *pmv = mv;
+
+    reconstructInterMacroblock(recon, pred, mat_quan, last, ctx->scale, x_block, y_block);
+}
+
+static void analyzeInterRow(const EncoderContext* ctx, const ImageInfo* imageinfo, int y_block) {
+    MotionVector pmv = { 0, 0 };
+    uint64_t start = profileStart();
+    for(int x_block = 0; x_block < ctx->mb_width; x_block++) {
+        analyzeInterMacroblock(ctx, &imageinfo->frame->planes, &ctx->ref->planes, &ctx->recon->planes, x_block, y_block, &pmv);
+        finishMacroblock(ctx, x_block, y_block);
+    }
+    profileSpan(PROFILE_SLICE, start);
+}
+
+// Write one slice of a P picture from the analysis. Motion vector and DC
+// predictors reset at the start of each slice.
+static void writeInterSlice(const EncoderContext* ctx, int slice, BitWriter* bw) {
+    uint64_t start = profileStart();
+    int first_row;
+    int end_row;
+    sliceRows(ctx, slice, &first_row, &end_row);
+    int prev_dc[3] = { DC_PREDICTOR_RESET, DC_PREDICTOR_RESET, DC_PREDICTOR_RESET };
+    int prev_intra = 0;
+    int skipped = 0;
+    MotionVector pmv = { 0, 0 };
+
+    writeSliceHeader(bw, first_row + 1, ctx->scale);
+    for(int y_block = first_row; y_block < end_row; y_block++) {
+        for(int x_block = 0; x_block < ctx->mb_width; x_block++) {
+            const MacroblockDecision* decision = &ctx->decisions[y_block * ctx->mb_width + x_block];
+            int mat_quan[6][BLOCKSIZE * BLOCKSIZE];
+            int last[6];
+            if(decision->mode == PREDICT_INTRA) {
+                loadLevels(decision, mat_quan, last);
+                // DC prediction restarts after any non-intra macroblock
+                if(!prev_intra) {
+                    prev_dc[0] = prev_dc[1] = prev_dc[2] = DC_PREDICTOR_RESET;
+                }
+                encode_address_increment(bw, skipped + 1);
+                skipped = 0;
+                putBits(bw, MB_TYPE_P_INTRA_CODE, MB_TYPE_P_INTRA_BITS);
+                writeIntraMacroblock(bw, mat_quan, last, prev_dc);
+                pmv = (MotionVector){ 0, 0 };
+                prev_intra = 1;
+                continue;
+            }
+
+            MotionVector mv = decision->mv[0];
+            int cbp = decision->cbp;
+            prev_intra = 0;
+            if(cbp == 0 && mv.x == 0 && mv.y == 0 && !isSliceEdge(ctx, x_block, y_block)) {
+                pmv = mv;
+                skipped++;
+                continue;
+            }
+
+            encode_address_increment(bw, skipped + 1);
+            skipped = 0;
+            if(cbp == 0) {
+                putBits(bw, MB_TYPE_P_MC_CODE, MB_TYPE_P_MC_BITS);
+                encode_motion(bw, mv.x - pmv.x, ctx->f_code);
+                encode_motion(bw, mv.y - pmv.y, ctx->f_code);
+            } else if(mv.x == 0 && mv.y == 0) {
+                // No motion vector is sent, which also resets the predictor
+                putBits(bw, MB_TYPE_P_CODED_CODE, MB_TYPE_P_CODED_BITS);
+                encode_cbp(bw, cbp);
+            } else {
+                putBits(bw, MB_TYPE_P_MC_CODED_CODE, MB_TYPE_P_MC_CODED_BITS);
+                encode_motion(bw, mv.x - pmv.x, ctx->f_code);
+                encode_motion(bw, mv.y - pmv.y, ctx->f_code);
+                encode_cbp(bw, cbp);
+            }
+            pmv = mv;
+            if(cbp) {
+                loadLevels(decision, mat_quan, last);
+                writeInterBlocks(bw, mat_quan, last);
+            }
+        }
+    }
+    finishBitWriter(bw);
+    profileCount(PROFILE_BITS, bitWriterTell(bw));
+    profileSpan(PROFILE_VLC, start);
+}
+
+// Interpolate a reference once, a macroblock row per task
+static void interpolateReference(const EncoderContext* ctx, HalfPelPlanes* planes, const uint8_t* luma, int* ready) {
+    if(*ready) {
+        return;
+    }
+    int num_threads = ctx->num_threads > 0 ? ctx->num_threads : omp_get_max_threads();
+    planes->plane[0] = luma;
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+    for(int y_block = 0; y_block < ctx->mb_height; y_block++) {
+        buildHalfPelRows(planes, y_block * MACROBLOCK_SIZE, MACROBLOCK_SIZE);
+    }
+    *ready = 1;
+}
+
+// Analyze the rows as a wavefront, then write the slices in parallel.
+// Rows are handed out in order, so a row only ever waits for rows that
+// are already running.
+int encodeInterPicture(EncoderContext* ctx, const ImageInfo* imageinfo, BitWriter* bw) {
+    if(!ctx->recon || ctx->num_anchors < 1) {
+        return -1;
+    }
+    uint64_t start = profileStart();
+    padPartialMacroblocks(ctx, imageinfo);
+    int num_threads = ctx->num_threads > 0 ? ctx->num_threads : omp_get_max_threads();
+    interpolateReference(ctx, &ctx->halfpel, ctx->ref->planes.y, &ctx->halfpel_ready);
+    resetRowProgress(ctx);
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads)
+    for(int y_block = 0; y_block < ctx->mb_height; y_block++) {
+        analyzeInterRow(ctx, imageinfo, y_block);
+    }
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+    for(int slice = 0; slice < numSlices(ctx); slice++) {
+        resetBitWriter(&ctx->slices[slice]);
+        writeInterSlice(ctx, slice, &ctx->slices[slice]);
+    }
+    finishReferencePicture(ctx);
+    int ret = stitchSlices(ctx, bw);
+    profileSpan(PROFILE_PICTURE, start);
+    return ret;
+}
+
+// No picture refers to a B picture, so its errors do not carry on and it
+// can take a coarser quantizer: 1.25 times that of I and P pictures
+static uint8_t bidirScale(uint8_t scale) {
+    int bidir = scale + (scale + 2) / 4;
+    return bidir > MAX_QUANT_SCALE ? MAX_QUANT_SCALE : bidir;
+}
+
+// Search both references and choose the prediction of one macroblock of a
+// B picture: from the past anchor, the future one or the average of both.
+// Nothing refers to a B picture, so it is only reconstructed, into the
+// spare `recon`, with reconstruct_bidir.
+static void analyzeBidirMacroblock(const EncoderContext* ctx, const YuvPlanes* cur, int x_block, int y_block,
+                                   int forward_distance, int backward_distance, MotionVector pmv[2]) {
+    uint8_t scale = bidirScale(ctx->scale);
+    const YuvPlanes* refs[2] = { &ctx->ref_prev->planes, &ctx->ref->planes };
+    const HalfPelPlanes* halfpel[2] = { &ctx->halfpel_prev, &ctx->halfpel };
+    int span = forward_distance + backward_distance;
+    int mb = y_block * ctx->mb_width + x_block;
+    int x = x_block * MACROBLOCK_SIZE;
+    int y = y_block * MACROBLOCK_SIZE;
+    const uint8_t* cur_y = cur->y + y * cur->stride_y + x;
+    MacroblockDecision* decision = &ctx->decisions[mb];
+    MotionRange range = searchRange(ctx, x_block, y_block);
+
+    // Per direction: the vectors found left, above and above right of this
+    // macroblock, and the future anchor's vector here scaled to the
+    // distance of the reference
+    if(y_block > 0) {
+        waitForRow(ctx, y_block - 1, x_block);
+    }
+    MotionVector anchor = ctx->prev_mvs[mb];
+    MotionVector mv[2];
+    int sad[3];
+    int cost[3];
+    uint64_t start = profileStart();
+    for(int d = 0; d < 2; d++) {
+        MotionVector candidates[4];
+        int num_candidates = 0;
+        candidates[num_candidates++] = d == 0 ?
+            (MotionVector){ anchor.x * forward_distance / span, anchor.y * forward_distance / span } :
+            (MotionVector){ -anchor.x * backward_distance / span, -anchor.y * backward_distance / span };
+        if(x_block > 0) {
+            candidates[num_candidates++] = decision[-1].mv[d];
+        }
+        if(y_block > 0) {
+            candidates[num_candidates++] = decision[-ctx->mb_width].mv[d];
+            if(x_block + 1 < ctx->mb_width) {
+                candidates[num_candidates++] = decision[1 - ctx->mb_width].mv[d];
+            }
+        }
+        const YuvPlanes* ref = refs[d];
+        searchMotion(cur_y, ref->y + y * ref->stride_y + x, cur->stride_y, &range,
+                     candidates, num_candidates, pmv[d], ctx->f_code, scale, &mv[d]);
+        sad[d] = refineHalfPel(cur_y, cur->stride_y, halfpel[d], x, y, &range, pmv[d], ctx->f_code, scale, &mv[d]);
+        cost[d] = sad[d] + scale * (motion_bits(mv[d].x - pmv[d].x, ctx->f_code) + motion_bits(mv[d].y - pmv[d].y, ctx->f_code));
+    }
+    decision->mv[0] = mv[0];
+    decision->mv[1] = mv[1];
+    uint8_t average[MACROBLOCK_SIZE * MACROBLOCK_SIZE];
+    averageBlock(average, MACROBLOCK_SIZE, halfPelBlock(halfpel[0], x, y, mv[0].x, mv[0].y), halfpel[0]->stride,
+                 halfPelBlock(halfpel[1], x, y, mv[1].x, mv[1].y), halfpel[1]->stride, MACROBLOCK_SIZE, MACROBLOCK_SIZE);
+    sad[2] = sad16x16(cur_y, cur->stride_y, average, MACROBLOCK_SIZE);
+    cost[2] = sad[2] + cost[0] - sad[0] + cost[1] - sad[1];
+    profileStop(PROFILE_MOTION, start);
+
+    int choice = 2;
+    for(int d = 0; d < 2; d++) {
+        if(cost[d] < cost[choice]) {
+            choice = d;
+        }
+    }
+    int mode = choice == 2 ? PREDICT_INTERPOLATED : (choice == 0 ? PREDICT_FORWARD : PREDICT_BACKWARD);
+
+    int mat_quan[6][BLOCKSIZE * BLOCKSIZE];
+    int last[6];
+    if(intraCost(cur_y, cur->stride_y) + INTRA_MODE_BIAS < sad[choice]) {
+        quantizeIntraMacroblock(cur, x_block, y_block, quant_recip_y[scale], mat_quan, last);
+        storeLevels(decision, mat_quan, last);
+        decision->mode = PREDICT_INTRA;
+        pmv[0] = pmv[1] = (MotionVector){ 0, 0 };
+        if(ctx->reconstruct_bidir) {
+            reconstructIntraMacroblock(ctx, mat_quan, last, scale, x_block, y_block);
+        }
+        return;
+    }
+
+    uint8_t pred[6][BLOCKSIZE * BLOCKSIZE];
+    uint8_t pred_backward[6][BLOCKSIZE * BLOCKSIZE];
+    if(mode & PREDICT_FORWARD) {
+        predictMacroblock(halfpel[0], refs[0], x_block, y_block, mv[0], pred);
+    }
+    if(mode & PREDICT_BACKWARD) {
+        predictMacroblock(halfpel[1], refs[1], x_block, y_block, mv[1], mode == PREDICT_INTERPOLATED ? pred_backward : pred);
+    }
+    if(mode == PREDICT_INTERPOLATED) {
+        for(int b = 0; b < 6; b++) {
+            averageBlock(pred[b], BLOCKSIZE, pred[b], BLOCKSIZE, pred_backward[b], BLOCKSIZE, BLOCKSIZE, BLOCKSIZE);
+        }
+    }
+    decision->cbp = (uint8_t)quantizeResidualMacroblock(cur, x_block, y_block, pred, scale, mat_quan, last);
+    storeLevels(decision, mat_quan, last);
+    decision->mode = (uint8_t)mode;
+    if(ctx->reconstruct_bidir) {
+        reconstructInterMacroblock(&ctx->recon->planes, pred, mat_quan, last, scale, x_block, y_block);
+    }
+    // Skipping leaves the predictors as they are, which then equal the vectors
+    for(int d = 0; d < 2; d++) {
+        if(mode & (1 << d)) {
+            pmv[d] = mv[d];
+        }
+    }
+}
+
+static void analyzeBidirRow(const EncoderContext* ctx, const ImageInfo* imageinfo, int y_block,
+                            int forward_distance, int backward_distance) {
+    MotionVector pmv[2] = { { 0, 0 }, { 0, 0 } };
+    uint64_t start = profileStart();
+    for(int x_block = 0; x_block < ctx->mb_width; x_block++) {
+        analyzeBidirMacroblock(ctx, &imageinfo->frame->planes, x_block, y_block, forward_distance, backward_distance, pmv);
+        finishMacroblock(ctx, x_block, y_block);
+    }
+    profileSpan(PROFILE_SLICE, start);
+}
+
+// Write one slice of a B picture from the analysis
+static void writeBidirSlice(const EncoderContext* ctx, int slice, BitWriter* bw) {
+    uint64_t start = profileStart();
+    uint8_t scale = bidirScale(ctx->scale);
+    int first_row;
+    int end_row;
+    sliceRows(ctx, slice, &first_row, &end_row);
+    int prev_dc[3] = { DC_PREDICTOR_RESET, DC_PREDICTOR_RESET, DC_PREDICTOR_RESET };
+    int prev_mode = PREDICT_INTRA;
+    int skipped = 0;
+    MotionVector pmv[2] = { { 0, 0 }, { 0, 0 } };
+
+    writeSliceHeader(bw, first_row + 1, scale);
+    for(int y_block = first_row; y_block < end_row; y_block++) {
+        for(int x_block = 0; x_block < ctx->mb_width; x_block++) {
+            const MacroblockDecision* decision = &ctx->decisions[y_block * ctx->mb_width + x_block];
+            int mat_quan[6][BLOCKSIZE * BLOCKSIZE];
+            int last[6];
+            int mode = decision->mode;
+            if(mode == PREDICT_INTRA) {
+                loadLevels(decision, mat_quan, last);
+                if(prev_mode != PREDICT_INTRA) {
+                    prev_dc[0] = prev_dc[1] = prev_dc[2] = DC_PREDICTOR_RESET;
+                }
+                encode_address_increment(bw, skipped + 1);
+                skipped = 0;
+                putBits(bw, MB_TYPE_B_INTRA_CODE, MB_TYPE_B_INTRA_BITS);
+                writeIntraMacroblock(bw, mat_quan, last, prev_dc);
+                pmv[0] = pmv[1] = (MotionVector){ 0, 0 };
+                prev_mode = PREDICT_INTRA;
+                continue;
+            }
+
+            // A skipped macroblock of a B picture repeats the prediction of
+            // the previous one, which must not be intra
+            const MotionVector* mv = decision->mv;
+            int cbp = decision->cbp;
+            if(cbp == 0 && mode == prev_mode && !isSliceEdge(ctx, x_block, y_block) &&
+               (!(mode & PREDICT_FORWARD) || (mv[0].x == pmv[0].x && mv[0].y == pmv[0].y)) &&
+               (!(mode & PREDICT_BACKWARD) || (mv[1].x == pmv[1].x && mv[1].y == pmv[1].y))) {
+                skipped++;
+                continue;
+            }
+
+            encode_address_increment(bw, skipped + 1);
+            skipped = 0;
+            int code = mode == PREDICT_INTERPOLATED ? MB_TYPE_B_INTERPOLATED_CODE :
+                (mode == PREDICT_BACKWARD ? MB_TYPE_B_BACKWARD_CODE : MB_TYPE_B_FORWARD_CODE);
+            int bits = mode == PREDICT_INTERPOLATED ? MB_TYPE_B_INTERPOLATED_BITS :
+                (mode == PREDICT_BACKWARD ? MB_TYPE_B_BACKWARD_BITS : MB_TYPE_B_FORWARD_BITS);
+            putBits(bw, code + (cbp != 0), bits);
+            for(int d = 0; d < 2; d++) {
+                if(mode & (1 << d)) {
+                    encode_motion(bw, mv[d].x - pmv[d].x, ctx->f_code);
+                    encode_motion(bw, mv[d].y - pmv[d].y, ctx->f_code);
+                    pmv[d] = mv[d];
+                }
+            }
+            if(cbp) {
+                encode_cbp(bw, cbp);
+                loadLevels(decision, mat_quan, last);
+                writeInterBlocks(bw, mat_quan, last);
+            }
+            prev_mode = mode;
+        }
+    }
+    finishBitWriter(bw);
+    profileCount(PROFILE_BITS, bitWriterTell(bw));
+    profileSpan(PROFILE_VLC, start);
+}
+
+int encodeBidirPicture(EncoderContext* ctx, const ImageInfo* imageinfo, int forward_distance, int backward_distance, BitWriter* bw) {
+    if(!ctx->recon || ctx->num_anchors < 2 || forward_distance < 1 || backward_distance < 1) {
+        return -1;
+    }
+    uint64_t start = profileStart();
+    padPartialMacroblocks(ctx, imageinfo);
+    int num_threads = ctx->num_threads > 0 ? ctx->num_threads : omp_get_max_threads();
+    interpolateReference(ctx, &ctx->halfpel_prev, ctx->ref_prev->planes.y, &ctx->halfpel_prev_ready);
+    interpolateReference(ctx, &ctx->halfpel, ctx->ref->planes.y, &ctx->halfpel_ready);
+    resetRowProgress(ctx);
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads)
+    for(int y_block = 0; y_block < ctx->mb_height; y_block++) {
+        analyzeBidirRow(ctx, imageinfo, y_block, forward_distance, backward_distance);
+    }
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+    for(int slice = 0; slice < numSlices(ctx); slice++) {
+        resetBitWriter(&ctx->slices[slice]);
+        writeBidirSlice(ctx, slice, &ctx->slices[slice]);
+    }
+    ctx->decoded = ctx->reconstruct_bidir ? ctx->recon : NULL;
+    int ret = stitchSlices(ctx, bw);
+    profileSpan(PROFILE_PICTURE, start);
+    return ret;
+}
+
+// Encode the macroblock rows of one slice from JPEG coefficients
+static void encodeTranscodedSlice(const EncoderContext* ctx, const CoefImage* image, int slice, BitWriter* bw) {
+    int prev_dc[3] = { DC_PREDICTOR_RESET, DC_PREDICTOR_RESET, DC_PREDICTOR_RESET };
+    const uint32_t* recip = quant_recip_y[ctx->scale];
+    uint64_t start_slice = profileStart();
+    int first_row;
+    int end_row;
+    sliceRows(ctx, slice, &first_row, &end_row);
+
+    writeSliceHeader(bw, first_row + 1, ctx->scale);
+    for(int y_block = first_row; y_block < end_row; y_block++) {
+        for(int x_block = 0; x_block < ctx->mb_width; x_block++) {
+            int mat_quan[6][BLOCKSIZE * BLOCKSIZE];
+            int last[6];
+            // Luma blocks of the macroblock in the order Y0 Y1 / Y2 Y3
+            for(int i = 0; i < 4; i++) {
+                const JCOEF* coef = image->rows[0][y_block * 2 + i / 2][x_block * 2 + i % 2];
+                last[i] = requantizeBlock(mat_quan[i], coef, image->quant[0], recip);
+            }
+            last[4] = requantizeBlock(mat_quan[4], image->rows[1][y_block][x_block], image->quant[1], recip);
+            last[5] = requantizeBlock(mat_quan[5], image->rows[2][y_block][x_block], image->quant[2], recip);
+
+            // Macroblock header: address increment 1, intra without quantizer
+            uint64_t start = profileStart();
+            putBits(bw, 1, 1);
+            putBits(bw, 1, 1);
+            writeIntraMacroblock(bw, mat_quan, last, prev_dc);
+            profileStop(PROFILE_VLC, start);
+            if(ctx->recon) {
+                reconstructIntraMacroblock(ctx, mat_quan, last, ctx->scale, x_block, y_block);
+            }
+        }
+    }
+    finishBitWriter(bw);
+    profileCount(PROFILE_BITS, bitWriterTell(bw));
+    profileSpan(PROFILE_SLICE, start_slice);
+}
+
+int encodeTranscodedPicture(EncoderContext* ctx, const CoefImage* image, BitWriter* bw) {
+    uint64_t start = profileStart();
+    int num_threads = ctx->num_threads > 0 ? ctx->num_threads : omp_get_max_threads();
+
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+    for(int slice = 0; slice < numSlices(ctx); slice++) {
+        resetBitWriter(&ctx->slices[slice]);
+        encodeTranscodedSlice(ctx, image, slice, &ctx->slices[slice]);
+    }
+    if(ctx->mvs) {
+        memset(ctx->mvs, 0, ctx->mb_width * ctx->mb_height * sizeof(MotionVector));
+    }
+    finishReferencePicture(ctx);
+    int ret = stitchSlices(ctx, bw);
+    profileSpan(PROFILE_PICTURE, start);
+    return ret;
+}
+
+int encodeCodedPicture(EncoderContext* ctx, const CodedPicture* picture, uint8_t frame_rate_code, BitWriter* bw) {
+    if(picture->gop_start) {
+        writeGOPHeader(bw, picture->gop_first, frame_rate_code, picture->closed_gop);
+    }
+    writePictureHeader(bw, picture->temporal_reference, picture->type, VBV_DELAY_VARIABLE, ctx->f_code, ctx->f_code);
+    switch(picture->type) {
+    case PICTURE_TYPE_I:
+        return encodeIntraPicture(ctx, &picture->image, bw);
+    case PICTURE_TYPE_P:
+        return encodeInterPicture(ctx, &picture->image, bw);
+    default:
+        return encodeBidirPicture(ctx, &picture->image, picture->forward_distance, picture->backward_distance, bw);
+    }
+}
@@ -1,32 +1,104 @@
+#include <pthread.h>
+
 #include "ffwt.h"
 
+// FFTW planning is expensive and not thread-safe, but executing an existing
+// plan on new arrays (fftw_execute_r2r) is. All plans are therefore built once
+// under a lock and then shared by every thread. FFTW_UNALIGNED lets a plan run
+// on any block, whatever its alignment.
+#define PLAN_FLAGS (FFTW_ESTIMATE | FFTW_UNALIGNED)
+
+static const fftw_r2r_kind dct_kind[2] = { FFTW_REDFT10, FFTW_REDFT10 };
+static const int dct_size[2] = { N, N };
+
+static pthread_once_t plan_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t plan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fftw_plan plan_block;
+
+// Batched plans, one per distinct number of blocks
+static struct {
+    int count;
+    fftw_plan plan;
+} batch_plans[MAX_BATCH_PLANS];
+static int num_batch_plans = 0;
+
+static fftw_plan planBatch(int count) {
+    double* scratch = (double*)fftw_malloc(sizeof(double) * N * N * count);
+    fftw_plan plan = fftw_plan_many_r2r(2, dct_size, count,
+                                        scratch, NULL, 1, N * N,
+                                        scratch, NULL, 1, N * N,
+                                        dct_kind, PLAN_FLAGS);
+    fftw_free(scratch);
+    return plan;
+}
+
+static void buildBlockPlan(void) {
+    double scratch[N][N];
+    pthread_mutex_lock(&plan_mutex);
+    plan_block = fftw_plan_r2r_2d(N, N, &scratch[0][0], &scratch[0][0], FFTW_REDFT10, FFTW_REDFT10, PLAN_FLAGS);
+    pthread_mutex_unlock(&plan_mutex);
+}
+
+void initDCTPlans(void) {
+    pthread_once(&plan_once, buildBlockPlan);
+}
+
+void cleanupDCTPlans(void) {
+    pthread_mutex_lock(&plan_mutex);
+    for(int i = 0; i < num_batch_plans; i++) {
+        fftw_destroy_plan(batch_plans[i].plan);
+    }
+    num_batch_plans = 0;
+    if(plan_block) {
+        fftw_destroy_plan(plan_block);
+        plan_block = NULL;
+    }
+    pthread_mutex_unlock(&plan_mutex);
+}
+
 // Function to perform 2D DCT-II on an 8x8 matrix
 void performdct2d(double mat[8][8]) {
-    // Step 1: Apply DCT to each row (1D DCT on rows)
-    for (int i = 0; i < N; i++) {
-        fftw_plan plan_row = fftw_plan_r2r_1d(N, mat[i], mat[i], FFTW_REDFT10, FFTW_ESTIMATE);
-        fftw_execute(plan_row);
-        fftw_destroy_plan(plan_row);
-    }
+    initDCTPlans();
+    // Rows and columns are both transformed by the single cached 2D plan
+    fftw_execute_r2r(plan_block, &mat[0][0], &mat[0][0]);
+}
 
-    // Step 2: Apply DCT to each column (1D DCT on columns)
-    for (int j = 0; j < N; j++) {
-        double column[8];  // Temporary array to hold one column
-        double column_out[8];  // Output for one column
+// Transform `count` consecutive 8x8 blocks in one FFTW call
+void performdct2dBatch(double blocks[][8][8], int count) {
+    if(count <= 0) {
+        return;
+    }
+    if(count == 1) {
+        performdct2d(blocks[0]);
+        return;
+    }
 
-        // Extract the column
-        for (int i = 0; i < N; i++) {
-            column[i] = mat[i][j];
+    fftw_plan plan = NULL;
+    int cached = 1;
+    pthread_mutex_lock(&plan_mutex);
+    for(int i = 0; i < num_batch_plans; i++) {
+        if(batch_plans[i].count == count) {
+            plan = batch_plans[i].plan;
+            break;
         }
+    }
+    if(!plan) {
+        plan = planBatch(count);
+        if(num_batch_plans < MAX_BATCH_PLANS) {
+            batch_plans[num_batch_plans].count = count;
+            batch_plans[num_batch_plans].plan = plan;
+            num_batch_plans++;
+        } else {
+            cached = 0; // Cache is full, this plan is used only once
+        }
+    }
+    pthread_mutex_unlock(&plan_mutex);
 
-        // Apply 1D DCT to the column
-        fftw_plan plan_col = fftw_plan_r2r_1d(N, column, column_out, FFTW_REDFT10, FFTW_ESTIMATE);
-        fftw_execute(plan_col);
-        fftw_destroy_plan(plan_col);
+    fftw_execute_r2r(plan, &blocks[0][0][0], &blocks[0][0][0]);
 
-        // Save the result back to the output matrix
-        for (int i = 0; i < N; i++) {
-            mat[i][j] = column_out[i];
-        }
+    if(!cached) {
+        pthread_mutex_lock(&plan_mutex);
+        fftw_destroy_plan(plan);
+        pthread_mutex_unlock(&plan_mutex);
     }
-}
\ No newline at end of file
+}
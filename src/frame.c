@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+
+static int alignUp(int n) {
+    return (n + FRAME_ALIGN - 1) / FRAME_ALIGN * FRAME_ALIGN;
+}
+
+// Lay out one plane of width x height with a border of `pad` at `*size`
+// bytes into the frame, grow `*size` past it and return the offset of its
+// top-left pixel
+static size_t placePlane(size_t* size, int width, int height, int pad, int* stride) {
+    int left = alignUp(pad);
+    *stride = alignUp(left + width + pad);
+    size_t offset = *size + (size_t)pad * *stride + left;
+    *size += (size_t)(height + 2 * pad) * *stride;
+    return offset;
+}
+
+Frame* allocFrame(int width, int height, int pad) {
+    Frame* frame = (Frame*)calloc(1, sizeof(Frame));
+    if(!frame) {
+        return NULL;
+    }
+    int width_c = (width + 1) / 2;
+    int height_c = (height + 1) / 2;
+    YuvPlanes* planes = &frame->planes;
+    size_t offset_y = placePlane(&frame->size, width, height, pad, &planes->stride_y);
+    size_t offset_cb = placePlane(&frame->size, width_c, height_c, pad / 2, &planes->stride_cb);
+    size_t offset_cr = placePlane(&frame->size, width_c, height_c, pad / 2, &planes->stride_cr);
+    // Every plane is a multiple of FRAME_ALIGN, as aligned_alloc wants
+    frame->data = (uint8_t*)aligned_alloc(FRAME_ALIGN, frame->size);
+    if(!frame->data) {
+        free(frame);
+        return NULL;
+    }
+    planes->y = frame->data + offset_y;
+    planes->cb = frame->data + offset_cb;
+    planes->cr = frame->data + offset_cr;
+    frame->width = width;
+    frame->height = height;
+    frame->pad = pad;
+    return frame;
+}
+
+void freeFrame(Frame* frame) {
+    if(frame) {
+        free(frame->data);
+        free(frame);
+    }
+}
+
+static void padPlane(uint8_t* plane, int stride, int width, int height, int pad) {
+    if(pad == 0) {
+        return;
+    }
+    for(int i = 0; i < height; i++) {
+        uint8_t* row = plane + (size_t)i * stride;
+        memset(row - pad, row[0], pad);
+        memset(row + width, row[width - 1], pad);
+    }
+    for(int i = 1; i <= pad; i++) {
+        memcpy(plane - (size_t)i * stride - pad, plane - pad, width + 2 * pad);
+        memcpy(plane + (size_t)(height - 1 + i) * stride - pad, plane + (size_t)(height - 1) * stride - pad, width + 2 * pad);
+    }
+}
+
+void padFrame(Frame* frame) {
+    int width_c = (frame->width + 1) / 2;
+    int height_c = (frame->height + 1) / 2;
+    const YuvPlanes* planes = &frame->planes;
+    padPlane(planes->y, planes->stride_y, frame->width, frame->height, frame->pad);
+    padPlane(planes->cb, planes->stride_cb, width_c, height_c, frame->pad / 2);
+    padPlane(planes->cr, planes->stride_cr, width_c, height_c, frame->pad / 2);
+}
+
+void initFramePool(FramePool* pool, int pad) {
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->frames = NULL;
+    pool->num_frames = 0;
+    pool->capacity = 0;
+    pool->pad = pad;
+    pool->num_allocated = 0;
+}
+
+void freeFramePool(FramePool* pool) {
+    for(int i = 0; i < pool->num_frames; i++) {
+        freeFrame(pool->frames[i]);
+    }
+    free(pool->frames);
+    pool->frames = NULL;
+    pool->num_frames = 0;
+    pool->capacity = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
+
+Frame* acquireFrame(FramePool* pool, int width, int height) {
+    pthread_mutex_lock(&pool->lock);
+    // Newest first: it is the most likely to still be in cache
+    for(int i = pool->num_frames - 1; i >= 0; i--) {
+        Frame* frame = pool->frames[i];
+        if(frame->width == width && frame->height == height) {
+            pool->frames[i] = pool->frames[--pool->num_frames];
+            pthread_mutex_unlock(&pool->lock);
+            return frame;
+        }
+    }
+    for(int i = 0; i < pool->num_frames; i++) {
+        freeFrame(pool->frames[i]);
+    }
+    pool->num_frames = 0;
+    pool->num_allocated++;
+    pthread_mutex_unlock(&pool->lock);
+    return allocFrame(width, height, pool->pad);
+}
+
+void releaseFrame(FramePool* pool, Frame* frame) {
+    if(!frame) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    if(pool->num_frames == pool->capacity) {
+        int capacity = pool->capacity ? 2 * pool->capacity : 8;
+        Frame** frames = (Frame**)realloc(pool->frames, capacity * sizeof(Frame*));
+        if(!frames) {
+            pthread_mutex_unlock(&pool->lock);
+            freeFrame(frame);
+            return;
+        }
+        pool->frames = frames;
+        pool->capacity = capacity;
+    }
+    pool->frames[pool->num_frames++] = frame;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+
+#include "createMLV.h"
+#include "gop.h"
+
+int initReorderBuffer(ReorderBuffer* reorder, const GopConfig* config) {
+    if(config->size < 1 || config->distance < 1 || config->distance > config->size) {
+        return -1;
+    }
+    reorder->config = *config;
+    // The B pictures before an anchor, the anchor and the picture returned last
+    reorder->capacity = config->distance + 1;
+    reorder->pictures = (CodedPicture*)calloc(reorder->capacity, sizeof(CodedPicture));
+    reorder->free_list = (CodedPicture**)calloc(reorder->capacity, sizeof(CodedPicture*));
+    reorder->pending = (CodedPicture**)calloc(reorder->capacity, sizeof(CodedPicture*));
+    reorder->queue = (CodedPicture**)calloc(reorder->capacity, sizeof(CodedPicture*));
+    if(!reorder->pictures || !reorder->free_list || !reorder->pending || !reorder->queue) {
+        freeReorderBuffer(reorder);
+        return -1;
+    }
+    for(int i = 0; i < reorder->capacity; i++) {
+        reorder->free_list[i] = &reorder->pictures[i];
+    }
+    reorder->num_free = reorder->capacity;
+    reorder->num_pending = 0;
+    reorder->queue_head = 0;
+    reorder->queue_len = 0;
+    reorder->current = NULL;
+    reorder->next_display = 0;
+    reorder->last_anchor = -1;
+    reorder->gop_first = 0;
+    return 0;
+}
+
+void freeReorderBuffer(ReorderBuffer* reorder) {
+    for(int i = 0; reorder->pictures && i < reorder->capacity; i++) {
+        freeFrame(reorder->pictures[i].image.frame);
+    }
+    free(reorder->pictures);
+    free(reorder->free_list);
+    free(reorder->pending);
+    free(reorder->queue);
+    reorder->pictures = NULL;
+    reorder->free_list = NULL;
+    reorder->pending = NULL;
+    reorder->queue = NULL;
+}
+
+int gopPictureType(const GopConfig* config, int display_index) {
+    int position = display_index % config->size;
+    if(position == 0) {
+        return PICTURE_TYPE_I;
+    }
+    if(position % config->distance == 0 || (config->closed && position == config->size - 1)) {
+        return PICTURE_TYPE_P;
+    }
+    return PICTURE_TYPE_B;
+}
+
+static void enqueue(ReorderBuffer* reorder, CodedPicture* picture) {
+    reorder->queue[(reorder->queue_head + reorder->queue_len) % reorder->capacity] = picture;
+    reorder->queue_len++;
+}
+
+// Queue an anchor followed by the B pictures it closes. An I picture
+// starts a GOP, which in display order begins with those B pictures.
+static void queueAnchor(ReorderBuffer* reorder, CodedPicture* anchor) {
+    int display = anchor->display_index;
+    anchor->gop_start = anchor->type == PICTURE_TYPE_I;
+    if(anchor->gop_start) {
+        reorder->gop_first = reorder->num_pending ? reorder->pending[0]->display_index : display;
+        anchor->closed_gop = reorder->num_pending == 0;
+    }
+    anchor->gop_first = reorder->gop_first;
+    anchor->temporal_reference = display - reorder->gop_first;
+    anchor->forward_distance = anchor->type == PICTURE_TYPE_I ? 0 : display - reorder->last_anchor;
+    anchor->backward_distance = 0;
+    enqueue(reorder, anchor);
+
+    for(int i = 0; i < reorder->num_pending; i++) {
+        CodedPicture* picture = reorder->pending[i];
+        picture->gop_start = 0;
+        picture->gop_first = reorder->gop_first;
+        picture->temporal_reference = picture->display_index - reorder->gop_first;
+        picture->forward_distance = picture->display_index - reorder->last_anchor;
+        picture->backward_distance = display - picture->display_index;
+        enqueue(reorder, picture);
+    }
+    reorder->num_pending = 0;
+    reorder->last_anchor = display;
+}
+
+int pushReorderFrame(ReorderBuffer* reorder, ImageInfo* frame, int type) {
+    if(reorder->num_free == 0) {
+        return -1;
+    }
+    CodedPicture* picture = reorder->free_list[--reorder->num_free];
+    Frame* spare = picture->image.frame;
+    picture->image = *frame;
+    frame->frame = spare;
+
+    picture->display_index = reorder->next_display++;
+    if(reorder->last_anchor < 0) {
+        type = PICTURE_TYPE_I;
+    } else if(type == PICTURE_TYPE_B && reorder->num_pending == reorder->config.distance - 1) {
+        type = PICTURE_TYPE_P;
+    }
+    picture->type = type;
+    if(picture->type == PICTURE_TYPE_B) {
+        reorder->pending[reorder->num_pending++] = picture;
+    } else {
+        queueAnchor(reorder, picture);
+    }
+    return 0;
+}
+
+void flushReorderBuffer(ReorderBuffer* reorder) {
+    if(reorder->num_pending > 0) {
+        CodedPicture* anchor = reorder->pending[--reorder->num_pending];
+        anchor->type = PICTURE_TYPE_P;
+        queueAnchor(reorder, anchor);
+    }
+}
+
+CodedPicture* nextCodedPicture(ReorderBuffer* reorder) {
+    if(reorder->current) {
+        reorder->free_list[reorder->num_free++] = reorder->current;
+        reorder->current = NULL;
+    }
+    if(reorder->queue_len == 0) {
+        return NULL;
+    }
+    reorder->current = reorder->queue[reorder->queue_head];
+    reorder->queue_head = (reorder->queue_head + 1) % reorder->capacity;
+    reorder->queue_len--;
+    return reorder->current;
+}
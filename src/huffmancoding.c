@@ -43,32 +43,13 @@ const int zigzag_order[64] = {
     35, 36, 48, 49, 57, 58, 62, 63
 };
 
-// A dummy function to simulate bitstream writing
-void writeBits(uint8_t* bitstream_buffer, int* bitstream_index_p, uint16_t bitstring, uint8_t bitlength) {
-    // Ensure the buffer has enough space
-    if(*bitstream_index_p + (bitlength / 8) + 1 > MAX_BITSTREAM_SIZE) {
-        // printf("Buffer overflow detected!\n");
-        return;
-    }
-
-    // Writing the bitstring to the buffer
-    for(int i = 0; i < bitlength; i++) {
-        int byte_pos = *bitstream_index_p + (i / 8);
-        int bit_pos = 7 - (i % 8);
-        uint8_t bit = (bitstring >> (bitlength - i - 1)) & 1;
-        
-        if(bit == 1) {
-            bitstream_buffer[byte_pos] |= (1 << bit_pos);  // Set the bit
-        } else {
-            bitstream_buffer[byte_pos] &= ~(1 << bit_pos); // Clear the bit
-        }
-    }
-    *bitstream_index_p += (bitlength + 7) / 8; // Update buffer index
+// Append a code to the bitstream
+void writeBits(BitWriter* bw, uint16_t bitstring, uint8_t bitlength) {
+    putBits(bw, bitstring, bitlength);
 }
 
 // Perform Huffman coding on the DCT coefficients
-void performHuffmanCoding(uint8_t* bitstream_buffer, int* bitstream_index_p, double* mat, double previous_dc_coeffi) {
-    *bitstream_index_p = 0;
+void performHuffmanCoding(BitWriter* bw, double* mat, double previous_dc_coeffi) {
     // 1. DC coefficient differential encoding
     int dc_coeffi = round(mat[0]); // Current block's DC coefficient
     int dc_diff = dc_coeffi - previous_dc_coeffi; // Difference
@@ -80,7 +61,7 @@ void performHuffmanCoding(uint8_t* bitstream_buffer, int* bitstream_index_p, dou
         dc_category = 11;  // Ensure the maximum category is 11
     }
     HuffmanCode dc_code = dc_huffman_table[dc_category];
-    writeBits(bitstream_buffer, bitstream_index_p, dc_code.bitstring, dc_code.bitlength);
+    writeBits(bw, dc_code.bitstring, dc_code.bitlength);
 
     // 2. AC coefficients encoding
     int run = 0; // Number of consecutive zeros
@@ -92,21 +73,21 @@ void performHuffmanCoding(uint8_t* bitstream_buffer, int* bitstream_index_p, dou
             run++;
             if(run == 16) { // More than 16 zeros, write the special code for Run = 15
                 HuffmanCode zrl_code = ac_huffman_table[0x0f]; // Assume 0x0f represents 15 consecutive zeros
-                writeBits(bitstream_buffer, bitstream_index_p, zrl_code.bitstring, zrl_code.bitlength);
+                writeBits(bw, zrl_code.bitstring, zrl_code.bitlength);
                 run = 0;
             }
         } else {
             int size = log2(abs(coeff)) + 1; // Magnitude of the non-zero coefficient
             int run_size = (run << 4) | size; // Combination of run length and magnitude
             HuffmanCode ac_code = ac_huffman_table[run_size];
-            writeBits(bitstream_buffer, bitstream_index_p, ac_code.bitstring, ac_code.bitlength);
+            writeBits(bw, ac_code.bitstring, ac_code.bitlength);
             // Encode the actual coefficient
-            writeBits(bitstream_buffer, bitstream_index_p, coeff, size);
+            writeBits(bw, coeff, size);
             run = 0; // Reset the number of consecutive zeros
         }
     }
 
     // 3. Write End of Block (EOB)
     HuffmanCode eob_code = ac_huffman_table[0x00];  // Assume 0x00 is EOB
-    writeBits(bitstream_buffer, bitstream_index_p, eob_code.bitstring, eob_code.bitlength);
+    writeBits(bw, eob_code.bitstring, eob_code.bitlength);
 }
\ No newline at end of file
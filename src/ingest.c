@@ -0,0 +1,167 @@
+#include <string.h>
+#include <unistd.h>
+
+#include "ingest.h"
+#include "profile.h"
+
+enum {
+    INGEST_SLOT_FREE = 0,
+    INGEST_SLOT_DECODING,
+    INGEST_SLOT_READY,
+    INGEST_SLOT_FAILED,
+};
+
+static void frameFileName(const IngestPipeline* pipeline, int index, char* filename) {
+    snprintf(filename, INGEST_MAX_PATH, pipeline->pattern, pipeline->first + index);
+}
+
+int countIngestFrames(const char* pattern, int first) {
+    char filename[INGEST_MAX_PATH];
+    int count = 0;
+    for(;;) {
+        snprintf(filename, INGEST_MAX_PATH, pattern, first + count);
+        if(access(filename, R_OK) != 0) {
+            return count;
+        }
+        count++;
+    }
+}
+
+static void* ingestThread(void* arg) {
+    IngestPipeline* pipeline = (IngestPipeline*)arg;
+    char filename[INGEST_MAX_PATH];
+
+    pthread_mutex_lock(&pipeline->lock);
+    for(;;) {
+        // Slot of the next frame is busy until the consumer releases the
+        // frame num_slots before it
+        while(!pipeline->stop && pipeline->next_decode < pipeline->count &&
+              pipeline->next_decode >= pipeline->released + pipeline->num_slots) {
+            pthread_cond_wait(&pipeline->slot_free, &pipeline->lock);
+        }
+        if(pipeline->stop || pipeline->next_decode >= pipeline->count) {
+            break;
+        }
+        int index = pipeline->next_decode++;
+        IngestSlot* slot = &pipeline->slots[index % pipeline->num_slots];
+        slot->index = index;
+        slot->state = INGEST_SLOT_DECODING;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        frameFileName(pipeline, index, filename);
+        uint64_t start = profileStart();
+        int ret = readImageInto(&slot->image, filename, &pipeline->pool);
+        profileSpan(PROFILE_DECODE, start);
+
+        pthread_mutex_lock(&pipeline->lock);
+        slot->state = ret == 0 ? INGEST_SLOT_READY : INGEST_SLOT_FAILED;
+        pipeline->failed |= ret != 0;
+        pthread_cond_broadcast(&pipeline->frame_ready);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+int startIngest(IngestPipeline* pipeline, const char* pattern, int first, int count, int num_threads, int num_slots) {
+    if(num_threads <= 0) {
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = num_threads > 0 ? num_threads : 1;
+    }
+    if(num_slots <= 0) {
+        num_slots = 2 * num_threads;
+    }
+    strncpy(pipeline->pattern, pattern, INGEST_MAX_PATH - 1);
+    pipeline->pattern[INGEST_MAX_PATH - 1] = '\0';
+    pipeline->first = first;
+    pipeline->count = count;
+    pipeline->num_slots = num_slots;
+    pipeline->num_threads = 0;
+    pipeline->next_decode = 0;
+    pipeline->next_out = 0;
+    pipeline->released = 0;
+    pipeline->stop = 0;
+    pipeline->failed = 0;
+    pipeline->slots = (IngestSlot*)calloc(num_slots, sizeof(IngestSlot));
+    pipeline->threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+    if(!pipeline->slots || !pipeline->threads) {
+        free(pipeline->slots);
+        free(pipeline->threads);
+        return -1;
+    }
+    for(int i = 0; i < num_slots; i++) {
+        pipeline->slots[i].index = -1;
+    }
+    initFramePool(&pipeline->pool, FRAME_PAD);
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->slot_free, NULL);
+    pthread_cond_init(&pipeline->frame_ready, NULL);
+
+    for(int i = 0; i < num_threads; i++) {
+        if(pthread_create(&pipeline->threads[i], NULL, ingestThread, pipeline) != 0) {
+            break;
+        }
+        pipeline->num_threads++;
+    }
+    if(pipeline->num_threads == 0) {
+        stopIngest(pipeline);
+        return -1;
+    }
+    return 0;
+}
+
+ImageInfo* nextIngestFrame(IngestPipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    if(pipeline->next_out >= pipeline->count) {
+        pthread_mutex_unlock(&pipeline->lock);
+        return NULL;
+    }
+    IngestSlot* slot = &pipeline->slots[pipeline->next_out % pipeline->num_slots];
+    while(!pipeline->stop && (slot->index != pipeline->next_out ||
+                              (slot->state != INGEST_SLOT_READY && slot->state != INGEST_SLOT_FAILED))) {
+        pthread_cond_wait(&pipeline->frame_ready, &pipeline->lock);
+    }
+    if(pipeline->stop || slot->state == INGEST_SLOT_FAILED) {
+        pthread_mutex_unlock(&pipeline->lock);
+        return NULL;
+    }
+    pipeline->next_out++;
+    pthread_mutex_unlock(&pipeline->lock);
+    return &slot->image;
+}
+
+void releaseIngestFrame(IngestPipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    if(pipeline->released < pipeline->next_out) {
+        pipeline->slots[pipeline->released % pipeline->num_slots].state = INGEST_SLOT_FREE;
+        pipeline->released++;
+        pthread_cond_broadcast(&pipeline->slot_free);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+void cancelIngest(IngestPipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->stop = 1;
+    pthread_cond_broadcast(&pipeline->slot_free);
+    pthread_cond_broadcast(&pipeline->frame_ready);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+void stopIngest(IngestPipeline* pipeline) {
+    cancelIngest(pipeline);
+    // Decoders finish the frame they are on
+    for(int i = 0; i < pipeline->num_threads; i++) {
+        pthread_join(pipeline->threads[i], NULL);
+    }
+    for(int i = 0; i < pipeline->num_slots; i++) {
+        freeFrame(pipeline->slots[i].image.frame);
+    }
+    freeFramePool(&pipeline->pool);
+    free(pipeline->slots);
+    free(pipeline->threads);
+    pipeline->slots = NULL;
+    pipeline->threads = NULL;
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->slot_free);
+    pthread_cond_destroy(&pipeline->frame_ready);
+}
@@ -0,0 +1,374 @@
+#include <pthread.h>
+
+#include "intdct.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define INTDCT_X86 1
+#include <immintrin.h>
+#endif
+
+// round(2^13 * a(k) * cos((2n+1) k pi / 16)), a(0) = sqrt(1/8), a(k) = 1/2
+static const int16_t dct_coef[8][8] = {
+    {  2896,   2896,   2896,   2896,   2896,   2896,   2896,   2896 },
+    {  4017,   3406,   2276,    799,   -799,  -2276,  -3406,  -4017 },
+    {  3784,   1567,  -1567,  -3784,  -3784,  -1567,   1567,   3784 },
+    {  3406,   -799,  -4017,  -2276,   2276,   4017,    799,  -3406 },
+    {  2896,  -2896,  -2896,   2896,   2896,  -2896,  -2896,   2896 },
+    {  2276,  -4017,    799,   3406,  -3406,   -799,   4017,  -2276 },
+    {  1567,  -3784,   3784,  -1567,  -1567,   3784,  -3784,   1567 },
+    {   799,  -2276,   3406,  -4017,   4017,  -3406,   2276,   -799 },
+};
+
+// Pass 1 keeps DCT_PASS1_BITS extra fraction bits, pass 2 removes them
+#define SHIFT_PASS1 (DCT_CONST_BITS - DCT_PASS1_BITS)
+#define SHIFT_PASS2 (DCT_CONST_BITS + DCT_PASS1_BITS)
+
+static inline int16_t saturate16(int32_t v) {
+    return v > 32767 ? 32767 : (v < -32768 ? -32768 : (int16_t)v);
+}
+
+// Both passes use the same arithmetic in every backend: 32-bit accumulation,
+// round half up, arithmetic shift and saturation to int16.
+static void performIntDCTScalar(int16_t block[64]) {
+    int16_t tmp[64];
+
+    // Rows
+    for(int i = 0; i < 8; i++) {
+        for(int k = 0; k < 8; k++) {
+            int32_t acc = 1 << (SHIFT_PASS1 - 1);
+            for(int n = 0; n < 8; n++) {
+                acc += dct_coef[k][n] * block[i * 8 + n];
+            }
+            tmp[i * 8 + k] = saturate16(acc >> SHIFT_PASS1);
+        }
+    }
+
+    // Columns
+    for(int j = 0; j < 8; j++) {
+        for(int k = 0; k < 8; k++) {
+            int32_t acc = 1 << (SHIFT_PASS2 - 1);
+            for(int n = 0; n < 8; n++) {
+                acc += dct_coef[k][n] * tmp[n * 8 + j];
+            }
+            block[k * 8 + j] = saturate16(acc >> SHIFT_PASS2);
+        }
+    }
+}
+
+static void performIntDCTPixelsScalar(int16_t block[64], const uint8_t* src, int stride) {
+    for(int i = 0; i < 8; i++) {
+        for(int j = 0; j < 8; j++) {
+            block[i * 8 + j] = src[i * stride + j];
+        }
+    }
+    performIntDCTScalar(block);
+}
+
+static void performIntDCTResidualScalar(int16_t block[64], const uint8_t* src, int stride_src, const uint8_t* pred, int stride_pred) {
+    for(int i = 0; i < 8; i++) {
+        for(int j = 0; j < 8; j++) {
+            block[i * 8 + j] = src[i * stride_src + j] - pred[i * stride_pred + j];
+        }
+    }
+    performIntDCTScalar(block);
+}
+
+#ifdef INTDCT_X86
+// Coefficient pair (C[k][2m], C[k][2m+1]) broadcast to every 32-bit lane
+#define COEF_PAIR(k, m) ((uint16_t)dct_coef[k][2 * (m)] | ((uint32_t)(uint16_t)dct_coef[k][2 * (m) + 1] << 16))
+
+static inline void transpose8x8SSE2(__m128i r[8]) {
+    __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+    __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+    __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+    __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+    __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+    __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+    __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+    __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+    __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+    r[0] = _mm_unpacklo_epi64(b0, b4);
+    r[1] = _mm_unpackhi_epi64(b0, b4);
+    r[2] = _mm_unpacklo_epi64(b1, b5);
+    r[3] = _mm_unpackhi_epi64(b1, b5);
+    r[4] = _mm_unpacklo_epi64(b2, b6);
+    r[5] = _mm_unpackhi_epi64(b2, b6);
+    r[6] = _mm_unpacklo_epi64(b3, b7);
+    r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+// 1D DCT down the columns: output row k = sum_n C[k][n] * row n.
+// Rows are interleaved in pairs so that pmaddwd does two taps at once.
+static inline void dctPassSSE2(__m128i r[8], int shift) {
+    __m128i p_lo[4], p_hi[4];
+    for(int m = 0; m < 4; m++) {
+        p_lo[m] = _mm_unpacklo_epi16(r[2 * m], r[2 * m + 1]);
+        p_hi[m] = _mm_unpackhi_epi16(r[2 * m], r[2 * m + 1]);
+    }
+    const __m128i rounding = _mm_set1_epi32(1 << (shift - 1));
+    for(int k = 0; k < 8; k++) {
+        __m128i lo = rounding;
+        __m128i hi = rounding;
+        for(int m = 0; m < 4; m++) {
+            __m128i c = _mm_set1_epi32((int)COEF_PAIR(k, m));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(p_lo[m], c));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(p_hi[m], c));
+        }
+        r[k] = _mm_packs_epi32(_mm_srai_epi32(lo, shift), _mm_srai_epi32(hi, shift));
+    }
+}
+
+// Rows of 8 pixels widened to int16, straight from the picture
+static inline void loadPixelsSSE2(__m128i r[8], const uint8_t* src, int stride) {
+    const __m128i zero = _mm_setzero_si128();
+    for(int i = 0; i < 8; i++) {
+        r[i] = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + i * stride)), zero);
+    }
+}
+
+static inline void loadResidualSSE2(__m128i r[8], const uint8_t* src, int stride_src, const uint8_t* pred, int stride_pred) {
+    const __m128i zero = _mm_setzero_si128();
+    for(int i = 0; i < 8; i++) {
+        __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + i * stride_src)), zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pred + i * stride_pred)), zero);
+        r[i] = _mm_sub_epi16(a, b);
+    }
+}
+
+static inline void transformSSE2(int16_t block[64], __m128i r[8]) {
+    transpose8x8SSE2(r);
+    dctPassSSE2(r, SHIFT_PASS1);
+    transpose8x8SSE2(r);
+    dctPassSSE2(r, SHIFT_PASS2);
+    for(int i = 0; i < 8; i++) {
+        _mm_storeu_si128((__m128i*)(block + i * 8), r[i]);
+    }
+}
+
+static void performIntDCTSSE2(int16_t block[64]) {
+    __m128i r[8];
+    for(int i = 0; i < 8; i++) {
+        r[i] = _mm_loadu_si128((const __m128i*)(block + i * 8));
+    }
+    transformSSE2(block, r);
+}
+
+static void performIntDCTPixelsSSE2(int16_t block[64], const uint8_t* src, int stride) {
+    __m128i r[8];
+    loadPixelsSSE2(r, src, stride);
+    transformSSE2(block, r);
+}
+
+static void performIntDCTResidualSSE2(int16_t block[64], const uint8_t* src, int stride_src, const uint8_t* pred, int stride_pred) {
+    __m128i r[8];
+    loadResidualSSE2(r, src, stride_src, pred, stride_pred);
+    transformSSE2(block, r);
+}
+
+// Same pass with 256-bit registers: each pair of rows is spread over both
+// lanes so one vpmaddwd covers all eight columns.
+__attribute__((target("avx2")))
+static inline void dctPassAVX2(__m128i r[8], int shift) {
+    __m256i p[4];
+    for(int m = 0; m < 4; m++) {
+        p[m] = _mm256_set_m128i(_mm_unpackhi_epi16(r[2 * m], r[2 * m + 1]),
+                                _mm_unpacklo_epi16(r[2 * m], r[2 * m + 1]));
+    }
+    const __m256i rounding = _mm256_set1_epi32(1 << (shift - 1));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    for(int k = 0; k < 8; k += 2) {
+        __m256i acc0 = rounding;
+        __m256i acc1 = rounding;
+        for(int m = 0; m < 4; m++) {
+            acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(p[m], _mm256_set1_epi32((int)COEF_PAIR(k, m))));
+            acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(p[m], _mm256_set1_epi32((int)COEF_PAIR(k + 1, m))));
+        }
+        // packs works per lane, reorder 64-bit quarters back into rows k, k+1
+        __m256i rows = _mm256_packs_epi32(_mm256_sra_epi32(acc0, count), _mm256_sra_epi32(acc1, count));
+        rows = _mm256_permute4x64_epi64(rows, 0xD8);
+        r[k] = _mm256_castsi256_si128(rows);
+        r[k + 1] = _mm256_extracti128_si256(rows, 1);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline void transformAVX2(int16_t block[64], __m128i r[8]) {
+    transpose8x8SSE2(r);
+    dctPassAVX2(r, SHIFT_PASS1);
+    transpose8x8SSE2(r);
+    dctPassAVX2(r, SHIFT_PASS2);
+    for(int i = 0; i < 8; i++) {
+        _mm_storeu_si128((__m128i*)(block + i * 8), r[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+static void performIntDCTAVX2(int16_t block[64]) {
+    __m128i r[8];
+    for(int i = 0; i < 8; i++) {
+        r[i] = _mm_loadu_si128((const __m128i*)(block + i * 8));
+    }
+    transformAVX2(block, r);
+}
+
+__attribute__((target("avx2")))
+static void performIntDCTPixelsAVX2(int16_t block[64], const uint8_t* src, int stride) {
+    __m128i r[8];
+    loadPixelsSSE2(r, src, stride);
+    transformAVX2(block, r);
+}
+
+__attribute__((target("avx2")))
+static void performIntDCTResidualAVX2(int16_t block[64], const uint8_t* src, int stride_src, const uint8_t* pred, int stride_pred) {
+    __m128i r[8];
+    loadResidualSSE2(r, src, stride_src, pred, stride_pred);
+    transformAVX2(block, r);
+}
+#endif
+
+static void (*const dct_backends[DCT_BACKEND_COUNT])(int16_t*) = {
+    performIntDCTScalar,
+#ifdef INTDCT_X86
+    performIntDCTSSE2,
+    performIntDCTAVX2,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+static void (*const dct_pixel_backends[DCT_BACKEND_COUNT])(int16_t*, const uint8_t*, int) = {
+    performIntDCTPixelsScalar,
+#ifdef INTDCT_X86
+    performIntDCTPixelsSSE2,
+    performIntDCTPixelsAVX2,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+static void (*const dct_residual_backends[DCT_BACKEND_COUNT])(int16_t*, const uint8_t*, int, const uint8_t*, int) = {
+    performIntDCTResidualScalar,
+#ifdef INTDCT_X86
+    performIntDCTResidualSSE2,
+    performIntDCTResidualAVX2,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+static const char* dct_backend_names[DCT_BACKEND_COUNT] = { "scalar", "sse2", "avx2" };
+
+static pthread_once_t dct_once = PTHREAD_ONCE_INIT;
+static DCTBackend dct_backend = DCT_BACKEND_SCALAR;
+
+int isDCTBackendSupported(DCTBackend backend) {
+    switch(backend) {
+    case DCT_BACKEND_SCALAR:
+        return 1;
+#ifdef INTDCT_X86
+    case DCT_BACKEND_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case DCT_BACKEND_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return 0;
+    }
+}
+
+static void selectDCTBackend(void) {
+#ifdef INTDCT_X86
+    __builtin_cpu_init();
+#endif
+    for(int b = DCT_BACKEND_COUNT - 1; b >= 0; b--) {
+        if(isDCTBackendSupported((DCTBackend)b)) {
+            dct_backend = (DCTBackend)b;
+            return;
+        }
+    }
+}
+
+void initIntDCT(void) {
+    pthread_once(&dct_once, selectDCTBackend);
+}
+
+void performIntDCT(int16_t block[64]) {
+    initIntDCT();
+    dct_backends[dct_backend](block);
+}
+
+void performIntDCTPixels(int16_t block[64], const uint8_t* src, int stride) {
+    initIntDCT();
+    dct_pixel_backends[dct_backend](block, src, stride);
+}
+
+void performIntDCTResidual(int16_t block[64], const uint8_t* src, int stride_src, const uint8_t* pred, int stride_pred) {
+    initIntDCT();
+    dct_residual_backends[dct_backend](block, src, stride_src, pred, stride_pred);
+}
+
+DCTBackend getDCTBackend(void) {
+    initIntDCT();
+    return dct_backend;
+}
+
+int setDCTBackend(DCTBackend backend) {
+    initIntDCT();
+    if(backend < 0 || backend >= DCT_BACKEND_COUNT || !isDCTBackendSupported(backend)) {
+        return -1;
+    }
+    dct_backend = backend;
+    return 0;
+}
+
+const char* getDCTBackendName(DCTBackend backend) {
+    if(backend < 0 || backend >= DCT_BACKEND_COUNT) {
+        return "unknown";
+    }
+    return dct_backend_names[backend];
+}
+
+// Inverse pass 1 keeps fewer fraction bits than the forward one: rows of
+// dequantized coefficients (up to +-2048) grow by up to sqrt(8), and the
+// column sums must still fit in 32 bits
+#define IDCT_PASS1_BITS 3
+#define SHIFT_IPASS1 (DCT_CONST_BITS - IDCT_PASS1_BITS)
+#define SHIFT_IPASS2 (DCT_CONST_BITS + IDCT_PASS1_BITS)
+
+void performIntIDCT(int16_t block[64]) {
+    int32_t tmp[64];
+
+    // Rows: f(n) = sum_k C[k][n] F(k)
+    for(int i = 0; i < 8; i++) {
+        for(int n = 0; n < 8; n++) {
+            int32_t acc = 1 << (SHIFT_IPASS1 - 1);
+            for(int k = 0; k < 8; k++) {
+                acc += dct_coef[k][n] * block[i * 8 + k];
+            }
+            tmp[i * 8 + n] = acc >> SHIFT_IPASS1;
+        }
+    }
+
+    // Columns
+    for(int j = 0; j < 8; j++) {
+        for(int n = 0; n < 8; n++) {
+            int32_t acc = 1 << (SHIFT_IPASS2 - 1);
+            for(int k = 0; k < 8; k++) {
+                acc += dct_coef[k][n] * tmp[k * 8 + j];
+            }
+            block[n * 8 + j] = saturate16(acc >> SHIFT_IPASS2);
+        }
+    }
+}
@@ -0,0 +1,247 @@
+#include <stdlib.h>
+
+#include "createMLV.h"
+#include "lookahead.h"
+#include "motion.h"
+
+// Search range of the inter estimate in low-res pixels
+#define LOOKAHEAD_RANGE 4
+// Inter cost above this percentage of the intra cost: scene cut
+#define LOOKAHEAD_SCENECUT_PERCENT 60
+// Inter cost below this percentage of the intra cost: B picture
+#define LOOKAHEAD_BIDIR_PERCENT 50
+
+static uint8_t* lowresPlane(const Lookahead* lookahead, int index) {
+    return lookahead->lowres + (size_t)(index % (lookahead->depth + 1)) * lookahead->width * lookahead->height;
+}
+
+// Average of each LOOKAHEAD_SCALE x LOOKAHEAD_SCALE block of the luma plane
+static void downsample(const ImageInfo* image, uint8_t* lowres, int width, int height) {
+    const int count = LOOKAHEAD_SCALE * LOOKAHEAD_SCALE;
+    const YuvPlanes* planes = &image->frame->planes;
+    for(int y = 0; y < height; y++) {
+        const uint8_t* row = planes->y + (size_t)y * LOOKAHEAD_SCALE * planes->stride_y;
+        for(int x = 0; x < width; x++) {
+            int sum = 0;
+            for(int i = 0; i < LOOKAHEAD_SCALE; i++) {
+                for(int j = 0; j < LOOKAHEAD_SCALE; j++) {
+                    sum += row[i * planes->stride_y + x * LOOKAHEAD_SCALE + j];
+                }
+            }
+            lowres[y * width + x] = (uint8_t)((sum + count / 2) / count);
+        }
+    }
+}
+
+// Sum over the 8x8 blocks of their SAD against their mean, and of the
+// smaller of that and the best SAD in `prev` if there is one
+static void estimateCosts(const Lookahead* lookahead, const uint8_t* cur, const uint8_t* prev,
+                          int64_t* intra_cost, int64_t* inter_cost) {
+    const int width = lookahead->width;
+    const int height = lookahead->height;
+    int64_t intra_sum = 0;
+    int64_t inter_sum = 0;
+    for(int y = 0; y + 8 <= height; y += 8) {
+        for(int x = 0; x + 8 <= width; x += 8) {
+            const uint8_t* block = cur + y * width + x;
+            int sum = 0;
+            for(int i = 0; i < 8; i++) {
+                for(int j = 0; j < 8; j++) {
+                    sum += block[i * width + j];
+                }
+            }
+            uint8_t mean[8];
+            for(int j = 0; j < 8; j++) {
+                mean[j] = (uint8_t)((sum + 32) / 64);
+            }
+            int intra = sad8x8(block, width, mean, 0);
+            int best = intra;
+            for(int dy = -LOOKAHEAD_RANGE; prev && dy <= LOOKAHEAD_RANGE; dy++) {
+                if(y + dy < 0 || y + dy + 8 > height) {
+                    continue;
+                }
+                for(int dx = -LOOKAHEAD_RANGE; dx <= LOOKAHEAD_RANGE; dx++) {
+                    if(x + dx < 0 || x + dx + 8 > width) {
+                        continue;
+                    }
+                    int sad = sad8x8(block, width, prev + (y + dy) * width + x + dx, width);
+                    best = sad < best ? sad : best;
+                }
+            }
+            intra_sum += intra;
+            inter_sum += best;
+        }
+    }
+    *intra_cost = intra_sum;
+    *inter_cost = inter_sum;
+}
+
+// Type of `frame`, the frame after it being `next`, NULL at the end.
+// The picture before a scene cut is an anchor, so no B picture refers to
+// the new scene, and so is the one before every I of a closed GOP.
+static void decideType(Lookahead* lookahead, LookaheadFrame* frame, const LookaheadFrame* next) {
+    const GopConfig* config = &lookahead->config;
+    if(frame->index == 0 || frame->scenecut || frame->index - lookahead->last_intra >= config->size) {
+        frame->type = PICTURE_TYPE_I;
+    } else if(!next || next->scenecut || (config->closed && next->index - lookahead->last_intra >= config->size)) {
+        frame->type = PICTURE_TYPE_P;
+    } else if(lookahead->bidir_run < config->distance - 1 &&
+              frame->inter_cost * 100 < frame->intra_cost * LOOKAHEAD_BIDIR_PERCENT) {
+        frame->type = PICTURE_TYPE_B;
+    } else {
+        frame->type = PICTURE_TYPE_P;
+    }
+
+    if(frame->type == PICTURE_TYPE_I) {
+        lookahead->last_intra = frame->index;
+    }
+    lookahead->bidir_run = frame->type == PICTURE_TYPE_B ? lookahead->bidir_run + 1 : 0;
+    lookahead->num_decided++;
+}
+
+static void* lookaheadThread(void* arg) {
+    Lookahead* lookahead = (Lookahead*)arg;
+    for(;;) {
+        pthread_mutex_lock(&lookahead->lock);
+        while(!lookahead->stop && lookahead->num_analyzed - lookahead->num_out >= lookahead->depth) {
+            pthread_cond_wait(&lookahead->consumed, &lookahead->lock);
+        }
+        int stop = lookahead->stop;
+        pthread_mutex_unlock(&lookahead->lock);
+        if(stop) {
+            break;
+        }
+
+        int index = lookahead->num_analyzed;
+        ImageInfo* image = nextIngestFrame(lookahead->ingest);
+        LookaheadFrame* frame = &lookahead->frames[index % lookahead->depth];
+        LookaheadFrame* last = index > 0 ? &lookahead->frames[(index - 1) % lookahead->depth] : NULL;
+        if(!image) {
+            pthread_mutex_lock(&lookahead->lock);
+            if(last) {
+                decideType(lookahead, last, NULL);
+            }
+            lookahead->done = 1;
+            pthread_cond_broadcast(&lookahead->decided);
+            pthread_mutex_unlock(&lookahead->lock);
+            break;
+        }
+
+        frame->image = image;
+        frame->index = index;
+        frame->type = 0;
+        frame->scenecut = 0;
+        if(image->width / LOOKAHEAD_SCALE != lookahead->width || image->height / LOOKAHEAD_SCALE != lookahead->height) {
+            // Not the size of the sequence; the encoder rejects it
+            frame->intra_cost = 0;
+            frame->inter_cost = 0;
+        } else {
+            uint8_t* lowres = lowresPlane(lookahead, index);
+            downsample(image, lowres, lookahead->width, lookahead->height);
+            estimateCosts(lookahead, lowres, index > 0 ? lowresPlane(lookahead, index - 1) : NULL,
+                          &frame->intra_cost, &frame->inter_cost);
+            frame->scenecut = index > 0 && frame->inter_cost * 100 >= frame->intra_cost * LOOKAHEAD_SCENECUT_PERCENT;
+        }
+
+        pthread_mutex_lock(&lookahead->lock);
+        lookahead->num_analyzed++;
+        if(last) {
+            decideType(lookahead, last, frame);
+            pthread_cond_broadcast(&lookahead->decided);
+        }
+        pthread_mutex_unlock(&lookahead->lock);
+    }
+    return NULL;
+}
+
+int startLookahead(Lookahead* lookahead, IngestPipeline* ingest, const GopConfig* config, int depth) {
+    if(ingest->num_slots < 2 || config->size < 1 || config->distance < 1) {
+        return -1;
+    }
+    // The first frame sets the size of the low-res planes
+    ImageInfo* first = nextIngestFrame(ingest);
+    if(!first) {
+        return -1;
+    }
+    // Frames beyond the ingest ring could never be analyzed ahead
+    depth = depth < 2 ? 2 : depth;
+    depth = depth > ingest->num_slots ? ingest->num_slots : depth;
+
+    lookahead->config = *config;
+    lookahead->ingest = ingest;
+    lookahead->depth = depth;
+    lookahead->width = first->width / LOOKAHEAD_SCALE;
+    lookahead->height = first->height / LOOKAHEAD_SCALE;
+    lookahead->lowres = (uint8_t*)malloc((size_t)(depth + 1) * lookahead->width * lookahead->height);
+    lookahead->frames = (LookaheadFrame*)calloc(depth, sizeof(LookaheadFrame));
+    if(!lookahead->lowres || !lookahead->frames) {
+        free(lookahead->lowres);
+        free(lookahead->frames);
+        return -1;
+    }
+    lookahead->num_analyzed = 1;
+    lookahead->num_decided = 0;
+    lookahead->num_out = 0;
+    lookahead->returned = 0;
+    lookahead->done = 0;
+    lookahead->stop = 0;
+    lookahead->last_intra = 0;
+    lookahead->bidir_run = 0;
+
+    LookaheadFrame* frame = &lookahead->frames[0];
+    frame->image = first;
+    frame->index = 0;
+    frame->scenecut = 0;
+    downsample(first, lowresPlane(lookahead, 0), lookahead->width, lookahead->height);
+    estimateCosts(lookahead, lowresPlane(lookahead, 0), NULL, &frame->intra_cost, &frame->inter_cost);
+
+    pthread_mutex_init(&lookahead->lock, NULL);
+    pthread_cond_init(&lookahead->decided, NULL);
+    pthread_cond_init(&lookahead->consumed, NULL);
+    if(pthread_create(&lookahead->thread, NULL, lookaheadThread, lookahead) != 0) {
+        pthread_mutex_destroy(&lookahead->lock);
+        pthread_cond_destroy(&lookahead->decided);
+        pthread_cond_destroy(&lookahead->consumed);
+        free(lookahead->lowres);
+        free(lookahead->frames);
+        return -1;
+    }
+    return 0;
+}
+
+LookaheadFrame* nextLookaheadFrame(Lookahead* lookahead) {
+    pthread_mutex_lock(&lookahead->lock);
+    if(lookahead->returned) {
+        lookahead->num_out++;
+        lookahead->returned = 0;
+        pthread_cond_broadcast(&lookahead->consumed);
+    }
+    while(lookahead->num_decided <= lookahead->num_out && !lookahead->done) {
+        pthread_cond_wait(&lookahead->decided, &lookahead->lock);
+    }
+    LookaheadFrame* frame = NULL;
+    if(lookahead->num_decided > lookahead->num_out) {
+        frame = &lookahead->frames[lookahead->num_out % lookahead->depth];
+        lookahead->returned = 1;
+    }
+    pthread_mutex_unlock(&lookahead->lock);
+    return frame;
+}
+
+void stopLookahead(Lookahead* lookahead) {
+    pthread_mutex_lock(&lookahead->lock);
+    lookahead->stop = 1;
+    pthread_cond_broadcast(&lookahead->consumed);
+    pthread_mutex_unlock(&lookahead->lock);
+    // The thread may be waiting for a frame that no decoder can start
+    cancelIngest(lookahead->ingest);
+    pthread_join(lookahead->thread, NULL);
+
+    pthread_mutex_destroy(&lookahead->lock);
+    pthread_cond_destroy(&lookahead->decided);
+    pthread_cond_destroy(&lookahead->consumed);
+    free(lookahead->lowres);
+    free(lookahead->frames);
+    lookahead->lowres = NULL;
+    lookahead->frames = NULL;
+}
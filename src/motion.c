@@ -0,0 +1,503 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "motion.h"
+#include "mpeg1_encoder.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MOTION_X86 1
+#include <immintrin.h>
+#endif
+
+// Upper bound on hexagon steps, the walk normally stops far earlier
+#define MAX_HEXAGON_STEPS 32
+
+static int sad16x16Scalar(const uint8_t* a, int stride_a, const uint8_t* b, int stride_b) {
+    int sad = 0;
+    for(int i = 0; i < 16; i++) {
+        for(int j = 0; j < 16; j++) {
+            sad += abs(a[j] - b[j]);
+        }
+        a += stride_a;
+        b += stride_b;
+    }
+    return sad;
+}
+
+static int sad8x8Scalar(const uint8_t* a, int stride_a, const uint8_t* b, int stride_b) {
+    int sad = 0;
+    for(int i = 0; i < 8; i++) {
+        for(int j = 0; j < 8; j++) {
+            sad += abs(a[j] - b[j]);
+        }
+        a += stride_a;
+        b += stride_b;
+    }
+    return sad;
+}
+
+// One row of the three half-pel planes; row1 is the row below row0
+static void interpolateRowScalar(const uint8_t* row0, const uint8_t* row1, uint8_t* h, uint8_t* v, uint8_t* hv, int start, int width) {
+    for(int j = start; j < width; j++) {
+        int next = j + 1 < width ? j + 1 : j;
+        h[j] = (row0[j] + row0[next] + 1) >> 1;
+        v[j] = (row0[j] + row1[j] + 1) >> 1;
+        hv[j] = (row0[j] + row0[next] + row1[j] + row1[next] + 2) >> 2;
+    }
+}
+
+static void predictBlockScalar(uint8_t* dst, int stride_dst, const uint8_t* src, int stride_src, int half_x, int half_y, int width, int height) {
+    for(int i = 0; i < height; i++) {
+        const uint8_t* row0 = src + i * stride_src;
+        const uint8_t* row1 = row0 + half_y * stride_src;
+        for(int j = 0; j < width; j++) {
+            if(half_x && half_y) {
+                dst[j] = (row0[j] + row0[j + 1] + row1[j] + row1[j + 1] + 2) >> 2;
+            } else if(half_x) {
+                dst[j] = (row0[j] + row0[j + 1] + 1) >> 1;
+            } else {
+                dst[j] = (row0[j] + row1[j] + 1) >> 1;
+            }
+        }
+        dst += stride_dst;
+    }
+}
+
+static void averageBlockScalar(uint8_t* dst, int stride_dst, const uint8_t* a, int stride_a, const uint8_t* b, int stride_b, int width, int height) {
+    for(int i = 0; i < height; i++) {
+        for(int j = 0; j < width; j++) {
+            dst[j] = (a[j] + b[j] + 1) >> 1;
+        }
+        dst += stride_dst;
+        a += stride_a;
+        b += stride_b;
+    }
+}
+
+#ifdef MOTION_X86
+// psadbw sums 8 absolute differences into each 64-bit half
+static int sad16x16SSE2(const uint8_t* a, int stride_a, const uint8_t* b, int stride_b) {
+    __m128i acc = _mm_setzero_si128();
+    for(int i = 0; i < 16; i++) {
+        __m128i ra = _mm_loadu_si128((const __m128i*)(a + i * stride_a));
+        __m128i rb = _mm_loadu_si128((const __m128i*)(b + i * stride_b));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(ra, rb));
+    }
+    return _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_srli_si128(acc, 8)));
+}
+
+// Two rows of 8 per register
+static int sad8x8SSE2(const uint8_t* a, int stride_a, const uint8_t* b, int stride_b) {
+    __m128i acc = _mm_setzero_si128();
+    for(int i = 0; i < 8; i += 2) {
+        __m128i ra = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(a + i * stride_a)),
+                                        _mm_loadl_epi64((const __m128i*)(a + (i + 1) * stride_a)));
+        __m128i rb = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(b + i * stride_b)),
+                                        _mm_loadl_epi64((const __m128i*)(b + (i + 1) * stride_b)));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(ra, rb));
+    }
+    return _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_srli_si128(acc, 8)));
+}
+
+// pavgb rounds up like the decoder. The four-pixel average is summed in
+// 16 bits, as two pavgb would round twice.
+static inline __m128i average4SSE2(__m128i a, __m128i b, __m128i c, __m128i d) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+                               _mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero)));
+    __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+                               _mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero)));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+    return _mm_packus_epi16(lo, hi);
+}
+
+// 16 pixels per step while the pixel to the right exists
+static void interpolateRowSSE2(const uint8_t* row0, const uint8_t* row1, uint8_t* h, uint8_t* v, uint8_t* hv, int start, int width) {
+    int j = start;
+    for(; j + 16 < width; j += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(row0 + j));
+        __m128i b = _mm_loadu_si128((const __m128i*)(row0 + j + 1));
+        __m128i c = _mm_loadu_si128((const __m128i*)(row1 + j));
+        __m128i d = _mm_loadu_si128((const __m128i*)(row1 + j + 1));
+        _mm_storeu_si128((__m128i*)(h + j), _mm_avg_epu8(a, b));
+        _mm_storeu_si128((__m128i*)(v + j), _mm_avg_epu8(a, c));
+        _mm_storeu_si128((__m128i*)(hv + j), average4SSE2(a, b, c, d));
+    }
+    interpolateRowScalar(row0, row1, h, v, hv, j, width);
+}
+
+// 8 pixels per step, the low halves of the registers
+static void predictBlockSSE2(uint8_t* dst, int stride_dst, const uint8_t* src, int stride_src, int half_x, int half_y, int width, int height) {
+    for(int i = 0; i < height; i++) {
+        const uint8_t* row0 = src + i * stride_src;
+        const uint8_t* row1 = row0 + half_y * stride_src;
+        for(int j = 0; j < width; j += 8) {
+            __m128i a = _mm_loadl_epi64((const __m128i*)(row0 + j));
+            __m128i p;
+            if(half_x && half_y) {
+                p = average4SSE2(a, _mm_loadl_epi64((const __m128i*)(row0 + j + 1)),
+                                 _mm_loadl_epi64((const __m128i*)(row1 + j)),
+                                 _mm_loadl_epi64((const __m128i*)(row1 + j + 1)));
+            } else if(half_x) {
+                p = _mm_avg_epu8(a, _mm_loadl_epi64((const __m128i*)(row0 + j + 1)));
+            } else {
+                p = _mm_avg_epu8(a, _mm_loadl_epi64((const __m128i*)(row1 + j)));
+            }
+            _mm_storel_epi64((__m128i*)(dst + j), p);
+        }
+        dst += stride_dst;
+    }
+}
+
+static void averageBlockSSE2(uint8_t* dst, int stride_dst, const uint8_t* a, int stride_a, const uint8_t* b, int stride_b, int width, int height) {
+    for(int i = 0; i < height; i++) {
+        for(int j = 0; j < width; j += 8) {
+            __m128i p = _mm_avg_epu8(_mm_loadl_epi64((const __m128i*)(a + j)), _mm_loadl_epi64((const __m128i*)(b + j)));
+            _mm_storel_epi64((__m128i*)(dst + j), p);
+        }
+        dst += stride_dst;
+        a += stride_a;
+        b += stride_b;
+    }
+}
+
+// Two rows per 256-bit register
+__attribute__((target("avx2")))
+static int sad16x16AVX2(const uint8_t* a, int stride_a, const uint8_t* b, int stride_b) {
+    __m256i acc = _mm256_setzero_si256();
+    for(int i = 0; i < 16; i += 2) {
+        __m256i ra = _mm256_set_m128i(_mm_loadu_si128((const __m128i*)(a + (i + 1) * stride_a)),
+                                      _mm_loadu_si128((const __m128i*)(a + i * stride_a)));
+        __m256i rb = _mm256_set_m128i(_mm_loadu_si128((const __m128i*)(b + (i + 1) * stride_b)),
+                                      _mm_loadu_si128((const __m128i*)(b + i * stride_b)));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(ra, rb));
+    }
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    return _mm_cvtsi128_si32(_mm_add_epi64(sum, _mm_srli_si128(sum, 8)));
+}
+
+// 32 pixels per step. Unpack and pack both work within 128-bit lanes, so
+// the pixel order is kept.
+__attribute__((target("avx2")))
+static void interpolateRowAVX2(const uint8_t* row0, const uint8_t* row1, uint8_t* h, uint8_t* v, uint8_t* hv, int start, int width) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i two = _mm256_set1_epi16(2);
+    int j = start;
+    for(; j + 32 < width; j += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(row0 + j));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(row0 + j + 1));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(row1 + j));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(row1 + j + 1));
+        _mm256_storeu_si256((__m256i*)(h + j), _mm256_avg_epu8(a, b));
+        _mm256_storeu_si256((__m256i*)(v + j), _mm256_avg_epu8(a, c));
+        __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero)),
+                                      _mm256_add_epi16(_mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(d, zero)));
+        __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero)),
+                                      _mm256_add_epi16(_mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(d, zero)));
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+        _mm256_storeu_si256((__m256i*)(hv + j), _mm256_packus_epi16(lo, hi));
+    }
+    interpolateRowSSE2(row0, row1, h, v, hv, j, width);
+}
+#endif
+
+static int (*const sad_backends[SAD_BACKEND_COUNT])(const uint8_t*, int, const uint8_t*, int) = {
+    sad16x16Scalar,
+#ifdef MOTION_X86
+    sad16x16SSE2,
+    sad16x16AVX2,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+// 8-pixel rows are too short to gain from 256-bit registers
+static int (*const sad8_backends[SAD_BACKEND_COUNT])(const uint8_t*, int, const uint8_t*, int) = {
+    sad8x8Scalar,
+#ifdef MOTION_X86
+    sad8x8SSE2,
+    sad8x8SSE2,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+static void (*const interpolate_backends[SAD_BACKEND_COUNT])(const uint8_t*, const uint8_t*, uint8_t*, uint8_t*, uint8_t*, int, int) = {
+    interpolateRowScalar,
+#ifdef MOTION_X86
+    interpolateRowSSE2,
+    interpolateRowAVX2,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+// Blocks are at most 16 wide, one 8-pixel step per half register
+static void (*const predict_backends[SAD_BACKEND_COUNT])(uint8_t*, int, const uint8_t*, int, int, int, int, int) = {
+    predictBlockScalar,
+#ifdef MOTION_X86
+    predictBlockSSE2,
+    predictBlockSSE2,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+static void (*const average_backends[SAD_BACKEND_COUNT])(uint8_t*, int, const uint8_t*, int, const uint8_t*, int, int, int) = {
+    averageBlockScalar,
+#ifdef MOTION_X86
+    averageBlockSSE2,
+    averageBlockSSE2,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+static const char* sad_backend_names[SAD_BACKEND_COUNT] = { "scalar", "sse2", "avx2" };
+
+static pthread_once_t sad_once = PTHREAD_ONCE_INIT;
+static SADBackend sad_backend = SAD_BACKEND_SCALAR;
+
+int isSADBackendSupported(SADBackend backend) {
+    switch(backend) {
+    case SAD_BACKEND_SCALAR:
+        return 1;
+#ifdef MOTION_X86
+    case SAD_BACKEND_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case SAD_BACKEND_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return 0;
+    }
+}
+
+static void selectSADBackend(void) {
+#ifdef MOTION_X86
+    __builtin_cpu_init();
+#endif
+    for(int b = SAD_BACKEND_COUNT - 1; b >= 0; b--) {
+        if(isSADBackendSupported((SADBackend)b)) {
+            sad_backend = (SADBackend)b;
+            return;
+        }
+    }
+}
+
+void initMotionSearch(void) {
+    pthread_once(&sad_once, selectSADBackend);
+}
+
+int sad16x16(const uint8_t* a, int stride_a, const uint8_t* b, int stride_b) {
+    initMotionSearch();
+    return sad_backends[sad_backend](a, stride_a, b, stride_b);
+}
+
+int sad8x8(const uint8_t* a, int stride_a, const uint8_t* b, int stride_b) {
+    initMotionSearch();
+    return sad8_backends[sad_backend](a, stride_a, b, stride_b);
+}
+
+SADBackend getSADBackend(void) {
+    initMotionSearch();
+    return sad_backend;
+}
+
+int setSADBackend(SADBackend backend) {
+    initMotionSearch();
+    if(backend < 0 || backend >= SAD_BACKEND_COUNT || !isSADBackendSupported(backend)) {
+        return -1;
+    }
+    sad_backend = backend;
+    return 0;
+}
+
+const char* getSADBackendName(SADBackend backend) {
+    if(backend < 0 || backend >= SAD_BACKEND_COUNT) {
+        return "unknown";
+    }
+    return sad_backend_names[backend];
+}
+
+// State of one search; positions are full-pel displacements
+typedef struct SearchState {
+    const uint8_t* cur;
+    const uint8_t* ref;
+    int stride;
+    const MotionRange* range;
+    MotionVector pmv;
+    int f_code;
+    int lambda;
+    int (*sad)(const uint8_t*, int, const uint8_t*, int);
+    int best_x;
+    int best_y;
+    int best_sad;
+    int best_cost;
+} SearchState;
+
+static inline int inRange(const MotionRange* range, int x, int y) {
+    return x >= range->x_min && x <= range->x_max && y >= range->y_min && y <= range->y_max;
+}
+
+// Evaluate a displacement and keep it if it is cheaper. Returns 1 if it won.
+static int tryVector(SearchState* s, int x, int y) {
+    if(!inRange(s->range, x, y)) {
+        return 0;
+    }
+    int sad = s->sad(s->cur, s->stride, s->ref + y * s->stride + x, s->stride);
+    int cost = sad + s->lambda * (motion_bits(2 * x - s->pmv.x, s->f_code) + motion_bits(2 * y - s->pmv.y, s->f_code));
+    if(cost < s->best_cost) {
+        s->best_x = x;
+        s->best_y = y;
+        s->best_sad = sad;
+        s->best_cost = cost;
+        return 1;
+    }
+    return 0;
+}
+
+int searchMotion(const uint8_t* cur, const uint8_t* ref, int stride, const MotionRange* range,
+                 const MotionVector* candidates, int num_candidates, MotionVector pmv, int f_code, int lambda,
+                 MotionVector* best) {
+    static const int hexagon[6][2] = { { -2, 0 }, { 2, 0 }, { -1, -2 }, { 1, -2 }, { -1, 2 }, { 1, 2 } };
+    static const int diamond[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+    initMotionSearch();
+    SearchState s = {
+        .cur = cur, .ref = ref, .stride = stride, .range = range, .pmv = pmv,
+        .f_code = f_code, .lambda = lambda, .sad = sad_backends[sad_backend],
+        .best_x = 0, .best_y = 0, .best_sad = 0, .best_cost = 0x7FFFFFFF,
+    };
+    // The zero vector is always legal, so there is a valid start
+    tryVector(&s, 0, 0);
+    for(int i = 0; i < num_candidates; i++) {
+        // Candidates may carry half-pel parts; round them to full pels
+        tryVector(&s, candidates[i].x >> 1, candidates[i].y >> 1);
+    }
+
+    for(int step = 0; step < MAX_HEXAGON_STEPS; step++) {
+        int center_x = s.best_x;
+        int center_y = s.best_y;
+        for(int i = 0; i < 6; i++) {
+            tryVector(&s, center_x + hexagon[i][0], center_y + hexagon[i][1]);
+        }
+        if(s.best_x == center_x && s.best_y == center_y) {
+            break;
+        }
+    }
+    int center_x = s.best_x;
+    int center_y = s.best_y;
+    for(int i = 0; i < 4; i++) {
+        tryVector(&s, center_x + diamond[i][0], center_y + diamond[i][1]);
+    }
+
+    best->x = 2 * s.best_x;
+    best->y = 2 * s.best_y;
+    return s.best_sad;
+}
+
+int refineHalfPel(const uint8_t* cur, int stride, const HalfPelPlanes* planes, int x, int y, const MotionRange* range,
+                  MotionVector pmv, int f_code, int lambda, MotionVector* best) {
+    initMotionSearch();
+    int (*sad)(const uint8_t*, int, const uint8_t*, int) = sad_backends[sad_backend];
+    int center_x = best->x;
+    int center_y = best->y;
+    int best_sad = sad(cur, stride, halfPelBlock(planes, x, y, center_x, center_y), planes->stride);
+    int best_cost = best_sad + lambda * (motion_bits(center_x - pmv.x, f_code) + motion_bits(center_y - pmv.y, f_code));
+    for(int dy = -1; dy <= 1; dy++) {
+        for(int dx = -1; dx <= 1; dx++) {
+            int mv_x = center_x + dx;
+            int mv_y = center_y + dy;
+            // Both full-pel positions the average reads must be in range
+            if((dx == 0 && dy == 0) || (mv_x >> 1) < range->x_min || ((mv_x + 1) >> 1) > range->x_max ||
+               (mv_y >> 1) < range->y_min || ((mv_y + 1) >> 1) > range->y_max) {
+                continue;
+            }
+            int s = sad(cur, stride, halfPelBlock(planes, x, y, mv_x, mv_y), planes->stride);
+            int cost = s + lambda * (motion_bits(mv_x - pmv.x, f_code) + motion_bits(mv_y - pmv.y, f_code));
+            if(cost < best_cost) {
+                best_cost = cost;
+                best_sad = s;
+                best->x = mv_x;
+                best->y = mv_y;
+            }
+        }
+    }
+    return best_sad;
+}
+
+int initHalfPelPlanes(HalfPelPlanes* planes, int width, int height, int stride) {
+    planes->width = width;
+    planes->height = height;
+    planes->stride = stride;
+    planes->buf = (uint8_t*)malloc(3 * (size_t)stride * height);
+    if(!planes->buf) {
+        return -1;
+    }
+    planes->plane[0] = NULL;
+    for(int i = 1; i < 4; i++) {
+        planes->plane[i] = planes->buf + (i - 1) * (size_t)stride * height;
+    }
+    return 0;
+}
+
+void freeHalfPelPlanes(HalfPelPlanes* planes) {
+    free(planes->buf);
+    planes->buf = NULL;
+}
+
+void buildHalfPelRows(HalfPelPlanes* planes, int first_row, int num_rows) {
+    const uint8_t* luma = planes->plane[0];
+    initMotionSearch();
+    for(int i = first_row; i < first_row + num_rows && i < planes->height; i++) {
+        const uint8_t* row0 = luma + i * planes->stride;
+        const uint8_t* row1 = i + 1 < planes->height ? row0 + planes->stride : row0;
+        size_t offset = (size_t)i * planes->stride;
+        interpolate_backends[sad_backend](row0, row1, planes->buf + offset,
+                                          planes->buf + (size_t)planes->stride * planes->height + offset,
+                                          planes->buf + 2 * (size_t)planes->stride * planes->height + offset, 0, planes->width);
+    }
+}
+
+const uint8_t* halfPelBlock(const HalfPelPlanes* planes, int x, int y, int mv_x, int mv_y) {
+    const uint8_t* plane = planes->plane[((mv_y & 1) << 1) | (mv_x & 1)];
+    return plane + (y + (mv_y >> 1)) * planes->stride + x + (mv_x >> 1);
+}
+
+void predictBlock(uint8_t* dst, int stride_dst, const uint8_t* ref, int stride_ref, int mv_x, int mv_y, int width, int height) {
+    // Arithmetic shift: the full-pel part rounds down, the half-pel flag is the low bit
+    const uint8_t* src = ref + (mv_y >> 1) * stride_ref + (mv_x >> 1);
+    int half_x = mv_x & 1;
+    int half_y = mv_y & 1;
+    if(!half_x && !half_y) {
+        for(int i = 0; i < height; i++) {
+            memcpy(dst + i * stride_dst, src + i * stride_ref, width);
+        }
+        return;
+    }
+    initMotionSearch();
+    if(width % 8 == 0) {
+        predict_backends[sad_backend](dst, stride_dst, src, stride_ref, half_x, half_y, width, height);
+    } else {
+        predictBlockScalar(dst, stride_dst, src, stride_ref, half_x, half_y, width, height);
+    }
+}
+
+void averageBlock(uint8_t* dst, int stride_dst, const uint8_t* a, int stride_a, const uint8_t* b, int stride_b, int width, int height) {
+    initMotionSearch();
+    if(width % 8 == 0) {
+        average_backends[sad_backend](dst, stride_dst, a, stride_a, b, stride_b, width, height);
+    } else {
+        averageBlockScalar(dst, stride_dst, a, stride_a, b, stride_b, width, height);
+    }
+}
@@ -1,4 +1,6 @@
 #include "mpeg1_encoder.h"
+#include "profile.h"
+#include <pthread.h>
 #include <stdio.h>
 
 // MPEG-1 DC coefficient Huffman encoding table (12 categories)
@@ -51,92 +53,274 @@ const uint16_t ff_mpeg1_vlc_table[113][2] = {
     { 0x2, 2 }, /* EOB */
 };
 
+// motion_code VLC by |motion_code| 0..16; a sign bit follows nonzero codes
+const uint8_t mpeg1_motion_vlc[17][2] = {
+    { 0x1, 1 },  { 0x1, 2 },  { 0x1, 3 },  { 0x1, 4 },
+    { 0x3, 6 },  { 0x5, 7 },  { 0x4, 7 },  { 0x3, 7 },
+    { 0xb, 9 },  { 0xa, 9 },  { 0x9, 9 },  { 0x11, 10 },
+    { 0x10, 10 }, { 0xf, 10 }, { 0xe, 10 }, { 0xd, 10 },
+    { 0xc, 10 },
+};
+
+// macroblock_address_increment VLC by increment 1..33
+const uint8_t mpeg1_address_increment_vlc[34][2] = {
+    { 0x0, 0 },
+    { 0x1, 1 },  { 0x3, 3 },  { 0x2, 3 },  { 0x3, 4 },  { 0x2, 4 },  { 0x3, 5 },  { 0x2, 5 },  { 0x7, 7 },
+    { 0x6, 7 },  { 0xb, 8 },  { 0xa, 8 },  { 0x9, 8 },  { 0x8, 8 },  { 0x7, 8 },  { 0x6, 8 },  { 0x17, 10 },
+    { 0x16, 10 }, { 0x15, 10 }, { 0x14, 10 }, { 0x13, 10 }, { 0x12, 10 }, { 0x23, 11 }, { 0x22, 11 }, { 0x21, 11 },
+    { 0x20, 11 }, { 0x1f, 11 }, { 0x1e, 11 }, { 0x1d, 11 }, { 0x1c, 11 }, { 0x1b, 11 }, { 0x1a, 11 }, { 0x19, 11 },
+    { 0x18, 11 },
+};
+
+// coded_block_pattern VLC by pattern 1..63 (0 cannot be coded in MPEG-1)
+const uint8_t mpeg1_cbp_vlc[64][2] = {
+    { 0x0, 0 },  { 0xb, 5 },  { 0x9, 5 },  { 0xd, 6 },  { 0xd, 4 },  { 0x17, 7 }, { 0x13, 7 }, { 0x1f, 8 },
+    { 0xc, 4 },  { 0x16, 7 }, { 0x12, 7 }, { 0x1e, 8 }, { 0x13, 5 }, { 0x1b, 8 }, { 0x17, 8 }, { 0x13, 8 },
+    { 0xb, 4 },  { 0x15, 7 }, { 0x11, 7 }, { 0x1d, 8 }, { 0x11, 5 }, { 0x19, 8 }, { 0x15, 8 }, { 0x11, 8 },
+    { 0xf, 6 },  { 0xf, 8 },  { 0xd, 8 },  { 0x3, 9 },  { 0xf, 5 },  { 0xb, 8 },  { 0x7, 8 },  { 0x7, 9 },
+    { 0xa, 4 },  { 0x14, 7 }, { 0x10, 7 }, { 0x1c, 8 }, { 0xe, 6 },  { 0xe, 8 },  { 0xc, 8 },  { 0x2, 9 },
+    { 0x10, 5 }, { 0x18, 8 }, { 0x14, 8 }, { 0x10, 8 }, { 0xe, 5 },  { 0xa, 8 },  { 0x6, 8 },  { 0x6, 9 },
+    { 0x12, 5 }, { 0x1a, 8 }, { 0x16, 8 }, { 0x12, 8 }, { 0xd, 5 },  { 0x9, 8 },  { 0x5, 8 },  { 0x5, 9 },
+    { 0xc, 5 },  { 0x8, 8 },  { 0x4, 8 },  { 0x4, 9 },  { 0x7, 3 },  { 0xa, 5 },  { 0x8, 5 },  { 0xc, 6 },
+};
+
+// Run and level of each entry of ff_mpeg1_vlc_table
+static const int8_t mpeg1_run[111] = {
+     0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,
+     1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  2,  2,  2,  2,  2,  3,
+     3,  3,  3,  4,  4,  4,  5,  5,
+     5,  6,  6,  6,  7,  7,  8,  8,
+     9,  9, 10, 10, 11, 11, 12, 12,
+    13, 13, 14, 14, 15, 15, 16, 16,
+    17, 18, 19, 20, 21, 22, 23, 24,
+    25, 26, 27, 28, 29, 30, 31,
+};
+
+static const int8_t mpeg1_level[111] = {
+     1,  2,  3,  4,  5,  6,  7,  8,
+     9, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23, 24,
+    25, 26, 27, 28, 29, 30, 31, 32,
+    33, 34, 35, 36, 37, 38, 39, 40,
+     1,  2,  3,  4,  5,  6,  7,  8,
+     9, 10, 11, 12, 13, 14, 15, 16,
+    17, 18,  1,  2,  3,  4,  5,  1,
+     2,  3,  4,  1,  2,  3,  1,  2,
+     3,  1,  2,  3,  1,  2,  1,  2,
+     1,  2,  1,  2,  1,  2,  1,  2,
+     1,  2,  1,  2,  1,  2,  1,  2,
+     1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,
+};
+
+// Final code of every (run, level) pair, see AC_VLC_INDEX
+static uint32_t ac_vlc_table[AC_VLC_RUNS * AC_VLC_LEVELS];
+static pthread_once_t ac_vlc_once = PTHREAD_ONCE_INIT;
+
 // Zigzag scan table
 const int zigzag_scan[64] = {
     0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
     12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
-    35, 42, 49, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 52, 45, 38,
-    31, 39, 46, 53, 54, 47, 55, 56, 57, 58, 59, 60, 61, 62, 63
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
 };
 
+// Escape sequence: escape code, 6-bit run, then an 8-bit level or, for
+// |level| >= 128, a 16-bit level
+static uint32_t escapeCode(int run, int level, int* bits) {
+    uint32_t code = (ff_mpeg1_vlc_table[AC_VLC_ESCAPE][0] << 6) | run;
+    if(level > -128 && level < 128) {
+        *bits = 6 + 6 + 8;
+        return (code << 8) | (level & 0xFF);
+    }
+    *bits = 6 + 6 + 16;
+    return (code << 16) | (level < 0 ? 0x8000 : 0x0000) | (level & 0xFF);
+}
+
+static void buildAcVlcTable(void) {
+    for(int run = 0; run < AC_VLC_RUNS; run++) {
+        for(int level = -AC_VLC_MAX_LEVEL; level <= AC_VLC_MAX_LEVEL; level++) {
+            int bits = 0;
+            uint32_t code = level ? escapeCode(run, level, &bits) : 0;
+            ac_vlc_table[AC_VLC_INDEX(run, level)] = (code << 8) | bits;
+        }
+    }
+    // Entries with a variable length code, followed by the sign bit
+    for(int i = 0; i < AC_VLC_ESCAPE; i++) {
+        uint32_t code = ff_mpeg1_vlc_table[i][0];
+        int bits = ff_mpeg1_vlc_table[i][1] + 1;
+        ac_vlc_table[AC_VLC_INDEX(mpeg1_run[i], mpeg1_level[i])] = ((code << 1) << 8) | bits;
+        ac_vlc_table[AC_VLC_INDEX(mpeg1_run[i], -mpeg1_level[i])] = (((code << 1) | 1) << 8) | bits;
+    }
+}
+
+void initAcVlcTable(void) {
+    pthread_once(&ac_vlc_once, buildAcVlcTable);
+}
+
 // Helper function to encode the DC coefficient with differential encoding
 void encode_dc(int dc_val, int prev_dc_val, const uint16_t* code_table, const unsigned char* bit_table, int* code, int* bits) {
     // Compute the difference (delta) between the current and previous DC value
     int diff_dc = dc_val - prev_dc_val;
 
-    // Determine the category of the difference value (absolute value)
-    int category = diff_dc < 0 ? -diff_dc : diff_dc;  // Absolute value for category
-    if (category > 11) category = 11;  // Limit to the max category (12 categories)
+    // dct_dc_size is the number of bits of |diff|
+    int magnitude = diff_dc < 0 ? -diff_dc : diff_dc;
+    int size = 0;
+    while(magnitude >> size) {
+        size++;
+    }
 
-    // Encode the difference using Huffman code based on category
-    *code = code_table[category];
-    *bits = bit_table[category];
+    // Size code followed by `size` bits; negative values are sent as diff - 1
+    int extra = diff_dc < 0 ? diff_dc + (1 << size) - 1 : diff_dc;
+    *code = (code_table[size] << size) | extra;
+    *bits = bit_table[size] + size;
 }
 
-// Helper function to get the AC coefficient Huffman code and bits
-void encode_ac(int ac_val, int* code, int* bits) {
-    if (ac_val == 0) {
-        *code = 0x00;  // EOB (End of Block)
-        *bits = 1;
+// Helper function to get the AC coefficient code (sign bit or escape included) and bits
+void encode_ac(int run, int level, uint32_t* code, int* bits) {
+    if(level >= -AC_VLC_MAX_LEVEL && level <= AC_VLC_MAX_LEVEL) {
+        uint32_t entry = ac_vlc_table[AC_VLC_INDEX(run, level)];
+        *code = entry >> 8;
+        *bits = entry & 0xFF;
     } else {
-        if (ac_val < 0 || ac_val > 113) {
-            *code = 0x00;  // Handle out-of-range AC values
-            *bits = 1;
-        } else { // maybe we only need this
-            *code = ff_mpeg1_vlc_table[ac_val][0];
-            *bits = ff_mpeg1_vlc_table[ac_val][1];
-        }
+        *code = escapeCode(run, level, bits);
+    }
+    // Codes of the table are at most 17 bits long, escapes at least 20
+    if(*bits > 17) {
+        profileCount(PROFILE_ESCAPES, 1);
     }
 }
 
-// Function to encode the 8x8 matrix with Zigzag scan order and write to the buffer
-int encode_mpeg1(uint8_t* buffer, int matrix[64], int prev_dc, const uint16_t* huff_code, const unsigned char* huff_bits) {
-    int pos_bit = 0;
+// Function to encode the 8x8 matrix with Zigzag scan order and write to the bit writer
+// last: zigzag index of the last nonzero coefficient (63 if unknown)
+int encode_mpeg1(BitWriter* bw, int matrix[64], int last, int prev_dc, const uint16_t* huff_code, const unsigned char* huff_bits) {
+    size_t start_bit = bitWriterTell(bw);
     int dc_code, dc_bits;
-    int ac_code, ac_bits;
+    uint32_t ac_code;
+    int ac_bits;
     int run_length = 0;  // RLE counter
 
+    initAcVlcTable();
+    profileCount(PROFILE_BLOCKS, 1);
+
     // Encode the DC coefficient with differential encoding
     encode_dc(matrix[zigzag_scan[0]], prev_dc, huff_code, huff_bits, &dc_code, &dc_bits);
-    for (int i = dc_bits - 1; i >= 0; i--) {
-        buffer[pos_bit / 8] |= ((dc_code >> i) & 1) << (7 - (pos_bit % 8));
-        (pos_bit)++;
-    }
+    putBits(bw, dc_code, dc_bits);
 
     // Encode AC coefficients (run-length encoding)
-    for(int i = 1; i < 64; i++) {
+    for(int i = 1; i <= last; i++) {
         int ac_val = matrix[zigzag_scan[i]];
-        encode_ac(ac_val, &ac_code, &ac_bits);
-        
-        if (ac_val == 0) {
+        if(ac_val == 0) {
             run_length++;
+            continue;
+        }
+        encode_ac(run_length, ac_val, &ac_code, &ac_bits);
+        putBits(bw, ac_code, ac_bits);
+        run_length = 0;  // Reset RLE counter
+    }
+
+    putBits(bw, ff_mpeg1_vlc_table[AC_VLC_EOB][0], ff_mpeg1_vlc_table[AC_VLC_EOB][1]);
+
+    // Return total number of bits written
+    return (int)(bitWriterTell(bw) - start_bit);
+}
+
+
+int encode_mpeg1_y(BitWriter* bw, int matrix[64], int last, int prev_dc) {
+    return encode_mpeg1(bw, matrix, last, prev_dc, ff_mpeg12_vlc_dc_lum_code, ff_mpeg12_vlc_dc_lum_bits);
+}
+
+int encode_mpeg1_c(BitWriter* bw, int matrix[64], int last, int prev_dc) {
+    return encode_mpeg1(bw, matrix, last, prev_dc, ff_mpeg12_vlc_dc_chroma_code, ff_mpeg12_vlc_dc_chroma_bits);
+}
+
+// Non-intra blocks have no separate DC: every coefficient is a (run, level)
+// pair, and the first one uses the short code '1s' for (0, +-1) because EOB
+// cannot occur there
+int encode_mpeg1_inter(BitWriter* bw, int matrix[64], int last) {
+    size_t start_bit = bitWriterTell(bw);
+    uint32_t ac_code;
+    int ac_bits;
+    int run_length = 0;
+
+    initAcVlcTable();
+    profileCount(PROFILE_BLOCKS, 1);
+
+    for(int i = 0; i <= last; i++) {
+        int ac_val = matrix[zigzag_scan[i]];
+        if(ac_val == 0) {
+            run_length++;
+            continue;
+        }
+        if(i == 0 && (ac_val == 1 || ac_val == -1)) {
+            putBits(bw, ac_val < 0 ? 0x3 : 0x2, 2);
         } else {
-            if (run_length > 15) {
-                // Handle large run-length (escaping sequence)
-                for(int j = 8 - 1; j >= 0; j--) {
-                    buffer[pos_bit / 8] |= ((0xF0 >> j) & 1) << (7 - (pos_bit % 8));
-                    (pos_bit)++;
-                }
-                run_length -=16;
-            }
-            
-            for(int j = ac_bits - 1; j >= 0; j--) {
-                buffer[pos_bit / 8] |= ((ac_code >> i) & 1) << (7 - (pos_bit % 8));
-                (pos_bit)++;
-            }
-            run_length = 0;  // Reset RLE counter
+            encode_ac(run_length, ac_val, &ac_code, &ac_bits);
+            putBits(bw, ac_code, ac_bits);
         }
+        run_length = 0;
     }
 
-    // Return total number of bytes written to the buffer
-    return (pos_bit + 7) / 8;  // Round up to full bytes
+    putBits(bw, ff_mpeg1_vlc_table[AC_VLC_EOB][0], ff_mpeg1_vlc_table[AC_VLC_EOB][1]);
+    return (int)(bitWriterTell(bw) - start_bit);
 }
 
+// Split a motion vector difference into motion_code and motion_r. The
+// difference wraps around modulo 32 * f, the range of the f_code.
+static int motionCode(int delta, int f_code, int* residual) {
+    int r_size = f_code - 1;
+    int f = 1 << r_size;
+    if(delta < -16 * f) {
+        delta += 32 * f;
+    } else if(delta > 16 * f - 1) {
+        delta -= 32 * f;
+    }
+    *residual = 0;
+    if(delta == 0) {
+        return 0;
+    }
+    int magnitude = (delta < 0 ? -delta : delta) - 1;
+    *residual = magnitude & (f - 1);
+    int code = (magnitude >> r_size) + 1;
+    return delta < 0 ? -code : code;
+}
 
-int encode_mpeg1_y(uint8_t* buffer, int matrix[64], int prev_dc) {
-    return encode_mpeg1(buffer, matrix, prev_dc, ff_mpeg12_vlc_dc_lum_code, ff_mpeg12_vlc_dc_lum_bits);
+int encode_motion(BitWriter* bw, int delta, int f_code) {
+    int residual;
+    int code = motionCode(delta, f_code, &residual);
+    int magnitude = code < 0 ? -code : code;
+    putBits(bw, mpeg1_motion_vlc[magnitude][0], mpeg1_motion_vlc[magnitude][1]);
+    if(code == 0) {
+        return mpeg1_motion_vlc[0][1];
+    }
+    putBits(bw, code < 0, 1);
+    putBits(bw, residual, f_code - 1);
+    return mpeg1_motion_vlc[magnitude][1] + f_code;
 }
 
-int encode_mpeg1_c(uint8_t* buffer, int matrix[64], int prev_dc) {
-    return encode_mpeg1(buffer, matrix, prev_dc, ff_mpeg12_vlc_dc_chroma_code, ff_mpeg12_vlc_dc_chroma_bits);
-}
\ No newline at end of file
+int motion_bits(int delta, int f_code) {
+    int residual;
+    int code = motionCode(delta, f_code, &residual);
+    return code == 0 ? mpeg1_motion_vlc[0][1] : mpeg1_motion_vlc[code < 0 ? -code : code][1] + f_code;
+}
+
+int encode_address_increment(BitWriter* bw, int increment) {
+    int bits = 0;
+    while(increment > 33) {
+        putBits(bw, MB_ADDRESS_ESCAPE_CODE, MB_ADDRESS_ESCAPE_BITS);
+        bits += MB_ADDRESS_ESCAPE_BITS;
+        increment -= 33;
+    }
+    putBits(bw, mpeg1_address_increment_vlc[increment][0], mpeg1_address_increment_vlc[increment][1]);
+    return bits + mpeg1_address_increment_vlc[increment][1];
+}
+
+void encode_cbp(BitWriter* bw, int cbp) {
+    putBits(bw, mpeg1_cbp_vlc[cbp][0], mpeg1_cbp_vlc[cbp][1]);
+}
@@ -0,0 +1,261 @@
+#include <string.h>
+
+#include "createMLV.h"
+#include "mux.h"
+
+#define START_CODE_PICTURE 0x00
+#define START_CODE_SLICE_FIRST 0x01
+#define START_CODE_SLICE_LAST 0xAF
+#define START_CODE_SEQUENCE 0xB3
+#define START_CODE_GOP 0xB8
+#define START_CODE_END 0xB9
+
+// Exact frame rate of each frame_rate_code as num / den; 0 is taken as 30
+static const uint32_t rate_num[9] = { 30, 24000, 24, 25, 30000, 30, 50, 60000, 60 };
+static const uint32_t rate_den[9] = { 1, 1001, 1, 1, 1001, 1, 1, 1001, 1 };
+
+// Largest mux_rate, in bits/s
+#define MAX_MUX_RATE (0x3FFFFF * 400)
+
+static int rateIndex(const Muxer* mux) {
+    return mux->frame_rate_code < 9 ? mux->frame_rate_code : 0;
+}
+
+// 90 kHz ticks of `pictures` frame periods
+static uint64_t pictureTicks(const Muxer* mux, long pictures) {
+    return (uint64_t)pictures * 90000 * rate_den[rateIndex(mux)] / rate_num[rateIndex(mux)];
+}
+
+// The sink is open, the rest of `mux` zero
+static void startMuxer(Muxer* mux, int raw) {
+    mux->raw = raw;
+    mux->code = -1;
+    mux->std_buffer_size = STD_BUFFER_SIZE_MAX;
+    mux->data_dts = MUX_DELAY;
+}
+
+int openMuxer(Muxer* mux, const char* filename, int raw) {
+    memset(mux, 0, sizeof(Muxer));
+    if(!filename) {
+        openMemorySink(&mux->sink);
+    } else if(openFileSink(&mux->sink, filename) != 0) {
+        return -1;
+    }
+    startMuxer(mux, raw);
+    return 0;
+}
+
+int openCallbackMuxer(Muxer* mux, SinkCallback callback, void* opaque, int raw) {
+    memset(mux, 0, sizeof(Muxer));
+    if(openCallbackSink(&mux->sink, callback, opaque) != 0) {
+        return -1;
+    }
+    startMuxer(mux, raw);
+    return 0;
+}
+
+// A picture whose headers started at header_start enters the STD buffer
+// model. If it is full, the oldest picture must be decoded before the
+// next pack.
+static void bufferPicture(Muxer* mux, uint64_t dts) {
+    if(mux->num_buffered == MUX_MAX_BUFFERED) {
+        mux->decoded_dts = mux->buffered[0].dts;
+        mux->num_buffered--;
+        memmove(mux->buffered, mux->buffered + 1, mux->num_buffered * sizeof(MuxBuffered));
+    }
+    mux->buffered[mux->num_buffered].start = mux->header_start;
+    mux->buffered[mux->num_buffered].dts = dts;
+    mux->num_buffered++;
+    mux->header_open = 0;
+}
+
+// The fields after a start code are complete
+static void parseFields(Muxer* mux) {
+    const uint8_t* f = mux->fields;
+    if(mux->code == START_CODE_SEQUENCE && mux->rate_bound == 0) {
+        // Any coded stream stays below the rate of the raw 4:2:0 pictures
+        mux->frame_rate_code = f[3] & 0x0F;
+        uint64_t width = (uint32_t)f[0] << 4 | f[1] >> 4;
+        uint64_t height = (uint32_t)(f[1] & 0x0F) << 8 | f[2];
+        uint64_t rate = width * height * 12 * rate_num[rateIndex(mux)] / rate_den[rateIndex(mux)];
+        mux->rate_bound = rate < MAX_MUX_RATE ? (int)rate : MAX_MUX_RATE;
+        // The STD buffer takes a pack on top of a full VBV buffer
+        int vbv_buffer_size = (f[6] & 0x1F) << 5 | f[7] >> 3;
+        int size = vbv_buffer_size * 2048 + MUX_PACK_SIZE;
+        mux->std_buffer_size = size < STD_BUFFER_SIZE_MAX ? size : STD_BUFFER_SIZE_MAX;
+    } else if(mux->code == START_CODE_PICTURE) {
+        // Anchors are shown one picture later than they are decoded, B
+        // pictures right away
+        long display = mux->gop_first + (f[0] << 2 | f[1] >> 6);
+        if(mux->num_pictures < MUX_MAX_PICTURES) {
+            MuxPicture* picture = &mux->pictures[mux->num_pictures++];
+            picture->offset = mux->code_offset;
+            picture->dts = MUX_DELAY + pictureTicks(mux, mux->coded);
+            picture->pts = MUX_DELAY + pictureTicks(mux, display + 1);
+        }
+        bufferPicture(mux, MUX_DELAY + pictureTicks(mux, mux->coded));
+        mux->coded++;
+    }
+    mux->code = -1;
+}
+
+// Follow the start codes of window[from, to)
+static void parseStartCodes(Muxer* mux, int from, int to) {
+    for(int i = from; i < to; i++) {
+        uint8_t c = mux->window[i];
+        if(mux->num_fields < mux->need_fields) {
+            mux->fields[mux->num_fields++] = c;
+            if(mux->num_fields == mux->need_fields) {
+                parseFields(mux);
+            }
+        } else if(mux->prefix == 0x000001) {
+            mux->code = c;
+            mux->code_offset = i - 3;
+            mux->num_fields = 0;
+            mux->need_fields = c == START_CODE_PICTURE ? 2 : (c == START_CODE_SEQUENCE ? 8 : 0);
+            // Sequence and GOP headers leave the STD buffer with the
+            // picture after them, slices with the one before
+            if(!mux->header_open && (c < START_CODE_SLICE_FIRST || c > START_CODE_SLICE_LAST)) {
+                mux->header_open = 1;
+                mux->header_start = (uint64_t)((int64_t)mux->position + mux->code_offset);
+            }
+            if(c == START_CODE_GOP) {
+                // GOPs hold whole pictures, so the ones before it come first
+                mux->gop_first = mux->coded;
+            }
+        }
+        mux->prefix = (mux->prefix << 8 | c) & 0xFFFFFF;
+    }
+}
+
+// Decoding time by which the STD buffer has room for the stream up to
+// `end`: every picture that starts more than the buffer size before it
+// must be gone
+static uint64_t roomDts(const Muxer* mux, uint64_t end) {
+    uint64_t dts = mux->decoded_dts;
+    for(int i = 0; i < mux->num_buffered && mux->buffered[i].start + mux->std_buffer_size < end; i++) {
+        dts = mux->buffered[i].dts > dts ? mux->buffered[i].dts : dts;
+    }
+    return dts;
+}
+
+// MUX_RATE_MARGIN times the rate of the stream up to `end` over the
+// pictures it has reached, within the bound of the sequence header
+static int measureRate(const Muxer* mux, uint64_t end) {
+    uint64_t ticks = mux->data_dts + pictureTicks(mux, 1) - MUX_DELAY;
+    uint64_t rate = end * 8 * 90000 * MUX_RATE_MARGIN / ticks;
+    int bound = mux->rate_bound ? mux->rate_bound : MAX_MUX_RATE;
+    return rate < (uint64_t)bound ? (int)rate : bound;
+}
+
+// Write the start of the window as one pack
+static int writePack(Muxer* mux) {
+    int first = mux->packs == 0;
+    int room = MUX_PACK_SIZE - PACK_HEADER_BYTES - (first ? SYSTEM_HEADER_BYTES : 0);
+
+    // The time stamps belong to the first picture that starts in the packet
+    MuxPicture* picture = mux->num_pictures > 0 ? &mux->pictures[0] : NULL;
+    uint64_t pts = TIME_STAMP_NONE;
+    uint64_t dts = TIME_STAMP_NONE;
+    if(picture && picture->offset < room - packetHeaderSize(first, picture->pts, picture->dts)) {
+        pts = picture->pts;
+        dts = picture->dts;
+    }
+    int len = room - packetHeaderSize(first, pts, dts);
+    len = len < mux->fill ? len : mux->fill;
+
+    // Data arrives at the mux_rate of the last pack, no more than MUX_DELAY
+    // ahead of decoding, and once there is room for it in the STD buffer
+    uint64_t scr = 0;
+    if(!first) {
+        uint64_t byte_rate = (uint64_t)(mux->mux_rate + 399) / 400 * 50;
+        scr = mux->scr + ((uint64_t)mux->pack_bytes * 90000 + byte_rate - 1) / byte_rate;
+    }
+    if(mux->data_dts > scr + MUX_DELAY) {
+        scr = mux->data_dts - MUX_DELAY;
+    }
+    uint64_t room_dts = roomDts(mux, mux->position + len);
+    scr = scr > room_dts ? scr : room_dts;
+    int mux_rate = measureRate(mux, mux->position + len);
+    int rate_bound = mux->rate_bound ? mux->rate_bound : MAX_MUX_RATE;
+
+    uint8_t header[PACK_HEADER_BYTES + SYSTEM_HEADER_BYTES + 32];
+    BitWriter bw;
+    initBitWriter(&bw, header, sizeof(header));
+    writePackHeader(&bw, scr, mux_rate);
+    if(first) {
+        writeSystemHeader(&bw, LEN_SYS_HEADER, rate_bound, mux->std_buffer_size);
+    }
+    writePacket(&bw, len, first, pts, dts, mux->std_buffer_size);
+    long len_header = finishBitWriter(&bw);
+    if(sinkWrite(&mux->sink, header, len_header) != 0 || sinkWrite(&mux->sink, mux->window, len) != 0) {
+        return -1;
+    }
+    mux->scr = scr;
+    mux->mux_rate = mux_rate;
+    mux->pack_bytes = (int)len_header + len;
+    mux->packs++;
+    mux->position += len;
+
+    // Pictures decoded by now have left the STD buffer
+    int decoded = 0;
+    while(decoded < mux->num_buffered && mux->buffered[decoded].dts <= scr) {
+        decoded++;
+    }
+    mux->num_buffered -= decoded;
+    memmove(mux->buffered, mux->buffered + decoded, mux->num_buffered * sizeof(MuxBuffered));
+
+    // Drop the data written and the pictures that started in it
+    int written = 0;
+    while(written < mux->num_pictures && mux->pictures[written].offset < len) {
+        mux->data_dts = mux->pictures[written].dts;
+        written++;
+    }
+    mux->num_pictures -= written;
+    memmove(mux->pictures, mux->pictures + written, mux->num_pictures * sizeof(MuxPicture));
+    for(int i = 0; i < mux->num_pictures; i++) {
+        mux->pictures[i].offset -= len;
+    }
+    mux->code_offset -= len;
+    mux->fill -= len;
+    memmove(mux->window, mux->window + len, mux->fill);
+    return 0;
+}
+
+int muxWrite(Muxer* mux, const uint8_t* data, size_t len) {
+    if(mux->raw) {
+        return sinkWrite(&mux->sink, data, len);
+    }
+    while(len > 0) {
+        size_t n = sizeof(mux->window) - mux->fill;
+        n = n < len ? n : len;
+        memcpy(mux->window + mux->fill, data, n);
+        parseStartCodes(mux, mux->fill, mux->fill + (int)n);
+        mux->fill += (int)n;
+        data += n;
+        len -= n;
+        // A full window has a whole packet of data plus MUX_LOOKAHEAD
+        // bytes, enough to finish any start code in the packet
+        if(mux->fill == sizeof(mux->window) && writePack(mux) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int closeMuxer(Muxer* mux) {
+    int ret = 0;
+    if(!mux->raw) {
+        while(mux->fill > 0 && ret == 0) {
+            ret = writePack(mux);
+        }
+        const uint8_t end_code[4] = { 0x00, 0x00, 0x01, START_CODE_END };
+        if(ret == 0) {
+            ret = sinkWrite(&mux->sink, end_code, sizeof(end_code));
+        }
+    }
+    if(closeSink(&mux->sink) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
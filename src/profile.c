@@ -0,0 +1,214 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "profile.h"
+
+typedef struct ProfileEvent {
+    uint64_t start;     // ns since enableProfile
+    uint64_t end;
+    int stage;
+} ProfileEvent;
+
+// Totals of one thread, written only by that thread
+typedef struct ProfileThread {
+    int id;
+    uint64_t time[PROFILE_STAGE_COUNT];     // ns
+    uint64_t calls[PROFILE_STAGE_COUNT];
+    uint64_t counters[PROFILE_COUNTER_COUNT];
+    ProfileEvent* events;
+    size_t num_events;
+    size_t capacity;
+    struct ProfileThread* next;
+} ProfileThread;
+
+static const char* const stage_names[PROFILE_STAGE_COUNT] = {
+    "decode", "color", "picture", "slice", "motion", "dct", "quant", "vlc", "mux", "write",
+};
+
+static const char* const counter_names[PROFILE_COUNTER_COUNT] = {
+    "blocks", "zero blocks", "bits", "escapes",
+};
+
+int profile_enabled = 0;
+static int profile_trace = 0;
+static uint64_t profile_origin = 0;
+
+// Threads register once and stay listed, so totals survive their exit
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static ProfileThread* profile_threads = NULL;
+static int num_profile_threads = 0;
+static __thread ProfileThread* profile_self = NULL;
+
+uint64_t profileNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static ProfileThread* profileThread(void) {
+    if(!profile_self) {
+        ProfileThread* thread = (ProfileThread*)calloc(1, sizeof(ProfileThread));
+        if(!thread) {
+            return NULL;
+        }
+        pthread_mutex_lock(&profile_lock);
+        thread->id = num_profile_threads++;
+        thread->next = profile_threads;
+        profile_threads = thread;
+        pthread_mutex_unlock(&profile_lock);
+        profile_self = thread;
+    }
+    return profile_self;
+}
+
+void enableProfile(int trace) {
+    if(!profile_enabled) {
+        profile_origin = profileNow();
+    }
+    profile_trace = trace;
+    profile_enabled = 1;
+}
+
+void resetProfile(void) {
+    profile_enabled = 0;
+    pthread_mutex_lock(&profile_lock);
+    for(ProfileThread* thread = profile_threads; thread; thread = thread->next) {
+        memset(thread->time, 0, sizeof(thread->time));
+        memset(thread->calls, 0, sizeof(thread->calls));
+        memset(thread->counters, 0, sizeof(thread->counters));
+        thread->num_events = 0;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void profileRecord(ProfileStage stage, uint64_t start, int event) {
+    uint64_t end = profileNow();
+    ProfileThread* thread = profileThread();
+    // A scope that began before profiling did has no start
+    if(!thread || start == 0) {
+        return;
+    }
+    thread->time[stage] += end - start;
+    thread->calls[stage]++;
+    if(!event || !profile_trace) {
+        return;
+    }
+    if(thread->num_events == thread->capacity) {
+        size_t capacity = thread->capacity ? 2 * thread->capacity : 1024;
+        ProfileEvent* events = (ProfileEvent*)realloc(thread->events, capacity * sizeof(ProfileEvent));
+        if(!events) {
+            return;
+        }
+        thread->events = events;
+        thread->capacity = capacity;
+    }
+    ProfileEvent* e = &thread->events[thread->num_events++];
+    e->start = start - profile_origin;
+    e->end = end - profile_origin;
+    e->stage = stage;
+}
+
+void profileAdd(ProfileCounter counter, uint64_t n) {
+    ProfileThread* thread = profileThread();
+    if(thread) {
+        thread->counters[counter] += n;
+    }
+}
+
+uint64_t profileStageTime(ProfileStage stage) {
+    uint64_t time = 0;
+    pthread_mutex_lock(&profile_lock);
+    for(ProfileThread* thread = profile_threads; thread; thread = thread->next) {
+        time += thread->time[stage];
+    }
+    pthread_mutex_unlock(&profile_lock);
+    return time;
+}
+
+uint64_t profileCounterTotal(ProfileCounter counter) {
+    uint64_t total = 0;
+    pthread_mutex_lock(&profile_lock);
+    for(ProfileThread* thread = profile_threads; thread; thread = thread->next) {
+        total += thread->counters[counter];
+    }
+    pthread_mutex_unlock(&profile_lock);
+    return total;
+}
+
+const char* profileStageName(ProfileStage stage) {
+    return stage_names[stage];
+}
+
+void printProfileSummary(FILE* file) {
+    uint64_t time[PROFILE_STAGE_COUNT] = { 0 };
+    uint64_t calls[PROFILE_STAGE_COUNT] = { 0 };
+    uint64_t counters[PROFILE_COUNTER_COUNT] = { 0 };
+    pthread_mutex_lock(&profile_lock);
+    for(ProfileThread* thread = profile_threads; thread; thread = thread->next) {
+        for(int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+            time[s] += thread->time[s];
+            calls[s] += thread->calls[s];
+        }
+    }
+
+    // Stages nest, so their times overlap
+    fprintf(file, "%-8s %10s %12s %10s\n", "stage", "calls", "total ms", "avg us");
+    for(int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+        if(calls[s] == 0) {
+            continue;
+        }
+        fprintf(file, "%-8s %10llu %12.1f %10.2f\n", stage_names[s], (unsigned long long)calls[s],
+                time[s] / 1e6, time[s] / 1e3 / calls[s]);
+    }
+
+    fprintf(file, "\n%-8s", "thread");
+    for(int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+        fprintf(file, " %12s", counter_names[c]);
+    }
+    fprintf(file, "\n");
+    for(int id = 0; id < num_profile_threads; id++) {
+        for(ProfileThread* thread = profile_threads; thread; thread = thread->next) {
+            if(thread->id != id) {
+                continue;
+            }
+            fprintf(file, "%-8d", id);
+            for(int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+                fprintf(file, " %12llu", (unsigned long long)thread->counters[c]);
+                counters[c] += thread->counters[c];
+            }
+            fprintf(file, "\n");
+        }
+    }
+    fprintf(file, "%-8s", "total");
+    for(int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+        fprintf(file, " %12llu", (unsigned long long)counters[c]);
+    }
+    fprintf(file, "\n");
+    pthread_mutex_unlock(&profile_lock);
+}
+
+int writeProfileTrace(const char* filename) {
+    FILE* file = fopen(filename, "w");
+    if(!file) {
+        fprintf(stderr, "Error creating trace file %s!\n", filename);
+        return -1;
+    }
+    int pid = (int)getpid();
+    int first = 1;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    pthread_mutex_lock(&profile_lock);
+    for(ProfileThread* thread = profile_threads; thread; thread = thread->next) {
+        for(size_t i = 0; i < thread->num_events; i++) {
+            const ProfileEvent* e = &thread->events[i];
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",\n", stage_names[e->stage], pid, thread->id, e->start / 1e3, (e->end - e->start) / 1e3);
+            first = 0;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0 ? 0 : -1;
+}
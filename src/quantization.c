@@ -1,15 +1,22 @@
 #include "quantization.h"
+#include "mpeg1_encoder.h"
+#include "profile.h"
 
-const unsigned char quantization_table_y[BLOCKSIZE * BLOCKSIZE] = {
-    8, 16, 19, 22, 26, 27, 29, 34,
-    16, 16, 22, 24, 27, 29, 34, 37,
-    19, 22, 26, 27, 29, 34, 34, 38,
-    22, 22, 26, 27, 29, 34, 37, 40,
-    22, 26, 27, 29, 32, 35, 40, 48,
-    26, 27, 29, 32, 35, 40, 48, 58,
-    26, 27, 29, 34, 38, 46, 56, 69,
-    27, 29, 35, 38, 46, 56, 69, 83
-};
+// The intra matrix is written as an X-macro so that the reciprocal table
+// below is derived from it at compile time. X(s, w) is expanded once per entry.
+#define QUANT_MATRIX_Y(X, s) \
+    X(s,  8) X(s, 16) X(s, 19) X(s, 22) X(s, 26) X(s, 27) X(s, 29) X(s, 34) \
+    X(s, 16) X(s, 16) X(s, 22) X(s, 24) X(s, 27) X(s, 29) X(s, 34) X(s, 37) \
+    X(s, 19) X(s, 22) X(s, 26) X(s, 27) X(s, 29) X(s, 34) X(s, 34) X(s, 38) \
+    X(s, 22) X(s, 22) X(s, 26) X(s, 27) X(s, 29) X(s, 34) X(s, 37) X(s, 40) \
+    X(s, 22) X(s, 26) X(s, 27) X(s, 29) X(s, 32) X(s, 35) X(s, 40) X(s, 48) \
+    X(s, 26) X(s, 27) X(s, 29) X(s, 32) X(s, 35) X(s, 40) X(s, 48) X(s, 58) \
+    X(s, 26) X(s, 27) X(s, 29) X(s, 34) X(s, 38) X(s, 46) X(s, 56) X(s, 69) \
+    X(s, 27) X(s, 29) X(s, 35) X(s, 38) X(s, 46) X(s, 56) X(s, 69) X(s, 83)
+
+#define MATRIX_ENTRY(s, w) w,
+
+const unsigned char quantization_table_y[BLOCKSIZE * BLOCKSIZE] = { QUANT_MATRIX_Y(MATRIX_ENTRY, 0) };
 /*{
     16, 11, 10, 16, 24, 40, 51, 61,
     12, 12, 14, 19, 26, 58, 60, 55,
@@ -42,6 +49,35 @@ const unsigned char quantization_table_c[BLOCKSIZE * BLOCKSIZE] = {
     99, 99, 99, 99, 99, 99, 99, 99
 };*/
 
+// ceil(2^(QUANT_RECIP_BITS + 3) / (scale * w)), so that
+// (|F| * recip) >> QUANT_RECIP_BITS == 8 * |F| / (scale * w). Rounding the
+// reciprocal up makes exact .5 ties round up like round() does, and with 24
+// fraction bits the error stays below one step for any |F| < 3260.
+// Scale 0 is not a legal quantizer_scale and maps to 0.
+#define QUANT_RECIP(d) ((d) ? (uint32_t)((((uint64_t)1 << (QUANT_RECIP_BITS + 3)) + (d) - 1) / ((d) ? (d) : 1)) : 0)
+#define RECIP_ENTRY(s, w) QUANT_RECIP((s) * (w)),
+
+#define RECIP_ROWS(M) \
+    { M(RECIP_ENTRY, 0) },  { M(RECIP_ENTRY, 1) },  { M(RECIP_ENTRY, 2) },  { M(RECIP_ENTRY, 3) },  \
+    { M(RECIP_ENTRY, 4) },  { M(RECIP_ENTRY, 5) },  { M(RECIP_ENTRY, 6) },  { M(RECIP_ENTRY, 7) },  \
+    { M(RECIP_ENTRY, 8) },  { M(RECIP_ENTRY, 9) },  { M(RECIP_ENTRY, 10) }, { M(RECIP_ENTRY, 11) }, \
+    { M(RECIP_ENTRY, 12) }, { M(RECIP_ENTRY, 13) }, { M(RECIP_ENTRY, 14) }, { M(RECIP_ENTRY, 15) }, \
+    { M(RECIP_ENTRY, 16) }, { M(RECIP_ENTRY, 17) }, { M(RECIP_ENTRY, 18) }, { M(RECIP_ENTRY, 19) }, \
+    { M(RECIP_ENTRY, 20) }, { M(RECIP_ENTRY, 21) }, { M(RECIP_ENTRY, 22) }, { M(RECIP_ENTRY, 23) }, \
+    { M(RECIP_ENTRY, 24) }, { M(RECIP_ENTRY, 25) }, { M(RECIP_ENTRY, 26) }, { M(RECIP_ENTRY, 27) }, \
+    { M(RECIP_ENTRY, 28) }, { M(RECIP_ENTRY, 29) }, { M(RECIP_ENTRY, 30) }, { M(RECIP_ENTRY, 31) }
+
+const uint32_t quant_recip_y[MAX_QUANT_SCALE + 1][BLOCKSIZE * BLOCKSIZE] = { RECIP_ROWS(QUANT_MATRIX_Y) };
+
+// ceil(2^QUANT_RECIP_BITS / (2 * scale)), a truncating division by the
+// non-intra step
+#define INTER_RECIP(s) (s) ? (uint32_t)((((uint64_t)1 << QUANT_RECIP_BITS) + 2 * (s) - 1) / (2 * ((s) ? (s) : 1))) : 0,
+#define INTER_RECIP_ROW(X) \
+    X(0)  X(1)  X(2)  X(3)  X(4)  X(5)  X(6)  X(7)  X(8)  X(9)  X(10) X(11) X(12) X(13) X(14) X(15) \
+    X(16) X(17) X(18) X(19) X(20) X(21) X(22) X(23) X(24) X(25) X(26) X(27) X(28) X(29) X(30) X(31)
+
+const uint32_t quant_recip_inter[MAX_QUANT_SCALE + 1] = { INTER_RECIP_ROW(INTER_RECIP) };
+
 // 预计算常量 (AAN 优化系数)
 const float C1 = 0.49039;  // cos(pi/16)
 const float C2 = 0.46194;  // cos(2pi/16)
@@ -164,4 +200,124 @@ void quantizeBlock(int mat[BLOCKSIZE * BLOCKSIZE], uint8_t block[BLOCKSIZE*BLOCK
         }
     }
     return;
-}
\ No newline at end of file
+}
+
+// Intra level of an AC coefficient, saturated to what MPEG-1 can code
+static inline int intraLevel(int f, uint32_t recip) {
+    uint32_t magnitude = f < 0 ? -f : f;
+    int level = (int)(((uint64_t)magnitude * recip + (1 << (QUANT_RECIP_BITS - 1))) >> QUANT_RECIP_BITS);
+    if(level > MAX_QUANT_LEVEL) {
+        level = MAX_QUANT_LEVEL;
+    }
+    return f < 0 ? -level : level;
+}
+
+// Intra quantization of orthonormal DCT coefficients in raster order.
+// Levels are computed in zigzag order so the position of the last nonzero
+// one falls out of the same loop.
+static inline int quantizeIntra(int mat[BLOCKSIZE * BLOCKSIZE], const int coef[BLOCKSIZE * BLOCKSIZE], const uint32_t recip[BLOCKSIZE * BLOCKSIZE]) {
+    // Intra DC always uses a step of 8
+    mat[0] = (coef[0] + 4) >> 3;
+    int last = mat[0] ? 0 : -1;
+    for(int i = 1; i < BLOCKSIZE * BLOCKSIZE; i++) {
+        int pos = zigzag_scan[i];
+        mat[pos] = intraLevel(coef[pos], recip[pos]);
+        if(mat[pos]) {
+            last = i;
+        }
+    }
+    return last;
+}
+
+// Fused forward DCT and intra quantization
+int transformQuantizeBlock(int mat[BLOCKSIZE * BLOCKSIZE], const uint8_t* block, int stride, const uint32_t recip[BLOCKSIZE * BLOCKSIZE]) {
+    int16_t dct[BLOCKSIZE * BLOCKSIZE];
+    uint64_t start = profileStart();
+    performIntDCTPixels(dct, block, stride);
+    profileStop(PROFILE_DCT, start);
+    start = profileStart();
+    int coef[BLOCKSIZE * BLOCKSIZE];
+    for(int i = 0; i < BLOCKSIZE * BLOCKSIZE; i++) {
+        coef[i] = dct[i];
+    }
+    int last = quantizeIntra(mat, coef, recip);
+    profileStop(PROFILE_QUANT, start);
+    return last;
+}
+
+// JPEG codes the DCT of samples shifted down by 128, which only moves the
+// DC coefficient: by 128 * 8 in the orthonormal scaling.
+#define JPEG_DC_SHIFT (128 * BLOCKSIZE)
+
+int requantizeBlock(int mat[BLOCKSIZE * BLOCKSIZE], const int16_t jpeg_coef[BLOCKSIZE * BLOCKSIZE], const uint16_t jpeg_quant[BLOCKSIZE * BLOCKSIZE], const uint32_t recip[BLOCKSIZE * BLOCKSIZE]) {
+    int coef[BLOCKSIZE * BLOCKSIZE];
+    uint64_t start = profileStart();
+    for(int i = 0; i < BLOCKSIZE * BLOCKSIZE; i++) {
+        coef[i] = jpeg_coef[i] * jpeg_quant[i];
+    }
+    // Rounding in the JPEG encoder can push the DC slightly outside the
+    // range of 8-bit samples
+    coef[0] += JPEG_DC_SHIFT;
+    if(coef[0] < 0) {
+        coef[0] = 0;
+    } else if(coef[0] > 255 * BLOCKSIZE) {
+        coef[0] = 255 * BLOCKSIZE;
+    }
+    int last = quantizeIntra(mat, coef, recip);
+    profileStop(PROFILE_QUANT, start);
+    return last;
+}
+
+// level = |F| / (2 * scale), truncated: with the flat non-intra matrix the
+// reconstruction (2 * level + 1) * scale is the middle of each step, and
+// everything below 2 * scale falls in the dead zone
+int transformQuantizeResidual(int mat[BLOCKSIZE * BLOCKSIZE], const uint8_t* src, int stride_src, const uint8_t* pred, int stride_pred, uint8_t scale) {
+    int16_t coef[BLOCKSIZE * BLOCKSIZE];
+    uint64_t start = profileStart();
+    performIntDCTResidual(coef, src, stride_src, pred, stride_pred);
+    profileStop(PROFILE_DCT, start);
+    start = profileStart();
+
+    uint32_t recip = quant_recip_inter[scale];
+    int last = -1;
+    for(int i = 0; i < BLOCKSIZE * BLOCKSIZE; i++) {
+        int pos = zigzag_scan[i];
+        int f = coef[pos];
+        uint32_t magnitude = f < 0 ? -f : f;
+        int level = (int)(((uint64_t)magnitude * recip) >> QUANT_RECIP_BITS);
+        if(level > MAX_QUANT_LEVEL) {
+            level = MAX_QUANT_LEVEL;
+        }
+        mat[pos] = f < 0 ? -level : level;
+        if(level) {
+            last = i;
+        }
+    }
+    profileStop(PROFILE_QUANT, start);
+    if(last < 0) {
+        profileCount(PROFILE_ZERO_BLOCKS, 1);
+    }
+    return last;
+}
+
+// Mismatch control: every reconstructed coefficient is made odd, then clipped
+static inline int16_t reconCoefficient(int v) {
+    if(!(v & 1) && v != 0) {
+        v -= v > 0 ? 1 : -1;
+    }
+    return v < -2048 ? -2048 : (v > 2047 ? 2047 : v);
+}
+
+void dequantizeIntraBlock(int16_t coef[BLOCKSIZE * BLOCKSIZE], const int mat[BLOCKSIZE * BLOCKSIZE], uint8_t scale) {
+    coef[0] = mat[0] * 8;
+    for(int i = 1; i < BLOCKSIZE * BLOCKSIZE; i++) {
+        coef[i] = mat[i] ? reconCoefficient(2 * mat[i] * scale * quantization_table_y[i] / 16) : 0;
+    }
+}
+
+void dequantizeInterBlock(int16_t coef[BLOCKSIZE * BLOCKSIZE], const int mat[BLOCKSIZE * BLOCKSIZE], uint8_t scale) {
+    for(int i = 0; i < BLOCKSIZE * BLOCKSIZE; i++) {
+        int level = mat[i];
+        coef[i] = level ? reconCoefficient((2 * level + (level > 0 ? 1 : -1)) * scale * NON_INTRA_QUANT / 16) : 0;
+    }
+}
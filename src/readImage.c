@@ -1,79 +1,295 @@
+#include <setjmp.h>
+#include <string.h>
+
+#include "colorconv.h"
 #include "readImage.h"
 
 #define FPS 30
 #define BITRATEPAR 100
 
+// Packed frame layout: Y, then Cb and Cr of (width + 1) / 2 by (height + 1) / 2
 void transferrRgb2Yuv420(unsigned char *yuv,unsigned char *rgb, int width, int height) {
-    int frame_size = width * height + (width / 2) * (height / 2) * 2;
-    int i, j;
-    unsigned char *y = yuv;
-    unsigned char *u = yuv + width * height;
-    unsigned char *v = u + (width / 2) * (height / 2);
-
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            int r = rgb[(i * width + j) * 3];
-            int g = rgb[(i * width + j) * 3 + 1];
-            int b = rgb[(i * width + j) * 3 + 2];
-            
-            int y_val = (0.299 * r + 0.587 * g + 0.114 * b);
-            int u_val = (-0.147 * r - 0.289 * g + 0.436 * b);
-            int v_val = (0.615 * r - 0.515 * g - 0.100 * b);
-
-            y[i * width + j] = y_val;
-            
-            if (i % 2 == 0 && j % 2 == 0) {
-                u[(i / 2) * (width / 2) + (j / 2)] = u_val + 128;
-                v[(i / 2) * (width / 2) + (j / 2)] = v_val + 128;
+    int width_c = (width + 1) / 2;
+    int height_c = (height + 1) / 2;
+    YuvPlanes planes = {
+        .y = yuv,
+        .cb = yuv + width * height,
+        .cr = yuv + width * height + width_c * height_c,
+        .stride_y = width,
+        .stride_cb = width_c,
+        .stride_cr = width_c,
+    };
+    convertRgbToYuv420(rgb, width * 3, width, height, &planes);
+}
+
+static void jumpOnError(j_common_ptr cinfo) {
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(((JpegError*)cinfo->err)->jump, 1);
+}
+
+static void ignoreMessage(j_common_ptr cinfo) {
+    (void)cinfo;
+}
+
+// The error manager of a reader, which must setjmp on error->jump before
+// any libjpeg call that can fail. Messages go to stderr unless `quiet`.
+static struct jpeg_error_mgr* initJpegError(JpegError* error, int quiet) {
+    jpeg_std_error(&error->mgr);
+    error->mgr.error_exit = jumpOnError;
+    if(quiet) {
+        error->mgr.output_message = ignoreMessage;
+    }
+    return &error->mgr;
+}
+
+// libjpeg can hand out its internal YCbCr planes directly when the file is
+// 4:2:0: a 2x2 sampled luma component and two 1x1 chroma components.
+static int isYuv420(const struct jpeg_decompress_struct* cinfo) {
+    return cinfo->jpeg_color_space == JCS_YCbCr && cinfo->num_components == 3 &&
+        cinfo->comp_info[0].h_samp_factor == 2 && cinfo->comp_info[0].v_samp_factor == 2 &&
+        cinfo->comp_info[1].h_samp_factor == 1 && cinfo->comp_info[1].v_samp_factor == 1 &&
+        cinfo->comp_info[2].h_samp_factor == 1 && cinfo->comp_info[2].v_samp_factor == 1;
+}
+
+// Decode the Y/Cb/Cr planes without upsampling or color conversion. Rows go
+// straight into the frame; libjpeg always writes whole blocks, which the
+// right border of the frame takes when it is wide enough. Lines past the
+// bottom edge land in a dummy row, and a width the border cannot take is
+// decoded through one row group of scratch memory, which libjpeg frees
+// with the image, also when it fails.
+static void readRawYuv420(struct jpeg_decompress_struct* cinfo, ImageInfo* imageinfo) {
+    int height = imageinfo->height;
+    int width_c = (imageinfo->width + 1) / 2;
+    int height_c = (height + 1) / 2;
+    int row_y = cinfo->comp_info[0].width_in_blocks * DCTSIZE;
+    int row_c = cinfo->comp_info[1].width_in_blocks * DCTSIZE;
+    const Frame* frame = imageinfo->frame;
+    const YuvPlanes* planes = &frame->planes;
+
+    int direct = row_y <= imageinfo->width + frame->pad && row_c <= width_c + frame->pad / 2;
+    unsigned char* scratch = NULL;
+    unsigned char dummy[direct ? row_y : 1];
+    if(!direct) {
+        scratch = (unsigned char*)(*cinfo->mem->alloc_large)((j_common_ptr)cinfo, JPOOL_IMAGE,
+                                                             2 * DCTSIZE * row_y + 2 * DCTSIZE * row_c);
+    }
+
+    JSAMPROW rows_y[2 * DCTSIZE];
+    JSAMPROW rows_cb[DCTSIZE];
+    JSAMPROW rows_cr[DCTSIZE];
+    JSAMPARRAY rows[3] = { rows_y, rows_cb, rows_cr };
+    while(cinfo->output_scanline < cinfo->output_height) {
+        int line_y = cinfo->output_scanline;
+        int line_c = line_y / 2;
+        for(int i = 0; i < 2 * DCTSIZE; i++) {
+            if(!direct) {
+                rows_y[i] = scratch + i * row_y;
+            } else {
+                rows_y[i] = line_y + i < height ? planes->y + (line_y + i) * planes->stride_y : dummy;
+            }
+        }
+        for(int i = 0; i < DCTSIZE; i++) {
+            if(!direct) {
+                rows_cb[i] = scratch + 2 * DCTSIZE * row_y + i * row_c;
+                rows_cr[i] = scratch + 2 * DCTSIZE * row_y + (DCTSIZE + i) * row_c;
+            } else {
+                rows_cb[i] = line_c + i < height_c ? planes->cb + (line_c + i) * planes->stride_cb : dummy;
+                rows_cr[i] = line_c + i < height_c ? planes->cr + (line_c + i) * planes->stride_cr : dummy;
+            }
+        }
+        jpeg_read_raw_data(cinfo, rows, 2 * DCTSIZE);
+
+        if(!direct) {
+            for(int i = 0; i < 2 * DCTSIZE && line_y + i < height; i++) {
+                memcpy(planes->y + (line_y + i) * planes->stride_y, rows_y[i], imageinfo->width);
+            }
+            for(int i = 0; i < DCTSIZE && line_c + i < height_c; i++) {
+                memcpy(planes->cb + (line_c + i) * planes->stride_cb, rows_cb[i], width_c);
+                memcpy(planes->cr + (line_c + i) * planes->stride_cr, rows_cr[i], width_c);
             }
         }
     }
 }
 
+// Other layouts: decode to RGB and convert one batch of lines at a time,
+// while it is still in cache
+static void readRgb(struct jpeg_decompress_struct* cinfo, ImageInfo* imageinfo) {
+    int width = imageinfo->width;
+    int height = imageinfo->height;
+    int pixel_size = cinfo->output_components;
+    int batch_size = NUMOFLINESREADINONETIME; // The number of lines the algorithm is going to read in one time, even
+    unsigned char* buf_rgb = (unsigned char*)(*cinfo->mem->alloc_large)((j_common_ptr)cinfo, JPOOL_IMAGE,
+                                                                      (size_t)batch_size * width * pixel_size);
+    unsigned char* rowptr[batch_size];
+    for(int i = 0; i < batch_size; i++) {
+        rowptr[i] = buf_rgb + i * width * pixel_size;
+    }
+    YuvPlanes planes = imageinfo->frame->planes;
+    while((int)cinfo->output_scanline < height) {
+        int line = cinfo->output_scanline;
+        int lines_to_read = line + batch_size > height ? height - line : batch_size;
+        while((int)cinfo->output_scanline < line + lines_to_read) {
+            jpeg_read_scanlines(cinfo, rowptr + (cinfo->output_scanline - line), line + lines_to_read - cinfo->output_scanline);
+        }
+        YuvPlanes batch = planes;
+        batch.y += line * planes.stride_y;
+        batch.cb += line / 2 * planes.stride_cb;
+        batch.cr += line / 2 * planes.stride_cr;
+        convertRgbToYuv420(buf_rgb, width * pixel_size, width, lines_to_read, &batch);
+    }
+}
 
-int readImage(ImageInfo* imageinfo, char* filename) {
+// Decode the JPEG of `cinfo`, whose source is set, into imageinfo->frame.
+// Returns -1 if out of memory, 1 for a 4:2:0 file read as raw planes and 0
+// for one converted from RGB.
+static int decodeJpeg(struct jpeg_decompress_struct* cinfo, ImageInfo* imageinfo, FramePool* pool) {
+    jpeg_read_header(cinfo, TRUE);
+
+    int raw = isYuv420(cinfo);
+    if(raw) {
+        cinfo->raw_data_out = TRUE;
+        cinfo->do_fancy_upsampling = FALSE;
+        cinfo->out_color_space = JCS_YCbCr;
+    } else {
+        cinfo->out_color_space = JCS_RGB;
+    }
+    jpeg_start_decompress(cinfo);
+
+    imageinfo->width = cinfo->output_width;
+    imageinfo->height = cinfo->output_height;
+    Frame* frame = imageinfo->frame;
+    if(!frame || frame->width != imageinfo->width || frame->height != imageinfo->height) {
+        if(pool) {
+            releaseFrame(pool, frame);
+            frame = acquireFrame(pool, imageinfo->width, imageinfo->height);
+        } else {
+            freeFrame(frame);
+            frame = allocFrame(imageinfo->width, imageinfo->height, FRAME_PAD);
+        }
+        imageinfo->frame = frame;
+        if(!frame) {
+            return -1;
+        }
+    }
+
+    if(raw) {
+        readRawYuv420(cinfo, imageinfo);
+    } else {
+        readRgb(cinfo, imageinfo);
+    }
+    jpeg_finish_decompress(cinfo);
+
+    imageinfo->fps = FPS;
+    imageinfo->bitrate = imageinfo->width * imageinfo->height * imageinfo->fps * BITRATEPAR;
+    return raw;
+}
+
+int readImageInto(ImageInfo* imageinfo, char* filename, FramePool* pool) {
     FILE* infile = fopen(filename, "rb");
     if(!infile) {
         fprintf(stderr, "Error opening JPEG file %s!\n", filename);
-        exit(EXIT_FAILURE);
+        return -1;
     }
-    
-    struct jpeg_error_mgr jerr;
+
+    JpegError error;
     struct jpeg_decompress_struct cinfo;
-    cinfo.err = jpeg_std_error(&jerr);
+    cinfo.err = initJpegError(&error, 0);
     jpeg_create_decompress(&cinfo);
-    jpeg_stdio_src(&cinfo, infile);   // Set cinfo.src
-    jpeg_read_header(&cinfo, TRUE);
-    jpeg_start_decompress(&cinfo);
-
-    imageinfo->width = cinfo.output_width;
-    imageinfo->height = cinfo.output_height;
-    int pixel_size = cinfo.output_components;
-    imageinfo->buf_size = imageinfo->width * imageinfo->height * pixel_size;
-    unsigned char* buf_rgb = (unsigned char*)malloc(imageinfo->buf_size);
-    int batch_size = NUMOFLINESREADINONETIME; // The number of lines the algorithm is going to read in one time
-    unsigned char* rowptr[batch_size];
-    while(cinfo.output_scanline < imageinfo->height) {
-        int lines_to_read = cinfo.output_scanline +
-            batch_size > imageinfo->height ? imageinfo->height - cinfo.output_scanline : batch_size;
-        // Set row pointers for the batch
-        for(int i = 0; i < lines_to_read; i++) {
-            rowptr[i] = buf_rgb + (cinfo.output_scanline + i) * imageinfo->width * pixel_size;
-        }
-        jpeg_read_scanlines(&cinfo, rowptr, lines_to_read);
+    if(setjmp(error.jump) != 0) {
+        // libjpeg has printed the reason
+        fprintf(stderr, "Error decoding %s!\n", filename);
+        jpeg_destroy_decompress(&cinfo);
+        fclose(infile);
+        return -1;
     }
-    jpeg_finish_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, infile);   // Set cinfo.src
+    int raw = decodeJpeg(&cinfo, imageinfo, pool);
+    jpeg_destroy_decompress(&cinfo);
     fclose(infile);
+    if(raw < 0) {
+        fprintf(stderr, "Out of memory for the frame of %s!\n", filename);
+        return -1;
+    }
+    return 0;
+}
 
-    imageinfo->buf_size = 1.5 * imageinfo->width * imageinfo->height;
-    imageinfo->buf_p = (uint8_t*)malloc(imageinfo->buf_size);
-    transferrRgb2Yuv420(imageinfo->buf_p, buf_rgb, imageinfo->width, imageinfo->height);
-    free(buf_rgb);
+int readImageData(ImageInfo* imageinfo, const uint8_t* data, size_t size, FramePool* pool) {
+    JpegError error;
+    struct jpeg_decompress_struct cinfo;
+    cinfo.err = initJpegError(&error, 1);
+    jpeg_create_decompress(&cinfo);
+    if(setjmp(error.jump) != 0) {
+        jpeg_destroy_decompress(&cinfo);
+        return -1;
+    }
+    jpeg_mem_src(&cinfo, data, size);
+    int raw = decodeJpeg(&cinfo, imageinfo, pool);
+    jpeg_destroy_decompress(&cinfo);
+    return raw < 0 ? -1 : 0;
+}
 
-    imageinfo->fps = FPS;
-    imageinfo->bitrate = imageinfo->width * imageinfo->height * imageinfo->fps * BITRATEPAR;
+int readImage(ImageInfo* imageinfo, char* filename) {
+    imageinfo->frame = NULL;
+    return readImageInto(imageinfo, filename, NULL);
+}
+
+void freeImage(ImageInfo* imageinfo) {
+    freeFrame(imageinfo->frame);
+    imageinfo->frame = NULL;
+}
+
+// JPEG 4:2:0 and MPEG-1 use the same 16x16 luma + 2x 8x8 chroma layout,
+// so each MCU maps to one macroblock when no MCU is cut by the image edge.
+int readCoefficients(CoefImage* image, char* filename) {
+    image->file = fopen(filename, "rb");
+    if(!image->file) {
+        fprintf(stderr, "Error opening JPEG file %s!\n", filename);
+        return -1;
+    }
+    for(int c = 0; c < 3; c++) {
+        image->rows[c] = NULL;
+    }
+    image->cinfo.err = initJpegError(&image->error, 0);
+    jpeg_create_decompress(&image->cinfo);
+    if(setjmp(image->error.jump) != 0) {
+        fprintf(stderr, "Error decoding %s!\n", filename);
+        freeCoefficients(image);
+        return -1;
+    }
+    jpeg_stdio_src(&image->cinfo, image->file);
+    jpeg_read_header(&image->cinfo, TRUE);
 
-    // 图片数据已在 bmp_buffer 中，可进一步处理
-    printf("Image width: %d, height: %d, pixel size: %d\n", imageinfo->width, imageinfo->height, pixel_size);
+    struct jpeg_decompress_struct* cinfo = &image->cinfo;
+    if(!isYuv420(cinfo) || cinfo->image_width % 16 != 0 || cinfo->image_height % 16 != 0) {
+        freeCoefficients(image);
+        return -1;
+    }
+    jvirt_barray_ptr* arrays = jpeg_read_coefficients(cinfo);
+
+    // The arrays are fully in memory, so the row pointers stay valid and
+    // the blocks can be read from any thread until freeCoefficients
+    for(int c = 0; c < 3; c++) {
+        jpeg_component_info* comp = &cinfo->comp_info[c];
+        image->rows[c] = (JBLOCKROW*)malloc(comp->height_in_blocks * sizeof(JBLOCKROW));
+        for(JDIMENSION r = 0; r < comp->height_in_blocks; r++) {
+            image->rows[c][r] = cinfo->mem->access_virt_barray((j_common_ptr)cinfo, arrays[c], r, 1, FALSE)[0];
+        }
+        image->quant[c] = comp->quant_table->quantval;
+    }
+
+    image->info.frame = NULL;
+    image->info.width = cinfo->image_width;
+    image->info.height = cinfo->image_height;
+    image->info.fps = FPS;
+    image->info.bitrate = image->info.width * image->info.height * image->info.fps * BITRATEPAR;
     return 0;
-}
\ No newline at end of file
+}
+
+void freeCoefficients(CoefImage* image) {
+    for(int c = 0; c < 3; c++) {
+        free(image->rows[c]);
+        image->rows[c] = NULL;
+    }
+    jpeg_destroy_decompress(&image->cinfo);
+    fclose(image->file);
+}
@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "createMLV.h"
+#include "encoder.h"
+#include "gop.h"
+#include "session.h"
+
+struct EncoderSession {
+    SessionParams params;
+    GopConfig gop;
+    uint8_t frame_rate_code;
+    Muxer mux;
+    BitWriter bw;
+    FramePool pool;
+    ReorderBuffer reorder;
+    EncoderContext ctx;
+    int started;        // the encoder is set up for the size of the first frame
+    ImageInfo next;     // frame to fill, traded with the reorder buffer
+    int num_frames;
+    int flushed;
+    int failed;
+};
+
+void defaultSessionParams(SessionParams* params) {
+    params->fps = 30;
+    params->scale = 8;
+    params->gop_size = 12;
+    params->gop_distance = 3;
+    params->closed_gop = 0;
+    params->search_range = 16;
+    params->num_threads = 0;
+    params->raw = 0;
+}
+
+EncoderSession* openSession(const SessionParams* params, SinkCallback callback, void* opaque) {
+    if(params->fps <= 0 || params->scale < 1 || params->scale > 31 || params->search_range < 0) {
+        return NULL;
+    }
+    EncoderSession* session = (EncoderSession*)calloc(1, sizeof(EncoderSession));
+    if(!session) {
+        return NULL;
+    }
+    session->params = *params;
+    // Without motion search every picture is an I picture
+    session->gop.size = params->search_range ? params->gop_size : 1;
+    session->gop.distance = params->search_range ? params->gop_distance : 1;
+    session->gop.closed = params->closed_gop;
+    session->frame_rate_code = frameRateCode(params->fps);
+    if(initReorderBuffer(&session->reorder, &session->gop) != 0) {
+        free(session);
+        return NULL;
+    }
+    if(openCallbackMuxer(&session->mux, callback, opaque, params->raw) != 0) {
+        freeReorderBuffer(&session->reorder);
+        free(session);
+        return NULL;
+    }
+    initBitWriter(&session->bw, NULL, 0);
+    initFramePool(&session->pool, FRAME_PAD);
+    return session;
+}
+
+// Encode every picture the reorder buffer can release and pass the output on
+static int encodeReadyPictures(EncoderSession* session) {
+    CodedPicture* picture;
+    while((picture = nextCodedPicture(&session->reorder))) {
+        if(encodeCodedPicture(&session->ctx, picture, session->frame_rate_code, &session->bw) != 0 ||
+           flushBitstream(&session->mux, &session->bw) != 0) {
+            return -1;
+        }
+    }
+    return sinkFlush(&session->mux.sink);
+}
+
+// Set up the encoder and write the sequence header for the first frame;
+// later frames must have its size
+static int checkFrameSize(EncoderSession* session, int width, int height) {
+    if(session->started) {
+        return width == session->ctx.width && height == session->ctx.height ? 0 : -1;
+    }
+    if(width <= 0 || height <= 0 ||
+       initEncoder(&session->ctx, width, height, (uint8_t)session->params.scale, session->params.num_threads,
+                   session->params.search_range) != 0) {
+        return -1;
+    }
+    session->started = 1;
+    writeSequenceHeader(&session->bw, width, height, session->frame_rate_code);
+    return flushBitstream(&session->mux, &session->bw);
+}
+
+// The frame to fill next, of the given size
+static Frame* nextFrame(EncoderSession* session, int width, int height) {
+    Frame* frame = session->next.frame;
+    if(!frame || frame->width != width || frame->height != height) {
+        releaseFrame(&session->pool, frame);
+        frame = acquireFrame(&session->pool, width, height);
+        session->next.frame = frame;
+    }
+    return frame;
+}
+
+// Hand the filled frame to the reorder buffer and encode what it releases
+static int encodeFrame(EncoderSession* session) {
+    ImageInfo* image = &session->next;
+    image->width = session->ctx.width;
+    image->height = session->ctx.height;
+    image->fps = (uint16_t)session->params.fps;
+    int type = gopPictureType(&session->gop, session->num_frames++);
+    if(pushReorderFrame(&session->reorder, image, type) != 0 || encodeReadyPictures(session) != 0) {
+        session->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+int pushYuvFrame(EncoderSession* session, const YuvPlanes* planes, int width, int height) {
+    if(session->flushed || session->failed || checkFrameSize(session, width, height) != 0) {
+        return -1;
+    }
+    Frame* frame = nextFrame(session, width, height);
+    if(!frame) {
+        return -1;
+    }
+    int width_c = (width + 1) / 2;
+    for(int i = 0; i < height; i++) {
+        memcpy(frame->planes.y + (size_t)i * frame->planes.stride_y, planes->y + (size_t)i * planes->stride_y, width);
+    }
+    for(int i = 0; i < (height + 1) / 2; i++) {
+        memcpy(frame->planes.cb + (size_t)i * frame->planes.stride_cb, planes->cb + (size_t)i * planes->stride_cb, width_c);
+        memcpy(frame->planes.cr + (size_t)i * frame->planes.stride_cr, planes->cr + (size_t)i * planes->stride_cr, width_c);
+    }
+    return encodeFrame(session);
+}
+
+int pushRgbFrame(EncoderSession* session, const uint8_t* rgb, int stride, int width, int height) {
+    if(session->flushed || session->failed || checkFrameSize(session, width, height) != 0) {
+        return -1;
+    }
+    Frame* frame = nextFrame(session, width, height);
+    if(!frame) {
+        return -1;
+    }
+    convertRgbToYuv420(rgb, stride, width, height, &frame->planes);
+    return encodeFrame(session);
+}
+
+int pushJpegData(EncoderSession* session, const uint8_t* data, size_t size) {
+    if(session->flushed || session->failed || readImageData(&session->next, data, size, &session->pool) != 0 ||
+       checkFrameSize(session, session->next.width, session->next.height) != 0) {
+        return -1;
+    }
+    return encodeFrame(session);
+}
+
+int pushJpegFile(EncoderSession* session, const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if(!file) {
+        return -1;
+    }
+    uint8_t* data = NULL;
+    long size = -1;
+    if(fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0) {
+        data = (uint8_t*)malloc(size);
+    }
+    int ret = -1;
+    if(data && fread(data, 1, size, file) == (size_t)size) {
+        ret = pushJpegData(session, data, size);
+    }
+    free(data);
+    fclose(file);
+    return ret;
+}
+
+int flushSession(EncoderSession* session) {
+    if(session->flushed) {
+        return session->failed ? -1 : 0;
+    }
+    session->flushed = 1;
+    if(session->started && !session->failed) {
+        flushReorderBuffer(&session->reorder);
+        if(encodeReadyPictures(session) != 0) {
+            session->failed = 1;
+        }
+        writeSequenceEndCode(&session->bw);
+        if(flushBitstream(&session->mux, &session->bw) != 0) {
+            session->failed = 1;
+        }
+    }
+    if(closeMuxer(&session->mux) != 0) {
+        session->failed = 1;
+    }
+    return session->failed ? -1 : 0;
+}
+
+void closeSession(EncoderSession* session) {
+    if(!session) {
+        return;
+    }
+    flushSession(session);
+    if(session->started) {
+        freeEncoder(&session->ctx);
+    }
+    freeReorderBuffer(&session->reorder);
+    releaseFrame(&session->pool, session->next.frame);
+    freeFramePool(&session->pool);
+    freeBitWriter(&session->bw);
+    free(session);
+}
@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "profile.h"
+#include "sink.h"
+
+static int writeAll(int fd, const uint8_t* data, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, data, len);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void* writerThread(void* arg) {
+    OutputSink* sink = (OutputSink*)arg;
+    pthread_mutex_lock(&sink->lock);
+    for(;;) {
+        while(!sink->pending && !sink->stop) {
+            pthread_cond_wait(&sink->ready, &sink->lock);
+        }
+        if(!sink->pending) {
+            break;
+        }
+        const uint8_t* data = sink->pending;
+        size_t size = sink->pending_size;
+        pthread_mutex_unlock(&sink->lock);
+
+        uint64_t start = profileStart();
+        int ret = writeAll(sink->fd, data, size);
+        profileSpan(PROFILE_WRITE, start);
+
+        pthread_mutex_lock(&sink->lock);
+        sink->error |= ret != 0;
+        sink->pending = NULL;
+        pthread_cond_signal(&sink->done);
+    }
+    pthread_mutex_unlock(&sink->lock);
+    return NULL;
+}
+
+int openFileSink(OutputSink* sink, const char* filename) {
+    memset(sink, 0, sizeof(OutputSink));
+    sink->kind = SINK_FILE;
+    sink->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(sink->fd < 0) {
+        return -1;
+    }
+    sink->chunks[0] = (uint8_t*)malloc(SINK_CHUNK_SIZE);
+    sink->chunks[1] = (uint8_t*)malloc(SINK_CHUNK_SIZE);
+    pthread_mutex_init(&sink->lock, NULL);
+    pthread_cond_init(&sink->ready, NULL);
+    pthread_cond_init(&sink->done, NULL);
+    if(!sink->chunks[0] || !sink->chunks[1] || pthread_create(&sink->thread, NULL, writerThread, sink) != 0) {
+        free(sink->chunks[0]);
+        free(sink->chunks[1]);
+        pthread_mutex_destroy(&sink->lock);
+        pthread_cond_destroy(&sink->ready);
+        pthread_cond_destroy(&sink->done);
+        close(sink->fd);
+        return -1;
+    }
+    return 0;
+}
+
+void openMemorySink(OutputSink* sink) {
+    memset(sink, 0, sizeof(OutputSink));
+    sink->kind = SINK_MEMORY;
+    sink->fd = -1;
+}
+
+int openCallbackSink(OutputSink* sink, SinkCallback callback, void* opaque) {
+    memset(sink, 0, sizeof(OutputSink));
+    sink->kind = SINK_CALLBACK;
+    sink->fd = -1;
+    sink->callback = callback;
+    sink->opaque = opaque;
+    sink->chunks[0] = (uint8_t*)malloc(SINK_CHUNK_SIZE);
+    return sink->chunks[0] ? 0 : -1;
+}
+
+// Hand the current chunk to the writer thread once it is done with the
+// other one, and fill that one next. A callback sink passes it on at once.
+static int handOffChunk(OutputSink* sink) {
+    if(sink->kind == SINK_CALLBACK) {
+        int ret = sink->callback(sink->opaque, sink->chunks[0], sink->fill) == 0 ? 0 : -1;
+        sink->fill = 0;
+        return ret;
+    }
+    pthread_mutex_lock(&sink->lock);
+    while(sink->pending) {
+        pthread_cond_wait(&sink->done, &sink->lock);
+    }
+    sink->pending = sink->chunks[sink->current];
+    sink->pending_size = sink->fill;
+    pthread_cond_signal(&sink->ready);
+    int error = sink->error;
+    pthread_mutex_unlock(&sink->lock);
+    sink->current ^= 1;
+    sink->fill = 0;
+    return error ? -1 : 0;
+}
+
+static int appendMemory(OutputSink* sink, const void* data, size_t len) {
+    if(sink->size + len > sink->capacity) {
+        size_t capacity = sink->capacity ? sink->capacity : SINK_CHUNK_SIZE;
+        while(capacity < sink->size + len) {
+            capacity *= 2;
+        }
+        uint8_t* grown = (uint8_t*)realloc(sink->data, capacity);
+        if(!grown) {
+            return -1;
+        }
+        sink->data = grown;
+        sink->capacity = capacity;
+    }
+    memcpy(sink->data + sink->size, data, len);
+    sink->size += len;
+    return 0;
+}
+
+int sinkWrite(OutputSink* sink, const void* data, size_t len) {
+    if(sink->kind == SINK_MEMORY) {
+        if(appendMemory(sink, data, len) != 0) {
+            return -1;
+        }
+        sink->bytes += len;
+        return 0;
+    }
+    const uint8_t* p = (const uint8_t*)data;
+    while(len > 0) {
+        size_t n = SINK_CHUNK_SIZE - sink->fill;
+        n = n < len ? n : len;
+        memcpy(sink->chunks[sink->current] + sink->fill, p, n);
+        sink->fill += n;
+        sink->bytes += n;
+        p += n;
+        len -= n;
+        if(sink->fill == SINK_CHUNK_SIZE && handOffChunk(sink) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int sinkFlush(OutputSink* sink) {
+    if(sink->kind == SINK_MEMORY || sink->fill == 0) {
+        return 0;
+    }
+    return handOffChunk(sink);
+}
+
+int closeSink(OutputSink* sink) {
+    if(sink->kind == SINK_MEMORY) {
+        return 0;
+    }
+    int flushed = sinkFlush(sink);
+    if(sink->kind == SINK_CALLBACK) {
+        free(sink->chunks[0]);
+        sink->chunks[0] = NULL;
+        return flushed;
+    }
+    pthread_mutex_lock(&sink->lock);
+    sink->stop = 1;
+    pthread_cond_signal(&sink->ready);
+    pthread_mutex_unlock(&sink->lock);
+    pthread_join(sink->thread, NULL);
+
+    int ret = sink->error ? -1 : 0;
+    if(close(sink->fd) != 0) {
+        ret = -1;
+    }
+    free(sink->chunks[0]);
+    free(sink->chunks[1]);
+    pthread_mutex_destroy(&sink->lock);
+    pthread_cond_destroy(&sink->ready);
+    pthread_cond_destroy(&sink->done);
+    sink->fd = -1;
+    return ret;
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "createMLV.h"
+#include "profile.h"
+#include "stitch.h"
+
+#define START_CODE_PICTURE 0x00
+#define START_CODE_SEQUENCE_END 0xB7
+#define START_CODE_SEQUENCE 0xB3
+#define START_CODE_GOP 0xB8
+
+// Bytes of the sequence header after its start code, up to the buffer sizes
+#define SEQUENCE_HEADER_BYTES 8
+
+typedef struct Stitcher {
+    Muxer mux;
+    uint8_t sequence_header[SEQUENCE_HEADER_BYTES];
+    int have_sequence_header;
+    uint8_t frame_rate_code;
+    long pictures;          // written so far, the time code of the next GOP
+} Stitcher;
+
+static int putByte(Stitcher* stitcher, int c) {
+    uint8_t byte = (uint8_t)c;
+    return muxWrite(&stitcher->mux, &byte, 1);
+}
+
+static int putStartCodeBytes(Stitcher* stitcher, int code) {
+    const uint8_t bytes[4] = { 0x00, 0x00, 0x01, (uint8_t)code };
+    return muxWrite(&stitcher->mux, bytes, sizeof(bytes));
+}
+
+// Time code, closed_gop and broken_link of a GOP header, after its start code
+static void rewriteTimeCode(const Stitcher* stitcher, uint8_t fields[4]) {
+    uint8_t buf[8];
+    BitWriter bw;
+    initBitWriter(&bw, buf, sizeof(buf));
+    writeGOPHeader(&bw, (uint32_t)stitcher->pictures, stitcher->frame_rate_code, (fields[3] >> 6) & 1);
+    finishBitWriter(&bw);
+    // broken_link stays as it was
+    fields[0] = buf[4];
+    fields[1] = buf[5];
+    fields[2] = buf[6];
+    fields[3] = (buf[7] & ~0x20) | (fields[3] & 0x20);
+}
+
+// Copy one segment up to its sequence end code. Start codes are found
+// after two or more zero bytes, which are held back until it is known
+// whether they belong to one.
+static int appendSegment(Stitcher* stitcher, FILE* in, int first_segment) {
+    int copying = first_segment;
+    int first_gop = 1;
+    int zeros = 0;
+    int failed = 0;
+    int c;
+    while((c = getc(in)) != EOF && !failed) {
+        if(c == 0x00) {
+            zeros++;
+            continue;
+        }
+        if(c != 0x01 || zeros < 2) {
+            for(; copying && zeros > 0; zeros--) {
+                failed |= putByte(stitcher, 0x00);
+            }
+            zeros = 0;
+            if(copying) {
+                failed |= putByte(stitcher, c);
+            }
+            continue;
+        }
+        // Zero bytes before the prefix are stuffing
+        for(zeros -= 2; copying && zeros > 0; zeros--) {
+            failed |= putByte(stitcher, 0x00);
+        }
+        zeros = 0;
+        int code = getc(in);
+        if(code == EOF) {
+            return -1;
+        }
+        if(code == START_CODE_SEQUENCE_END) {
+            return failed ? -1 : 0;
+        }
+
+        uint8_t fields[SEQUENCE_HEADER_BYTES];
+        size_t num_fields = code == START_CODE_SEQUENCE ? SEQUENCE_HEADER_BYTES : (code == START_CODE_GOP ? 4 : 0);
+        if(num_fields && fread(fields, 1, num_fields, in) != num_fields) {
+            return -1;
+        }
+        if(code == START_CODE_SEQUENCE) {
+            if(!stitcher->have_sequence_header) {
+                memcpy(stitcher->sequence_header, fields, SEQUENCE_HEADER_BYTES);
+                stitcher->frame_rate_code = fields[3] & 0x0F;
+                stitcher->have_sequence_header = 1;
+            } else if(memcmp(stitcher->sequence_header, fields, SEQUENCE_HEADER_BYTES) != 0) {
+                fprintf(stderr, "Segments differ in size or frame rate!\n");
+                return -1;
+            }
+        } else if(code == START_CODE_GOP) {
+            if(!stitcher->have_sequence_header) {
+                return -1;
+            }
+            // Everything before the first GOP of a later segment repeats
+            // the headers already written
+            if(first_gop && !first_segment && !((fields[3] >> 6) & 1)) {
+                fprintf(stderr, "Segment does not start with a closed GOP!\n");
+                return -1;
+            }
+            first_gop = 0;
+            copying = 1;
+            rewriteTimeCode(stitcher, fields);
+        } else if(code == START_CODE_PICTURE && copying) {
+            stitcher->pictures++;
+        }
+        if(copying) {
+            failed |= putStartCodeBytes(stitcher, code);
+            failed |= muxWrite(&stitcher->mux, fields, num_fields);
+        }
+    }
+    // Without an end code the segment was cut short
+    return -1;
+}
+
+int stitchSegments(const char* filename_o, char* const* segments, int num_segments, int raw) {
+    Stitcher stitcher = { 0 };
+    if(openMuxer(&stitcher.mux, filename_o, raw) != 0) {
+        fprintf(stderr, "Error creating output file %s!\n", filename_o);
+        return -1;
+    }
+    uint64_t start = profileStart();
+    int ret = 0;
+    for(int i = 0; i < num_segments && ret == 0; i++) {
+        FILE* in = fopen(segments[i], "rb");
+        if(!in) {
+            fprintf(stderr, "Error opening segment %s!\n", segments[i]);
+            ret = -1;
+            break;
+        }
+        if(appendSegment(&stitcher, in, i == 0) != 0) {
+            fprintf(stderr, "Error joining segment %s!\n", segments[i]);
+            ret = -1;
+        }
+        fclose(in);
+    }
+    if(putStartCodeBytes(&stitcher, START_CODE_SEQUENCE_END) != 0 || closeMuxer(&stitcher.mux) != 0) {
+        ret = -1;
+    }
+    profileSpan(PROFILE_MUX, start);
+    return ret;
+}
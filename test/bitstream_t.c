@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitstream.h"
+
+#define NUM_CODES 100000
+
+// Reference: one bit at a time
+static void putBitsSlow(uint8_t* buf, size_t* pos_bit, uint32_t value, int n) {
+    for(int i = n - 1; i >= 0; i--) {
+        buf[*pos_bit / 8] |= ((value >> i) & 1) << (7 - (*pos_bit % 8));
+        (*pos_bit)++;
+    }
+}
+
+int main() {
+    uint8_t* ref = (uint8_t*)calloc(NUM_CODES * 4 + 1, 1);
+    size_t ref_bits = 0;
+    BitWriter bw;
+    initBitWriter(&bw, NULL, 16); // small on purpose, must grow
+
+    srand(11172);
+    for(int i = 0; i < NUM_CODES; i++) {
+        int n = rand() % 33;
+        uint32_t value = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        if(n < 32) {
+            value &= (1u << n) - 1;
+        }
+        putBitsSlow(ref, &ref_bits, value, n);
+        putBits(&bw, value, n);
+    }
+    long len = finishBitWriter(&bw);
+    int failed = len != (long)((ref_bits + 7) / 8) || memcmp(bw.buf, ref, len) != 0;
+    printf("Growable writer: %ld bytes, %s\n", len, failed ? "MISMATCH" : "ok");
+    freeBitWriter(&bw);
+
+    // A fixed buffer must report overflow instead of truncating
+    uint8_t small[8];
+    initBitWriter(&bw, small, sizeof(small));
+    for(int i = 0; i < 5; i++) {
+        putBits(&bw, 0xDEADBEEF, 32);
+    }
+    len = finishBitWriter(&bw);
+    printf("Fixed writer: %ld (needed %zu bits), %s\n", len, bitWriterTell(&bw), len == -1 ? "ok" : "NOT DETECTED");
+    failed |= len != -1 || bitWriterTell(&bw) != 160;
+
+    free(ref);
+    return failed;
+}
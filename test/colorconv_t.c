@@ -0,0 +1,105 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "colorconv.h"
+
+// Sizes around the 16-pixel step of the vector kernels, odd ones included
+static const int sizes[][2] = { { 1, 1 }, { 17, 3 }, { 18, 2 }, { 33, 7 }, { 64, 16 }, { 549, 409 }, { 1000, 562 } };
+
+#define NUM_SIZES (int)(sizeof(sizes) / sizeof(sizes[0]))
+#define PADDING 13
+
+// Convert with one backend into planes with padded strides
+static void convert(ColorBackend backend, const uint8_t* rgb, int width, int height, uint8_t* out) {
+    int width_c = (width + 1) / 2;
+    int height_c = (height + 1) / 2;
+    YuvPlanes planes = {
+        .y = out,
+        .cb = out + (width + PADDING) * height,
+        .cr = out + (width + PADDING) * height + (width_c + PADDING) * height_c,
+        .stride_y = width + PADDING,
+        .stride_cb = width_c + PADDING,
+        .stride_cr = width_c + PADDING,
+    };
+    setColorBackend(backend);
+    convertRgbToYuv420(rgb, width * 3 + PADDING, width, height, &planes);
+}
+
+int main() {
+    int failed = 0;
+    srand(2087);
+    for(int s = 0; s < NUM_SIZES; s++) {
+        int width = sizes[s][0];
+        int height = sizes[s][1];
+        int width_c = (width + 1) / 2;
+        int height_c = (height + 1) / 2;
+        int stride_rgb = width * 3 + PADDING;
+        size_t size_out = (size_t)(width + PADDING) * height + 2 * (size_t)(width_c + PADDING) * height_c;
+        uint8_t* rgb = malloc((size_t)stride_rgb * height);
+        uint8_t* ref = calloc(size_out, 1);
+        uint8_t* out = calloc(size_out, 1);
+        for(int i = 0; i < stride_rgb * height; i++) {
+            rgb[i] = rand() % 256;
+        }
+
+        // The scalar code against the floating point formulas
+        convert(COLOR_BACKEND_SCALAR, rgb, width, height, ref);
+        int max_err = 0;
+        for(int i = 0; i < height; i++) {
+            for(int j = 0; j < width; j++) {
+                const uint8_t* p = rgb + i * stride_rgb + j * 3;
+                double y = 0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2];
+                int err = abs(ref[i * (width + PADDING) + j] - (int)round(y));
+                max_err = err > max_err ? err : max_err;
+            }
+        }
+        for(int i = 0; i < height_c; i++) {
+            for(int j = 0; j < width_c; j++) {
+                double r = 0, g = 0, b = 0;
+                for(int k = 0; k < 4; k++) {
+                    int y = 2 * i + k / 2 < height ? 2 * i + k / 2 : height - 1;
+                    int x = 2 * j + k % 2 < width ? 2 * j + k % 2 : width - 1;
+                    const uint8_t* p = rgb + y * stride_rgb + x * 3;
+                    r += p[0] / 4.0;
+                    g += p[1] / 4.0;
+                    b += p[2] / 4.0;
+                }
+                double cb = -0.168736 * r - 0.331264 * g + 0.5 * b + 128;
+                double cr = 0.5 * r - 0.418688 * g - 0.081312 * b + 128;
+                const uint8_t* plane_cb = ref + (width + PADDING) * height;
+                const uint8_t* plane_cr = plane_cb + (width_c + PADDING) * height_c;
+                int err_cb = abs(plane_cb[i * (width_c + PADDING) + j] - (int)fmin(round(cb), 255));
+                int err_cr = abs(plane_cr[i * (width_c + PADDING) + j] - (int)fmin(round(cr), 255));
+                max_err = err_cb > max_err ? err_cb : max_err;
+                max_err = err_cr > max_err ? err_cr : max_err;
+            }
+        }
+        printf("%4dx%-4d scalar: max error %d\n", width, height, max_err);
+        if(max_err > 1) {
+            failed = 1;
+        }
+
+        // Every other backend must match the scalar code exactly
+        for(int b = COLOR_BACKEND_SCALAR + 1; b < COLOR_BACKEND_COUNT; b++) {
+            if(!isColorBackendSupported((ColorBackend)b)) {
+                continue;
+            }
+            memset(out, 0, size_out);
+            convert((ColorBackend)b, rgb, width, height, out);
+            int mismatches = 0;
+            for(size_t i = 0; i < size_out; i++) {
+                mismatches += out[i] != ref[i];
+            }
+            printf("%4dx%-4d %-6s: %d mismatches\n", width, height, getColorBackendName((ColorBackend)b), mismatches);
+            if(mismatches) {
+                failed = 1;
+            }
+        }
+        free(rgb);
+        free(ref);
+        free(out);
+    }
+    return failed;
+}
@@ -7,6 +7,9 @@ int main() {
     imageinfo.width = 16;
     imageinfo.height = 16;
     char filenmae[15] = FILENAME;
-    createMLV(filenmae, imageinfo);
-    return 0;
+    Muxer mux;
+    if(createMLV(&mux, filenmae, imageinfo, 0) != 0) {
+        return 1;
+    }
+    return closeMuxer(&mux);
 }
\ No newline at end of file
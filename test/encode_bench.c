@@ -0,0 +1,425 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ingest.h"
+#include "jpegfixture.h"
+#include "profile.h"
+#include "sequence.h"
+
+// End-to-end throughput of the sequence encoder.
+//
+// Usage: encode_bench [-j threads,...] [-s WxH,...] [-n frames] [-q]
+//                     [-f table|json|csv] [-o results] [pattern]
+//
+// Encodes a numbered JPEG sequence (the bundled inputFiles by default) with
+// the settings of test.c once per thread count, and with -s also copies
+// of it scaled to each size, such as 1920x1080. Every run is a child
+// process of its own, so its peak RSS is its own. Reported per run:
+// frames/s, seconds per stage, output bytes per frame, the ratio of JPEG
+// input to MPEG output, and the PSNR of what a decoder shows against the
+// decoded JPEGs. B pictures are reconstructed for that, which the
+// encoder does not need; that time and the PSNR itself are not counted.
+// Stage timers cost a few percent, -q turns them off.
+
+#define INPUTPATTERN "../inputFiles/Image%03d.jpeg"
+#define FIRST_FRAME 1
+#define SYNTHETIC_QUALITY 90
+#define MAX_RUNS 16
+
+typedef enum OutputFormat {
+    FORMAT_TABLE = 0,
+    FORMAT_JSON,
+    FORMAT_CSV,
+} OutputFormat;
+
+typedef struct BenchResult {
+    int ok;
+    int width;
+    int height;
+    int threads;        // 0: one per core
+    int frames;
+    double seconds;
+    double fps;
+    long output_bytes;
+    long jpeg_bytes;
+    double psnr_y;
+    double psnr;        // all three planes
+    long peak_rss_kb;
+    double stage_ms[PROFILE_STAGE_COUNT];
+} BenchResult;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Comma-separated list of integers, e.g. 1,2,4
+static int parseList(const char* text, int* values, int max_values) {
+    int count = 0;
+    while(*text && count < max_values) {
+        char* end;
+        values[count++] = (int)strtol(text, &end, 10);
+        text = *end == ',' ? end + 1 : end;
+        if(end == text && *end) {
+            return -1;
+        }
+    }
+    return count;
+}
+
+// Comma-separated list of sizes, e.g. 1920x1080,3840x2160
+static int parseSizes(const char* text, int sizes[][2], int max_sizes) {
+    int count = 0;
+    while(*text && count < max_sizes) {
+        int consumed;
+        if(sscanf(text, "%dx%d%n", &sizes[count][0], &sizes[count][1], &consumed) != 2) {
+            return -1;
+        }
+        if(sizes[count][0] <= 0 || sizes[count][1] <= 0) {
+            return -1;
+        }
+        count++;
+        text += consumed;
+        text += *text == ',';
+    }
+    return count;
+}
+
+// Rows of a packed RGB picture
+static void copyRow(uint8_t* rgb, int y, int width, void* opaque) {
+    memcpy(rgb, (const uint8_t*)opaque + (size_t)y * width * 3, (size_t)width * 3);
+}
+
+// Bilinear resampling of packed RGB
+static void scaleRgb(const uint8_t* src, int src_width, int src_height, uint8_t* dst, int width, int height) {
+    for(int y = 0; y < height; y++) {
+        double sy = (y + 0.5) * src_height / height - 0.5;
+        int y0 = sy < 0 ? 0 : (int)sy;
+        int y1 = y0 + 1 < src_height ? y0 + 1 : y0;
+        double fy = sy < 0 ? 0 : sy - y0;
+        for(int x = 0; x < width; x++) {
+            double sx = (x + 0.5) * src_width / width - 0.5;
+            int x0 = sx < 0 ? 0 : (int)sx;
+            int x1 = x0 + 1 < src_width ? x0 + 1 : x0;
+            double fx = sx < 0 ? 0 : sx - x0;
+            for(int c = 0; c < 3; c++) {
+                double top = src[((size_t)y0 * src_width + x0) * 3 + c] * (1 - fx) + src[((size_t)y0 * src_width + x1) * 3 + c] * fx;
+                double bottom = src[((size_t)y1 * src_width + x0) * 3 + c] * (1 - fx) + src[((size_t)y1 * src_width + x1) * 3 + c] * fx;
+                dst[((size_t)y * width + x) * 3 + c] = (uint8_t)(top * (1 - fy) + bottom * fy + 0.5);
+            }
+        }
+    }
+}
+
+// Copies of the first `count` frames scaled to width x height in `dir`
+static int writeSyntheticSequence(const char* pattern, int count, int width, int height, const char* dir) {
+    uint8_t* scaled = malloc((size_t)width * height * 3);
+    for(int n = 0; n < count; n++) {
+        char filename[INGEST_MAX_PATH];
+        int src_width;
+        int src_height;
+        snprintf(filename, sizeof(filename), pattern, FIRST_FRAME + n);
+        uint8_t* rgb = readJpegRgb(filename, &src_width, &src_height);
+        if(!rgb) {
+            free(scaled);
+            return -1;
+        }
+        scaleRgb(rgb, src_width, src_height, scaled, width, height);
+        free(rgb);
+        snprintf(filename, sizeof(filename), "%s/Image%03d.jpeg", dir, FIRST_FRAME + n);
+        if(writeJpegFixture(filename, width, height, SYNTHETIC_QUALITY, copyRow, scaled) != 0) {
+            free(scaled);
+            return -1;
+        }
+    }
+    free(scaled);
+    return 0;
+}
+
+// Squared error of two frames of one size, luma and all planes
+static void addSquaredError(const Frame* a, const Frame* b, uint64_t* sse_y, uint64_t* sse) {
+    const uint8_t* planes_a[3] = { a->planes.y, a->planes.cb, a->planes.cr };
+    const uint8_t* planes_b[3] = { b->planes.y, b->planes.cb, b->planes.cr };
+    int strides_a[3] = { a->planes.stride_y, a->planes.stride_cb, a->planes.stride_cr };
+    int strides_b[3] = { b->planes.stride_y, b->planes.stride_cb, b->planes.stride_cr };
+    for(int c = 0; c < 3; c++) {
+        int width = c == 0 ? a->width : (a->width + 1) / 2;
+        int height = c == 0 ? a->height : (a->height + 1) / 2;
+        uint64_t sum = 0;
+        for(int i = 0; i < height; i++) {
+            const uint8_t* row_a = planes_a[c] + (size_t)i * strides_a[c];
+            const uint8_t* row_b = planes_b[c] + (size_t)i * strides_b[c];
+            for(int j = 0; j < width; j++) {
+                int d = row_a[j] - row_b[j];
+                sum += d * d;
+            }
+        }
+        if(c == 0) {
+            *sse_y += sum;
+        }
+        *sse += sum;
+    }
+}
+
+static double psnr(uint64_t sse, uint64_t samples) {
+    return sse == 0 ? 99.0 : 10.0 * log10(255.0 * 255.0 * samples / sse);
+}
+
+// Error of what a decoder shows against the input, and the time taken
+// to measure it, which does not count as encoding
+typedef struct Measure {
+    uint64_t sse_y;
+    uint64_t sse;
+    double seconds;
+} Measure;
+
+static void measurePicture(const EncoderContext* ctx, const CodedPicture* picture, void* opaque) {
+    Measure* measure = opaque;
+    double start = now();
+    if(ctx->decoded) {
+        addSquaredError(ctx->decoded, picture->image.frame, &measure->sse_y, &measure->sse);
+    }
+    measure->seconds += now() - start;
+}
+
+// One run of test.c's sequence encoder, measuring as it goes
+static void encodeRun(const char* pattern, int count, int num_threads, int profile, const char* filename_o, BenchResult* result) {
+    memset(result, 0, sizeof(*result));
+    result->threads = num_threads;
+    for(int n = 0; n < count; n++) {
+        char filename[INGEST_MAX_PATH];
+        struct stat st;
+        snprintf(filename, sizeof(filename), pattern, FIRST_FRAME + n);
+        if(stat(filename, &st) == 0) {
+            result->jpeg_bytes += st.st_size;
+        }
+    }
+    if(profile) {
+        enableProfile(0);
+    }
+
+    Measure measure = { 0 };
+    SequenceOptions options = { .first = FIRST_FRAME, .count = count, .num_threads = num_threads,
+                                .reconstruct_bidir = 1, .done = measurePicture, .opaque = &measure };
+    SequenceStats stats;
+    double start = now();
+    int ret = encodeSequence(filename_o, pattern, &options, &stats);
+    result->seconds = now() - start - measure.seconds;
+    result->width = stats.width;
+    result->height = stats.height;
+    result->frames = stats.frames;
+    result->output_bytes = (long)stats.output_bytes;
+
+    uint64_t luma = (uint64_t)stats.width * stats.height * stats.frames;
+    uint64_t samples = luma + 2 * (uint64_t)((stats.width + 1) / 2) * ((stats.height + 1) / 2) * stats.frames;
+    result->fps = stats.frames / result->seconds;
+    result->psnr_y = psnr(measure.sse_y, luma);
+    result->psnr = psnr(measure.sse, samples);
+    for(int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+        result->stage_ms[s] = profileStageTime((ProfileStage)s) / 1e6;
+    }
+    result->ok = ret == 0 && stats.frames == count;
+}
+
+// Run encodeRun in a child and take its peak RSS from the kernel
+static int benchmark(const char* pattern, int count, int num_threads, int profile, BenchResult* result) {
+    char filename_o[] = "/tmp/encode_bench_XXXXXX";
+    int fd_o = mkstemp(filename_o);
+    int fds[2];
+    if(fd_o < 0 || pipe(fds) != 0) {
+        return -1;
+    }
+    close(fd_o);
+    fflush(stdout);
+    pid_t child = fork();
+    if(child == 0) {
+        close(fds[0]);
+        encodeRun(pattern, count, num_threads, profile, filename_o, result);
+        ssize_t written = write(fds[1], result, sizeof(*result));
+        _exit(written == (ssize_t)sizeof(*result) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    close(fds[1]);
+    memset(result, 0, sizeof(*result));
+    int ok = child > 0 && read(fds[0], result, sizeof(*result)) == (ssize_t)sizeof(*result);
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage;
+    if(child > 0 && wait4(child, &status, 0, &usage) == child) {
+        result->peak_rss_kb = usage.ru_maxrss;
+    }
+    remove(filename_o);
+    return ok && result->ok && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static void printResults(FILE* file, OutputFormat format, const BenchResult* results, int num_results) {
+    if(format == FORMAT_JSON) {
+        fprintf(file, "{\"runs\":[\n");
+        for(int r = 0; r < num_results; r++) {
+            const BenchResult* b = &results[r];
+            fprintf(file, "  {\"width\":%d,\"height\":%d,\"threads\":%d,\"frames\":%d,\"seconds\":%.3f,\"fps\":%.2f,"
+                    "\"output_bytes\":%ld,\"bytes_per_frame\":%.0f,\"jpeg_bytes\":%ld,\"compression_ratio\":%.3f,"
+                    "\"psnr_y\":%.3f,\"psnr\":%.3f,\"peak_rss_kb\":%ld,\"stage_ms\":{",
+                    b->width, b->height, b->threads, b->frames, b->seconds, b->fps, b->output_bytes,
+                    (double)b->output_bytes / b->frames, b->jpeg_bytes, (double)b->jpeg_bytes / b->output_bytes,
+                    b->psnr_y, b->psnr, b->peak_rss_kb);
+            for(int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+                fprintf(file, "%s\"%s\":%.1f", s ? "," : "", profileStageName((ProfileStage)s), b->stage_ms[s]);
+            }
+            fprintf(file, "}}%s\n", r + 1 < num_results ? "," : "");
+        }
+        fprintf(file, "]}\n");
+        return;
+    }
+    if(format == FORMAT_CSV) {
+        fprintf(file, "width,height,threads,frames,seconds,fps,output_bytes,bytes_per_frame,jpeg_bytes,compression_ratio,psnr_y,psnr,peak_rss_kb");
+        for(int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+            fprintf(file, ",%s_ms", profileStageName((ProfileStage)s));
+        }
+        fprintf(file, "\n");
+        for(int r = 0; r < num_results; r++) {
+            const BenchResult* b = &results[r];
+            fprintf(file, "%d,%d,%d,%d,%.3f,%.2f,%ld,%.0f,%ld,%.3f,%.3f,%.3f,%ld", b->width, b->height, b->threads,
+                    b->frames, b->seconds, b->fps, b->output_bytes, (double)b->output_bytes / b->frames, b->jpeg_bytes,
+                    (double)b->jpeg_bytes / b->output_bytes, b->psnr_y, b->psnr, b->peak_rss_kb);
+            for(int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+                fprintf(file, ",%.1f", b->stage_ms[s]);
+            }
+            fprintf(file, "\n");
+        }
+        return;
+    }
+    fprintf(file, "%-10s %7s %6s %8s %12s %7s %7s %7s %8s\n",
+            "size", "threads", "frames", "fps", "bytes/frame", "ratio", "PSNR Y", "PSNR", "RSS MB");
+    for(int r = 0; r < num_results; r++) {
+        const BenchResult* b = &results[r];
+        char size[32];
+        snprintf(size, sizeof(size), "%dx%d", b->width, b->height);
+        fprintf(file, "%-10s %7d %6d %8.2f %12.0f %7.2f %7.2f %7.2f %8.1f\n", size, b->threads, b->frames, b->fps,
+                (double)b->output_bytes / b->frames, (double)b->jpeg_bytes / b->output_bytes, b->psnr_y, b->psnr,
+                b->peak_rss_kb / 1024.0);
+        int first = 1;
+        for(int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+            if(b->stage_ms[s] > 0) {
+                fprintf(file, "%s%s %.0f ms", first ? "    " : ", ", profileStageName((ProfileStage)s), b->stage_ms[s]);
+                first = 0;
+            }
+        }
+        if(!first) {
+            fprintf(file, "\n");
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int threads[MAX_RUNS] = { 1 };
+    int num_threads = 1;
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_cores > 1) {
+        threads[num_threads++] = (int)num_cores;
+    }
+    int sizes[MAX_RUNS][2];
+    int num_sizes = 0;
+    int max_frames = 0;
+    int profile = 1;
+    OutputFormat format = FORMAT_TABLE;
+    const char* filename_results = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "j:s:n:qf:o:")) != -1) {
+        switch(opt) {
+        case 'j':
+            num_threads = parseList(optarg, threads, MAX_RUNS);
+            break;
+        case 's':
+            num_sizes = parseSizes(optarg, sizes, MAX_RUNS);
+            break;
+        case 'n':
+            max_frames = atoi(optarg);
+            break;
+        case 'q':
+            profile = 0;
+            break;
+        case 'f':
+            format = strcmp(optarg, "json") == 0 ? FORMAT_JSON : (strcmp(optarg, "csv") == 0 ? FORMAT_CSV : FORMAT_TABLE);
+            break;
+        case 'o':
+            filename_results = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j threads,...] [-s WxH,...] [-n frames] [-q] [-f table|json|csv] [-o results] [pattern]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(num_threads <= 0 || num_sizes < 0) {
+        fprintf(stderr, "Invalid thread counts or sizes!\n");
+        return EXIT_FAILURE;
+    }
+    const char* pattern = optind < argc ? argv[optind] : INPUTPATTERN;
+    int count = countIngestFrames(pattern, FIRST_FRAME);
+    if(max_frames > 0 && max_frames < count) {
+        count = max_frames;
+    }
+    if(count == 0) {
+        fprintf(stderr, "No input files match %s!\n", pattern);
+        return EXIT_FAILURE;
+    }
+
+    BenchResult results[MAX_RUNS * (MAX_RUNS + 1)];
+    int num_results = 0;
+    int failed = 0;
+    // Size -1 is the sequence as it is
+    for(int s = -1; s < num_sizes; s++) {
+        char dir[] = "/tmp/encode_bench_frames_XXXXXX";
+        char synthetic[INGEST_MAX_PATH];
+        const char* run_pattern = pattern;
+        if(s >= 0) {
+            if(!mkdtemp(dir)) {
+                return EXIT_FAILURE;
+            }
+            fprintf(stderr, "Scaling %d frames to %dx%d\n", count, sizes[s][0], sizes[s][1]);
+            if(writeSyntheticSequence(pattern, count, sizes[s][0], sizes[s][1], dir) != 0) {
+                fprintf(stderr, "Error writing frames to %s!\n", dir);
+                return EXIT_FAILURE;
+            }
+            snprintf(synthetic, sizeof(synthetic), "%s/Image%%03d.jpeg", dir);
+            run_pattern = synthetic;
+        }
+        for(int t = 0; t < num_threads; t++) {
+            fprintf(stderr, "Encoding %s with %d threads\n", run_pattern, threads[t]);
+            if(benchmark(run_pattern, count, threads[t], profile, &results[num_results]) != 0) {
+                fprintf(stderr, "Run with %d threads failed!\n", threads[t]);
+                failed = 1;
+                continue;
+            }
+            num_results++;
+        }
+        if(s >= 0) {
+            for(int n = 0; n < count; n++) {
+                char filename[INGEST_MAX_PATH];
+                snprintf(filename, sizeof(filename), synthetic, FIRST_FRAME + n);
+                remove(filename);
+            }
+            rmdir(dir);
+        }
+    }
+
+    printResults(stdout, format, results, num_results);
+    if(filename_results) {
+        FILE* file = fopen(filename_results, "w");
+        if(!file) {
+            fprintf(stderr, "Error creating %s!\n", filename_results);
+            return EXIT_FAILURE;
+        }
+        printResults(file, format, results, num_results);
+        fclose(file);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
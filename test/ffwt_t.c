@@ -0,0 +1,64 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ffwt.h"
+
+// Blocks in one row of macroblocks of a 1920 pixel wide picture: two
+// luma blocks across each macroblock
+#define ROW_BLOCKS (1920 / 16 * 2)
+
+// A batch of `count` blocks against the same blocks transformed one at a
+// time. Returns the largest difference.
+static double checkBatch(int count) {
+    double (*blocks)[8][8] = malloc(sizeof(double[8][8]) * count);
+    double (*ref)[8][8] = malloc(sizeof(double[8][8]) * count);
+    if(!blocks || !ref) {
+        free(blocks);
+        free(ref);
+        return INFINITY;
+    }
+    for(int b = 0; b < count; b++) {
+        for(int i = 0; i < 64; i++) {
+            blocks[b][i / 8][i % 8] = rand() % 256 - 128;
+        }
+    }
+    memcpy(ref, blocks, sizeof(double[8][8]) * count);
+    performdct2dBatch(blocks, count);
+    // More distinct sizes than the cache keeps
+    double max_diff = 0;
+    for(int b = 0; b < count; b++) {
+        performdct2d(ref[b]);
+        for(int i = 0; i < 64; i++) {
+            double diff = fabs(blocks[b][i / 8][i % 8] - ref[b][i / 8][i % 8]);
+            max_diff = diff > max_diff ? diff : max_diff;
+        }
+    }
+    free(blocks);
+    free(ref);
+    return max_diff;
+}
+
+int main() {
+    int failed = 0;
+    srand(8);
+    initDCTPlans();
+    // A macroblock row, its cached plan used again, and one block
+    int counts[] = { ROW_BLOCKS, ROW_BLOCKS, 1, 2, 3 };
+    for(size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        double diff = checkBatch(counts[i]);
+        printf("%d blocks: largest difference %g\n", counts[i], diff);
+        failed |= !(diff < 1e-9);
+    }
+    // More distinct sizes than the cache keeps
+    double max_diff = 0;
+    for(int count = 4; count < 4 + 2 * MAX_BATCH_PLANS; count++) {
+        double diff = checkBatch(count);
+        max_diff = diff > max_diff ? diff : max_diff;
+    }
+    printf("%d more sizes: largest difference %g\n", 2 * MAX_BATCH_PLANS, max_diff);
+    failed |= !(max_diff < 1e-9);
+    cleanupDCTPlans();
+    return failed;
+}
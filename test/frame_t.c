@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+#define WIDTH 37
+#define HEIGHT 21
+
+static int isAligned(const uint8_t* p) {
+    return (uintptr_t)p % FRAME_ALIGN == 0;
+}
+
+// Every border pixel equals the nearest picture pixel
+static int checkPadding(const uint8_t* plane, int stride, int width, int height, int pad) {
+    int mismatches = 0;
+    for(int i = -pad; i < height + pad; i++) {
+        for(int j = -pad; j < width + pad; j++) {
+            int y = i < 0 ? 0 : (i >= height ? height - 1 : i);
+            int x = j < 0 ? 0 : (j >= width ? width - 1 : j);
+            mismatches += plane[i * stride + j] != plane[y * stride + x];
+        }
+    }
+    return mismatches;
+}
+
+int main() {
+    int failed = 0;
+
+    Frame* frame = allocFrame(WIDTH, HEIGHT, FRAME_PAD);
+    YuvPlanes* planes = &frame->planes;
+    int aligned = isAligned(planes->y) && isAligned(planes->cb) && isAligned(planes->cr) &&
+        planes->stride_y % FRAME_ALIGN == 0 && planes->stride_cb % FRAME_ALIGN == 0 && planes->stride_cr % FRAME_ALIGN == 0;
+    printf("strides %d %d %d, %zu bytes, aligned: %d\n", planes->stride_y, planes->stride_cb, planes->stride_cr,
+           frame->size, aligned);
+    failed |= !aligned;
+
+    for(int i = 0; i < HEIGHT; i++) {
+        for(int j = 0; j < WIDTH; j++) {
+            planes->y[i * planes->stride_y + j] = (uint8_t)(i * 7 + j * 3);
+        }
+    }
+    for(int i = 0; i < (HEIGHT + 1) / 2; i++) {
+        for(int j = 0; j < (WIDTH + 1) / 2; j++) {
+            planes->cb[i * planes->stride_cb + j] = (uint8_t)(i * 5 + j);
+            planes->cr[i * planes->stride_cr + j] = (uint8_t)(255 - i - j * 9);
+        }
+    }
+    padFrame(frame);
+    int mismatches = checkPadding(planes->y, planes->stride_y, WIDTH, HEIGHT, FRAME_PAD) +
+        checkPadding(planes->cb, planes->stride_cb, (WIDTH + 1) / 2, (HEIGHT + 1) / 2, FRAME_PAD / 2) +
+        checkPadding(planes->cr, planes->stride_cr, (WIDTH + 1) / 2, (HEIGHT + 1) / 2, FRAME_PAD / 2);
+    printf("padding mismatches: %d\n", mismatches);
+    failed |= mismatches != 0;
+    freeFrame(frame);
+
+    // Released frames come back; a new size replaces them
+    FramePool pool;
+    initFramePool(&pool, FRAME_PAD);
+    Frame* a = acquireFrame(&pool, WIDTH, HEIGHT);
+    Frame* b = acquireFrame(&pool, WIDTH, HEIGHT);
+    releaseFrame(&pool, a);
+    releaseFrame(&pool, b);
+    Frame* c = acquireFrame(&pool, WIDTH, HEIGHT);
+    Frame* d = acquireFrame(&pool, WIDTH, HEIGHT);
+    int reused = pool.num_allocated == 2 && (c == a || c == b) && (d == a || d == b) && c != d;
+    releaseFrame(&pool, c);
+    Frame* e = acquireFrame(&pool, 2 * WIDTH, HEIGHT);
+    int resized = pool.num_allocated == 3 && pool.num_frames == 0 && e->width == 2 * WIDTH;
+    printf("allocated: %d, reused: %d, resized: %d\n", pool.num_allocated, reused, resized);
+    failed |= !reused || !resized;
+    releaseFrame(&pool, d);
+    releaseFrame(&pool, e);
+    freeFramePool(&pool);
+    return failed;
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "createMLV.h"
+#include "gop.h"
+
+// Push `count` frames and print the coded order as type, display index and
+// temporal reference, with c or o after the I of a closed or open GOP
+static void codedOrder(const GopConfig* config, int count, char* out) {
+    ReorderBuffer reorder;
+    initReorderBuffer(&reorder, config);
+    out[0] = '\0';
+    for(int n = 0; n <= count; n++) {
+        if(n < count) {
+            ImageInfo frame = { 0 };
+            pushReorderFrame(&reorder, &frame, gopPictureType(config, n));
+        } else {
+            flushReorderBuffer(&reorder);
+        }
+        CodedPicture* picture;
+        while((picture = nextCodedPicture(&reorder))) {
+            char token[32];
+            snprintf(token, sizeof(token), "%s%c%d/%d", out[0] ? " " : "", " IPB"[picture->type],
+                     picture->display_index, picture->temporal_reference);
+            if(picture->gop_start) {
+                snprintf(token + strlen(token), sizeof(token) - strlen(token), "%s", picture->closed_gop ? "c" : "o");
+            }
+            strcat(out, token);
+        }
+    }
+    freeReorderBuffer(&reorder);
+}
+
+static const struct {
+    GopConfig config;
+    int count;
+    const char* expected;
+} cases[] = {
+    // The B pictures before an I belong to the GOP of that I
+    { { 6, 3, 0 }, 10, "I0/0c P3/3 B1/1 B2/2 I6/2o B4/0 B5/1 P9/5 B7/3 B8/4" },
+    // Trailing B pictures end with a P
+    { { 6, 3, 0 }, 8, "I0/0c P3/3 B1/1 B2/2 I6/2o B4/0 B5/1 P7/3" },
+    { { 5, 2, 0 }, 7, "I0/0c P2/2 B1/1 P4/4 B3/3 I5/0c P6/1" },
+    // A closed GOP ends with a P
+    { { 6, 3, 1 }, 10, "I0/0c P3/3 B1/1 B2/2 P5/5 B4/4 I6/0c P9/3 B7/1 B8/2" },
+    { { 4, 1, 0 }, 5, "I0/0c P1/1 P2/2 P3/3 I4/0c" },
+};
+
+int main() {
+    int failed = 0;
+    char order[1024];
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        codedOrder(&cases[i].config, cases[i].count, order);
+        int ok = strcmp(order, cases[i].expected) == 0;
+        printf("N=%d M=%d %s: %s %s\n", cases[i].config.size, cases[i].config.distance,
+               cases[i].config.closed ? "closed" : "open  ", order, ok ? "ok" : "FAILED");
+        if(!ok) {
+            printf("  expected %s\n", cases[i].expected);
+            failed = 1;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ingest.h"
+#include "jpegfixture.h"
+
+#define PATTERN "ingest_t%03d.jpeg"
+#define WIDTH 64
+#define HEIGHT 48
+#define NUM_FRAMES 24
+#define NUM_THREADS 8
+#define NUM_SLOTS 3
+
+// Frame n is flat with a luma of its own
+static int frameLuma(int n) {
+    return 16 + 8 * n;
+}
+
+static void fillFlat(uint8_t* rgb, int y, int width, void* opaque) {
+    (void)y;
+    memset(rgb, *(const int*)opaque, (size_t)width * 3);
+}
+
+// Whether `image` is frame n
+static int isFrame(const ImageInfo* image, int n) {
+    int luma = image->frame->planes.y[(HEIGHT / 2) * image->frame->planes.stride_y + WIDTH / 2];
+    return image->width == WIDTH && image->height == HEIGHT && abs(luma - frameLuma(n)) <= 2;
+}
+
+// Take up to `limit` frames, holding `held` at a time before releasing the
+// oldest, and count those that came in order
+static int takeFrames(IngestPipeline* pipeline, int limit, int held) {
+    int in_order = 0;
+    int taken = 0;
+    int outstanding = 0;
+    ImageInfo* image;
+    while(taken < limit && (image = nextIngestFrame(pipeline))) {
+        in_order += isFrame(image, taken);
+        taken++;
+        if(++outstanding == held) {
+            releaseIngestFrame(pipeline);
+            outstanding--;
+        }
+    }
+    while(outstanding-- > 0) {
+        releaseIngestFrame(pipeline);
+    }
+    return taken == in_order ? taken : -1;
+}
+
+int main() {
+    int failed = 0;
+    char filename[INGEST_MAX_PATH];
+    for(int n = 0; n < NUM_FRAMES; n++) {
+        snprintf(filename, sizeof(filename), PATTERN, n);
+        int luma = frameLuma(n);
+        failed |= writeJpegFixture(filename, WIDTH, HEIGHT, 95, fillFlat, &luma) != 0;
+    }
+    int count = countIngestFrames(PATTERN, 0);
+    printf("%d files\n", count);
+    failed |= count != NUM_FRAMES;
+
+    // More decoders than slots still hand the frames out in order, also
+    // with every slot held at once
+    for(int held = 1; held <= NUM_SLOTS; held++) {
+        IngestPipeline pipeline;
+        int taken = -1;
+        if(startIngest(&pipeline, PATTERN, 0, NUM_FRAMES, NUM_THREADS, NUM_SLOTS) == 0) {
+            taken = takeFrames(&pipeline, NUM_FRAMES + 1, held);
+            failed |= pipeline.failed;
+            stopIngest(&pipeline);
+        }
+        printf("%d threads, %d slots, %d held: %d frames in order\n", NUM_THREADS, NUM_SLOTS, held, taken);
+        failed |= taken != NUM_FRAMES;
+    }
+
+    // Stopping in the middle of the sequence, with the decoders waiting for
+    // slots, and cancelling, after which no frame comes
+    IngestPipeline pipeline;
+    int taken = -1;
+    if(startIngest(&pipeline, PATTERN, 0, NUM_FRAMES, NUM_THREADS, NUM_SLOTS) == 0) {
+        taken = takeFrames(&pipeline, NUM_FRAMES / 2, 1);
+        stopIngest(&pipeline);
+    }
+    int cancelled = 0;
+    if(startIngest(&pipeline, PATTERN, 0, NUM_FRAMES, NUM_THREADS, NUM_SLOTS) == 0) {
+        ImageInfo* image = nextIngestFrame(&pipeline);
+        cancelIngest(&pipeline);
+        cancelled = image && isFrame(image, 0) && !nextIngestFrame(&pipeline) && !pipeline.failed;
+        releaseIngestFrame(&pipeline);
+        stopIngest(&pipeline);
+    }
+    printf("stopped after %d frames, cancel %s\n", taken, cancelled ? "ends the sequence" : "FAILED");
+    failed |= taken != NUM_FRAMES / 2 || !cancelled;
+
+    // The sequence ends at a file that cannot be read
+    snprintf(filename, sizeof(filename), PATTERN, NUM_FRAMES / 2);
+    FILE* file = fopen(filename, "wb");
+    fputs("no JPEG", file);
+    fclose(file);
+    taken = -1;
+    int marked = 0;
+    if(startIngest(&pipeline, PATTERN, 0, NUM_FRAMES, NUM_THREADS, NUM_SLOTS) == 0) {
+        taken = takeFrames(&pipeline, NUM_FRAMES, 1);
+        marked = pipeline.failed;
+        stopIngest(&pipeline);
+    }
+    printf("bad file %d: %d frames, %s\n", NUM_FRAMES / 2, taken, marked ? "failed" : "NOT MARKED");
+    failed |= taken != NUM_FRAMES / 2 || !marked;
+
+    for(int n = 0; n < NUM_FRAMES; n++) {
+        snprintf(filename, sizeof(filename), PATTERN, n);
+        remove(filename);
+    }
+    return failed;
+}
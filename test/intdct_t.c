@@ -0,0 +1,127 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ffwt.h"
+#include "intdct.h"
+
+#define NUM_BLOCKS 10000
+
+// Inverse DCT against the direct double-precision formula, on coefficients
+// of the range a decoder sees. Returns the largest error.
+static int checkIDCT(void) {
+    int max_err = 0;
+    srand(1180);
+    for(int n = 0; n < NUM_BLOCKS; n++) {
+        int16_t block[64];
+        double coef[64];
+        for(int i = 0; i < 64; i++) {
+            // Mostly small values with a few large ones, like dequantized blocks
+            int range = i == 0 || rand() % 8 == 0 ? 2048 : 64;
+            block[i] = rand() % (2 * range) - range;
+            coef[i] = block[i];
+        }
+        performIntIDCT(block);
+        for(int x = 0; x < 8; x++) {
+            for(int y = 0; y < 8; y++) {
+                double sum = 0;
+                for(int u = 0; u < 8; u++) {
+                    for(int v = 0; v < 8; v++) {
+                        double cu = u == 0 ? 1.0 / sqrt(2.0) : 1.0;
+                        double cv = v == 0 ? 1.0 / sqrt(2.0) : 1.0;
+                        sum += cu * cv * coef[u * 8 + v] * cos((2 * x + 1) * u * M_PI / 16) * cos((2 * y + 1) * v * M_PI / 16);
+                    }
+                }
+                int err = abs(block[x * 8 + y] - (int)round(sum / 4));
+                if(err > max_err) {
+                    max_err = err;
+                }
+            }
+        }
+    }
+    return max_err;
+}
+
+// Blocks loaded from strided pixels must transform exactly like the same
+// samples copied into a block. Returns the number of differing blocks.
+static int checkStridedLoads(void) {
+    enum { STRIDE = 40 };
+    uint8_t src[8 * STRIDE];
+    uint8_t pred[8 * STRIDE];
+    int mismatches = 0;
+    for(int n = 0; n < NUM_BLOCKS / 10; n++) {
+        for(int i = 0; i < 8 * STRIDE; i++) {
+            src[i] = rand() % 256;
+            pred[i] = rand() % 256;
+        }
+        // Any alignment of the rows
+        int offset = n % (STRIDE - 8);
+        int16_t pixels[64];
+        int16_t residual[64];
+        for(int i = 0; i < 8; i++) {
+            for(int j = 0; j < 8; j++) {
+                pixels[i * 8 + j] = src[offset + i * STRIDE + j];
+                residual[i * 8 + j] = src[offset + i * STRIDE + j] - pred[i * STRIDE + j];
+            }
+        }
+        performIntDCT(pixels);
+        performIntDCT(residual);
+        int16_t block[64];
+        performIntDCTPixels(block, src + offset, STRIDE);
+        mismatches += memcmp(block, pixels, sizeof(block)) != 0;
+        performIntDCTResidual(block, src + offset, STRIDE, pred, STRIDE);
+        mismatches += memcmp(block, residual, sizeof(block)) != 0;
+    }
+    return mismatches;
+}
+
+// Compare every fixed-point backend against the FFTW reference
+int main() {
+    int failed = 0;
+    srand(2087);
+    for(int b = 0; b < DCT_BACKEND_COUNT; b++) {
+        if(!isDCTBackendSupported((DCTBackend)b)) {
+            printf("%-6s: not supported on this CPU\n", getDCTBackendName((DCTBackend)b));
+            continue;
+        }
+        setDCTBackend((DCTBackend)b);
+        srand(2087);
+        int max_err = 0;
+        for(int n = 0; n < NUM_BLOCKS; n++) {
+            // Half of the blocks are pixels, the other half residuals
+            int residual = n & 1;
+            int16_t block[64];
+            double ref[8][8];
+            for(int i = 0; i < 64; i++) {
+                block[i] = residual ? rand() % 511 - 255 : rand() % 256;
+                ref[i / 8][i % 8] = block[i];
+            }
+            performdct2d(ref);
+            performIntDCT(block);
+            for(int u = 0; u < 8; u++) {
+                for(int v = 0; v < 8; v++) {
+                    double cu = u == 0 ? 1.0 / sqrt(2.0) : 1.0;
+                    double cv = v == 0 ? 1.0 / sqrt(2.0) : 1.0;
+                    int expected = (int)round(ref[u][v] * cu * cv / 16);
+                    int err = abs(block[u * 8 + v] - expected);
+                    if(err > max_err) {
+                        max_err = err;
+                    }
+                }
+            }
+        }
+        int strided = checkStridedLoads();
+        printf("%-6s: max error %d (tolerance %d), strided mismatches %d\n", getDCTBackendName((DCTBackend)b),
+               max_err, DCT_TOLERANCE, strided);
+        if(max_err > DCT_TOLERANCE || strided != 0) {
+            failed = 1;
+        }
+    }
+    int idct_err = checkIDCT();
+    printf("idct  : max error %d (tolerance %d)\n", idct_err, DCT_TOLERANCE);
+    if(idct_err > DCT_TOLERANCE) {
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,98 @@
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <jpeglib.h>
+
+#include "jpegfixture.h"
+
+typedef struct FixtureError {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} FixtureError;
+
+// Return to the writer instead of exiting the process
+static void jumpOnError(j_common_ptr cinfo) {
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(((FixtureError*)cinfo->err)->jump, 1);
+}
+
+int writeJpegFixture(const char* filename, int width, int height, int quality, FixtureRow fill, void* opaque) {
+    FILE* file = fopen(filename, "wb");
+    uint8_t* row = malloc((size_t)width * 3);
+    if(!file || !row) {
+        if(file) {
+            fclose(file);
+        }
+        free(row);
+        return -1;
+    }
+    struct jpeg_compress_struct cinfo;
+    FixtureError error;
+    cinfo.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = jumpOnError;
+    jpeg_create_compress(&cinfo);
+    if(setjmp(error.jump) != 0) {
+        jpeg_destroy_compress(&cinfo);
+        fclose(file);
+        free(row);
+        return -1;
+    }
+    jpeg_stdio_dest(&cinfo, file);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while(cinfo.next_scanline < cinfo.image_height) {
+        fill(row, cinfo.next_scanline, width, opaque);
+        JSAMPROW rows[1] = { row };
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+    return fclose(file);
+}
+
+uint8_t* readJpegRgb(const char* filename, int* width, int* height) {
+    FILE* file = fopen(filename, "rb");
+    if(!file) {
+        return NULL;
+    }
+    struct jpeg_decompress_struct cinfo;
+    FixtureError error;
+    cinfo.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = jumpOnError;
+    uint8_t* volatile rgb = NULL;
+    jpeg_create_decompress(&cinfo);
+    if(setjmp(error.jump) != 0) {
+        jpeg_destroy_decompress(&cinfo);
+        fclose(file);
+        free(rgb);
+        return NULL;
+    }
+    jpeg_stdio_src(&cinfo, file);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    size_t row_size = (size_t)cinfo.output_width * 3;
+    rgb = malloc(row_size * cinfo.output_height);
+    if(!rgb) {
+        jpeg_destroy_decompress(&cinfo);
+        fclose(file);
+        return NULL;
+    }
+    while(cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = rgb + cinfo.output_scanline * row_size;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(file);
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    return rgb;
+}
@@ -0,0 +1,17 @@
+#ifndef JPEGFIXTURE_H
+#define JPEGFIXTURE_H
+#include <stdint.h>
+
+// JPEG files written and read by the tests and benchmarks
+
+// Fills row `y` of a picture, `width` packed RGB pixels
+typedef void (*FixtureRow)(uint8_t* rgb, int y, int width, void* opaque);
+
+// Write a width x height RGB JPEG at `quality`, one row at a time from
+// `fill`. Returns -1 if the file cannot be written or libjpeg fails.
+int writeJpegFixture(const char* filename, int width, int height, int quality, FixtureRow fill, void* opaque);
+
+// Decode a JPEG to newly allocated packed RGB, for the caller to free.
+// NULL if it cannot be opened or decoded, or out of memory.
+uint8_t* readJpegRgb(const char* filename, int* width, int* height);
+#endif
@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bitstream.h"
+#include "colorconv.h"
+#include "encoder.h"
+#include "ffwt.h"
+#include "intdct.h"
+#include "jpegfixture.h"
+#include "motion.h"
+#include "mpeg1_encoder.h"
+#include "quantization.h"
+#include "readImage.h"
+#include "seperateMatrix.h"
+
+// Throughput of the encoder's kernels on blocks of real pictures.
+//
+// Usage: kernels_bench [-c] [image [next image]]
+//
+// Every kernel runs over the same NUM_BLOCKS blocks, a set that fits in
+// L2, for at least MIN_TIME seconds; the fastest pass is reported. Figures
+// are per 8x8 block, so a macroblock kernel counts four and color
+// conversion counts the luma blocks of the picture. MB/s is the input read.
+// -c prints CSV for comparing runs.
+
+#define INPUT_IMAGE "../inputFiles/Image001.jpeg"
+#define INPUT_NEXT_IMAGE "../inputFiles/Image002.jpeg"
+#define NUM_BLOCKS 4096
+#define NUM_MACROBLOCKS (NUM_BLOCKS / 4)
+#define MIN_TIME 0.25
+#define SCALE_QUANT 8
+
+static uint8_t pixels[NUM_BLOCKS][BLOCKSIZE * BLOCKSIZE];       // luma, then chroma from NUM_BLOCKS * 2 / 3
+static const uint8_t* sources[NUM_BLOCKS];                      // the same blocks in the picture
+static const uint8_t* next_sources[NUM_BLOCKS];                 // and in the next one
+static int source_strides[NUM_BLOCKS];
+static uint8_t macroblocks[NUM_MACROBLOCKS][MACROBLOCK_SIZE * MACROBLOCK_SIZE];
+static int levels[NUM_BLOCKS][BLOCKSIZE * BLOCKSIZE];
+static int lasts[NUM_BLOCKS];
+static int offsets[NUM_MACROBLOCKS];                            // luma macroblocks in the picture
+
+static ImageInfo picture;
+static ImageInfo next_picture;
+static uint8_t* rgb;    // packed RGB, the input of the color conversion
+static uint8_t* yuv;
+static HalfPelPlanes halfpel;
+static BitWriter bw;
+static volatile uint32_t sink;
+
+static int csv = 0;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Blocks spread evenly over the luma and chroma planes
+static void sampleBlocks(void) {
+    int width = picture.width;
+    int height = picture.height;
+    const YuvPlanes* yuv_planes = &picture.frame->planes;
+    const YuvPlanes* next_yuv_planes = &next_picture.frame->planes;
+    const uint8_t* planes[3] = { yuv_planes->y, yuv_planes->cb, yuv_planes->cr };
+    const uint8_t* next_planes[3] = { next_yuv_planes->y, next_yuv_planes->cb, next_yuv_planes->cr };
+    int strides[3] = { yuv_planes->stride_y, yuv_planes->stride_cb, yuv_planes->stride_cr };
+    int num_luma = NUM_BLOCKS * 2 / 3;
+    for(int n = 0; n < NUM_BLOCKS; n++) {
+        int c = n < num_luma ? 0 : 1 + n % 2;
+        int stride = strides[c];
+        int blocks_x = (c == 0 ? width : width / 2) / BLOCKSIZE;
+        int blocks_y = (c == 0 ? height : height / 2) / BLOCKSIZE;
+        int count = c == 0 ? num_luma : NUM_BLOCKS - num_luma;
+        int index = (int)((long)(c == 0 ? n : n - num_luma) * blocks_x * blocks_y / count);
+        size_t offset = (size_t)(index / blocks_x) * BLOCKSIZE * stride + (index % blocks_x) * BLOCKSIZE;
+        for(int i = 0; i < BLOCKSIZE; i++) {
+            for(int j = 0; j < BLOCKSIZE; j++) {
+                pixels[n][i * BLOCKSIZE + j] = planes[c][offset + i * stride + j];
+            }
+        }
+        sources[n] = planes[c] + offset;
+        next_sources[n] = next_planes[c] + offset;
+        source_strides[n] = stride;
+        lasts[n] = transformQuantizeBlock(levels[n], pixels[n], BLOCKSIZE, quant_recip_y[SCALE_QUANT]);
+    }
+
+    int mb_x = (width - MACROBLOCK_SIZE) / MACROBLOCK_SIZE;
+    int mb_y = (height - MACROBLOCK_SIZE) / MACROBLOCK_SIZE;
+    for(int n = 0; n < NUM_MACROBLOCKS; n++) {
+        int index = (int)((long)n * mb_x * mb_y / NUM_MACROBLOCKS);
+        offsets[n] = (index / mb_x) * MACROBLOCK_SIZE * yuv_planes->stride_y + (index % mb_x) * MACROBLOCK_SIZE;
+        for(int i = 0; i < MACROBLOCK_SIZE; i++) {
+            memcpy(macroblocks[n] + i * MACROBLOCK_SIZE, yuv_planes->y + offsets[n] + i * yuv_planes->stride_y, MACROBLOCK_SIZE);
+        }
+    }
+}
+
+// Run `pass` until MIN_TIME has passed and print its fastest pass
+static void measure(const char* kernel, const char* backend, uint32_t (*pass)(void), long blocks, int bytes_per_block) {
+    double best = 1e30;
+    double total = 0;
+    do {
+        double start = now();
+        sink += pass();
+        double elapsed = now() - start;
+        best = elapsed < best ? elapsed : best;
+        total += elapsed;
+    } while(total < MIN_TIME);
+    double ns = best * 1e9 / blocks;
+    double blocks_per_s = blocks / best;
+    double mb_per_s = blocks_per_s * bytes_per_block / 1e6;
+    if(csv) {
+        printf("%s,%s,%.2f,%.0f,%.1f\n", kernel, backend, ns, blocks_per_s, mb_per_s);
+    } else {
+        printf("%-24s %-7s %10.2f %14.0f %10.1f\n", kernel, backend, ns, blocks_per_s, mb_per_s);
+    }
+}
+
+static uint32_t passDCT(void) {
+    uint32_t sum = 0;
+    for(int n = 0; n < NUM_BLOCKS; n++) {
+        double block[BLOCKSIZE][BLOCKSIZE];
+        for(int i = 0; i < BLOCKSIZE * BLOCKSIZE; i++) {
+            block[i / BLOCKSIZE][i % BLOCKSIZE] = pixels[n][i];
+        }
+        performDCT(block);
+        sum += (uint32_t)block[0][1];
+    }
+    return sum;
+}
+
+static uint32_t passFastDCT(void) {
+    uint32_t sum = 0;
+    for(int n = 0; n < NUM_BLOCKS; n++) {
+        double block[BLOCKSIZE * BLOCKSIZE];
+        for(int i = 0; i < BLOCKSIZE * BLOCKSIZE; i++) {
+            block[i] = pixels[n][i];
+        }
+        performFastDCT(block);
+        sum += (uint32_t)block[1];
+    }
+    return sum;
+}
+
+static uint32_t passFFTWDCT(void) {
+    uint32_t sum = 0;
+    for(int n = 0; n < NUM_BLOCKS; n++) {
+        double block[BLOCKSIZE][BLOCKSIZE];
+        for(int i = 0; i < BLOCKSIZE * BLOCKSIZE; i++) {
+            block[i / BLOCKSIZE][i % BLOCKSIZE] = pixels[n][i];
+        }
+        performdct2d(block);
+        sum += (uint32_t)block[0][1];
+    }
+    return sum;
+}
+
+static uint32_t passIntDCT(void) {
+    uint32_t sum = 0;
+    for(int n = 0; n < NUM_BLOCKS; n++) {
+        int16_t block[BLOCKSIZE * BLOCKSIZE];
+        for(int i = 0; i < BLOCKSIZE * BLOCKSIZE; i++) {
+            block[i] = pixels[n][i];
+        }
+        performIntDCT(block);
+        sum += block[1];
+    }
+    return sum;
+}
+
+static uint32_t passIntIDCT(void) {
+    uint32_t sum = 0;
+    for(int n = 0; n < NUM_BLOCKS; n++) {
+        int16_t coef[BLOCKSIZE * BLOCKSIZE];
+        dequantizeIntraBlock(coef, levels[n], SCALE_QUANT);
+        performIntIDCT(coef);
+        sum += coef[0];
+    }
+    return sum;
+}
+
+static uint32_t passQuantizeBlock(void) {
+    uint32_t sum = 0;
+    for(int n = 0; n < NUM_BLOCKS; n++) {
+        int mat[BLOCKSIZE * BLOCKSIZE];
+        quantizeBlock(mat, pixels[n], quantization_table_y, SCALE_QUANT);
+        sum += mat[1];
+    }
+    return sum;
+}
+
+// Blocks read in place from the picture, as the encoder does
+static uint32_t passTransformQuantize(void) {
+    uint32_t sum = 0;
+    for(int n = 0; n < NUM_BLOCKS; n++) {
+        int mat[BLOCKSIZE * BLOCKSIZE];
+        sum += transformQuantizeBlock(mat, sources[n], source_strides[n], quant_recip_y[SCALE_QUANT]);
+    }
+    return sum;
+}
+
+// The next picture predicted by this one without motion
+static uint32_t passTransformQuantizeResidual(void) {
+    uint32_t sum = 0;
+    for(int n = 0; n < NUM_BLOCKS; n++) {
+        int mat[BLOCKSIZE * BLOCKSIZE];
+        sum += transformQuantizeResidual(mat, next_sources[n], source_strides[n], sources[n], source_strides[n], SCALE_QUANT);
+    }
+    return sum;
+}
+
+// The luma or chroma coder over all blocks, with DC prediction as in a slice
+static uint32_t passVLC(int chroma) {
+    resetBitWriter(&bw);
+    int prev_dc = DC_PREDICTOR_RESET;
+    for(int n = 0; n < NUM_BLOCKS; n++) {
+        if(chroma) {
+            encode_mpeg1_c(&bw, levels[n], lasts[n], prev_dc);
+        } else {
+            encode_mpeg1_y(&bw, levels[n], lasts[n], prev_dc);
+        }
+        prev_dc = levels[n][0];
+    }
+    return (uint32_t)bitWriterTell(&bw);
+}
+
+static uint32_t passVLCLuma(void) {
+    return passVLC(0);
+}
+
+static uint32_t passVLCChroma(void) {
+    return passVLC(1);
+}
+
+static uint32_t passSeperateMatrix(void) {
+    uint32_t sum = 0;
+    for(int n = 0; n < NUM_MACROBLOCKS; n++) {
+        uint8_t blocks[4][BLOCKSIZE * BLOCKSIZE];
+        seperateMatrix(blocks, macroblocks[n]);
+        sum += blocks[3][63];
+    }
+    return sum;
+}
+
+static uint32_t passTransferRgb(void) {
+    transferrRgb2Yuv420(yuv, rgb, picture.width, picture.height);
+    return yuv[picture.width + 1];
+}
+
+static uint32_t passConvertRgb(void) {
+    int width_c = (picture.width + 1) / 2;
+    YuvPlanes planes = {
+        .y = yuv,
+        .cb = yuv + picture.width * picture.height,
+        .cr = yuv + picture.width * picture.height + width_c * ((picture.height + 1) / 2),
+        .stride_y = picture.width,
+        .stride_cb = width_c,
+        .stride_cr = width_c,
+    };
+    convertRgbToYuv420(rgb, picture.width * 3, picture.width, picture.height, &planes);
+    return yuv[picture.width + 1];
+}
+
+// Each macroblock against the reference one pel down and right of it
+static uint32_t passSAD(void) {
+    uint32_t sum = 0;
+    for(int n = 0; n < NUM_MACROBLOCKS; n++) {
+        const YuvPlanes* next = &next_picture.frame->planes;
+        sum += sad16x16(macroblocks[n], MACROBLOCK_SIZE, next->y + offsets[n] + next->stride_y + 1, next->stride_y);
+    }
+    return sum;
+}
+
+static uint32_t passHalfPel(void) {
+    buildHalfPelRows(&halfpel, 0, halfpel.height);
+    return halfpel.plane[3][halfpel.stride + 1];
+}
+
+// Prediction of a macroblock from the diagonal half-pel position
+static uint32_t passPredict(void) {
+    uint32_t sum = 0;
+    for(int n = 0; n < NUM_MACROBLOCKS; n++) {
+        uint8_t pred[MACROBLOCK_SIZE * MACROBLOCK_SIZE];
+        const YuvPlanes* next = &next_picture.frame->planes;
+        predictBlock(pred, MACROBLOCK_SIZE, next->y + offsets[n], next->stride_y, 1, 1, MACROBLOCK_SIZE, MACROBLOCK_SIZE);
+        sum += pred[MACROBLOCK_SIZE + 1];
+    }
+    return sum;
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1 && strcmp(argv[1], "-c") == 0) {
+        csv = 1;
+        argc--;
+        argv++;
+    }
+    char* filename = argc > 1 ? argv[1] : INPUT_IMAGE;
+    char* next_filename = argc > 2 ? argv[2] : INPUT_NEXT_IMAGE;
+    int width;
+    int height;
+    if(readImage(&picture, filename) != 0 || readImage(&next_picture, next_filename) != 0 ||
+       !(rgb = readJpegRgb(filename, &width, &height))) {
+        fprintf(stderr, "Error reading %s and %s!\n", filename, next_filename);
+        return EXIT_FAILURE;
+    }
+    if(next_picture.width != picture.width || next_picture.height != picture.height ||
+       picture.width < 2 * MACROBLOCK_SIZE || picture.height < 2 * MACROBLOCK_SIZE) {
+        fprintf(stderr, "Pictures of %dx%d and %dx%d do not fit!\n", picture.width, picture.height,
+                next_picture.width, next_picture.height);
+        return EXIT_FAILURE;
+    }
+    yuv = malloc((size_t)picture.width * picture.height + 2 * (size_t)((picture.width + 1) / 2) * ((picture.height + 1) / 2));
+    initDCTPlans();
+    initBitWriter(&bw, NULL, 0);
+    initHalfPelPlanes(&halfpel, picture.width, picture.height, picture.frame->planes.stride_y);
+    halfpel.plane[0] = picture.frame->planes.y;
+    sampleBlocks();
+    long picture_blocks = (long)picture.width * picture.height / (BLOCKSIZE * BLOCKSIZE);
+
+    if(csv) {
+        printf("kernel,backend,ns_per_block,blocks_per_s,mb_per_s\n");
+    } else {
+        printf("%dx%d, %d blocks\n", picture.width, picture.height, NUM_BLOCKS);
+        printf("%-24s %-7s %10s %14s %10s\n", "kernel", "backend", "ns/block", "blocks/s", "MB/s");
+    }
+    measure("performDCT", "double", passDCT, NUM_BLOCKS, 64);
+    measure("performFastDCT", "float", passFastDCT, NUM_BLOCKS, 64);
+    measure("performdct2d", "fftw", passFFTWDCT, NUM_BLOCKS, 64);
+    DCTBackend dct_backend = getDCTBackend();
+    for(int b = 0; b < DCT_BACKEND_COUNT; b++) {
+        if(setDCTBackend((DCTBackend)b) == 0) {
+            measure("performIntDCT", getDCTBackendName((DCTBackend)b), passIntDCT, NUM_BLOCKS, 64);
+            measure("transformQuantizeBlock", getDCTBackendName((DCTBackend)b), passTransformQuantize, NUM_BLOCKS, 64);
+            measure("transformQuantizeResid", getDCTBackendName((DCTBackend)b), passTransformQuantizeResidual, NUM_BLOCKS, 128);
+        }
+    }
+    setDCTBackend(dct_backend);
+    measure("performIntIDCT", "scalar", passIntIDCT, NUM_BLOCKS, 256);
+    measure("quantizeBlock", "fftw", passQuantizeBlock, NUM_BLOCKS, 64);
+    measure("encode_mpeg1_y", "table", passVLCLuma, NUM_BLOCKS, 256);
+    measure("encode_mpeg1_c", "table", passVLCChroma, NUM_BLOCKS, 256);
+    measure("seperateMatrix", "scalar", passSeperateMatrix, NUM_BLOCKS, 64);
+
+    // The picture is larger than the caches, like in the encoder
+    ColorBackend color_backend = getColorBackend();
+    for(int b = 0; b < COLOR_BACKEND_COUNT; b++) {
+        if(setColorBackend((ColorBackend)b) == 0) {
+            measure("transferrRgb2Yuv420", getColorBackendName((ColorBackend)b), passTransferRgb, picture_blocks, 192);
+            measure("convertRgbToYuv420", getColorBackendName((ColorBackend)b), passConvertRgb, picture_blocks, 192);
+        }
+    }
+    setColorBackend(color_backend);
+
+    SADBackend sad_backend = getSADBackend();
+    for(int b = 0; b < SAD_BACKEND_COUNT; b++) {
+        if(setSADBackend((SADBackend)b) == 0) {
+            measure("sad16x16", getSADBackendName((SADBackend)b), passSAD, NUM_BLOCKS, 128);
+            measure("buildHalfPelRows", getSADBackendName((SADBackend)b), passHalfPel, picture_blocks, 64);
+            measure("predictBlock half-pel", getSADBackendName((SADBackend)b), passPredict, NUM_BLOCKS, 64);
+        }
+    }
+    setSADBackend(sad_backend);
+
+    freeHalfPelPlanes(&halfpel);
+    freeBitWriter(&bw);
+    cleanupDCTPlans();
+    free(yuv);
+    free(rgb);
+    freeImage(&picture);
+    freeImage(&next_picture);
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "createMLV.h"
+#include "jpegfixture.h"
+#include "lookahead.h"
+
+#define PATTERN "lookahead_t%03d.jpeg"
+#define WIDTH 256
+#define HEIGHT 192
+#define NUM_FRAMES 24
+#define SCENECUT_FRAME 12
+#define NUM_SLOTS 6
+#define DEPTH 4
+
+typedef struct FramePosition {
+    int scene;
+    int n;
+} FramePosition;
+
+// Gray 8x8 cells of random level, a different set per scene, panning left
+// by one low-res pixel per frame
+static void fillFrame(uint8_t* rgb, int y, int width, void* opaque) {
+    const FramePosition* position = opaque;
+    for(int x = 0; x < width; x++) {
+        srand(position->scene * 1000003 + (y / 8) * 1009 + (x + LOOKAHEAD_SCALE * position->n) / 8);
+        memset(rgb + 3 * x, 16 + rand() % 224, 3);
+    }
+}
+
+// Picture types of the first `count` frames as a string of I, P and B,
+// and the frames marked as scene cuts in `scenecuts`
+static void decideTypes(const GopConfig* config, int count, char* types, char* scenecuts) {
+    types[0] = '\0';
+    scenecuts[0] = '\0';
+    IngestPipeline pipeline;
+    if(startIngest(&pipeline, PATTERN, 0, count, 0, NUM_SLOTS) != 0) {
+        return;
+    }
+    Lookahead lookahead;
+    if(startLookahead(&lookahead, &pipeline, config, DEPTH) != 0) {
+        stopIngest(&pipeline);
+        return;
+    }
+    LookaheadFrame* frame;
+    int n = 0;
+    while((frame = nextLookaheadFrame(&lookahead))) {
+        types[n++] = frame->type == PICTURE_TYPE_I ? 'I' : (frame->type == PICTURE_TYPE_P ? 'P' : 'B');
+        if(frame->scenecut) {
+            sprintf(scenecuts + strlen(scenecuts), "%d ", frame->index);
+        }
+        releaseIngestFrame(&pipeline);
+    }
+    types[n] = '\0';
+    stopLookahead(&lookahead);
+    stopIngest(&pipeline);
+}
+
+int main() {
+    int failed = 0;
+    char filename[INGEST_MAX_PATH];
+    for(int n = 0; n < NUM_FRAMES; n++) {
+        snprintf(filename, sizeof(filename), PATTERN, n);
+        FramePosition position = { .scene = n < SCENECUT_FRAME ? 1 : 2, .n = n };
+        failed |= writeJpegFixture(filename, WIDTH, HEIGHT, 95, fillFrame, &position) != 0;
+    }
+    // Up to two B pictures in a row while the pan predicts well. The new
+    // scene starts a GOP, and the picture before it is an anchor.
+    char types[NUM_FRAMES + 1];
+    char scenecuts[NUM_FRAMES * 4];
+    GopConfig open = { .size = 30, .distance = 3, .closed = 0 };
+    decideTypes(&open, NUM_FRAMES, types, scenecuts);
+    printf("open:   %s, scene cuts at %s\n", types, scenecuts);
+    failed |= strcmp(types, "IBBPBBPBBPBPIBBPBBPBBPBP") != 0 || strcmp(scenecuts, "12 ") != 0;
+
+    // GOPs of 6 pictures, each closed, so a P picture ends every GOP
+    GopConfig closed = { .size = 6, .distance = 3, .closed = 1 };
+    decideTypes(&closed, SCENECUT_FRAME, types, scenecuts);
+    printf("closed: %s\n", types);
+    failed |= strcmp(types, "IBBPBPIBBPBP") != 0;
+
+    // Stopping in the middle of the sequence, while the lookahead thread
+    // waits for the encoder and the decoders wait for slots
+    IngestPipeline pipeline;
+    Lookahead lookahead;
+    int taken = 0;
+    if(startIngest(&pipeline, PATTERN, 0, NUM_FRAMES, 0, NUM_SLOTS) == 0) {
+        if(startLookahead(&lookahead, &pipeline, &open, DEPTH) == 0) {
+            for(; taken < 3 && nextLookaheadFrame(&lookahead); taken++) {
+                releaseIngestFrame(&pipeline);
+            }
+            stopLookahead(&lookahead);
+        }
+        stopIngest(&pipeline);
+    }
+    printf("stopped after %d frames\n", taken);
+    failed |= taken != 3;
+
+    for(int n = 0; n < NUM_FRAMES; n++) {
+        snprintf(filename, sizeof(filename), PATTERN, n);
+        remove(filename);
+    }
+    return failed;
+}
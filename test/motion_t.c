@@ -0,0 +1,269 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "createMLV.h"
+#include "encoder.h"
+#include "intdct.h"
+#include "motion.h"
+#include "mpeg1_encoder.h"
+#include "quantization.h"
+
+#define WIDTH 128
+#define HEIGHT 96
+#define NUM_BLOCKS 10000
+// Picture of the static sequence
+#define STATIC_WIDTH 320
+#define STATIC_HEIGHT 240
+#define STATIC_SCALE 8
+
+// A wide blob around the searched block, so that the search has a slope to follow
+static void makePicture(uint8_t* picture) {
+    for(int i = 0; i < HEIGHT; i++) {
+        for(int j = 0; j < WIDTH; j++) {
+            picture[i * WIDTH + j] = (uint8_t)(255 * exp(-((i - 40) * (i - 40) + (j - 56) * (j - 56)) / 800.0));
+        }
+    }
+}
+
+// A residual of `sad` spread over the `count` pixels that weigh most in
+// DCT basis function (u, v), with its signs, or over random pixels with
+// random signs if u < 0. pred is 0 or 255 so any pixel can take it all.
+static void makeResidual(uint8_t src[64], uint8_t pred[64], int sad, int u, int v, int count) {
+    int order[64];
+    double weight[64];
+    for(int i = 0; i < 64; i++) {
+        order[i] = i;
+        weight[i] = u < 0 ? rand() - RAND_MAX / 2 :
+            cos((2 * (i % 8) + 1) * u * M_PI / 16) * cos((2 * (i / 8) + 1) * v * M_PI / 16);
+    }
+    for(int i = 0; i < 64; i++) {
+        for(int j = i + 1; j < 64; j++) {
+            if(fabs(weight[order[j]]) > fabs(weight[order[i]])) {
+                int t = order[i];
+                order[i] = order[j];
+                order[j] = t;
+            }
+        }
+    }
+    for(int i = 0; i < 64; i++) {
+        pred[i] = 0;
+        src[i] = 0;
+    }
+    for(int i = 0; i < count; i++) {
+        int pos = order[i];
+        int magnitude = sad / count + (i < sad % count);
+        pred[pos] = weight[pos] < 0 ? 255 : 0;
+        src[pos] = weight[pos] < 0 ? 255 - magnitude : magnitude;
+    }
+}
+
+// Each 8x8 block one value, a multiple of 8, which an I picture
+// reconstructs exactly
+static void makeBlockyPicture(const YuvPlanes* planes, int width, int height) {
+    for(int i = 0; i < height; i++) {
+        for(int j = 0; j < width; j++) {
+            srand((i / 8) * 1000 + j / 8);
+            planes->y[i * planes->stride_y + j] = (uint8_t)(16 + 8 * (rand() % 28));
+        }
+    }
+    for(int i = 0; i < height / 2; i++) {
+        for(int j = 0; j < width / 2; j++) {
+            srand((i / 8) * 1000 + j / 8 + 500000);
+            planes->cb[i * planes->stride_cb + j] = (uint8_t)(16 + 8 * (rand() % 28));
+            planes->cr[i * planes->stride_cr + j] = (uint8_t)(240 - 8 * (rand() % 28));
+        }
+    }
+}
+
+// Add 1 to `count` pixels of every 8x8 block of a plane
+static void perturbPlane(uint8_t* plane, int stride, int width, int height, int count) {
+    for(int y = 0; y < height; y += 8) {
+        for(int x = 0; x < width; x += 8) {
+            for(int i = 0; i < count; i++) {
+                plane[(y + i / 8) * stride + x + i % 8]++;
+            }
+        }
+    }
+}
+
+int main() {
+    int failed = 0;
+    uint8_t* ref = malloc(WIDTH * HEIGHT);
+    uint8_t* cur = malloc(WIDTH * HEIGHT);
+    srand(2087);
+    for(int i = 0; i < WIDTH * HEIGHT; i++) {
+        ref[i] = rand() % 256;
+        cur[i] = rand() % 256;
+    }
+
+    // Every backend must give the SAD of the scalar code, also with stride 0
+    for(int b = SAD_BACKEND_SCALAR + 1; b < SAD_BACKEND_COUNT; b++) {
+        if(!isSADBackendSupported((SADBackend)b)) {
+            continue;
+        }
+        int mismatches = 0;
+        srand(2087);
+        for(int n = 0; n < NUM_BLOCKS; n++) {
+            int x = rand() % (WIDTH - 16);
+            int y = rand() % (HEIGHT - 16);
+            int stride_b = n % 4 == 0 ? 0 : WIDTH;
+            setSADBackend(SAD_BACKEND_SCALAR);
+            int expected = sad16x16(cur + y * WIDTH + x, WIDTH, ref + x, stride_b);
+            int expected8 = sad8x8(cur + y * WIDTH + x, WIDTH, ref + x, stride_b);
+            setSADBackend((SADBackend)b);
+            mismatches += sad16x16(cur + y * WIDTH + x, WIDTH, ref + x, stride_b) != expected;
+            mismatches += sad8x8(cur + y * WIDTH + x, WIDTH, ref + x, stride_b) != expected8;
+        }
+        printf("%-6s: %d mismatches\n", getSADBackendName((SADBackend)b), mismatches);
+        if(mismatches) {
+            failed = 1;
+        }
+    }
+
+    // Half-pel planes and predictions must match the scalar code exactly.
+    // The last columns of each row go through the vector loops' tails.
+    HalfPelPlanes planes[SAD_BACKEND_COUNT];
+    for(int b = SAD_BACKEND_SCALAR; b < SAD_BACKEND_COUNT; b++) {
+        if(!isSADBackendSupported((SADBackend)b)) {
+            continue;
+        }
+        setSADBackend((SADBackend)b);
+        initHalfPelPlanes(&planes[b], WIDTH, HEIGHT, WIDTH);
+        planes[b].plane[0] = ref;
+        buildHalfPelRows(&planes[b], 0, HEIGHT);
+        uint8_t pred[16 * 16];
+        uint8_t expected[16 * 16];
+        int mismatches = 0;
+        srand(2087);
+        for(int n = 0; n < NUM_BLOCKS; n++) {
+            int size = n & 1 ? 16 : 8;
+            int x = 8 + rand() % (WIDTH - 16 - 8 - 1);
+            int y = 8 + rand() % (HEIGHT - 16 - 8 - 1);
+            int mv_x = rand() % 9 - 4;
+            int mv_y = rand() % 9 - 4;
+            setSADBackend(SAD_BACKEND_SCALAR);
+            predictBlock(expected, 16, ref + y * WIDTH + x, WIDTH, mv_x, mv_y, size, size);
+            setSADBackend((SADBackend)b);
+            predictBlock(pred, 16, ref + y * WIDTH + x, WIDTH, mv_x, mv_y, size, size);
+            // The planes are the same averages
+            const uint8_t* block = halfPelBlock(&planes[b], x, y, mv_x, mv_y);
+            for(int i = 0; i < size; i++) {
+                for(int j = 0; j < size; j++) {
+                    mismatches += pred[i * 16 + j] != expected[i * 16 + j];
+                    mismatches += block[i * WIDTH + j] != expected[i * 16 + j];
+                }
+            }
+        }
+        for(int i = 1; i < 4 && b > SAD_BACKEND_SCALAR; i++) {
+            for(int y = 0; y < HEIGHT; y++) {
+                for(int x = 0; x < WIDTH; x++) {
+                    mismatches += planes[b].plane[i][y * WIDTH + x] != planes[SAD_BACKEND_SCALAR].plane[i][y * WIDTH + x];
+                }
+            }
+        }
+        printf("%-6s: %d half-pel mismatches\n", getSADBackendName((SADBackend)b), mismatches);
+        if(mismatches) {
+            failed = 1;
+        }
+    }
+    for(int b = SAD_BACKEND_SCALAR; b < SAD_BACKEND_COUNT; b++) {
+        if(isSADBackendSupported((SADBackend)b)) {
+            freeHalfPelPlanes(&planes[b]);
+        }
+    }
+
+    // A shifted copy of the picture must be found exactly
+    makePicture(ref);
+    static const int shifts[][2] = { { 0, 0 }, { 3, -2 }, { -7, 5 }, { 10, -6 } };
+    for(int s = 0; s < 4; s++) {
+        for(int i = 0; i < HEIGHT; i++) {
+            for(int j = 0; j < WIDTH; j++) {
+                int y = i + shifts[s][1];
+                int x = j + shifts[s][0];
+                y = y < 0 ? 0 : (y >= HEIGHT ? HEIGHT - 1 : y);
+                x = x < 0 ? 0 : (x >= WIDTH ? WIDTH - 1 : x);
+                cur[i * WIDTH + j] = ref[y * WIDTH + x];
+            }
+        }
+        int x = 48;
+        int y = 32;
+        MotionRange range = { -16, 16, -16, 16 };
+        MotionVector none = { 0, 0 };
+        MotionVector mv;
+        int sad = searchMotion(cur + y * WIDTH + x, ref + y * WIDTH + x, WIDTH, &range, &none, 1, none, 2, 0, &mv);
+        printf("shift %3d %3d: found %3d %3d, SAD %d\n", shifts[s][0], shifts[s][1], mv.x / 2, mv.y / 2, sad);
+        if(sad != 0 || mv.x != 2 * shifts[s][0] || mv.y != 2 * shifts[s][1]) {
+            failed = 1;
+        }
+    }
+    free(ref);
+    free(cur);
+
+    // A block whose SAD against its prediction is under 4 * (2s - 1) has
+    // no nonzero level, however the SAD is spread. Static macroblocks are
+    // skipped on that bound without a DCT.
+    initIntDCT();
+    int nonzero = 0;
+    srand(2087);
+    for(int scale = 1; scale <= MAX_QUANT_SCALE; scale++) {
+        int sad = 4 * (2 * scale - 1) - 1;
+        uint8_t src[64];
+        uint8_t pred[64];
+        int mat[64];
+        for(int u = -1; u < 8; u++) {
+            for(int v = 0; v < 8; v++) {
+                for(int count = 1; count <= 64; count++) {
+                    makeResidual(src, pred, sad, u, v, count);
+                    nonzero += transformQuantizeResidual(mat, src, 8, pred, 8, (uint8_t)scale) >= 0;
+                }
+            }
+        }
+    }
+    printf("residuals under the static bound: %d with nonzero levels\n", nonzero);
+    failed |= nonzero != 0;
+
+    // A P picture of a static sequence codes only the first and last
+    // macroblock of each slice, which must be coded; all others are
+    // skipped. Every block is a little off, but under the bound.
+    EncoderContext ctx;
+    Frame* frame = allocFrame(STATIC_WIDTH, STATIC_HEIGHT, FRAME_PAD);
+    BitWriter bw;
+    BitWriter expected;
+    initBitWriter(&bw, NULL, 0);
+    initBitWriter(&expected, NULL, 0);
+    if(!frame || initEncoder(&ctx, STATIC_WIDTH, STATIC_HEIGHT, STATIC_SCALE, 0, 16) != 0) {
+        printf("Failed to initialize the encoder.\n");
+        return 1;
+    }
+    ImageInfo image = { .frame = frame, .width = STATIC_WIDTH, .height = STATIC_HEIGHT };
+    makeBlockyPicture(&frame->planes, STATIC_WIDTH, STATIC_HEIGHT);
+    int ret = encodeIntraPicture(&ctx, &image, &bw);
+    int count = 4 * (2 * STATIC_SCALE - 1) - 1;
+    perturbPlane(frame->planes.y, frame->planes.stride_y, STATIC_WIDTH, STATIC_HEIGHT, count);
+    perturbPlane(frame->planes.cb, frame->planes.stride_cb, STATIC_WIDTH / 2, STATIC_HEIGHT / 2, count);
+    perturbPlane(frame->planes.cr, frame->planes.stride_cr, STATIC_WIDTH / 2, STATIC_HEIGHT / 2, count);
+    resetBitWriter(&bw);
+    ret |= encodeInterPicture(&ctx, &image, &bw);
+    for(int row = 0; row < ctx.mb_height; row++) {
+        writeSliceHeader(&expected, (uint8_t)(row + 1), STATIC_SCALE);
+        int increments[2] = { 1, ctx.mb_width - 1 };
+        for(int i = 0; i < 2; i++) {
+            encode_address_increment(&expected, increments[i]);
+            putBits(&expected, MB_TYPE_P_MC_CODE, MB_TYPE_P_MC_BITS);
+            encode_motion(&expected, 0, ctx.f_code);
+            encode_motion(&expected, 0, ctx.f_code);
+        }
+    }
+    long size = finishBitWriter(&bw);
+    long expected_size = finishBitWriter(&expected);
+    int skipped = ret == 0 && size == expected_size && memcmp(bw.buf, expected.buf, size) == 0;
+    printf("static P picture: %ld bytes, %s\n", size, skipped ? "all skipped" : "NOT SKIPPED");
+    failed |= !skipped;
+    freeBitWriter(&bw);
+    freeBitWriter(&expected);
+    freeEncoder(&ctx);
+    freeFrame(frame);
+    return failed;
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "createMLV.h"
+
+#define FRAME_RATE_CODE 3
+#define TICKS 3600 // one picture at 25 fps
+#define NUM_PICTURES 10
+#define MAX_PACKETS 64
+
+// Display order of the pictures in coded order, I P B B P B B P B B with
+// the GOP starting at the P picture 4
+static const int display[NUM_PICTURES] = { 0, 3, 1, 2, 6, 4, 5, 9, 7, 8 };
+
+// A stream of pictures of very different sizes, so some share a packet and
+// some span several, muxed in memory. Each stays below the raw size and
+// the VBV buffer of a 64x64 picture.
+static uint8_t* writeStream(int raw, long* size) {
+    ImageInfo info = { .width = 64, .height = 64, .fps = 25 };
+    Muxer mux;
+    createMLV(&mux, NULL, info, raw);
+    BitWriter bw;
+    initBitWriter(&bw, NULL, 0);
+    for(int n = 0; n < NUM_PICTURES; n++) {
+        int gop_first = n < 4 ? 0 : 4;
+        if(n == 0 || n == 4) {
+            writeGOPHeader(&bw, gop_first, FRAME_RATE_CODE, n == 0);
+        }
+        int type = n == 0 ? PICTURE_TYPE_I : (display[n] % 3 == 0 ? PICTURE_TYPE_P : PICTURE_TYPE_B);
+        writePictureHeader(&bw, display[n] - gop_first, type, VBV_DELAY_VARIABLE, 1, 1);
+        writeSliceHeader(&bw, 1, 8);
+        for(int i = 0; i < (n % 3) * 1500 + 20; i++) {
+            putBits(&bw, 0x5A, 8);
+        }
+        flushBitstream(&mux, &bw);
+    }
+    writeSequenceEndCode(&bw);
+    flushBitstream(&mux, &bw);
+    freeBitWriter(&bw);
+    closeMuxer(&mux);
+    *size = (long)mux.sink.size;
+    return mux.sink.data;
+}
+
+static uint64_t readTimeStamp(const uint8_t* p) {
+    return (uint64_t)((p[0] >> 1) & 7) << 30 | p[1] << 22 | (p[2] >> 1) << 15 | p[3] << 7 | p[4] >> 1;
+}
+
+// Offset of the n-th picture start code of an elementary stream
+static long pictureOffset(const uint8_t* es, long size, int n) {
+    for(long i = 0; i + 4 <= size; i++) {
+        if(es[i] == 0 && es[i + 1] == 0 && es[i + 2] == 1 && es[i + 3] == 0 && n-- == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Where each picture starts to enter the STD buffer: at its own start
+// code, or at the sequence or GOP header before it
+static void pictureStarts(const uint8_t* es, long size, long* starts) {
+    int n = 0;
+    long header = -1;
+    for(long i = 0; i + 4 <= size; i++) {
+        if(es[i] != 0 || es[i + 1] != 0 || es[i + 2] != 1 || (es[i + 3] >= 0x01 && es[i + 3] <= 0xAF)) {
+            continue;
+        }
+        header = header < 0 ? i : header;
+        if(es[i + 3] == 0x00) {
+            starts[n++] = header;
+            header = -1;
+        }
+    }
+    starts[n] = size;
+}
+
+int main() {
+    int failed = 0;
+    long size_raw;
+    uint8_t* raw = writeStream(1, &size_raw);
+    long size;
+    uint8_t* data = writeStream(0, &size);
+
+    // Take the packets apart again
+    uint8_t* es = malloc(size);
+    long es_size = 0;
+    int packs = 0;
+    int short_packs = 0;
+    int stamp_errors = 0;
+    int stamps = 0;
+    uint64_t last_scr = 0;
+    uint64_t mux_rate = 0;
+    int std_buffer_size = 0;
+    long pack_start = 0;
+    // Stream bytes up to the end of each packet, and when they have arrived
+    long packet_end[MAX_PACKETS];
+    uint64_t arrival[MAX_PACKETS];
+    int packets = 0;
+    long i = 0;
+    while(i + 4 <= size && data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+        int code = data[i + 3];
+        if(code == 0xB9) {
+            i += 4;
+            break;
+        }
+        if(code == 0xBA) {
+            if(packs > 0 && i - pack_start != MUX_PACK_SIZE) {
+                short_packs++;
+            }
+            uint64_t scr = readTimeStamp(data + i + 4);
+            stamp_errors += packs > 0 && scr <= last_scr;
+            last_scr = scr;
+            mux_rate = (uint64_t)(data[i + 9] & 0x7F) << 15 | data[i + 10] << 7 | data[i + 11] >> 1;
+            pack_start = i;
+            packs++;
+            i += PACK_HEADER_BYTES;
+            continue;
+        }
+        long len = data[i + 4] << 8 | data[i + 5];
+        const uint8_t* p = data + i + 6;
+        if(code == 0xE0) {
+            if(p[0] >> 6 == 1) {
+                std_buffer_size = ((p[0] & 0x1F) << 8 | p[1]) * (p[0] & 0x20 ? 1024 : 128);
+                p += 2;
+            }
+            uint64_t pts = 0;
+            uint64_t dts = 0;
+            int has_pts = p[0] >> 4 == 3 || p[0] >> 4 == 2;
+            if(has_pts) {
+                pts = readTimeStamp(p);
+                dts = p[0] >> 4 == 3 ? readTimeStamp(p + 5) : pts;
+                p += p[0] >> 4 == 3 ? 10 : 5;
+            } else {
+                p++;
+            }
+            long len_data = data + i + 6 + len - p;
+            // The time stamps are of the first picture starting in the packet
+            if(has_pts) {
+                int n = 0;
+                long offset;
+                while((offset = pictureOffset(raw, size_raw, n)) >= 0 && offset < es_size) {
+                    n++;
+                }
+                stamps++;
+                stamp_errors += offset < 0 || offset >= es_size + len_data || dts != MUX_DELAY + (uint64_t)n * TICKS ||
+                    pts != MUX_DELAY + (uint64_t)(display[n] + 1) * TICKS || last_scr > dts;
+            }
+            memcpy(es + es_size, p, len_data);
+            es_size += len_data;
+            if(packets < MAX_PACKETS) {
+                packet_end[packets] = es_size;
+                arrival[packets++] = last_scr + ((i + 6 + len - pack_start) * 90000 + mux_rate * 50 - 1) / (mux_rate * 50);
+            }
+        }
+        i += 6 + len;
+    }
+    int same = es_size == size_raw && memcmp(es, raw, es_size) == 0;
+    printf("packs %d, shorter ones %d, stamped packets %d, stamp errors %d, stream %s\n", packs, short_packs, stamps,
+           stamp_errors, same ? "unchanged" : "DIFFERS");
+    failed |= !same || short_packs != 0 || stamps < NUM_PICTURES / 2 || stamp_errors != 0 || i != size;
+
+    // Replay the packs through the STD buffer: picture n leaves it at its
+    // DTS, after its last byte has arrived, and what has arrived and not
+    // left never exceeds the size declared
+    long starts[NUM_PICTURES + 1];
+    pictureStarts(raw, size_raw, starts);
+    long peak = 0;
+    int late = 0;
+    for(int k = 0; k < packets; k++) {
+        int n = 0;
+        while(n < NUM_PICTURES && MUX_DELAY + (uint64_t)n * TICKS <= arrival[k]) {
+            n++;
+        }
+        long fullness = packet_end[k] - starts[n];
+        peak = fullness > peak ? fullness : peak;
+    }
+    for(int n = 0, k = 0; n < NUM_PICTURES; n++) {
+        while(k < packets - 1 && packet_end[k] < starts[n + 1]) {
+            k++;
+        }
+        late += arrival[k] > MUX_DELAY + (uint64_t)n * TICKS;
+    }
+    printf("STD buffer %d bytes, fullness up to %ld, %d pictures late\n", std_buffer_size, peak, late);
+    failed |= packets == MAX_PACKETS || peak > std_buffer_size || late != 0;
+
+    free(es);
+    free(data);
+    free(raw);
+    return failed;
+}
@@ -0,0 +1,77 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+#define NUM_THREADS 3
+#define NUM_SPANS 5
+
+static void* worker(void* arg) {
+    (void)arg;
+    for(int i = 0; i < NUM_SPANS; i++) {
+        uint64_t start = profileStart();
+        profileCount(PROFILE_BLOCKS, 6);
+        profileStop(PROFILE_DCT, profileStart());
+        profileSpan(PROFILE_SLICE, start);
+    }
+    return NULL;
+}
+
+// Number of occurrences of `needle` in the file
+static int countInFile(const char* filename, const char* needle) {
+    FILE* file = fopen(filename, "rb");
+    if(!file) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = calloc(size + 1, 1);
+    fread(data, 1, size, file);
+    fclose(file);
+    int count = 0;
+    for(char* p = data; (p = strstr(p, needle)) != NULL; p++) {
+        count++;
+    }
+    free(data);
+    return count;
+}
+
+int main() {
+    int failed = 0;
+
+    // Nothing is recorded while profiling is off
+    worker(NULL);
+    writeProfileTrace("profile_t.json");
+    int events = countInFile("profile_t.json", "\"ph\":\"X\"");
+    printf("events while off: %d\n", events);
+    failed |= events != 0;
+
+    enableProfile(1);
+    pthread_t threads[NUM_THREADS];
+    for(int i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    for(int i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    printProfileSummary(stdout);
+
+    // Only spans become trace events, one per slice of each thread
+    writeProfileTrace("profile_t.json");
+    events = countInFile("profile_t.json", "\"ph\":\"X\"");
+    int slices = countInFile("profile_t.json", "\"name\":\"slice\"");
+    printf("events: %d, slices: %d\n", events, slices);
+    failed |= events != NUM_THREADS * NUM_SPANS || slices != NUM_THREADS * NUM_SPANS;
+
+    resetProfile();
+    writeProfileTrace("profile_t.json");
+    events = countInFile("profile_t.json", "\"ph\":\"X\"");
+    printf("events after reset: %d\n", events);
+    failed |= events != 0;
+
+    remove("profile_t.json");
+    return failed;
+}
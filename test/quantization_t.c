@@ -1,5 +1,7 @@
 #include "quantization.h"
+#include "mpeg1_encoder.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 int main() {
     uint8_t mat[64] = {
@@ -14,5 +16,58 @@ int main() {
     };
     int buf[64];
     quantizeBlock(buf, mat, quantization_table_y, 1);
-    return 0;
-}
\ No newline at end of file
+
+    // The reciprocal path must agree with a plain division of the same DCT output
+    int mismatches = 0;
+    for(int scale = 1; scale <= MAX_QUANT_SCALE; scale++) {
+        for(int n = 0; n < 200; n++) {
+            int16_t coef[64];
+            for(int i = 0; i < 64; i++) {
+                mat[i] = rand() % 256;
+                coef[i] = mat[i];
+            }
+            performIntDCT(coef);
+            int last = transformQuantizeBlock(buf, mat, BLOCKSIZE, quant_recip_y[scale]);
+            int expected_last = -1;
+            for(int i = 0; i < 64; i++) {
+                int pos = zigzag_scan[i];
+                int expected = i == 0 ? (int)round(coef[0] / 8.0)
+                    : (int)round(8.0 * coef[pos] / (scale * quantization_table_y[pos]));
+                if(expected > MAX_QUANT_LEVEL) expected = MAX_QUANT_LEVEL;
+                if(expected < -MAX_QUANT_LEVEL) expected = -MAX_QUANT_LEVEL;
+                if(expected != 0) expected_last = i;
+                if(buf[pos] != expected) mismatches++;
+            }
+            if(last != expected_last) mismatches++;
+        }
+    }
+    printf("Fused quantization mismatches: %d\n", mismatches);
+
+    // With unit JPEG steps requantization sees the same coefficients, only
+    // level shifted, and must give the same levels
+    int requant_mismatches = 0;
+    uint16_t unit_quant[64];
+    for(int i = 0; i < 64; i++) {
+        unit_quant[i] = 1;
+    }
+    for(int scale = 1; scale <= MAX_QUANT_SCALE; scale++) {
+        for(int n = 0; n < 200; n++) {
+            int16_t coef[64];
+            int expected[64];
+            for(int i = 0; i < 64; i++) {
+                mat[i] = rand() % 256;
+                coef[i] = mat[i];
+            }
+            performIntDCT(coef);
+            coef[0] -= 128 * 8;
+            int expected_last = transformQuantizeBlock(expected, mat, BLOCKSIZE, quant_recip_y[scale]);
+            int last = requantizeBlock(buf, coef, unit_quant, quant_recip_y[scale]);
+            for(int i = 0; i < 64; i++) {
+                if(buf[i] != expected[i]) requant_mismatches++;
+            }
+            if(last != expected_last) requant_mismatches++;
+        }
+    }
+    printf("Requantization mismatches: %d\n", requant_mismatches);
+    return mismatches != 0 || requant_mismatches != 0;
+}
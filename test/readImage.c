@@ -15,21 +15,30 @@ int main() {
     FILE* outfile = fopen(filename_o, "wb");
     if(!outfile) {
         fprintf(stderr, "Error creating output file %s!\n", filename_o);
-        free(imageinfo.buf_p);  // 释放分配的内存
+        freeImage(&imageinfo);  // 释放分配的内存
         return EXIT_FAILURE;
     }
 
-    size_t bytes_written = fwrite(imageinfo.buf_p, 1, imageinfo.buf_size, outfile);
-    if(bytes_written != imageinfo.buf_size) {
-        fprintf(stderr, "Error writing data to output file %s!\n", filename_o);
-        fclose(outfile);
-        free(imageinfo.buf_p);  // 释放分配的内存
-        return EXIT_FAILURE;
+    // Planes one after the other, without the frame's border
+    const YuvPlanes* planes = &imageinfo.frame->planes;
+    const uint8_t* data[3] = { planes->y, planes->cb, planes->cr };
+    int strides[3] = { planes->stride_y, planes->stride_cb, planes->stride_cr };
+    for(int c = 0; c < 3; c++) {
+        int width = c == 0 ? imageinfo.width : (imageinfo.width + 1) / 2;
+        int height = c == 0 ? imageinfo.height : (imageinfo.height + 1) / 2;
+        for(int i = 0; i < height; i++) {
+            if(fwrite(data[c] + (size_t)i * strides[c], 1, width, outfile) != (size_t)width) {
+                fprintf(stderr, "Error writing data to output file %s!\n", filename_o);
+                fclose(outfile);
+                freeImage(&imageinfo);  // 释放分配的内存
+                return EXIT_FAILURE;
+            }
+        }
     }
 
     printf("Image saved to %s\n", filename_o);
     fclose(outfile);
-    free(imageinfo.buf_p);  // 释放分配的内存
+    freeImage(&imageinfo);  // 释放分配的内存
 
     return 0;
 }
\ No newline at end of file
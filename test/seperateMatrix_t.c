@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "seperateMatrix.h"
 #include "readImage.h"
 
@@ -8,12 +10,18 @@ int main() {
     char filename[30] = FILENAME;
     readImage(&imageinfo, filename);
     uint8_t y_block[4][BLOCKSIZE * BLOCKSIZE];
-    seperateMatrix(y_block, imageinfo.buf_p);
+    // Top-left macroblock
+    uint8_t macro[16 * 16];
+    for(int i = 0; i < 16; i++) {
+        memcpy(macro + i * 16, imageinfo.frame->planes.y + i * imageinfo.frame->planes.stride_y, 16);
+    }
+    seperateMatrix(y_block, macro);
     for(int i = 0; i < 8; i++) {
         for(int j = 0; j < 8; j++) {
             printf("%d, ", y_block[0][i * 8+j]);
         }
         printf("\n");
     }
+    freeImage(&imageinfo);
     return 0;
 }
\ No newline at end of file
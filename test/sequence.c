@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "createMLV.h"
+#include "ingest.h"
+#include "lookahead.h"
+#include "sequence.h"
+
+// Encode and write every picture the reorder buffer can release. Returns
+// -1 if one fails to encode or cannot be written.
+static int encodeReadyPictures(EncoderContext* ctx, ReorderBuffer* reorder, uint8_t frame_rate_code, BitWriter* bw, Muxer* mux,
+                               const SequenceOptions* options, SequenceStats* stats) {
+    CodedPicture* picture;
+    while((picture = nextCodedPicture(reorder))) {
+        if(encodeCodedPicture(ctx, picture, frame_rate_code, bw) != 0 || flushBitstream(mux, bw) != 0) {
+            return -1;
+        }
+        stats->frames++;
+        if(options->done) {
+            options->done(ctx, picture, options->opaque);
+        }
+    }
+    return 0;
+}
+
+int encodeSequence(const char* filename_o, const char* pattern, const SequenceOptions* options, SequenceStats* stats) {
+    SequenceStats unused;
+    stats = stats ? stats : &unused;
+    memset(stats, 0, sizeof(SequenceStats));
+    if(options->count == 0) {
+        fprintf(stderr, "No input files match %s!\n", pattern);
+        return -1;
+    }
+    GopConfig gop = { .size = GOP_SIZE, .distance = GOP_DISTANCE, .closed = options->closed };
+    ReorderBuffer reorder;
+    if(initReorderBuffer(&reorder, &gop) != 0) {
+        fprintf(stderr, "Invalid GOP structure.\n");
+        return -1;
+    }
+    IngestPipeline pipeline;
+    // The lookahead holds LOOKAHEAD_DEPTH frames, the decoders fill the others
+    if(startIngest(&pipeline, pattern, options->first, options->count, options->num_threads, LOOKAHEAD_DEPTH + 2) != 0) {
+        fprintf(stderr, "Failed to start the decoders.\n");
+        freeReorderBuffer(&reorder);
+        return -1;
+    }
+    Lookahead lookahead;
+    if(startLookahead(&lookahead, &pipeline, &gop, LOOKAHEAD_DEPTH) != 0) {
+        fprintf(stderr, "Failed to start the lookahead.\n");
+        stopIngest(&pipeline);
+        freeReorderBuffer(&reorder);
+        return -1;
+    }
+    LookaheadFrame* next = nextLookaheadFrame(&lookahead);
+    if(!next) {
+        fprintf(stderr, "Failed to read the first frame of %s!\n", pattern);
+        stopLookahead(&lookahead);
+        stopIngest(&pipeline);
+        freeReorderBuffer(&reorder);
+        return -1;
+    }
+    ImageInfo* frame = next->image;
+    stats->width = frame->width;
+    stats->height = frame->height;
+
+    Muxer mux;
+    EncoderContext ctx;
+    int ret = createMLV(&mux, (char*)filename_o, *frame, options->raw);
+    if(ret == 0 && initEncoder(&ctx, frame->width, frame->height, SCALE_QUANT, options->num_threads, SEARCH_RANGE) != 0) {
+        fprintf(stderr, "Failed to initialize the encoder.\n");
+        closeMuxer(&mux);
+        ret = -1;
+    }
+    if(ret != 0) {
+        stopLookahead(&lookahead);
+        stopIngest(&pipeline);
+        freeReorderBuffer(&reorder);
+        return -1;
+    }
+    ctx.reconstruct_bidir = options->reconstruct_bidir;
+    uint8_t frame_rate_code = frameRateCode(frame->fps);
+    BitWriter bw;
+    initBitWriter(&bw, NULL, frame->width * frame->height);
+
+    int failed = 0;
+    for(int n = 0; next; n++) {
+        frame = next->image;
+        if(frame->width != ctx.width || frame->height != ctx.height) {
+            fprintf(stderr, "Frame %d is %dx%d, expected %dx%d!\n", n, frame->width, frame->height, ctx.width, ctx.height);
+            failed = 1;
+            break;
+        }
+        if(pushReorderFrame(&reorder, frame, next->type) != 0) {
+            fprintf(stderr, "Frame %d could not be reordered!\n", n);
+            failed = 1;
+            break;
+        }
+        releaseIngestFrame(&pipeline);
+        if(encodeReadyPictures(&ctx, &reorder, frame_rate_code, &bw, &mux, options, stats) != 0) {
+            fprintf(stderr, "Error writing %s!\n", filename_o);
+            failed = 1;
+            break;
+        }
+        next = nextLookaheadFrame(&lookahead);
+    }
+    flushReorderBuffer(&reorder);
+    if(encodeReadyPictures(&ctx, &reorder, frame_rate_code, &bw, &mux, options, stats) != 0) {
+        fprintf(stderr, "Error writing %s!\n", filename_o);
+        failed = 1;
+    }
+    stopLookahead(&lookahead);
+    if(pipeline.failed) {
+        fprintf(stderr, "The sequence ends at a file that cannot be read.\n");
+        failed = 1;
+    }
+    stopIngest(&pipeline);
+
+    writeSequenceEndCode(&bw);
+    if(flushBitstream(&mux, &bw) != 0 || closeMuxer(&mux) != 0) {
+        fprintf(stderr, "Error writing %s!\n", filename_o);
+        failed = 1;
+    }
+    stats->output_bytes = mux.sink.bytes;
+    freeReorderBuffer(&reorder);
+    freeBitWriter(&bw);
+    freeEncoder(&ctx);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,42 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include "encoder.h"
+#include "gop.h"
+
+// Settings of the command line encoder, which encode_bench measures
+#define SCALE_QUANT 8
+#define GOP_SIZE 12
+#define GOP_DISTANCE 3
+#define SEARCH_RANGE 16
+#define LOOKAHEAD_DEPTH 8
+
+// Called after each picture is encoded and written, in coded order
+typedef void (*PictureDone)(const EncoderContext* ctx, const CodedPicture* picture, void* opaque);
+
+typedef struct SequenceOptions {
+    int first;              // number of the first file
+    int count;              // files
+    int closed;             // closed GOPs
+    int num_threads;        // for the decoders and the encoder each, 0 for one per core
+    int raw;                // write the bare video stream
+    int reconstruct_bidir;  // also reconstruct B pictures for `done`
+    PictureDone done;       // or NULL
+    void* opaque;
+} SequenceOptions;
+
+typedef struct SequenceStats {
+    int width;
+    int height;
+    int frames;             // encoded
+    uint64_t output_bytes;
+} SequenceStats;
+
+// Encode files of a numbered JPEG sequence in GOPs of at most GOP_SIZE
+// pictures with up to GOP_DISTANCE - 1 B pictures between anchors,
+// decoding ahead of the encoder on a pool of threads and choosing picture
+// types and scene cuts LOOKAHEAD_DEPTH frames ahead. `stats` may be NULL.
+// Returns -1, with the reason on stderr, if the sequence could not be
+// started, stopped short or could not be written.
+int encodeSequence(const char* filename_o, const char* pattern, const SequenceOptions* options, SequenceStats* stats);
+#endif
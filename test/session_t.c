@@ -0,0 +1,176 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "session.h"
+
+#define WIDTH 96
+#define HEIGHT 64
+// Partial macroblocks on the right and at the bottom
+#define ODD_WIDTH 100
+#define ODD_HEIGHT 70
+#define NUM_FRAMES 20
+#define NUM_SESSIONS 3
+
+typedef struct Output {
+    uint8_t* data;
+    size_t size;
+    int chunks;
+} Output;
+
+// A sequence to encode and what came out
+typedef struct Sequence {
+    int width;
+    int height;
+    int raw;
+    int num_threads;
+    Output out;
+} Sequence;
+
+static int collect(void* opaque, const uint8_t* data, size_t len) {
+    Output* out = (Output*)opaque;
+    uint8_t* grown = realloc(out->data, out->size + len);
+    if(!grown) {
+        return -1;
+    }
+    memcpy(grown + out->size, data, len);
+    out->data = grown;
+    out->size += len;
+    out->chunks++;
+    return 0;
+}
+
+// A gradient moving right and down, so P and B pictures find vectors
+static void drawFrame(const YuvPlanes* planes, int width, int height, int n) {
+    for(int i = 0; i < height; i++) {
+        for(int j = 0; j < width; j++) {
+            planes->y[i * planes->stride_y + j] = (uint8_t)((i + n) * 3 + (j + 2 * n) * 2);
+        }
+    }
+    for(int i = 0; i < (height + 1) / 2; i++) {
+        for(int j = 0; j < (width + 1) / 2; j++) {
+            planes->cb[i * planes->stride_cb + j] = (uint8_t)(128 + i - j);
+            planes->cr[i * planes->stride_cr + j] = (uint8_t)(100 + j + n);
+        }
+    }
+}
+
+static void* encodeSequence(void* arg) {
+    Sequence* sequence = (Sequence*)arg;
+    Output* out = &sequence->out;
+    int width = sequence->width;
+    int height = sequence->height;
+    int width_c = (width + 1) / 2;
+    int height_c = (height + 1) / 2;
+    SessionParams params;
+    defaultSessionParams(&params);
+    params.num_threads = sequence->num_threads;
+    params.raw = sequence->raw;
+    EncoderSession* session = openSession(&params, collect, out);
+    uint8_t* y = malloc(width * height);
+    uint8_t* cb = malloc(width_c * height_c);
+    uint8_t* cr = malloc(width_c * height_c);
+    YuvPlanes planes = { .y = y, .cb = cb, .cr = cr, .stride_y = width, .stride_cb = width_c, .stride_cr = width_c };
+    int failed = !session;
+    for(int n = 0; n < NUM_FRAMES && !failed; n++) {
+        drawFrame(&planes, width, height, n);
+        failed |= pushYuvFrame(session, &planes, width, height) != 0;
+    }
+    failed |= !session || flushSession(session) != 0;
+    closeSession(session);
+    free(y);
+    free(cb);
+    free(cr);
+    if(failed) {
+        out->size = 0;
+    }
+    return NULL;
+}
+
+static int countStartCodes(const Output* out, uint8_t code) {
+    int count = 0;
+    for(size_t i = 0; i + 4 <= out->size; i++) {
+        count += out->data[i] == 0 && out->data[i + 1] == 0 && out->data[i + 2] == 1 && out->data[i + 3] == code;
+    }
+    return count;
+}
+
+int main() {
+    int failed = 0;
+
+    // Sessions on threads of their own give what one session alone gives
+    Sequence sequences[NUM_SESSIONS];
+    pthread_t threads[NUM_SESSIONS];
+    for(int i = 0; i < NUM_SESSIONS; i++) {
+        sequences[i] = (Sequence){ .width = WIDTH, .height = HEIGHT, .num_threads = 1 };
+        pthread_create(&threads[i], NULL, encodeSequence, &sequences[i]);
+    }
+    for(int i = 0; i < NUM_SESSIONS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    Sequence alone = { .width = WIDTH, .height = HEIGHT, .num_threads = 1 };
+    encodeSequence(&alone);
+    int same = alone.out.size > 0;
+    for(int i = 0; i < NUM_SESSIONS; i++) {
+        Output* out = &sequences[i].out;
+        same &= out->size == alone.out.size && memcmp(out->data, alone.out.data, alone.out.size) == 0;
+        free(out->data);
+    }
+    int pictures = countStartCodes(&alone.out, 0x00);
+    int packs = countStartCodes(&alone.out, 0xBA);
+    printf("%zu bytes in %d chunks, %d pictures, %d packs, concurrent sessions %s\n", alone.out.size, alone.out.chunks,
+           pictures, packs, same ? "agree" : "DIFFER");
+    failed |= !same || pictures != NUM_FRAMES || packs == 0 || countStartCodes(&alone.out, 0xB9) != 1;
+    free(alone.out.data);
+
+    // Every picture of a size with partial macroblocks has a slice for the
+    // last, partial row of macroblocks. Packs could split the start codes,
+    // so the video stream is taken bare.
+    Sequence odd = { .width = ODD_WIDTH, .height = ODD_HEIGHT, .raw = 1, .num_threads = 1 };
+    encodeSequence(&odd);
+    int mb_height = (ODD_HEIGHT + 15) / 16;
+    int last_slices = countStartCodes(&odd.out, (uint8_t)mb_height);
+    printf("%dx%d: %zu bytes, %d pictures, %d slices of row %d\n", ODD_WIDTH, ODD_HEIGHT, odd.out.size,
+           countStartCodes(&odd.out, 0x00), last_slices, mb_height);
+    failed |= countStartCodes(&odd.out, 0x00) != NUM_FRAMES || last_slices != NUM_FRAMES ||
+        countStartCodes(&odd.out, (uint8_t)(mb_height + 1)) != 0;
+
+    // The wavefront and the slices give the same stream on more threads
+    Sequence threaded = { .width = ODD_WIDTH, .height = ODD_HEIGHT, .raw = 1, .num_threads = 4 };
+    encodeSequence(&threaded);
+    same = threaded.out.size == odd.out.size && memcmp(threaded.out.data, odd.out.data, odd.out.size) == 0;
+    printf("%d threads: %zu bytes, %s\n", threaded.num_threads, threaded.out.size, same ? "same as 1" : "DIFFERENT");
+    failed |= !same;
+    free(threaded.out.data);
+    free(odd.out.data);
+
+    // RGB frames and bad input
+    SessionParams params;
+    defaultSessionParams(&params);
+    params.raw = 1;
+    params.search_range = 0;
+    Output out = { 0 };
+    EncoderSession* session = openSession(&params, collect, &out);
+    uint8_t* rgb = calloc(WIDTH * HEIGHT, 3);
+    int ret = pushRgbFrame(session, rgb, WIDTH * 3, WIDTH, HEIGHT);
+    // A JPEG that libjpeg cannot decode fails the push, not the process
+    uint8_t corrupt[64] = { 0xFF, 0xD8 };
+    int rejected = pushRgbFrame(session, rgb, WIDTH * 3, WIDTH / 2, HEIGHT) != 0 &&
+        pushJpegFile(session, "no/such/file.jpeg") != 0 && pushJpegData(session, corrupt, sizeof(corrupt)) != 0;
+    ret |= pushRgbFrame(session, rgb, WIDTH * 3, WIDTH, HEIGHT);
+    ret |= flushSession(session);
+    closeSession(session);
+    pictures = countStartCodes(&out, 0x00);
+    printf("RGB: %zu bytes, %d pictures, bad frames %s\n", out.size, pictures, rejected ? "rejected" : "ACCEPTED");
+    failed |= ret != 0 || pictures != 2 || !rejected || countStartCodes(&out, 0xBA) != 0;
+    free(out.data);
+    free(rgb);
+
+    params.scale = 0;
+    session = openSession(&params, collect, &out);
+    printf("invalid params: %s\n", session ? "ACCEPTED" : "rejected");
+    failed |= session != NULL;
+    closeSession(session);
+    return failed;
+}
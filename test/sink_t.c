@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sink.h"
+
+#define FILENAME "sink_t.bin"
+#define SIZE (3 * SINK_CHUNK_SIZE + 12345)
+
+int main() {
+    int failed = 0;
+    uint8_t* data = malloc(SIZE);
+    for(int i = 0; i < SIZE; i++) {
+        data[i] = (uint8_t)(i * 31 + (i >> 11));
+    }
+
+    // Pieces of every size, some across chunks and some larger than one
+    OutputSink sink;
+    if(openFileSink(&sink, FILENAME) != 0) {
+        printf("cannot create %s\n", FILENAME);
+        return 1;
+    }
+    int ret = 0;
+    size_t offset = 0;
+    for(size_t len = 1; offset < SIZE; len = len * 3 + 1) {
+        size_t n = SIZE - offset < len ? SIZE - offset : len;
+        ret |= sinkWrite(&sink, data + offset, n);
+        offset += n;
+    }
+    ret |= closeSink(&sink);
+
+    FILE* file = fopen(FILENAME, "rb");
+    uint8_t* read = malloc(SIZE + 1);
+    size_t size = file ? fread(read, 1, SIZE + 1, file) : 0;
+    if(file) {
+        fclose(file);
+    }
+    int same = size == SIZE && memcmp(read, data, SIZE) == 0;
+    printf("file sink: %llu bytes, %s\n", (unsigned long long)sink.bytes, same ? "written" : "DIFFERS");
+    failed |= ret != 0 || !same || sink.bytes != SIZE;
+    remove(FILENAME);
+
+    openMemorySink(&sink);
+    ret = sinkWrite(&sink, data, 100) | sinkWrite(&sink, data + 100, SIZE - 100) | closeSink(&sink);
+    same = sink.size == SIZE && memcmp(sink.data, data, SIZE) == 0;
+    printf("memory sink: %zu bytes, %s\n", sink.size, same ? "kept" : "DIFFERS");
+    failed |= ret != 0 || !same;
+    free(sink.data);
+
+    ret = openFileSink(&sink, "no/such/directory/" FILENAME);
+    printf("missing directory: %s\n", ret != 0 ? "rejected" : "FAILED");
+    failed |= ret == 0;
+
+    free(read);
+    free(data);
+    return failed;
+}
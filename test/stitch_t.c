@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "createMLV.h"
+#include "stitch.h"
+
+#define FRAME_RATE_CODE 3
+
+// A segment of GOPs of num_pictures[i] pictures, numbered from 0 like a
+// worker would
+static void writeSegment(char* filename, const int* num_pictures, const int* closed, int num_gops) {
+    ImageInfo info = { .width = 32, .height = 32, .fps = 25, .bitrate = 1000 };
+    Muxer mux;
+    createMLV(&mux, filename, info, 1);
+    BitWriter bw;
+    initBitWriter(&bw, NULL, 0);
+    int frame = 0;
+    for(int g = 0; g < num_gops; g++) {
+        writeGOPHeader(&bw, frame, FRAME_RATE_CODE, closed[g]);
+        for(int i = 0; i < num_pictures[g]; i++) {
+            writePictureHeader(&bw, i, i == 0 ? PICTURE_TYPE_I : PICTURE_TYPE_P, VBV_DELAY_VARIABLE, 1, 1);
+            writeSliceHeader(&bw, 1, 8);
+            putBits(&bw, 0, 7); // zeros that are no start code
+            putBits(&bw, 1, 1);
+        }
+        frame += num_pictures[g];
+    }
+    writeSequenceEndCode(&bw);
+    flushBitstream(&mux, &bw);
+    freeBitWriter(&bw);
+    closeMuxer(&mux);
+}
+
+// Count sequence headers and end codes and list the GOP time codes in
+// pictures at 25 fps, with c or o for closed or open
+static void describe(const char* filename, char* out) {
+    FILE* file = fopen(filename, "rb");
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* data = malloc(size);
+    fread(data, 1, size, file);
+    fclose(file);
+
+    int sequences = 0;
+    int ends = 0;
+    out[0] = '\0';
+    for(long i = 0; i + 4 <= size; i++) {
+        if(data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1) {
+            continue;
+        }
+        sequences += data[i + 3] == 0xB3;
+        ends += data[i + 3] == 0xB7;
+        if(data[i + 3] == 0xB8 && i + 8 <= size) {
+            uint32_t v = (uint32_t)data[i + 4] << 24 | data[i + 5] << 16 | data[i + 6] << 8 | data[i + 7];
+            int seconds = ((v >> 26) & 31) * 3600 + ((v >> 20) & 63) * 60 + ((v >> 13) & 63);
+            sprintf(out + strlen(out), "%d%c ", seconds * 25 + ((v >> 7) & 63), (v >> 6) & 1 ? 'c' : 'o');
+        }
+    }
+    sprintf(out + strlen(out), "seq %d end %d", sequences, ends);
+    free(data);
+}
+
+int main() {
+    int failed = 0;
+    char description[256];
+    char* segments[] = { "stitch0.mpg", "stitch1.mpg", "stitch2.mpg" };
+    const int pictures0[] = { 12, 20 };
+    const int closed0[] = { 1, 0 };
+    const int pictures1[] = { 30 };
+    const int closed1[] = { 1 };
+    const int pictures2[] = { 5 };
+    const int closed2[] = { 0 };
+    writeSegment(segments[0], pictures0, closed0, 2);
+    writeSegment(segments[1], pictures1, closed1, 1);
+    writeSegment(segments[2], pictures2, closed2, 1);
+
+    // Time codes continue across segments; one sequence header and end code
+    const char* expected = "0c 12o 32c seq 1 end 1";
+    int ret = stitchSegments("stitched.mpg", segments, 2, 1);
+    describe("stitched.mpg", description);
+    printf("joined: %s\n", description);
+    if(ret != 0 || strcmp(description, expected) != 0) {
+        printf("  expected %s\n", expected);
+        failed = 1;
+    }
+
+    // An open GOP cannot follow another segment
+    ret = stitchSegments("stitched.mpg", segments + 1, 2, 1);
+    printf("open GOP after a segment: %s\n", ret != 0 ? "rejected" : "FAILED");
+    failed |= ret == 0;
+
+    for(int i = 0; i < 3; i++) {
+        remove(segments[i]);
+    }
+    remove("stitched.mpg");
+    return failed;
+}
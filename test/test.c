@@ -1,117 +1,261 @@
 #include <math.h>
 #include <omp.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <mpeg1_encoder.h>
 #include "readImage.h"
 #include "createMLV.h"
-#include "seperateMatrix.h"
-#include "quantization.h"
+#include "encoder.h"
+#include "ffwt.h"
+#include "gop.h"
+#include "ingest.h"
+#include "profile.h"
+#include "sequence.h"
+#include "stitch.h"
 
-#define INPUTFILENAME "../../data/Video1/output_images/image_001.jpg"
+#define INPUTPATTERN "../inputFiles/Image%03d.jpeg"
+#define FIRST_FRAME 1
 #define FILENAME_OUTPUT "output.mpeg"
 #define BLOCK_SIZE 8
 #define FRAMERATE 10
-#define SCALE_QUANT 8
+#define GOP_CLOSED 0
 
-void doIntraframeCompression(char* filename_o, char* filename_i) {
-    // decompress the image and get the information
+// Chrome trace of -t, NULL without one
+static const char* trace_file = NULL;
+
+// -e: write the bare video stream instead of a system stream
+static int raw_output = 0;
+
+// Summary of -p and -t, and the trace to `filename`
+static void reportProfile(const char* filename) {
+    if(!profile_enabled) {
+        return;
+    }
+    printProfileSummary(stdout);
+    if(filename) {
+        writeProfileTrace(filename);
+    }
+}
+
+// Returns -1 if the picture could not be encoded or written
+int doIntraframeCompression(char* filename_o, char* filename_i) {
+    // Take the JPEG coefficients as they are if the blocks line up with
+    // macroblocks, otherwise decompress the image and get the information
+    CoefImage coefimage;
+    int transcode = readCoefficients(&coefimage, filename_i) == 0;
     ImageInfo imageinfo;
-    readImage(&imageinfo, filename_i);
+    if(transcode) {
+        imageinfo = coefimage.info;
+    } else if(readImage(&imageinfo, filename_i) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    printf("Image width: %d, height: %d, %s\n", imageinfo.width, imageinfo.height, transcode ? "DCT coefficients" : "decoded");
 
-    FILE* file_mlv = createMLV(filename_o, imageinfo);
+    Muxer mux;
+    if(createMLV(&mux, filename_o, imageinfo, raw_output) != 0) {
+        exit(EXIT_FAILURE);
+    }
 
-    // writePackHeader(file_mpeg, width, height, 10, (uint32_t)(bit_rate/400));
-    
+    EncoderContext ctx;
+    if(initEncoder(&ctx, imageinfo.width, imageinfo.height, SCALE_QUANT, 0, 0) != 0) {
+        fprintf(stderr, "Failed to initialize the encoder.\n");
+        exit(EXIT_FAILURE);
+    }
+    BitWriter bw;
+    initBitWriter(&bw, NULL, imageinfo.width * imageinfo.height);
 
-    // Establish the dynamic display
-    int i_CurrentBlock = 0;
-    printf("Processing blocks: 0/%d", 10000);
-    fflush(stdout); // Ensure the output is flushed to the terminal
-
-    // Process each 8x8 block in Y, Cb, and Cr
-    int prev_dc_coeffi_y = 0;
-    int prev_dc_coeffi_cb = 0;
-    int prev_dc_coeffi_cr = 0;
-    uint8_t* bitstream_buffer = (uint8_t*)malloc(MAX_BITSTREAM_SIZE * 3 * sizeof(uint8_t));
-    int bitstream_index = 0;
-    size_t length_buffer = 0;
-    //#pragma omp parallel for collapse(2) // Parallelize two nested loops
-    for(int y_block = 0; y_block < imageinfo.height / BLOCK_SIZE / 2; y_block++) { //height / BLOCK_SIZE
-        writeSliceHeader(file_mlv, y_block + 1, SCALE_QUANT);
-        for(int x_block = 0; x_block < imageinfo.width / BLOCK_SIZE / 2; x_block++) { // width / BLOCK_SIZE
-            i_CurrentBlock++;
-            // Dynamic progress update
-            printf("\rProcessing blocks: %d/%d", i_CurrentBlock, 10000);
-            fflush(stdout);
-
-            // Use 1D arrays instead of 2D arrays
-            uint8_t ym[4][BLOCK_SIZE * BLOCK_SIZE];  // Y matrix for this block
-            uint8_t cbm[BLOCK_SIZE * BLOCK_SIZE]; // Cb matrix for this block
-            uint8_t crm[BLOCK_SIZE * BLOCK_SIZE]; // Cr matrix for this block
-            uint8_t macro[2 * BLOCK_SIZE * 2 * BLOCK_SIZE];
-            int mat_quan[BLOCKSIZE * BLOCK_SIZE];
-            // Copy Y, Cb, Cr values into 1D arrays (this assumes YCbCr format)
-            for(int i = 0; i < 2 * BLOCK_SIZE; i++) {
-                for(int j = 0; j < 2 * BLOCK_SIZE; j++) {
-                    macro[i * 2 * BLOCK_SIZE + j] = imageinfo.buf_p[ 
-                        (y_block * 2 * BLOCK_SIZE + i) * imageinfo.width + 
-                        (x_block * 2 * BLOCK_SIZE + j)
-                    ];
-                }
-            }
-            seperateMatrix(ym, macro);
-            for(int y = 0; y < BLOCK_SIZE; y++) {
-                for(int x = 0; x < BLOCK_SIZE; x++) {
-                    cbm[y * BLOCK_SIZE + x] = imageinfo.buf_p[ 
-                        imageinfo.width * imageinfo.height + 
-                        (y_block * BLOCK_SIZE + y) * imageinfo.width + 
-                        (x_block * BLOCK_SIZE + x)
-                    ];
-                    int check = imageinfo.width * imageinfo.height * 5 / 4 + 
-                        (y_block * BLOCK_SIZE + y) * imageinfo.width / 2 + 
-                        (x_block * BLOCK_SIZE + x);
-                    crm[y * BLOCK_SIZE + x] = imageinfo.buf_p[ 
-                        imageinfo.width * imageinfo.height * 5 / 4 + 
-                        (y_block * BLOCK_SIZE + y) * imageinfo.width / 2 + 
-                        (x_block * BLOCK_SIZE + x)
-                    ];
-                }
-            }
+    writeGOPHeader(&bw, 0, frameRateCode(imageinfo.fps), 1);
+    writePictureHeader(&bw, 0, PICTURE_TYPE_I, VBV_DELAY_VARIABLE, 0, 0);
+    int ret;
+    if(transcode) {
+        ret = encodeTranscodedPicture(&ctx, &coefimage, &bw);
+        freeCoefficients(&coefimage);
+    } else {
+        ret = encodeIntraPicture(&ctx, &imageinfo, &bw);
+        freeImage(&imageinfo);
+    }
+    if(ret != 0) {
+        fprintf(stderr, "Failed to encode %s!\n", filename_i);
+    }
+    writeSequenceEndCode(&bw);
+    if(flushBitstream(&mux, &bw) != 0 || closeMuxer(&mux) != 0) {
+        fprintf(stderr, "Error writing %s!\n", filename_o);
+        ret = -1;
+    }
+    freeBitWriter(&bw);
+    freeEncoder(&ctx);
+    return ret;
+}
 
-            // Apply DCT, quantization and Huffman encoding to the blocks
-            for(int i = 0; i < 4; i++) {
-                quantizeBlock(mat_quan, ym[i], quantization_table_y, SCALE_QUANT);
-                bitstream_index = encode_mpeg1_y(bitstream_buffer, mat_quan, prev_dc_coeffi_y);
-                fwrite(bitstream_buffer, sizeof(uint8_t), bitstream_index, file_mlv);
-                prev_dc_coeffi_y = mat_quan[0]; // First element (DC coefficient for Y)
+// Encode `count` files of a numbered JPEG sequence from number `first`
+// with encodeSequence and report its size.
+// num_threads: for the decoders and the encoder each, 0 for one per core
+// raw: write the bare video stream
+// Returns -1 if the sequence stopped short or could not be written.
+int doSequenceCompression(char* filename_o, char* pattern, int first, int count, int closed, int num_threads, int raw) {
+    SequenceOptions options = { .first = first, .count = count, .closed = closed, .num_threads = num_threads, .raw = raw };
+    SequenceStats stats;
+    int ret = encodeSequence(filename_o, pattern, &options, &stats);
+    if(stats.frames > 0) {
+        printf("Image width: %d, height: %d, %d frames\n", stats.width, stats.height, stats.frames);
+    }
+    return ret;
+}
+
+// Remove the files of the workers and free their names
+static void removeSegments(char** segments, int num_workers) {
+    for(int i = 0; i < num_workers; i++) {
+        if(segments[i]) {
+            remove(segments[i]);
+            free(segments[i]);
+        }
+    }
+    free(segments);
+}
+
+// Encode a numbered JPEG sequence in `num_workers` processes, each one a
+// run of whole closed GOPs written as a bare video stream, and join and mux
+// their files. The cores are shared out among the workers. Returns -1 if
+// a worker could not be started or failed, or the files could not be
+// joined; the workers are stopped and their files removed in any case.
+int doParallelCompression(char* filename_o, char* pattern, int num_workers) {
+    int count = countIngestFrames(pattern, FIRST_FRAME);
+    int num_gops = (count + GOP_SIZE - 1) / GOP_SIZE;
+    num_workers = num_workers < num_gops ? num_workers : num_gops;
+    if(num_workers <= 1) {
+        return doSequenceCompression(filename_o, pattern, FIRST_FRAME, count, 1, 0, raw_output);
+    }
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_threads = num_cores > num_workers ? (int)(num_cores / num_workers) : 1;
+
+    char** segments = (char**)calloc(num_workers, sizeof(char*));
+    pid_t* workers = (pid_t*)calloc(num_workers, sizeof(pid_t));
+    if(!segments || !workers) {
+        free(segments);
+        free(workers);
+        return -1;
+    }
+    fflush(stdout);
+    int started = 0;
+    for(; started < num_workers; started++) {
+        // Worker i takes GOPs num_gops * i / num_workers onwards
+        int i = started;
+        int first = (int)((long)num_gops * i / num_workers) * GOP_SIZE;
+        int end = (int)((long)num_gops * (i + 1) / num_workers) * GOP_SIZE;
+        end = end < count ? end : count;
+        segments[i] = (char*)malloc(strlen(filename_o) + 16);
+        if(!segments[i]) {
+            break;
+        }
+        sprintf(segments[i], "%s.part%d", filename_o, i);
+        workers[i] = fork();
+        if(workers[i] == 0) {
+            int ret = doSequenceCompression(segments[i], pattern, FIRST_FRAME + first, end - first, 1, num_threads, 1);
+            // Each worker reports its own profile, the trace to <trace>.<i>
+            if(profile_enabled) {
+                char filename[256];
+                snprintf(filename, sizeof(filename), "%s.%d", trace_file ? trace_file : "", i);
+                printf("\nWorker %d:\n", i);
+                reportProfile(trace_file ? filename : NULL);
+                fflush(stdout);
             }
-            quantizeBlock(mat_quan, cbm, quantization_table_y, SCALE_QUANT);
-            bitstream_index = encode_mpeg1_c(bitstream_buffer, mat_quan, prev_dc_coeffi_cb);
-            fwrite(bitstream_buffer, sizeof(uint8_t), bitstream_index, file_mlv);
-            prev_dc_coeffi_cb = mat_quan[0]; // First element (DC coefficient for Cb)
-            quantizeBlock(mat_quan, crm, quantization_table_y, SCALE_QUANT);
-            bitstream_index = encode_mpeg1_c(bitstream_buffer, mat_quan, prev_dc_coeffi_cr);
-            fwrite(bitstream_buffer, sizeof(uint8_t), bitstream_index, file_mlv);
-            prev_dc_coeffi_cr = mat_quan[0]; // First element (DC coefficient for Cr)
+            _exit(ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        if(workers[i] < 0) {
+            fprintf(stderr, "Failed to start worker %d!\n", i);
+            break;
         }
     }
-    fclose(file_mlv);
+    // If one could not be started, the others are stopped
+    int failed = started < num_workers;
+    for(int i = 0; i < started && failed; i++) {
+        kill(workers[i], SIGTERM);
+    }
+    for(int i = 0; i < started; i++) {
+        int status;
+        if(waitpid(workers[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            if(started == num_workers) {
+                fprintf(stderr, "Worker %d failed!\n", i);
+            }
+            failed = 1;
+        }
+    }
+    if(!failed && stitchSegments(filename_o, segments, num_workers, raw_output) != 0) {
+        failed = 1;
+    }
+    removeSegments(segments, num_workers);
+    free(workers);
+    return failed ? -1 : 0;
 }
 
-int main() {
+// Usage: test [-p] [-t trace.json] [-e] [-j workers] [input [output]]
+//        test -s first count input output
+//        test [-e] -m output segment...
+// input is a single JPEG, or a printf pattern such as Image%03d.jpeg for a
+// sequence numbered from FIRST_FRAME. -j encodes in that many processes.
+// The output is an MPEG-1 system stream, or with -e the bare video stream.
+// On several machines sharing a file system, -s encodes `count` files from
+// number `first` as closed GOPs of a bare video stream, and -m joins such
+// files in order.
+// -p prints the time spent per stage and the counters of each thread, -t
+// also writes the stages as a Chrome trace.
+int main(int argc, char** argv) {
     struct timeval start, end;
-    
+    int num_workers = 1;
+    for(;;) {
+        if(argc > 1 && strcmp(argv[1], "-p") == 0) {
+            enableProfile(0);
+            argc -= 1;
+            argv += 1;
+        } else if(argc > 2 && strcmp(argv[1], "-t") == 0) {
+            trace_file = argv[2];
+            enableProfile(1);
+            argc -= 2;
+            argv += 2;
+        } else if(argc > 1 && strcmp(argv[1], "-e") == 0) {
+            raw_output = 1;
+            argc -= 1;
+            argv += 1;
+        } else if(argc > 2 && strcmp(argv[1], "-j") == 0) {
+            num_workers = atoi(argv[2]);
+            argc -= 2;
+            argv += 2;
+        } else {
+            break;
+        }
+    }
+    if(argc > 2 && strcmp(argv[1], "-m") == 0) {
+        return stitchSegments(argv[2], argv + 3, argc - 3, raw_output) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    char* filename_i = argc > 1 ? argv[1] : INPUTPATTERN;
+    char* filename_o = argc > 2 ? argv[2] : FILENAME_OUTPUT;
+
     gettimeofday(&start, NULL);
 
-    doIntraframeCompression(FILENAME_OUTPUT, INPUTFILENAME);
+    initDCTPlans();
+    int ret;
+    if(argc > 5 && strcmp(argv[1], "-s") == 0) {
+        ret = doSequenceCompression(argv[5], argv[4], atoi(argv[2]), atoi(argv[3]), 1, 0, 1);
+    } else if(strchr(filename_i, '%') && num_workers > 1) {
+        ret = doParallelCompression(filename_o, filename_i, num_workers);
+    } else if(strchr(filename_i, '%')) {
+        ret = doSequenceCompression(filename_o, filename_i, FIRST_FRAME, countIngestFrames(filename_i, FIRST_FRAME), GOP_CLOSED, 0, raw_output);
+    } else {
+        ret = doIntraframeCompression(filename_o, filename_i);
+    }
 
     gettimeofday(&end, NULL);
+    cleanupDCTPlans();
     
     double total_time = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
     printf("Total execution time: %.2f seconds\n", total_time);
+    reportProfile(trace_file);
 
-    return 0;
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }